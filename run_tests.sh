@@ -62,7 +62,13 @@ run_test() {
   compile_err="$OUT_DIR/$name.err"
   expected_err="$ROOT/testing/stderr/$name.err"
 
-  if ! "$ROOT/build/ionc" "$ion_file" -o "$OUT_DIR/$name.wat" 2> "$compile_err"; then
+  local -a flags=()
+  local flags_file="$ROOT/testing/flags/$name.flags"
+  if [ -f "$flags_file" ]; then
+    read -r -a flags < "$flags_file"
+  fi
+
+  if ! "$ROOT/build/ionc" "$ion_file" -o "$OUT_DIR/$name.wat" ${flags[@]+"${flags[@]}"} 2> "$compile_err"; then
     if [ -f "$expected_err" ]; then
       if diff -u "$expected_err" "$compile_err" > /dev/null; then
         note="expected error"
@@ -99,11 +105,18 @@ run_test() {
 
   local start_ns end_ns elapsed_ns
   start_ns="$(date +%s%N)"
-  local -a run_cmd
-  if [ "${#args[@]}" -eq 0 ]; then
-    run_cmd=(wasmtime "$OUT_DIR/$name.wat")
-  else
-    run_cmd=(wasmtime "$OUT_DIR/$name.wat" "${args[@]}")
+  local -a run_cmd=(wasmtime)
+  # --threads output imports shared memory and wasi-threads.
+  case " ${flags[*]-} " in
+    *" --threads"*) run_cmd+=(-W threads=y -S threads=y) ;;
+  esac
+  # --target=wasm-gc output uses GC struct/array types and typed references.
+  case " ${flags[*]-} " in
+    *" --target=wasm-gc"*) run_cmd+=(-W function-references=y -W gc=y) ;;
+  esac
+  run_cmd+=("$OUT_DIR/$name.wat")
+  if [ "${#args[@]}" -ne 0 ]; then
+    run_cmd+=("${args[@]}")
   fi
 
   if ! "${run_cmd[@]}" > "$actual"; then
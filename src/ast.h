@@ -14,12 +14,35 @@
 #include <utility>
 #include <vector>
 
-enum class TypeKind { Int, Real, Bool, String, Void, Struct, Array };
+// Vector is a two-lane SIMD128 value (int2, real2); element is the lane type.
+// StringBuilder is the growable string_builder, a pointer like String.
+// Map is map[K, V]: key is K, element is V. Vec is vec[T]: element is T.
+// Task is task[T], the result of `spawn f(...)` for a T-returning f.
+// Gen is gen[T], a suspended generator function yielding T values.
+enum class TypeKind {
+  Int,
+  Real,
+  Bool,
+  String,
+  Void,
+  Struct,
+  Array,
+  Vector,
+  StringBuilder,
+  Map,
+  Vec,
+  Task,
+  Gen
+};
 
 struct Type {
   TypeKind kind;
   std::string name;
   std::shared_ptr<Type> element;
+  // Arrays only: 2 for a rectangular real[,], laid out row-major as
+  // [d0][d1][elements].
+  int dims = 1;
+  std::shared_ptr<Type> key = nullptr; // Map only
 };
 
 #include "common.h"
@@ -38,6 +61,7 @@ enum class TokenType {
   RBracket,
   Comma,
   Dot,
+  DotDot,
   Colon,
   Plus,
   Minus,
@@ -66,6 +90,8 @@ struct TypeSpec {
   std::string name;
   int array_depth = 0;
   bool is_void = false;
+  int dims = 1; // of the array: `real[,]` is 2
+  std::vector<TypeSpec> params = {}; // `map[string, int]`: {string, int}
 };
 
 struct Expr;
@@ -84,7 +110,9 @@ enum class ExprKind {
   Call,
   Field,
   Index,
-  NewExpr
+  NewExpr,
+  Slice, // base[left:right], either bound may be omitted
+  Spawn  // spawn left, where left is a function call
 };
 
 struct Expr {
@@ -98,6 +126,8 @@ struct Expr {
   ExprPtr right;
   ExprPtr base;
   std::string field;
+  // Call arguments; for Index and NewExpr the indices/sizes after the first
+  // of a rectangular array, as in a[i, j] and new real[n, m].
   std::vector<ExprPtr> args;
   TypeSpec new_type;
   ExprPtr new_size;
@@ -105,7 +135,22 @@ struct Expr {
   int line = 0;
 };
 
-enum class StmtKind { VarDecl, Assign, If, While, Return, ExprStmt };
+// Yield is `yield expr` in a function returning gen[T]. Match is `match expr`
+// with one Case per arm in body (the arm's statements in then_body) and the
+// `else` arm in else_body. For is `for i in a..b step s`, parsed into the
+// counted loop it stands for (see Parser::ParseFor) in body.
+enum class StmtKind {
+  VarDecl,
+  Assign,
+  If,
+  While,
+  Return,
+  ExprStmt,
+  Yield,
+  Match,
+  Case,
+  For
+};
 
 struct Stmt {
   StmtKind kind;
@@ -116,6 +161,14 @@ struct Stmt {
   std::vector<StmtPtr> then_body;
   std::vector<StmtPtr> else_body;
   std::vector<StmtPtr> body;
+  // `parallel while`: iterations may run on several threads (--threads).
+  bool parallel = false;
+  // Case: the values the arm is taken for.
+  std::vector<int64_t> cases;
+  // For and its while loop: the step of the index var_name, and the number
+  // of iterations when both bounds are literals (-1 otherwise).
+  int64_t step = 0;
+  int64_t trip_count = -1;
   int line = 0;
 };
 
@@ -132,6 +185,8 @@ struct Function {
 struct StructDef {
   std::string name;
   std::string parent;
+  // `soa name:` stores arrays of the struct as one column per field.
+  bool soa = false;
   std::vector<std::pair<TypeSpec, std::string>> fields;
   std::vector<Function> methods;
   int line = 0;
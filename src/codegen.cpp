@@ -11,34 +11,95 @@
 
 #include <algorithm>
 #include <cctype>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <sstream>
 #include <unordered_map>
 #include <vector>
 
 #include "ast.h"
+#include "codegen_bounds.h"
+#include "codegen_parallel.h"
 #include "codegen_types.h"
 #include "common.h"
+#include "codegen_emitter_float.h"
+#include "codegen_emitter_gc.h"
+#include "codegen_emitter_gen.h"
+#include "codegen_emitter_map.h"
 #include "codegen_emitter_runtime.h"
+#include "codegen_emitter_sort.h"
+#include "codegen_emitter_thread.h"
+#include "codegen_emitter_vec.h"
+#include "codegen_rows.h"
+#include "codegen_simd.h"
 #include "semantics.h"
 #include "string_table.h"
 #include "type_system.h"
 
+// match: a jump table when there are at least kMatchTableMin cases and they
+// fill a kMatchTableSpread-th of their range or more; otherwise a binary
+// search that ends in at most kMatchLinearMax compares.
+constexpr size_t kMatchTableMin = 4;
+constexpr uint64_t kMatchTableSpread = 3;
+constexpr size_t kMatchLinearMax = 3;
+// for loops with literal bounds are unrolled when the copies of the body
+// add up to at most this many statements.
+constexpr int64_t kForUnrollBudget = 32;
+
 // Forward declarations
 class CodeGen;
 class CodeGen {
 public:
-  CodeGen(const Program &program) : program_(program), string_table_(4096) {}
+  CodeGen(const Program &program, const CodegenOptions &options)
+      : program_(program), options_(options), string_table_(4096) {}
 
   std::string Generate() {
     std::cerr << "Init Structs..." << std::endl;
     InitStructs(program_, structs_);
     std::cerr << "Compute Layouts..." << std::endl;
     ComputeStructLayouts(program_, structs_);
+    for (const auto &def : program_.structs) {
+      if (def.soa && GcTarget())
+        throw CompileError("soa struct " + def.name +
+                           " needs linear-memory arrays and is not available "
+                           "with --target=wasm-gc");
+    }
     std::cerr << "Build Catalog..." << std::endl;
     BuildFunctionCatalog(program_, structs_, functions_);
+    LayoutGenerators();
     std::cerr << "Build Strings..." << std::endl;
     string_table_.Build(program_);
+    if (options_.gc) {
+      gc_type_map_ptr_ = string_table_.AddData(BuildGcTypeMap());
+    }
+    layout_.digit_pairs_ptr = string_table_.AddData(DigitPairTable());
+    layout_.pow10_ptr = string_table_.AddData(Pow10Table());
+    layout_.pow5_split_ptr = string_table_.AddData(Pow5SplitTable());
+    layout_.pow5_inv_split_ptr = string_table_.AddData(Pow5InvSplitTable());
+    if (options_.bounds_check)
+      layout_.bounds_text_ptr = string_table_.AddData(BoundsFailText());
+    int print_args = 0;
+    for (const auto &fn : program_.functions)
+      print_args = std::max(print_args, MaxPrintArgs(fn.body));
+    for (const auto &def : program_.structs) {
+      for (const auto &method : def.methods)
+        print_args = std::max(print_args, MaxPrintArgs(method.body));
+    }
+    if (options_.threads) {
+      // Each thread's $tls block: low scratch, print arguments, stdout.
+      format_args_ptr_ = kLowScratchSize;
+      layout_.out_buf_ptr = kLowScratchSize + 8 * print_args;
+      layout_.tls_size = layout_.out_buf_ptr + kOutBufSize;
+      layout_.main_tls_ptr = string_table_.Reserve(layout_.tls_size);
+      layout_.pool_ptr = string_table_.Reserve(kPoolSize);
+      layout_.deques_ptr =
+          string_table_.Reserve(kDequeStride * options_.threads);
+    } else {
+      layout_.out_buf_ptr = string_table_.Reserve(kOutBufSize);
+      format_args_ptr_ = string_table_.Reserve(8 * print_args);
+    }
     std::cerr << "Type Check..." << std::endl;
 
     // Type Check
@@ -55,6 +116,7 @@ public:
             LocalInfo{p.second, ResolveType(p.first, structs_)};
         env.locals[p.second] = env.params[p.second];
       }
+      env.generator = GeneratorType(functions_.at(fn.name));
       CheckStmts(fn.body, env, ctx);
     }
     for (const auto &def : program_.structs) {
@@ -71,6 +133,8 @@ public:
               LocalInfo{p.second, ResolveType(p.first, structs_)};
           env.locals[p.second] = env.params[p.second];
         }
+        env.generator =
+            GeneratorType(functions_.at(def.name + "." + method.name));
         CheckStmts(method.body, env, ctx);
         std::cerr << "Finished method: " << def.name << "." << method.name
                   << std::endl;
@@ -87,14 +151,22 @@ public:
             "$args_sizes_get (param i32 i32) (result i32)))\n";
     out_ << "  (import \"wasi_snapshot_preview1\" \"args_get\" (func $args_get "
             "(param i32 i32) (result i32)))\n";
-    out_ << "  (memory (export \"memory\") 128)\n";
-    out_ << "  (global $heap (mut i64) (i64.const " << string_table_.HeapStart()
-         << "))\n";
+    if (options_.threads) {
+      out_ << "  (import \"wasi\" \"thread-spawn\" (func $thread_spawn "
+              "(param i32) (result i32)))\n";
+      out_ << "  (import \"env\" \"memory\" (memory 128 16384 shared))\n";
+      out_ << "  (export \"memory\" (memory 0))\n";
+    } else {
+      out_ << "  (memory (export \"memory\") 128)\n";
+    }
 
     std::cerr << "Emit Data Segments Start" << std::endl;
     EmitDataSegments();
     std::cerr << "Emit Runtime Start" << std::endl;
-    EmitRuntime(out_, string_table_.Offsets());
+    EmitRuntime(out_, string_table_.Offsets(), layout_, options_);
+    if (options_.gc) {
+      EmitGcRuntime(out_, gc_type_map_ptr_);
+    }
 
     // Emit Functions
     std::cerr << "Emit Functions Start" << std::endl;
@@ -120,16 +192,216 @@ public:
     }
 
     EmitStart();
+    EmitHeapArrayHelpers();
+    EmitGeneratorDispatch(out_, static_cast<int>(generators_.size()));
+    if (options_.threads) {
+      out_ << parallel_workers_.str();
+      EmitParallelDispatch(out_, parallel_sites_);
+      EmitTaskFunctions();
+      EmitTaskDispatch(out_, static_cast<int>(task_functions_.size()));
+    }
+    // Last: parallel loops reserve their context blocks while emitting.
+    out_ << "  (global $heap (mut i64) (i64.const " << string_table_.HeapStart()
+         << "))\n";
     out_ << ")\n";
-    return out_.str();
+    std::string wat = out_.str();
+    if (GcTarget()) {
+      // Heap types are only known once every function has been emitted.
+      wat.insert(std::string("(module\n").size(), HeapTypeSection());
+    }
+    return wat;
   }
 
 private:
   const Program &program_;
+  CodegenOptions options_;
   std::unordered_map<std::string, StructInfo> structs_;
   std::unordered_map<std::string, FunctionInfo> functions_;
   StringLiteralTable string_table_;
   std::ostringstream out_;
+  // --gc: header type id per struct, and the shadow stack slot of every
+  // pointer-typed local/param of the function being emitted.
+  std::unordered_map<std::string, int32_t> gc_type_ids_;
+  std::unordered_map<std::string, int> gc_slots_;
+  int64_t gc_type_map_ptr_ = 0;
+  RuntimeLayout layout_;
+  int64_t format_args_ptr_ = 0;
+  // --target=wasm-gc: array heap type name -> element value type.
+  std::map<std::string, std::string> gc_array_types_;
+  // --simd: vector plans for the loops of the function being emitted.
+  std::vector<SimdLoop> simd_loops_;
+  // --target=wasm-gc: $array_<op>.<type> helper name -> (op, array type).
+  std::map<std::string, std::pair<std::string, std::shared_ptr<Type>>>
+      gc_array_helpers_;
+  std::unordered_map<const Stmt *, size_t> simd_loop_ids_;
+  // The function being emitted and its params ($this first for methods).
+  const FunctionInfo *current_fn_ = nullptr;
+  std::vector<LocalInfo> current_params_;
+  // --bounds-check: what the function being emitted knows about its locals,
+  // and the (index, array) pairs proven in range at the current statement.
+  BoundsScope bounds_scope_;
+  RowPlan row_plan_;
+  BoundsFacts bounds_facts_;
+  // --threads: worker functions of the parallel loops emitted so far, and
+  // whether the code being emitted is one (nested loops then run inline).
+  int parallel_sites_ = 0;
+  std::ostringstream parallel_workers_;
+  bool in_parallel_worker_ = false;
+  // --threads: functions started by spawn, in task id order, and how many
+  // spawns enclose the one being emitted (each has its own $spawn<k>).
+  std::vector<std::string> task_functions_;
+  int spawn_depth_ = 0;
+  // gen[T] functions in generator id order with their frame layout, the one
+  // whose resume function is being emitted, and the yields (numbered from 1)
+  // inside each of its statements.
+  struct GeneratorFrame {
+    std::string function;
+    int32_t gc_type = 0;
+    std::vector<LocalInfo> slots;
+    std::vector<int64_t> offsets;
+    int64_t size = kGenSlots;
+  };
+  std::vector<GeneratorFrame> generators_;
+  const GeneratorFrame *generator_ = nullptr;
+  std::unordered_map<const Stmt *, std::pair<int, int>> yield_ranges_;
+
+  bool GcTarget() const { return options_.target == Target::WasmGc; }
+  // wasm-gc arrays are checked by the engine's array.get/array.set already.
+  bool BoundsChecked() const { return options_.bounds_check && !GcTarget(); }
+
+  // Heap type of a struct or array under --target=wasm-gc. Struct types keep
+  // the struct name; arrays append ".array" to their element's tag.
+  std::string HeapTypeName(const std::shared_ptr<Type> &type) {
+    if (type->kind == TypeKind::Struct)
+      return "$" + type->name;
+    if (type->kind == TypeKind::Vec)
+      throw CompileError("vec needs linear memory and is not available with "
+                         "--target=wasm-gc");
+    if (type->dims > 1)
+      throw CompileError("Rectangular arrays need linear memory and are not "
+                         "available with --target=wasm-gc");
+    std::string name = "$" + HeapTypeTag(type);
+    if (!gc_array_types_.count(name))
+      gc_array_types_[name] = StorageType(type->element);
+    return name;
+  }
+
+  static std::string HeapTypeTag(const std::shared_ptr<Type> &type) {
+    if (type->kind == TypeKind::Array)
+      return HeapTypeTag(type->element) + ".array";
+    return type->name;
+  }
+
+  int FieldIndex(const std::string &struct_name, const std::string &field) {
+    const auto &fields = structs_.at(struct_name).fields;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i].name == field)
+        return static_cast<int>(i);
+    }
+    throw CompileError("Unknown field " + field + " on struct " + struct_name);
+  }
+
+  // One recursion group with every struct (parents first, so children can
+  // declare them as supertypes) and every array type in use.
+  std::string HeapTypeSection() {
+    std::ostringstream types;
+    types << "  (rec\n";
+    std::unordered_set<std::string> emitted;
+    while (emitted.size() < program_.structs.size()) {
+      for (const auto &def : program_.structs) {
+        if (emitted.count(def.name) ||
+            (!def.parent.empty() && !emitted.count(def.parent)))
+          continue;
+        types << "    (type $" << def.name << " (sub";
+        if (!def.parent.empty())
+          types << " $" << def.parent;
+        types << " (struct";
+        for (const auto &field : structs_.at(def.name).fields)
+          types << " (field (mut " << StorageType(field.type) << "))";
+        types << ")))\n";
+        emitted.insert(def.name);
+      }
+    }
+    for (const auto &entry : gc_array_types_) {
+      types << "    (type " << entry.first << " (array (mut " << entry.second
+            << ")))\n";
+    }
+    types << "  )\n";
+    return types.str();
+  }
+
+  static bool IsGcRef(const std::shared_ptr<Type> &type) {
+    return type && (type->kind == TypeKind::String ||
+                    type->kind == TypeKind::StringBuilder ||
+                    type->kind == TypeKind::Map ||
+                    type->kind == TypeKind::Vec ||
+                    type->kind == TypeKind::Gen ||
+                    type->kind == TypeKind::Struct ||
+                    type->kind == TypeKind::Array ||
+                    (type->kind == TypeKind::Task && IsGcRef(type->element)));
+  }
+
+  // Type map consumed by $gc_scan: an i32 offset per type id followed by one
+  // [count][offsets...] descriptor per struct listing its pointer fields,
+  // then one per generator frame listing its pointer cells.
+  std::string BuildGcTypeMap() {
+    std::vector<int32_t> words(
+        kGcFirstStructType + program_.structs.size() + generators_.size(), 0);
+    for (size_t i = 0; i < program_.structs.size(); ++i) {
+      const auto &info = structs_.at(program_.structs[i].name);
+      gc_type_ids_[info.name] = kGcFirstStructType + static_cast<int32_t>(i);
+      words[kGcFirstStructType + i] = static_cast<int32_t>(words.size() * 4);
+      size_t count_at = words.size();
+      words.push_back(0);
+      for (const auto &field : info.fields) {
+        if (IsGcRef(field.type)) {
+          words.push_back(static_cast<int32_t>(field.offset));
+          words[count_at]++;
+        }
+      }
+    }
+    for (auto &frame : generators_) {
+      frame.gc_type = static_cast<int32_t>(
+          kGcFirstStructType + program_.structs.size() +
+          (&frame - generators_.data()));
+      words[frame.gc_type] = static_cast<int32_t>(words.size() * 4);
+      size_t count_at = words.size();
+      words.push_back(0);
+      if (IsGcRef(GeneratorType(functions_.at(frame.function))->element)) {
+        words.push_back(static_cast<int32_t>(kGenValue));
+        words[count_at]++;
+      }
+      for (size_t k = 0; k < frame.slots.size(); ++k) {
+        if (IsGcRef(frame.slots[k].type)) {
+          words.push_back(static_cast<int32_t>(frame.offsets[k]));
+          words[count_at]++;
+        }
+      }
+    }
+    std::string bytes;
+    for (int32_t word : words) {
+      for (int i = 0; i < 4; ++i) {
+        bytes.push_back(static_cast<char>((word >> (i * 8)) & 0xFF));
+      }
+    }
+    return bytes;
+  }
+
+  void EmitLocalSet(const LocalInfo &local) {
+    out_ << "    local.set " << local.wasm_name << "\n";
+    auto slot = gc_slots_.find(local.wasm_name);
+    if (slot != gc_slots_.end()) {
+      out_ << "    local.get $gc_frame\n    i32.wrap_i64\n";
+      out_ << "    local.get " << local.wasm_name << "\n";
+      out_ << "    i64.store offset=" << (slot->second * 8) << "\n";
+    }
+  }
+
+  void EmitGcLeave() {
+    if (options_.gc) {
+      out_ << "    local.get $gc_frame\n    global.set $gc_sp\n";
+    }
+  }
 
   void EmitDataSegments() {
     for (const auto &seg : string_table_.Segments()) {
@@ -173,6 +445,8 @@ private:
     }
 
     std::cerr << "Emit params, count=" << info.params.size() << std::endl;
+    current_fn_ = &info;
+    current_params_.clear();
     Env env;
     std::cerr << "Env created" << std::endl;
     env.current_struct = owner;
@@ -207,6 +481,7 @@ private:
       }
       env.params[name] = LocalInfo{pname, p};
       env.locals[name] = LocalInfo{pname, p};
+      current_params_.push_back(LocalInfo{pname, p});
     }
 
     std::cerr << "Checking return type: " << info.return_type << std::endl;
@@ -214,23 +489,38 @@ private:
       out_ << " (result " << WasmType(info.return_type) << ")";
     }
 
+    if (const GeneratorFrame *frame = FindGenerator(info.wasm_name)) {
+      EmitGenerator(info, *frame, env);
+      return;
+    }
+
     // Locals
     std::vector<LocalInfo> locals;
     if (info.decl) {
       CollectLocals(info.decl->body, env, locals);
     }
+    static const Function kNoDecl;
+    const Function &decl = info.decl ? *info.decl : kNoDecl;
+    PlanLoops(decl, env);
+    EmitLocalDecls(decl.body, locals);
 
-    out_ << " (local $tmp0 i64) (local $tmp1 i64) (local $tmp2 i64) (local "
-            "$tmp3 i64) (local $tmp4 i64) (local $tmpf f64)";
-    for (const auto &l : locals) {
-      out_ << " (local " << l.wasm_name << " " << WasmType(l.type) << ")";
+    if (options_.gc) {
+      EmitGcEnter(info, locals);
     }
-    out_ << "\n";
 
+    bool tail_loop = options_.tail_loops && info.decl &&
+                     HasSelfTailCall(info.decl->body);
+    if (tail_loop) {
+      out_ << "    loop $tail\n";
+    }
     if (info.decl) {
       EmitStmts(info.decl->body, env);
     }
+    if (tail_loop) {
+      out_ << "    end\n";
+    }
 
+    EmitGcLeave();
     if (info.return_type->kind != TypeKind::Void) {
       // If not returned, emit zero (safe default)
       // But usually control flow handles return.
@@ -241,6 +531,107 @@ private:
     out_ << "  )\n";
   }
 
+  // Per-function plans for --simd, --bounds-check and hoisted rows.
+  void PlanLoops(const Function &decl, Env &env) {
+    simd_loops_.clear();
+    simd_loop_ids_.clear();
+    if (options_.simd && !generator_) {
+      PlanSimdLoops(decl.body, env);
+    }
+    bounds_facts_.clear();
+    if (BoundsChecked()) {
+      bounds_scope_ = AnalyzeBounds(decl, env, structs_);
+    }
+    row_plan_ = RowPlan();
+    if (!GcTarget() && !generator_) {
+      row_plan_ = PlanRowAddresses(decl.body, env, structs_);
+    }
+  }
+
+  // The locals every function body gets, then its own and those the plans
+  // and the constructs in the body need.
+  void EmitLocalDecls(const std::vector<StmtPtr> &body,
+                      const std::vector<LocalInfo> &locals) {
+    out_ << " (local $tmp0 i64) (local $tmp1 i64) (local $tmp2 i64) (local "
+            "$tmp3 i64) (local $tmp4 i64) (local $tmpf f64)";
+    int print_args = MaxPrintArgs(body);
+    for (int k = 0; k < print_args; ++k) {
+      out_ << " (local $fmt" << k << " i64) (local $fmtf" << k << " f64)";
+    }
+    for (const auto &l : locals) {
+      out_ << " (local " << l.wasm_name << " " << WasmType(l.type) << ")";
+    }
+    for (const auto &loop : simd_loops_) {
+      std::string prefix = "$simd" + std::to_string(loop.id);
+      out_ << " (local " << prefix << "_n i64)";
+      for (size_t j = 0; j < loop.steps.size(); ++j) {
+        if (loop.steps[j].reduction)
+          out_ << " (local " << prefix << "_r" << j << " v128)";
+      }
+    }
+    for (int k = 0; k < row_plan_.count; ++k) {
+      out_ << " (local $row" << k << " i64)";
+    }
+    if (UsesGrids(body)) {
+      for (int k = 0; k <= kMaxArrayDims; ++k)
+        out_ << " (local $dim" << k << " i64)";
+    }
+    if (UsesSlices(body)) {
+      for (int k = 0; k < 3; ++k)
+        out_ << " (local $slice" << k << " i64)";
+    }
+    if (UsesPipelines(body)) {
+      for (const char *name : {"src", "n", "i", "k", "out", "acc", "x"})
+        out_ << " (local $pipe_" << name << " i64)";
+      out_ << " (local $pipe_accf f64) (local $pipe_xf f64)";
+      if (options_.simd)
+        out_ << " (local $pipe_v v128) (local $pipe_accv v128)";
+    }
+    if (UsesVectors(body)) {
+      out_ << " (local $tmpv v128)";
+    }
+    if (options_.threads && UsesParallelLoops(body)) {
+      out_ << " (local $par_ctx i64)";
+    }
+    if (options_.threads) {
+      for (int k = 0; k < MaxSpawnDepth(body); ++k)
+        out_ << " (local $spawn" << k << " i64)";
+    }
+    if (options_.gc) {
+      out_ << " (local $gc_frame i64)";
+    }
+    out_ << "\n";
+  }
+
+  // Reserves a shadow stack frame holding every pointer-typed param and local
+  // so the collector sees them as roots. Temporaries are pushed above it.
+  void EmitGcEnter(const FunctionInfo &info,
+                   const std::vector<LocalInfo> &locals) {
+    gc_slots_.clear();
+    std::vector<std::string> params;
+    for (size_t i = 0; i < info.params.size(); ++i) {
+      if (!IsGcRef(info.params[i]))
+        continue;
+      std::string pname = "$p" + std::to_string(i);
+      if (info.decl && info.decl->is_method && i == 0)
+        pname = "$this";
+      gc_slots_[pname] = static_cast<int>(gc_slots_.size());
+      params.push_back(pname);
+    }
+    for (const auto &l : locals) {
+      if (IsGcRef(l.type) && !gc_slots_.count(l.wasm_name))
+        gc_slots_[l.wasm_name] = static_cast<int>(gc_slots_.size());
+    }
+    out_ << "    i32.const " << gc_slots_.size() << "\n";
+    out_ << "    call $gc_enter\n";
+    out_ << "    local.set $gc_frame\n";
+    for (const auto &pname : params) {
+      out_ << "    local.get $gc_frame\n    i32.wrap_i64\n";
+      out_ << "    local.get " << pname << "\n";
+      out_ << "    i64.store offset=" << (gc_slots_.at(pname) * 8) << "\n";
+    }
+  }
+
   void CollectLocals(const std::vector<StmtPtr> &stmts, Env &env,
                      std::vector<LocalInfo> &locals) {
     for (const auto &s : stmts)
@@ -259,12 +650,821 @@ private:
       std::cerr << "  Resolved type addr: " << local.type.get() << std::endl;
       local.wasm_name = "$v" + stmt->var_name;
       env.locals[stmt->var_name] = local;
+      // Consecutive for loops over i declare it each time.
+      for (const auto &l : locals) {
+        if (l.wasm_name == local.wasm_name && l.type->name == local.type->name)
+          return;
+      }
       locals.push_back(local);
-    } else if (stmt->kind == StmtKind::If) {
+    } else if (stmt->kind == StmtKind::If || stmt->kind == StmtKind::Case) {
       CollectLocals(stmt->then_body, env, locals);
       CollectLocals(stmt->else_body, env, locals);
     } else if (stmt->kind == StmtKind::While) {
       CollectLocals(stmt->body, env, locals);
+    } else if (stmt->kind == StmtKind::Match ||
+               stmt->kind == StmtKind::For) {
+      CollectLocals(stmt->body, env, locals);
+      CollectLocals(stmt->else_body, env, locals);
+    }
+  }
+
+  // True when `pred` holds for an expression anywhere in the statements.
+  template <typename Pred>
+  static bool AnyExpr(const ExprPtr &expr, const Pred &pred) {
+    if (!expr)
+      return false;
+    if (pred(expr) || AnyExpr(expr->left, pred) ||
+        AnyExpr(expr->right, pred) || AnyExpr(expr->base, pred) ||
+        AnyExpr(expr->new_size, pred))
+      return true;
+    for (const auto &a : expr->args) {
+      if (AnyExpr(a, pred))
+        return true;
+    }
+    return false;
+  }
+
+  template <typename Pred>
+  static bool AnyExpr(const std::vector<StmtPtr> &stmts, const Pred &pred) {
+    for (const auto &s : stmts) {
+      if (AnyExpr(s->expr, pred) || AnyExpr(s->target, pred) ||
+          AnyExpr(s->then_body, pred) || AnyExpr(s->else_body, pred) ||
+          AnyExpr(s->body, pred))
+        return true;
+    }
+    return false;
+  }
+
+  static bool UsesVectors(const std::vector<StmtPtr> &stmts) {
+    return AnyExpr(stmts, [](const ExprPtr &e) {
+      return e->type && e->type->kind == TypeKind::Vector;
+    });
+  }
+
+  // a[i, j] or new T[n, m]: the function gets $dim0..$dim<max dims>. They
+  // are separate from $tmp<k> since a store keeps its address in $tmp2
+  // while the value is computed.
+  static bool UsesGrids(const std::vector<StmtPtr> &stmts) {
+    return AnyExpr(stmts, [](const ExprPtr &e) {
+      return (e->kind == ExprKind::Index || e->kind == ExprKind::NewExpr) &&
+             !e->args.empty();
+    });
+  }
+
+  // a[lo:hi] keeps its operands in $slice0..$slice2, for the same reason.
+  static bool UsesSlices(const std::vector<StmtPtr> &stmts) {
+    return AnyExpr(stmts,
+                   [](const ExprPtr &e) { return e->kind == ExprKind::Slice; });
+  }
+
+  // map/filter/reduce/sum/min/max keep the loop state in $pipe_*. A nested
+  // pipeline (in the source or reduce's init) finishes before they are set,
+  // and stage functions run in frames of their own.
+  static bool UsesPipelines(const std::vector<StmtPtr> &stmts) {
+    return AnyExpr(stmts, [](const ExprPtr &e) {
+      return e->kind == ExprKind::Call && e->base &&
+             e->base->kind == ExprKind::Var &&
+             IsPipelineBuiltin(e->base->text);
+    });
+  }
+
+  // --threads: a parallel loop keeps its context block address in $par_ctx.
+  static bool UsesParallelLoops(const std::vector<StmtPtr> &stmts) {
+    for (const auto &s : stmts) {
+      if ((s->kind == StmtKind::While && s->parallel) ||
+          UsesParallelLoops(s->then_body) || UsesParallelLoops(s->else_body) ||
+          UsesParallelLoops(s->body))
+        return true;
+    }
+    return false;
+  }
+
+  // spawn nested in the arguments of a spawn: one $spawn<k> per level.
+  static int MaxSpawnDepth(const ExprPtr &expr) {
+    if (!expr)
+      return 0;
+    int max = 0;
+    for (const auto &child :
+         {expr->left, expr->right, expr->base, expr->new_size})
+      max = std::max(max, MaxSpawnDepth(child));
+    for (const auto &arg : expr->args)
+      max = std::max(max, MaxSpawnDepth(arg));
+    return max + (expr->kind == ExprKind::Spawn ? 1 : 0);
+  }
+
+  static int MaxSpawnDepth(const std::vector<StmtPtr> &body) {
+    int max = 0;
+    for (const auto &stmt : body) {
+      max = std::max({max, MaxSpawnDepth(stmt->expr),
+                      MaxSpawnDepth(stmt->target),
+                      MaxSpawnDepth(stmt->then_body),
+                      MaxSpawnDepth(stmt->else_body),
+                      MaxSpawnDepth(stmt->body)});
+    }
+    return max;
+  }
+
+  static std::string VectorShape(const std::shared_ptr<Type> &vec) {
+    return vec->element->kind == TypeKind::Real ? "f64x2" : "i64x2";
+  }
+
+  // Vector operand of lane-wise arithmetic; scalars are broadcast to both
+  // lanes (int widened to real for real2).
+  void EmitVectorOperand(const ExprPtr &expr, const std::shared_ptr<Type> &vec,
+                         Env &env) {
+    auto type = EmitExpr(expr, env);
+    if (type->kind == TypeKind::Vector)
+      return;
+    if (vec->element->kind == TypeKind::Real && type->kind == TypeKind::Int)
+      out_ << "    f64.convert_i64_s\n";
+    out_ << "    " << VectorShape(vec) << ".splat\n";
+  }
+
+  // int2/real2 builtins, each a short SIMD128 sequence (see type_system.cpp
+  // for their signatures).
+  std::shared_ptr<Type> EmitVectorBuiltin(const ExprPtr &expr,
+                                          const std::string &name, Env &env) {
+    auto type = expr->type;
+    if (name == "int2" || name == "real2") {
+      EmitVectorOperand(expr->args[0], type, env);
+      if (expr->args.size() == 2) {
+        auto lane = EmitExpr(expr->args[1], env);
+        if (name == "real2" && lane->kind == TypeKind::Int)
+          out_ << "    f64.convert_i64_s\n";
+        out_ << "    " << VectorShape(type) << ".replace_lane 1\n";
+      }
+      return type;
+    }
+    if (name == "load2" || name == "store2") {
+      if (GcTarget())
+        throw CompileError(name + "() needs linear-memory arrays and is not "
+                                  "available with --target=wasm-gc at line " +
+                           std::to_string(expr->line));
+      // Elements i and i + 1: base + 8 + i*8.
+      EmitExpr(expr->args[0], env);
+      EmitExpr(expr->args[1], env);
+      if (BoundsChecked()) {
+        out_ << "    local.set $tmp1\n    local.set $tmp0\n";
+        EmitBoundsCheck("    local.get $tmp1\n", "$tmp0", expr->line);
+        EmitBoundsCheck("    local.get $tmp1\n    i64.const 1\n    i64.add\n",
+                        "$tmp0", expr->line);
+        out_ << "    local.get $tmp0\n    local.get $tmp1\n";
+      }
+      out_ << "    local.set $tmp1\n    i32.wrap_i64\n    local.get $tmp1\n";
+      out_ << "    i32.wrap_i64\n    i32.const 3\n    i32.shl\n    i32.add\n";
+      if (name == "load2") {
+        out_ << "    v128.load offset=8 align=8\n";
+        return type;
+      }
+      EmitExpr(expr->args[2], env);
+      out_ << "    v128.store offset=8 align=8\n";
+      return type;
+    }
+    if (name == "shuffle") {
+      EmitExpr(expr->args[0], env);
+      EmitExpr(expr->args[1], env);
+      out_ << "    i8x16.shuffle";
+      for (size_t k = 2; k < 4; ++k) {
+        for (int64_t b = 0; b < 8; ++b)
+          out_ << " " << (expr->args[k]->int_value * 8 + b);
+      }
+      out_ << "\n";
+      return type;
+    }
+    // hsum / hmin / hmax
+    auto vec = EmitExpr(expr->args[0], env);
+    std::string shape = VectorShape(vec);
+    bool real = vec->element->kind == TypeKind::Real;
+    out_ << "    local.tee $tmpv\n    " << shape << ".extract_lane 0\n";
+    out_ << "    local.get $tmpv\n    " << shape << ".extract_lane 1\n";
+    if (name == "hsum") {
+      out_ << (real ? "    f64.add\n" : "    i64.add\n");
+    } else if (real) {
+      out_ << (name == "hmin" ? "    f64.min\n" : "    f64.max\n");
+    } else {
+      out_ << "    local.set $tmp4\n    local.set $tmp3\n";
+      out_ << "    local.get $tmp3\n    local.get $tmp4\n";
+      out_ << "    local.get $tmp3\n    local.get $tmp4\n";
+      out_ << (name == "hmin" ? "    i64.lt_s\n" : "    i64.gt_s\n");
+      out_ << "    select\n";
+    }
+    return type;
+  }
+
+  bool IsPipeline(const ExprPtr &expr) const {
+    return expr->kind == ExprKind::Call && expr->base &&
+           expr->base->kind == ExprKind::Var &&
+           IsPipelineBuiltin(expr->base->text) &&
+           !functions_.count(expr->base->text);
+  }
+
+  // A chain like sum(map(filter(a, p), f)) is one loop over a: each element
+  // passes the map/filter stages in order and lands in the sink (sum, min,
+  // max, reduce, or a new array for a chain ending in map/filter), so no
+  // array is built in between.
+  std::shared_ptr<Type> EmitPipeline(const ExprPtr &expr, Env &env) {
+    if (GcTarget())
+      throw CompileError(expr->base->text +
+                         "() needs linear-memory arrays and is not available "
+                         "with --target=wasm-gc at line " +
+                         std::to_string(expr->line));
+    const std::string &sink = expr->base->text;
+    bool collect = sink == "map" || sink == "filter";
+    std::vector<ExprPtr> stages;
+    ExprPtr source = collect ? expr : expr->args[0];
+    while (IsPipeline(source) && (source->base->text == "map" ||
+                                  source->base->text == "filter")) {
+      stages.insert(stages.begin(), source);
+      source = source->args[0];
+    }
+    auto elem = source->type->element;
+    auto result = expr->type;
+    bool real = result->kind == TypeKind::Real;
+    std::string acc = real ? "$pipe_accf" : "$pipe_acc";
+
+    EmitExpr(source, env);
+    if (sink == "reduce") {
+      EmitCoerce(result, EmitExpr(expr->args[2], env));
+      out_ << "    local.set " << acc << "\n";
+    }
+    out_ << "    local.set $pipe_src\n";
+    out_ << ArrayLength("$pipe_src") << "    local.set $pipe_n\n";
+    out_ << "    i64.const 0\n    local.set $pipe_i\n";
+    out_ << "    i64.const 0\n    local.set $pipe_k\n";
+    if (sink == "sum") {
+      EmitZero(result);
+      out_ << "    local.set " << acc << "\n";
+    } else if (sink == "min" || sink == "max") {
+      // Replaced by the first element; an empty input traps below.
+      bool min = sink == "min";
+      if (real)
+        out_ << "    f64.const " << (min ? "inf" : "-inf") << "\n";
+      else
+        out_ << "    i64.const "
+             << (min ? "9223372036854775807" : "-9223372036854775808")
+             << "\n";
+      out_ << "    local.set " << acc << "\n";
+    } else if (collect) {
+      // Room for every element; the length is set to the count kept.
+      auto out_elem = result->element;
+      out_ << "    local.get $pipe_n\n";
+      out_ << "    i64.const " << GetTypeSize(out_elem) << "\n    i64.mul\n";
+      out_ << "    i64.const 8\n    i64.add\n";
+      if (options_.gc) {
+        out_ << "    i32.const "
+             << (IsGcRef(out_elem) ? kGcRefArrayType : kGcRawType) << "\n";
+        out_ << "    call $gc_alloc\n    call $gc_push\n";
+      } else {
+        out_ << "    call $alloc\n";
+      }
+      out_ << "    local.set $pipe_out\n";
+    }
+    if (options_.simd && stages.empty() && !collect && sink != "reduce" &&
+        GetTypeSize(elem) == 8)
+      EmitPipelineSimd(sink, result);
+
+    out_ << "    block\n    loop\n";
+    out_ << "    local.get $pipe_i\n    local.get $pipe_n\n    i64.ge_s\n";
+    out_ << "    br_if 1\n";
+    out_ << "    block\n";
+    out_ << "    local.get $pipe_src\n    i32.wrap_i64\n";
+    out_ << "    local.get $pipe_i\n    i32.wrap_i64\n";
+    out_ << "    i32.const " << GetTypeSize(elem) << "\n    i32.mul\n";
+    out_ << "    i32.add\n    i32.const 8\n    i32.add\n" << LoadOp(elem);
+    auto type = elem;
+    for (const auto &stage : stages) {
+      const FunctionInfo &fn = functions_.at(stage->args[1]->text);
+      if (stage->base->text == "map") {
+        EmitCoerce(fn.params[0], type);
+        out_ << "    call " << fn.wasm_name << "\n";
+        type = fn.return_type;
+        continue;
+      }
+      std::string x = PipeValue(type);
+      out_ << "    local.set " << x << "\n    local.get " << x << "\n";
+      EmitCoerce(fn.params[0], type);
+      out_ << "    call " << fn.wasm_name << "\n";
+      out_ << "    i64.eqz\n    br_if 0\n    local.get " << x << "\n";
+    }
+    EmitPipelineSink(sink,
+                     sink == "reduce" ? &functions_.at(expr->args[1]->text)
+                                      : nullptr,
+                     result, type);
+    out_ << "    end\n";
+    out_ << "    local.get $pipe_i\n    i64.const 1\n    i64.add\n";
+    out_ << "    local.set $pipe_i\n    br 0\n";
+    out_ << "    end\n    end\n";
+
+    if (collect) {
+      out_ << "    local.get $pipe_out\n    i32.wrap_i64\n";
+      out_ << "    local.get $pipe_k\n    i64.store\n";
+      out_ << "    local.get $pipe_out\n";
+      return result;
+    }
+    if (sink == "min" || sink == "max") {
+      // Like a failed bounds check: flush stdout, then trap.
+      out_ << "    local.get $pipe_k\n    i64.eqz\n";
+      out_ << "    if\n    call $flush\n    unreachable\n    end\n";
+    }
+    out_ << "    local.get " << acc << "\n";
+    return result;
+  }
+
+  static std::string PipeValue(const std::shared_ptr<Type> &type) {
+    return type->kind == TypeKind::Real ? "$pipe_xf" : "$pipe_x";
+  }
+
+  // Folds the element value on the stack (of `type`) into the sink;
+  // `reducer` is reduce's function.
+  void EmitPipelineSink(const std::string &sink, const FunctionInfo *reducer,
+                        const std::shared_ptr<Type> &result,
+                        const std::shared_ptr<Type> &type) {
+    bool real = result->kind == TypeKind::Real;
+    std::string acc = real ? "$pipe_accf" : "$pipe_acc";
+    std::string x = PipeValue(type);
+    if (sink == "sum") {
+      out_ << "    local.get " << acc << "\n";
+      out_ << (real ? "    f64.add\n" : "    i64.add\n");
+      out_ << "    local.set " << acc << "\n";
+    } else if (sink == "min" || sink == "max") {
+      if (real) {
+        out_ << "    local.get " << acc << "\n    f64." << sink << "\n";
+      } else {
+        out_ << "    local.set $pipe_x\n";
+        out_ << "    local.get $pipe_x\n    local.get $pipe_acc\n";
+        out_ << "    local.get $pipe_x\n    local.get $pipe_acc\n";
+        out_ << (sink == "min" ? "    i64.lt_s\n" : "    i64.gt_s\n");
+        out_ << "    select\n";
+      }
+      out_ << "    local.set " << acc << "\n";
+      out_ << "    local.get $pipe_k\n    i64.const 1\n    i64.add\n";
+      out_ << "    local.set $pipe_k\n";
+    } else if (sink == "reduce") {
+      out_ << "    local.set " << x << "\n";
+      out_ << "    local.get " << acc << "\n";
+      EmitCoerce(reducer->params[0], result);
+      out_ << "    local.get " << x << "\n";
+      EmitCoerce(reducer->params[1], type);
+      out_ << "    call " << reducer->wasm_name << "\n";
+      out_ << "    local.set " << acc << "\n";
+    } else {
+      out_ << "    local.set " << x << "\n";
+      out_ << "    local.get $pipe_out\n    i32.wrap_i64\n";
+      out_ << "    local.get $pipe_k\n    i32.wrap_i64\n";
+      out_ << "    i32.const " << GetTypeSize(type) << "\n    i32.mul\n";
+      out_ << "    i32.add\n    i32.const 8\n    i32.add\n";
+      out_ << "    local.get " << x << "\n" << StoreOp(type);
+      out_ << "    local.get $pipe_k\n    i64.const 1\n    i64.add\n";
+      out_ << "    local.set $pipe_k\n";
+    }
+  }
+
+  // --simd: sum/min/max straight over an int[] or real[] take two elements
+  // per step in $pipe_accv, fold the lanes into the scalar accumulator, and
+  // leave the odd last element to the scalar loop.
+  void EmitPipelineSimd(const std::string &sink,
+                        const std::shared_ptr<Type> &type) {
+    bool real = type->kind == TypeKind::Real;
+    std::string shape = real ? "f64x2" : "i64x2";
+    std::string acc = real ? "$pipe_accf" : "$pipe_acc";
+    out_ << "    local.get $pipe_n\n    i64.const 2\n    i64.ge_s\n    if\n";
+    out_ << "    local.get " << acc << "\n    " << shape << ".splat\n";
+    out_ << "    local.set $pipe_accv\n";
+    out_ << "    block\n    loop\n";
+    out_ << "    local.get $pipe_i\n    i64.const 2\n    i64.add\n";
+    out_ << "    local.get $pipe_n\n    i64.gt_s\n    br_if 1\n";
+    out_ << "    local.get $pipe_src\n    i32.wrap_i64\n";
+    out_ << "    local.get $pipe_i\n    i32.wrap_i64\n";
+    out_ << "    i32.const 3\n    i32.shl\n    i32.add\n";
+    out_ << "    v128.load offset=8 align=8\n";
+    if (sink == "sum") {
+      out_ << "    local.get $pipe_accv\n    " << shape << ".add\n";
+    } else if (real) {
+      out_ << "    local.get $pipe_accv\n    f64x2." << sink << "\n";
+    } else {
+      out_ << "    local.tee $pipe_v\n    local.get $pipe_accv\n";
+      out_ << "    local.get $pipe_v\n    local.get $pipe_accv\n";
+      out_ << (sink == "min" ? "    i64x2.lt_s\n" : "    i64x2.gt_s\n");
+      out_ << "    v128.bitselect\n";
+    }
+    out_ << "    local.set $pipe_accv\n";
+    out_ << "    local.get $pipe_i\n    i64.const 2\n    i64.add\n";
+    out_ << "    local.set $pipe_i\n    br 0\n";
+    out_ << "    end\n    end\n";
+    out_ << "    local.get $pipe_accv\n    " << shape << ".extract_lane 0\n";
+    out_ << "    local.set " << acc << "\n";
+    out_ << "    local.get $pipe_accv\n    " << shape << ".extract_lane 1\n";
+    EmitPipelineSink(sink, nullptr, type, type);
+    out_ << "    local.get $pipe_i\n    local.set $pipe_k\n";
+    out_ << "    end\n";
+  }
+
+  // copy lowers to memory.copy (array.copy under wasm-gc); fill, equals,
+  // resize and sort call the runtime helpers, or per-type helpers under
+  // wasm-gc (sort has none).
+  std::shared_ptr<Type> EmitArrayBuiltin(const ExprPtr &expr,
+                                         const std::string &name, Env &env) {
+    const auto &args = expr->args;
+    auto array = args[0]->type;
+    auto elem = array->element;
+    if (name == "copy") {
+      if (GcTarget()) {
+        for (size_t k = 0; k < 5; ++k) {
+          EmitExpr(args[k], env);
+          if (k % 2 == 1 || k == 4)
+            out_ << "    i32.wrap_i64\n";
+        }
+        out_ << "    array.copy " << HeapTypeName(array) << " "
+             << HeapTypeName(args[2]->type) << "\n";
+        return expr->type;
+      }
+      // Spilled once all five are evaluated: the arguments may use $tmpN.
+      int64_t size = GetTypeSize(elem);
+      for (size_t k = 0; k < 5; ++k)
+        EmitExpr(args[k], env);
+      for (size_t k = 5; k-- > 0;)
+        out_ << "    local.set $tmp" << k << "\n";
+      if (BoundsChecked()) {
+        for (size_t k = 0; k < 4; k += 2) {
+          out_ << "    local.get $tmp" << k << "\n    local.get $tmp" << k + 1
+               << "\n    local.get $tmp4\n";
+          out_ << "    i64.const " << expr->line << "\n    call $bounds_range\n";
+        }
+      }
+      for (size_t k = 0; k < 4; k += 2) {
+        out_ << "    local.get $tmp" << k << "\n    i64.const 8\n    i64.add\n";
+        out_ << "    local.get $tmp" << k + 1 << "\n";
+        out_ << "    i64.const " << size << "\n    i64.mul\n    i64.add\n";
+        out_ << "    i32.wrap_i64\n";
+      }
+      out_ << "    local.get $tmp4\n";
+      out_ << "    i64.const " << size << "\n    i64.mul\n    i32.wrap_i64\n";
+      out_ << "    memory.copy\n";
+      return expr->type;
+    }
+    if (name == "sort") {
+      if (GcTarget())
+        throw CompileError("sort() needs linear-memory arrays and is not "
+                           "available with --target=wasm-gc at line " +
+                           std::to_string(expr->line));
+      EmitExpr(args[0], env);
+      if (args.size() == 2) {
+        const auto &field = structs_.at(elem->name).field_map.at(args[1]->text);
+        out_ << "    i32.const " << field.offset << "\n";
+        out_ << "    call $sort_" << SortKeySuffix(field.type) << "\n";
+      } else {
+        out_ << "    call $sort_" << WasmType(elem) << "\n";
+      }
+      return expr->type;
+    }
+    EmitExpr(args[0], env);
+    if (name == "fill") {
+      auto value = EmitExpr(args[1], env);
+      if (elem->kind == TypeKind::Real && value->kind == TypeKind::Int)
+        out_ << "    f64.convert_i64_s\n";
+      if (GcTarget()) {
+        EmitToStorage(elem);
+        out_ << "    call " << HeapArrayHelper("fill", array) << "\n";
+      } else {
+        if (elem->name == "f32")
+          out_ << "    f32.demote_f64\n    i32.reinterpret_f32\n"
+                  "    i64.extend_i32_u\n";
+        else if (elem->kind == TypeKind::Real)
+          out_ << "    i64.reinterpret_f64\n";
+        out_ << "    i64.const " << GetTypeSize(elem) << "\n";
+        out_ << "    call $array_fill\n";
+      }
+      return expr->type;
+    }
+    EmitExpr(args[1], env);
+    if (GcTarget()) {
+      out_ << "    call " << HeapArrayHelper(name, array) << "\n";
+      return expr->type;
+    }
+    if (name == "equals") {
+      out_ << "    i32.const " << (elem->kind == TypeKind::Real ? 1 : 0) << "\n";
+      out_ << "    i32.const " << GetTypeSize(elem) << "\n";
+      out_ << "    call $array_equals\n";
+      return expr->type;
+    }
+    out_ << "    i32.const " << (IsGcRef(elem) ? kGcRefArrayType : kGcRawType)
+         << "\n";
+    out_ << "    i64.const " << GetTypeSize(elem) << "\n";
+    out_ << "    call $array_resize\n";
+    return expr->type;
+  }
+
+  // --target=wasm-gc: names the fill/equals/resize helper for an array heap
+  // type; the helper itself is emitted after all functions.
+  std::string HeapArrayHelper(const std::string &op,
+                              const std::shared_ptr<Type> &array) {
+    std::string helper = "$array_" + op + "." + HeapTypeName(array).substr(1);
+    gc_array_helpers_[helper] = {op, array};
+    return helper;
+  }
+
+  void EmitHeapArrayHelpers() {
+    for (const auto &entry : gc_array_helpers_) {
+      const std::string &op = entry.second.first;
+      const auto &array = entry.second.second;
+      std::string type = HeapTypeName(array);
+      std::string ref = "(ref null " + type + ")";
+      // Packed i8 elements are read and written as i32.
+      std::string elem = StorageType(array->element);
+      if (elem == "i8")
+        elem = "i32";
+      std::string get = "array.get" + HeapGetSuffix(array->element);
+      out_ << "  (func " << entry.first << " (param $a " << ref << ")";
+      if (op == "fill") {
+        out_ << " (param $v " << elem << ")\n";
+        out_ << "    local.get $a\n    i32.const 0\n    local.get $v\n";
+        out_ << "    local.get $a\n    array.len\n";
+        out_ << "    array.fill " << type << "\n";
+      } else if (op == "equals") {
+        out_ << " (param $b " << ref << ") (result i64)\n";
+        out_ << "    (local $i i32) (local $n i32)\n";
+        out_ << "    local.get $a\n    array.len\n    local.tee $n\n";
+        out_ << "    local.get $b\n    array.len\n    i32.ne\n";
+        out_ << "    if\n      i64.const 0\n      return\n    end\n";
+        out_ << "    block\n      loop\n";
+        out_ << "        local.get $i\n        local.get $n\n";
+        out_ << "        i32.ge_u\n        br_if 1\n";
+        out_ << "        local.get $a\n        local.get $i\n";
+        out_ << "        " << get << " " << type << "\n";
+        out_ << "        local.get $b\n        local.get $i\n";
+        out_ << "        " << get << " " << type << "\n";
+        out_ << "        " << elem << ".ne\n";
+        out_ << "        if\n          i64.const 0\n          return\n";
+        out_ << "        end\n";
+        out_ << "        local.get $i\n        i32.const 1\n        i32.add\n";
+        out_ << "        local.set $i\n        br 0\n";
+        out_ << "      end\n    end\n";
+        out_ << "    i64.const 1\n";
+      } else {
+        out_ << " (param $n i64) (result " << ref << ")\n";
+        out_ << "    (local $new " << ref << ") (local $keep i32)\n";
+        out_ << "    local.get $n\n    i32.wrap_i64\n";
+        out_ << "    array.new_default " << type << "\n    local.set $new\n";
+        out_ << "    local.get $a\n    array.len\n    local.tee $keep\n";
+        out_ << "    local.get $n\n    i32.wrap_i64\n";
+        out_ << "    local.get $keep\n    local.get $n\n    i32.wrap_i64\n";
+        out_ << "    i32.lt_u\n    select\n    local.set $keep\n";
+        out_ << "    local.get $new\n    i32.const 0\n";
+        out_ << "    local.get $a\n    i32.const 0\n    local.get $keep\n";
+        out_ << "    array.copy " << type << " " << type << "\n";
+        out_ << "    local.get $new\n";
+      }
+      out_ << "  )\n";
+    }
+  }
+
+  void PlanSimdLoops(const std::vector<StmtPtr> &stmts, const Env &env) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::If || s->kind == StmtKind::Case) {
+        PlanSimdLoops(s->then_body, env);
+        PlanSimdLoops(s->else_body, env);
+      } else if (s->kind == StmtKind::Match || s->kind == StmtKind::For) {
+        PlanSimdLoops(s->body, env);
+        PlanSimdLoops(s->else_body, env);
+      } else if (s->kind == StmtKind::While) {
+        auto plan = MatchSimdLoop(*s, env, structs_);
+        if (!plan) {
+          PlanSimdLoops(s->body, env);
+          continue;
+        }
+        plan->id = static_cast<int>(simd_loops_.size());
+        simd_loop_ids_[s.get()] = simd_loops_.size();
+        simd_loops_.push_back(*plan);
+      }
+    }
+  }
+
+  // --simd: runs the matched loop two lanes at a time while i < limit - 1.
+  // Reductions keep per-lane partials in v128 locals and fold them into the
+  // scalar accumulator afterwards; the original loop then finishes the tail.
+  void EmitSimdLoop(const SimdLoop &loop, Env &env) {
+    std::string prefix = "$simd" + std::to_string(loop.id);
+    std::string index = loop.index.wasm_name;
+    EmitExpr(loop.limit, env);
+    out_ << "    local.set " << prefix << "_n\n";
+    std::vector<SimdOperand> operands;
+    for (const auto &step : loop.steps) {
+      if (!step.reduction)
+        operands.push_back({&step.array, step.column, true});
+      SimdOperands(step.value, env, operands);
+    }
+    // The vector loop runs while i < n - 1, which needs n > INT64_MIN.
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    bool limit_min = loop.limit->kind != ExprKind::IntLit ||
+                     loop.limit->int_value == min;
+    bool guarded = BoundsChecked() || SimdMayOverlap(operands) || limit_min;
+    if (guarded)
+      out_ << "    i32.const 1\n";
+    if (limit_min) {
+      out_ << "    local.get " << prefix << "_n\n    i64.const " << min << "\n";
+      out_ << "    i64.ne\n    i32.and\n";
+    }
+    if (BoundsChecked()) {
+      // Vector accesses are unchecked: run them only when every lane is in
+      // range and leave the whole loop to the checked scalar code otherwise.
+      std::vector<std::string> arrays;
+      for (const auto &step : loop.steps) {
+        if (!step.reduction)
+          arrays.push_back(step.array.wasm_name);
+        SimdArrays(step.value, env, arrays);
+      }
+      out_ << "    local.get " << index << "\n    i64.const 0\n    i64.ge_s\n";
+      out_ << "    i32.and\n";
+      for (const auto &array : arrays) {
+        out_ << "    local.get " << prefix << "_n\n";
+        out_ << ArrayLength(array) << "    i64.le_s\n    i32.and\n";
+      }
+    }
+    EmitSimdOverlapCheck(operands);
+    if (guarded)
+      out_ << "    if\n";
+    for (size_t j = 0; j < loop.steps.size(); ++j) {
+      const auto &step = loop.steps[j];
+      if (!step.reduction)
+        continue;
+      bool real = step.acc.type->kind == TypeKind::Real;
+      out_ << (real ? "    f64.const " : "    i64.const ")
+           << (step.op == "*" ? 1 : 0) << "\n";
+      out_ << (real ? "    f64x2.splat\n" : "    i64x2.splat\n");
+      out_ << "    local.set " << prefix << "_r" << j << "\n";
+    }
+    out_ << "    block\n      loop\n";
+    out_ << "      local.get " << index << "\n";
+    out_ << "      local.get " << prefix << "_n\n      i64.const 1\n      i64.sub\n";
+    out_ << "      i64.lt_s\n      i32.eqz\n      br_if 1\n";
+    for (size_t j = 0; j < loop.steps.size(); ++j) {
+      const auto &step = loop.steps[j];
+      if (step.reduction) {
+        std::string shape =
+            step.acc.type->kind == TypeKind::Real ? "f64x2" : "i64x2";
+        out_ << "    local.get " << prefix << "_r" << j << "\n";
+        EmitSimdValue(step.value, loop, env);
+        out_ << "    " << shape << SimdOp(step.op) << "\n";
+        out_ << "    local.set " << prefix << "_r" << j << "\n";
+      } else {
+        EmitSimdAddress(step.array, index, step.column);
+        EmitSimdValue(step.value, loop, env);
+        out_ << "    v128.store offset=8 align=8\n";
+      }
+    }
+    out_ << "    local.get " << index << "\n    i64.const 2\n    i64.add\n";
+    out_ << "    local.set " << index << "\n";
+    out_ << "      br 0\n      end\n    end\n";
+    // a - e0 - e1 - ... accumulates the negated sum, so fold with add.
+    for (size_t j = 0; j < loop.steps.size(); ++j) {
+      const auto &step = loop.steps[j];
+      if (!step.reduction)
+        continue;
+      std::string shape =
+          step.acc.type->kind == TypeKind::Real ? "f64x2" : "i64x2";
+      std::string fold = (step.acc.type->kind == TypeKind::Real ? "f64" : "i64") +
+                         std::string(step.op == "*" ? ".mul" : ".add");
+      out_ << "    local.get " << step.acc.wasm_name << "\n";
+      for (int lane = 0; lane < 2; ++lane) {
+        out_ << "    local.get " << prefix << "_r" << j << "\n";
+        out_ << "    " << shape << ".extract_lane " << lane << "\n";
+        out_ << "    " << fold << "\n";
+      }
+      out_ << "    local.set " << step.acc.wasm_name << "\n";
+    }
+    if (guarded)
+      out_ << "    end\n";
+  }
+
+  // An element array or soa column the vector loop reads or stores.
+  struct SimdOperand {
+    const LocalInfo *array;
+    int64_t column;
+    bool stored;
+  };
+
+  void SimdOperands(const ExprPtr &expr, Env &env,
+                    std::vector<SimdOperand> &operands) {
+    if (!expr)
+      return;
+    if (expr->kind == ExprKind::Index) {
+      auto res = FindIdentifier(expr->base->text, env, structs_);
+      operands.push_back({res->local, 0, false});
+      return;
+    }
+    if (expr->kind == ExprKind::Field) {
+      auto res = FindIdentifier(expr->base->base->text, env, structs_);
+      operands.push_back({res->local, ColumnOffset(expr, structs_), false});
+      return;
+    }
+    SimdOperands(expr->left, env, operands);
+    SimdOperands(expr->right, env, operands);
+  }
+
+  static bool SimdOverlapPair(const SimdOperand &a, const SimdOperand &b) {
+    return (a.stored || b.stored) && a.array->wasm_name != b.array->wasm_name;
+  }
+
+  static bool SimdMayOverlap(const std::vector<SimdOperand> &operands) {
+    for (size_t a = 0; a < operands.size(); ++a) {
+      for (size_t b = a + 1; b < operands.size(); ++b) {
+        if (SimdOverlapPair(operands[a], operands[b]))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  // Two distinct locals may view the same elements through slices or
+  // as_array. Lanes only disagree with the scalar order when a stored
+  // operand sits exactly one element from another one, so that case leaves
+  // the whole loop to the scalar code. Columns of one local never do.
+  void EmitSimdOverlapCheck(const std::vector<SimdOperand> &operands) {
+    for (size_t a = 0; a < operands.size(); ++a) {
+      for (size_t b = a + 1; b < operands.size(); ++b) {
+        if (!SimdOverlapPair(operands[a], operands[b]))
+          continue;
+        EmitSimdBase(*operands[a].array, operands[a].column);
+        EmitSimdBase(*operands[b].array, operands[b].column);
+        out_ << "    i32.sub\n    i64.extend_i32_s\n    local.set $tmp0\n";
+        out_ << "    local.get $tmp0\n    i64.const 8\n    i64.ne\n";
+        out_ << "    local.get $tmp0\n    i64.const -8\n    i64.ne\n";
+        out_ << "    i32.and\n    i32.and\n";
+      }
+    }
+  }
+
+  void SimdArrays(const ExprPtr &expr, Env &env,
+                  std::vector<std::string> &arrays) {
+    if (!expr)
+      return;
+    if (expr->kind == ExprKind::Index) {
+      arrays.push_back(
+          FindIdentifier(expr->base->text, env, structs_)->local->wasm_name);
+      return;
+    }
+    if (expr->kind == ExprKind::Field) {
+      SimdArrays(expr->base, env, arrays);
+      return;
+    }
+    SimdArrays(expr->left, env, arrays);
+    SimdArrays(expr->right, env, arrays);
+  }
+
+  static std::string SimdOp(const std::string &op) {
+    if (op == "+")
+      return ".add";
+    if (op == "-")
+      return ".sub";
+    if (op == "*")
+      return ".mul";
+    return ".div";
+  }
+
+  // Lanes i and i+1 of an 8-byte element array: base + 8 + i*8, plus
+  // len * column for a soa column.
+  void EmitSimdAddress(const LocalInfo &array, const std::string &index,
+                       int64_t column = 0) {
+    EmitSimdBase(array, column);
+    out_ << "    local.get " << index << "\n    i32.wrap_i64\n";
+    out_ << "    i32.const 3\n    i32.shl\n    i32.add\n";
+  }
+
+  void EmitSimdBase(const LocalInfo &array, int64_t column) {
+    out_ << "    local.get " << array.wasm_name << "\n    i32.wrap_i64\n";
+    if (column != 0) {
+      out_ << "    local.get " << array.wasm_name << "\n    i32.wrap_i64\n";
+      out_ << "    i32.load\n    i32.const " << column << "\n    i32.mul\n";
+      out_ << "    i32.add\n";
+    }
+  }
+
+  void EmitSimdValue(const ExprPtr &expr, const SimdLoop &loop, Env &env) {
+    bool real = expr->type->kind == TypeKind::Real;
+    std::string shape = real ? "f64x2" : "i64x2";
+    if (expr->kind == ExprKind::Var && expr->text == loop.index_name) {
+      out_ << "    local.get " << loop.index.wasm_name << "\n";
+      out_ << "    i64x2.splat\n    v128.const i64x2 0 1\n    i64x2.add\n";
+    } else if (expr->kind == ExprKind::Index) {
+      auto res = FindIdentifier(expr->base->text, env, structs_);
+      EmitSimdAddress(*res->local, loop.index.wasm_name);
+      out_ << "    v128.load offset=8 align=8\n";
+    } else if (expr->kind == ExprKind::Field) {
+      auto res = FindIdentifier(expr->base->base->text, env, structs_);
+      EmitSimdAddress(*res->local, loop.index.wasm_name,
+                      ColumnOffset(expr, structs_));
+      out_ << "    v128.load offset=8 align=8\n";
+    } else if (expr->kind == ExprKind::Unary) {
+      EmitSimdValue(expr->left, loop, env);
+      out_ << "    " << shape << ".neg\n";
+    } else if (expr->kind == ExprKind::Binary) {
+      EmitSimdValue(expr->left, loop, env);
+      EmitSimdValue(expr->right, loop, env);
+      out_ << "    " << shape << SimdOp(expr->op) << "\n";
+    } else {
+      // Loop-invariant scalar: same value in both lanes.
+      EmitExpr(expr, env);
+      out_ << "    " << shape << ".splat\n";
     }
   }
 
@@ -274,12 +1474,22 @@ private:
     std::cerr << "WasmType check: " << type.get() << std::endl;
     if (type->kind == TypeKind::Real)
       return "f64";
+    if (type->kind == TypeKind::Vector)
+      return "v128";
+    if (GcTarget() &&
+        (type->kind == TypeKind::Struct || type->kind == TypeKind::Array))
+      return "(ref null " + HeapTypeName(type) + ")";
     return "i64";
   }
 
   void EmitZero(const std::shared_ptr<Type> &type) {
-    if (type->kind == TypeKind::Real)
+    if (GcTarget() &&
+        (type->kind == TypeKind::Struct || type->kind == TypeKind::Array))
+      out_ << "    ref.null " << HeapTypeName(type) << "\n";
+    else if (type->kind == TypeKind::Real)
       out_ << "    f64.const 0\n";
+    else if (type->kind == TypeKind::Vector)
+      out_ << "    v128.const i64x2 0 0\n";
     else if (type->kind == TypeKind::String)
       out_ << "    i64.const " << string_table_.Offsets().at("") << "\n";
     else
@@ -287,8 +1497,34 @@ private:
   }
 
   void EmitStmts(const std::vector<StmtPtr> &stmts, Env &env) {
-    for (const auto &s : stmts)
+    std::pair<int, int> yields = YieldRange(stmts);
+    bool resumable = generator_ && yields.first <= yields.second;
+    for (const auto &s : stmts) {
+      if (options_.gc) {
+        // Temporaries rooted by the previous statement are dead now.
+        out_ << "    local.get $gc_frame\n";
+        out_ << "    i64.const " << (gc_slots_.size() * 8) << "\n";
+        out_ << "    i64.add\n    global.set $gc_sp\n";
+      }
+      if (resumable) {
+        // Resuming skips to the statement holding the yield.
+        out_ << "    local.get $resume\n    i32.eqz\n";
+        auto range = yield_ranges_.find(s.get());
+        if (range != yield_ranges_.end()) {
+          EmitResumeIn(range->second);
+          out_ << "    i32.or\n";
+        }
+        out_ << "    if\n";
+      }
       EmitStmt(s, env);
+      if (resumable)
+        out_ << "    end\n";
+      if (BoundsChecked()) {
+        std::unordered_set<std::string> assigned;
+        AssignedNames(s, assigned);
+        KillFacts(bounds_facts_, assigned);
+      }
+    }
   }
 
   void EmitStmt(const StmtPtr &stmt, Env &env) {
@@ -297,14 +1533,12 @@ private:
     switch (stmt->kind) {
     case StmtKind::VarDecl:
       if (stmt->expr) {
-        EmitExpr(stmt->expr, env);
-        // implicit cast check not needed as we checked types
-        out_ << "    local.set " << env.locals[stmt->var_name].wasm_name
-             << "\n";
+        auto type = EmitExpr(stmt->expr, env);
+        EmitCoerce(env.locals[stmt->var_name].type, type);
+        EmitLocalSet(env.locals[stmt->var_name]);
       } else {
         EmitZero(env.locals[stmt->var_name].type);
-        out_ << "    local.set " << env.locals[stmt->var_name].wasm_name
-             << "\n";
+        EmitLocalSet(env.locals[stmt->var_name]);
       }
       break;
     case StmtKind::Assign:
@@ -317,29 +1551,862 @@ private:
       }
     } break;
     case StmtKind::Return:
+      if (generator_) {
+        EmitGeneratorDone();
+        out_ << "    i32.const 0\n    return\n";
+        break;
+      }
+      if (stmt->expr && TailCallee(stmt->expr) &&
+          !NeedsCoerce(current_fn_->return_type,
+                       TailCallee(stmt->expr)->return_type)) {
+        EmitTailCall(stmt->expr, env);
+        break;
+      }
       if (stmt->expr) {
-        EmitExpr(stmt->expr, env);
+        EmitCoerce(current_fn_->return_type, EmitExpr(stmt->expr, env));
       }
+      EmitGcLeave();
       out_ << "    return\n";
       break;
-    case StmtKind::If:
-      EmitExpr(stmt->expr, env);
-      out_ << "    i32.wrap_i64\n    if\n";
+    case StmtKind::If: {
+      EmitCondition(stmt->expr, YieldRange(stmt->then_body), env);
+      out_ << "    if\n";
+      BoundsFacts outer = bounds_facts_;
+      if (BoundsChecked()) {
+        auto guard = GuardFacts(stmt->expr, bounds_scope_, env, structs_);
+        bounds_facts_.insert(guard.begin(), guard.end());
+      }
       EmitStmts(stmt->then_body, env);
+      bounds_facts_ = outer;
       if (!stmt->else_body.empty()) {
         out_ << "    else\n";
         EmitStmts(stmt->else_body, env);
+        bounds_facts_ = outer;
       }
       out_ << "    end\n";
       break;
+    }
     case StmtKind::While:
-      out_ << "    block\n      loop\n";
-      EmitExpr(stmt->expr, env);
-      out_ << "      i32.wrap_i64\n      i32.eqz\n      br_if 1\n";
-      EmitStmts(stmt->body, env);
-      out_ << "      br 0\n      end\n    end\n";
+      if (stmt->parallel && options_.threads && !in_parallel_worker_) {
+        EmitParallelLoop(*stmt, env);
+        break;
+      }
+      if (stmt->trip_count == 0)
+        break;
+      EmitRowAddresses(*stmt, env);
+      if (simd_loop_ids_.count(stmt.get())) {
+        // The vector loop leaves fewer than two iterations for this one.
+        EmitSimdLoop(simd_loops_[simd_loop_ids_.at(stmt.get())], env);
+      }
+      if (BoundsChecked()) {
+        EmitCheckedWhile(*stmt, env);
+        break;
+      }
+      EmitWhile(*stmt, env);
+      break;
+    case StmtKind::Yield:
+      EmitYield(*stmt, env);
+      break;
+    case StmtKind::Match:
+      EmitMatch(*stmt, env);
+      break;
+    case StmtKind::Case:
       break;
+    case StmtKind::For:
+      if (!EmitUnrolledFor(*stmt, env))
+        EmitStmts(stmt->body, env);
+      break;
+    }
+  }
+
+  // match: one block per arm inside a block for the else arm and one to
+  // leave by, so arm k is reached with `br k` from the dispatch, which
+  // leaves the value in $tmp0 and is either a br_table (when the cases
+  // fill enough of their range) or a binary search over the sorted cases.
+  void EmitMatch(const Stmt &stmt, Env &env) {
+    int arms = static_cast<int>(stmt.body.size());
+    std::vector<std::pair<int64_t, int>> cases;
+    for (int k = 0; k < arms; ++k) {
+      for (int64_t value : stmt.body[k]->cases)
+        cases.push_back({value, k});
+    }
+    std::sort(cases.begin(), cases.end());
+    out_ << "    block\n    block\n";
+    for (int k = 0; k < arms; ++k)
+      out_ << "    block\n";
+    if (generator_) {
+      // Resuming goes straight to the arm holding the yield.
+      for (int k = 0; k <= arms; ++k) {
+        auto range = k < arms ? YieldRange({stmt.body[k]})
+                              : YieldRange(stmt.else_body);
+        if (range.first > range.second)
+          continue;
+        EmitResumeIn(range);
+        out_ << "    br_if " << k << "\n";
+      }
+    }
+    EmitExpr(stmt.expr, env);
+    out_ << "    local.set $tmp0\n";
+    uint64_t span = static_cast<uint64_t>(cases.back().first) -
+                    static_cast<uint64_t>(cases.front().first) + 1;
+    if (cases.size() >= kMatchTableMin && span != 0 &&
+        span <= kMatchTableSpread * cases.size()) {
+      std::vector<int> table(span, arms);
+      for (const auto &c : cases)
+        table[static_cast<uint64_t>(c.first) -
+              static_cast<uint64_t>(cases.front().first)] = c.second;
+      out_ << "    local.get $tmp0\n";
+      out_ << "    i64.const " << cases.front().first << "\n    i64.sub\n";
+      out_ << "    local.tee $tmp0\n";
+      out_ << "    i64.const " << span << "\n    i64.ge_u\n";
+      out_ << "    br_if " << arms << "\n";
+      out_ << "    local.get $tmp0\n    i32.wrap_i64\n    br_table";
+      for (int target : table)
+        out_ << " " << target;
+      out_ << " " << arms << "\n";
+    } else {
+      EmitMatchSearch(cases, 0, cases.size(), 0, arms);
+    }
+    BoundsFacts outer = bounds_facts_;
+    for (int k = 0; k < arms; ++k) {
+      out_ << "    end\n";
+      EmitStmts(stmt.body[k]->then_body, env);
+      bounds_facts_ = outer;
+      out_ << "    br " << (arms - k) << "\n";
+    }
+    out_ << "    end\n";
+    EmitStmts(stmt.else_body, env);
+    bounds_facts_ = outer;
+    out_ << "    end\n";
+  }
+
+  // Branches from `depth` nested ifs inside the dispatch of EmitMatch to the
+  // arm of $tmp0 among cases [lo, hi), or to the else arm.
+  void EmitMatchSearch(const std::vector<std::pair<int64_t, int>> &cases,
+                       size_t lo, size_t hi, int depth, int arms) {
+    if (hi - lo <= kMatchLinearMax) {
+      for (size_t i = lo; i < hi; ++i) {
+        out_ << "    local.get $tmp0\n";
+        out_ << "    i64.const " << cases[i].first << "\n    i64.eq\n";
+        out_ << "    br_if " << (cases[i].second + depth) << "\n";
+      }
+      out_ << "    br " << (arms + depth) << "\n";
+      return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    out_ << "    local.get $tmp0\n";
+    out_ << "    i64.const " << cases[mid].first << "\n    i64.lt_s\n";
+    out_ << "    if\n";
+    EmitMatchSearch(cases, lo, mid, depth + 1, arms);
+    out_ << "    else\n";
+    EmitMatchSearch(cases, mid, hi, depth + 1, arms);
+    out_ << "    end\n";
+  }
+
+  // $row<id> = a + 8 * dims + (leading index) * d_last * size, before the
+  // loop the row is invariant in (see RowPlan).
+  void EmitRowAddresses(const Stmt &loop, Env &env) {
+    auto it = row_plan_.hoisted.find(&loop);
+    if (it == row_plan_.hoisted.end())
+      return;
+    for (const auto &row : it->second) {
+      const ExprPtr &access = row.access;
+      auto array = EmitExpr(access->base, env);
+      out_ << "    local.set $dim0\n";
+      EmitExpr(access->left, env);
+      for (size_t k = 0; k + 1 < access->args.size(); ++k) {
+        EmitDim(k + 1);
+        out_ << "    i64.mul\n";
+        EmitExpr(access->args[k], env);
+        out_ << "    i64.add\n";
+      }
+      EmitDim(array->dims - 1);
+      out_ << "    i64.mul\n";
+      out_ << "    i64.const " << GetTypeSize(array->element)
+           << "\n    i64.mul\n";
+      out_ << "    local.get $dim0\n    i64.add\n";
+      out_ << "    i64.const " << 8 * array->dims << "\n    i64.add\n";
+      out_ << "    local.set $row" << row.id << "\n";
+    }
+  }
+
+  // Dimension k of the rectangular array in $dim0.
+  void EmitDim(size_t k) {
+    out_ << "    local.get $dim0\n    i32.wrap_i64\n    i64.load";
+    if (k != 0)
+      out_ << " offset=" << 8 * k;
+    out_ << "\n";
+  }
+
+  void EmitWhile(const Stmt &stmt, Env &env) {
+    if (stmt.step != 0) {
+      EmitCountedWhile(stmt, bounds_facts_, bounds_facts_, env);
+      return;
+    }
+    out_ << "    block\n      loop\n";
+    EmitCondition(stmt.expr, YieldRange(stmt.body), env);
+    out_ << "      i32.eqz\n      br_if 1\n";
+    EmitStmts(stmt.body, env);
+    out_ << "      br 0\n      end\n    end\n";
+  }
+
+  // --bounds-check: facts that survive the body hold at every test of the
+  // condition, and the condition's guards hold on entry to the body. When
+  // a[i] accesses are left unproven, the loop is versioned: one test of
+  // i >= 0 and limit <= a.length() up front selects an unchecked copy.
+  void EmitCheckedWhile(const Stmt &stmt, Env &env) {
+    BoundsFacts outer = bounds_facts_;
+    std::unordered_set<std::string> assigned;
+    AssignedNames(stmt.body, assigned);
+    KillFacts(bounds_facts_, assigned);
+    BoundsFacts base = bounds_facts_;
+    BoundsFacts entry = base;
+    auto guard = GuardFacts(stmt.expr, bounds_scope_, env, structs_);
+    entry.insert(guard.begin(), guard.end());
+    auto version =
+        MatchBoundsVersion(stmt, entry, bounds_scope_, env, structs_);
+    // A loop a generator resumes into is not versioned.
+    if (!version || yield_ranges_.count(&stmt)) {
+      EmitWhileWithFacts(stmt, base, entry, env);
+      bounds_facts_ = outer;
+      return;
+    }
+    auto index = FindIdentifier(version->index, env, structs_);
+    out_ << "    i32.const 1\n";
+    if (version->check_index) {
+      out_ << "    local.get " << index->local->wasm_name << "\n";
+      out_ << "    i64.const 0\n    i64.ge_s\n    i32.and\n";
+    }
+    BoundsFacts fast = entry;
+    for (const auto &name : version->arrays) {
+      auto array = FindIdentifier(name, env, structs_);
+      EmitExpr(version->limit, env);
+      out_ << ArrayLength(array->local->wasm_name);
+      out_ << "    i64.le_s\n    i32.and\n";
+      fast.insert({version->index, name});
+    }
+    out_ << "    if\n";
+    EmitWhileWithFacts(stmt, base, fast, env);
+    out_ << "    else\n";
+    EmitWhileWithFacts(stmt, base, entry, env);
+    out_ << "    end\n";
+    bounds_facts_ = outer;
+  }
+
+  void EmitWhileWithFacts(const Stmt &stmt, const BoundsFacts &cond,
+                          const BoundsFacts &body, Env &env) {
+    if (stmt.step != 0) {
+      EmitCountedWhile(stmt, cond, body, env);
+      return;
+    }
+    out_ << "    block\n      loop\n";
+    bounds_facts_ = cond;
+    EmitCondition(stmt.expr, YieldRange(stmt.body), env);
+    out_ << "      i32.eqz\n      br_if 1\n";
+    bounds_facts_ = body;
+    EmitStmts(stmt.body, env);
+    out_ << "      br 0\n      end\n    end\n";
+  }
+
+  // The while loop of a `for`, rotated: the condition is tested on entry
+  // and then at the bottom, so each iteration takes one branch. The entry
+  // test is left out when the bounds are literals and the loop runs at
+  // least once (unless a --simd loop may have taken every iteration).
+  // When `i + s` can pass the end of the int range, the bottom test also
+  // exits once it has wrapped.
+  void EmitCountedWhile(const Stmt &stmt, const BoundsFacts &cond,
+                        const BoundsFacts &body, Env &env) {
+    bool entry = stmt.trip_count < 1 || simd_loop_ids_.count(&stmt);
+    if (entry) {
+      bounds_facts_ = cond;
+      EmitCondition(stmt.expr, YieldRange(stmt.body), env);
+      out_ << "    if\n";
+    }
+    out_ << "      loop\n";
+    bounds_facts_ = body;
+    EmitStmts(stmt.body, env);
+    bounds_facts_ = cond;
+    EmitExpr(stmt.expr, env);
+    out_ << "      i32.wrap_i64\n";
+    if (ForStepMayWrap(stmt)) {
+      // i + s wrapped iff it is below INT64_MIN + s (above INT64_MAX + s).
+      const int64_t edge = stmt.step > 0
+                               ? std::numeric_limits<int64_t>::min() + stmt.step
+                               : std::numeric_limits<int64_t>::max() + stmt.step;
+      EmitExpr(stmt.expr->left, env);
+      out_ << "    i64.const " << edge << "\n";
+      out_ << (stmt.step > 0 ? "    i64.ge_s\n" : "    i64.le_s\n");
+      out_ << "    i32.and\n";
+    }
+    out_ << "      br_if 0\n      end\n";
+    if (entry)
+      out_ << "    end\n";
+  }
+
+  // The index of a `for` is never assigned in its body, so with a literal
+  // limit b the last i + s is below b + s and cannot wrap unless b is
+  // within s of the end of the range.
+  static bool ForStepMayWrap(const Stmt &stmt) {
+    const ExprPtr &limit = stmt.expr->right;
+    if (limit->kind != ExprKind::IntLit)
+      return true;
+    if (stmt.step > 0)
+      return limit->int_value > std::numeric_limits<int64_t>::max() - stmt.step + 1;
+    return limit->int_value < std::numeric_limits<int64_t>::min() - stmt.step - 1;
+  }
+
+  // The statements in `stmts`, nested ones included; -1 if one is a loop.
+  static int64_t StraightLineSize(const std::vector<StmtPtr> &stmts) {
+    int64_t size = 0;
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::While)
+        return -1;
+      for (const auto *inner : {&s->then_body, &s->else_body, &s->body}) {
+        int64_t n = StraightLineSize(*inner);
+        if (n < 0)
+          return -1;
+        size += n;
+      }
+      size++;
+    }
+    return size;
+  }
+
+  // A `for` with literal bounds and a body without loops emits the body once
+  // per iteration, setting the index in between, when the copies stay
+  // within kForUnrollBudget statements.
+  bool EmitUnrolledFor(const Stmt &stmt, Env &env) {
+    const Stmt &loop = *stmt.body.back();
+    std::vector<StmtPtr> body(loop.body.begin(), loop.body.end() - 1);
+    int64_t size = StraightLineSize(body);
+    if (loop.trip_count < 0 || loop.trip_count > kForUnrollBudget ||
+        generator_ || size < 0 ||
+        loop.trip_count * std::max<int64_t>(size, 1) > kForUnrollBudget)
+      return false;
+    const Stmt &start = *stmt.body.front();
+    EmitStmts({stmt.body.front()}, env);
+    const LocalInfo &index = env.locals.at(stmt.var_name);
+    for (int64_t k = 0; k < loop.trip_count; ++k) {
+      if (k > 0) {
+        out_ << "    i64.const " << start.expr->int_value + k * stmt.step
+             << "\n";
+        EmitLocalSet(index);
+        KillFacts(bounds_facts_, {stmt.var_name});
+      }
+      EmitStmts(body, env);
+    }
+    return true;
+  }
+
+  // Where a parallel loop's worker finds its inputs: [hi][captured values]
+  // then the partial result of each reduction for every thread slot.
+  struct ParallelContext {
+    std::vector<std::pair<std::string, int64_t>> captures;
+    int64_t partials = 0;
+    int64_t size = 0;
+  };
+
+  ParallelContext LayoutParallelContext(const ParallelLoop &plan,
+                                        const Env &env) {
+    ParallelContext ctx;
+    int64_t offset = 8;
+    for (const auto &name : plan.captures) {
+      bool folded = false;
+      for (const auto &r : plan.reductions)
+        folded = folded || r.name == name;
+      if (name == plan.index || folded)
+        continue;
+      auto res = FindIdentifier(name, env, structs_);
+      ctx.captures.push_back({name, offset});
+      offset += res->local->type->kind == TypeKind::Vector ? 16 : 8;
+    }
+    ctx.partials = offset;
+    ctx.size = offset + 8 * options_.threads *
+                            static_cast<int64_t>(plan.reductions.size());
+    return ctx;
+  }
+
+  // --threads: the body becomes worker function $par<site>, run over chunks
+  // of [i, limit) by $par_run. The block of values it reads is static, or
+  // allocated when the loop runs on a worker already (the static one may be
+  // in use then). Afterwards the partial results fold into the reductions
+  // in slot order and i is left at the limit, as the loop would leave it.
+  void EmitParallelLoop(const Stmt &stmt, Env &env) {
+    ParallelLoop plan = MatchParallelLoop(stmt, env, structs_);
+    ParallelContext ctx = LayoutParallelContext(plan, env);
+    int site = parallel_sites_++;
+    int64_t block = string_table_.Reserve(ctx.size);
+    EmitParallelWorker(stmt, plan, ctx, site, env);
+
+    auto ctx_addr = [this]() {
+      out_ << "    local.get $par_ctx\n    i32.wrap_i64\n";
+    };
+    out_ << "    global.get $par_depth\n";
+    out_ << "    if (result i64)\n";
+    out_ << "      i64.const " << ctx.size << "\n";
+    out_ << "      call $alloc\n";
+    out_ << "    else\n";
+    out_ << "      i64.const " << block << "\n";
+    out_ << "    end\n";
+    out_ << "    local.set $par_ctx\n";
+    ctx_addr();
+    EmitCoerce(ResolveType(TypeSpec{"int", 0, false}, structs_),
+               EmitExpr(plan.limit, env));
+    out_ << "    i64.store\n";
+    for (const auto &capture : ctx.captures) {
+      auto local = FindIdentifier(capture.first, env, structs_)->local;
+      ctx_addr();
+      out_ << "    local.get " << local->wasm_name << "\n";
+      out_ << "    " << WasmType(local->type) << ".store offset="
+           << capture.second << "\n";
+    }
+    for (size_t r = 0; r < plan.reductions.size(); ++r) {
+      const auto &red = plan.reductions[r];
+      bool real = FindIdentifier(red.name, env, structs_)->local->type->kind ==
+                  TypeKind::Real;
+      ctx_addr();
+      out_ << "    i32.const " << ParallelPartials(ctx, r) << "\n";
+      out_ << "    i32.add\n";
+      out_ << "    i32.const " << options_.threads << "\n";
+      if (red.op == "+")
+        out_ << "    i64.const 0\n";
+      else if (real)
+        out_ << "    f64.const 1\n    i64.reinterpret_f64\n";
+      else
+        out_ << "    i64.const 1\n";
+      out_ << "    call $par_fill\n";
+    }
+
+    auto index = FindIdentifier(plan.index, env, structs_)->local;
+    out_ << "    local.get " << index->wasm_name << "\n";
+    ctx_addr();
+    out_ << "    i64.load\n";
+    out_ << "    i64.lt_s\n";
+    out_ << "    if\n";
+    out_ << "    i32.const " << site << "\n";
+    ctx_addr();
+    out_ << "    local.get " << index->wasm_name << "\n";
+    ctx_addr();
+    out_ << "    i64.load\n";
+    out_ << "    call $par_run\n";
+    for (size_t r = 0; r < plan.reductions.size(); ++r) {
+      const auto &red = plan.reductions[r];
+      auto acc = FindIdentifier(red.name, env, structs_)->local;
+      std::string type = WasmType(acc->type);
+      ctx_addr();
+      out_ << "    i32.const " << ParallelPartials(ctx, r) << "\n";
+      out_ << "    i32.add\n";
+      out_ << "    i32.const " << options_.threads << "\n";
+      out_ << "    local.get " << acc->wasm_name << "\n";
+      out_ << "    call $par_fold_" << type << "_"
+           << (red.op == "+" ? "add" : "mul") << "\n";
+      EmitLocalSet(*acc);
+    }
+    ctx_addr();
+    out_ << "    i64.load\n";
+    EmitLocalSet(*index);
+    out_ << "    end\n";
+  }
+
+  // Offset of reduction r's partial results, one per thread slot.
+  int64_t ParallelPartials(const ParallelContext &ctx, size_t r) const {
+    return ctx.partials + 8 * options_.threads * static_cast<int64_t>(r);
+  }
+
+  // $par<site>(lo, hi, ctx, slot): loads the captured values and this
+  // slot's partial results into locals, runs `while i < hi` over the
+  // original body (so the loop plans of the worker apply to it) and stores
+  // the partial results back.
+  void EmitParallelWorker(const Stmt &stmt, const ParallelLoop &plan,
+                          const ParallelContext &ctx, int site,
+                          const Env &env) {
+    auto int_type = ResolveType(TypeSpec{"int", 0, false}, structs_);
+    Env worker;
+    worker.current_struct = env.current_struct;
+    for (const auto &name : plan.captures) {
+      auto local = FindIdentifier(name, env, structs_)->local;
+      // Field accesses read $this directly.
+      LocalInfo copy{name == "this" ? "$this" : "$c" + name, local->type};
+      if (name == "this")
+        worker.params[name] = copy;
+      else
+        worker.locals[name] = copy;
+    }
+    worker.locals["@hi"] = LocalInfo{"$hi", int_type};
+
+    auto hi = std::make_shared<Expr>();
+    hi->kind = ExprKind::Var;
+    hi->text = "@hi";
+    hi->type = int_type;
+    hi->line = stmt.line;
+    auto cond = std::make_shared<Expr>(*stmt.expr);
+    cond->right = hi;
+    auto loop = std::make_shared<Stmt>();
+    loop->kind = StmtKind::While;
+    loop->expr = cond;
+    loop->body = stmt.body;
+    loop->line = stmt.line;
+    Function decl;
+    decl.name = "par" + std::to_string(site);
+    decl.body.push_back(loop);
+
+    std::ostringstream text;
+    out_.swap(text);
+    auto saved_simd = std::move(simd_loops_);
+    auto saved_simd_ids = std::move(simd_loop_ids_);
+    auto saved_scope = bounds_scope_;
+    auto saved_facts = bounds_facts_;
+    auto saved_rows = row_plan_;
+    in_parallel_worker_ = true;
+
+    std::vector<LocalInfo> locals;
+    for (const auto &name : plan.captures) {
+      if (name != "this")
+        locals.push_back(worker.locals.at(name));
+    }
+    if (worker.params.count("this"))
+      locals.push_back(worker.params.at("this"));
+    CollectLocals(decl.body, worker, locals);
+    out_ << "  (func $par" << site
+         << " (param $lo i64) (param $hi i64) (param $ctx i32) (param $slot "
+            "i32)";
+    PlanLoops(decl, worker);
+    EmitLocalDecls(decl.body, locals);
+    for (const auto &capture : ctx.captures) {
+      const LocalInfo &local = capture.first == "this"
+                                   ? worker.params.at("this")
+                                   : worker.locals.at(capture.first);
+      out_ << "    local.get $ctx\n";
+      out_ << "    " << WasmType(local.type) << ".load offset="
+           << capture.second << "\n";
+      out_ << "    local.set " << local.wasm_name << "\n";
+    }
+    for (size_t r = 0; r < plan.reductions.size(); ++r) {
+      const LocalInfo &acc = worker.locals.at(plan.reductions[r].name);
+      out_ << "    local.get $ctx\n    local.get $slot\n";
+      out_ << "    i32.const 8\n    i32.mul\n    i32.add\n";
+      out_ << "    " << WasmType(acc.type) << ".load offset="
+           << ParallelPartials(ctx, r) << "\n";
+      out_ << "    local.set " << acc.wasm_name << "\n";
+    }
+    out_ << "    local.get $lo\n";
+    out_ << "    local.set " << worker.locals.at(plan.index).wasm_name << "\n";
+    EmitStmts(decl.body, worker);
+    for (size_t r = 0; r < plan.reductions.size(); ++r) {
+      const LocalInfo &acc = worker.locals.at(plan.reductions[r].name);
+      out_ << "    local.get $ctx\n    local.get $slot\n";
+      out_ << "    i32.const 8\n    i32.mul\n    i32.add\n";
+      out_ << "    local.get " << acc.wasm_name << "\n";
+      out_ << "    " << WasmType(acc.type) << ".store offset="
+           << ParallelPartials(ctx, r) << "\n";
+    }
+    out_ << "  )\n";
+
+    in_parallel_worker_ = false;
+    simd_loops_ = std::move(saved_simd);
+    simd_loop_ids_ = std::move(saved_simd_ids);
+    bounds_scope_ = saved_scope;
+    bounds_facts_ = saved_facts;
+    row_plan_ = saved_rows;
+    out_.swap(text);
+    parallel_workers_ << text.str();
+  }
+
+  // A task value is the result itself, as i64 bits, when the call runs on
+  // the spot. With --threads it is a heap block [state i32][task id i32]
+  // [result][arguments...] pushed on this thread's deque for any thread to
+  // run; the task id selects $task<id>, which calls the function.
+  std::shared_ptr<Type> EmitSpawn(const ExprPtr &expr, Env &env) {
+    if (GcTarget())
+      throw CompileError("spawn needs linear memory and is not available "
+                         "with --target=wasm-gc");
+    const ExprPtr &call = expr->left;
+    const FunctionInfo &fn = functions_.at(call->base->text);
+    if (!options_.threads) {
+      EmitCallArgs(call, fn, 0, env);
+      out_ << "    call " << fn.wasm_name << "\n";
+      if (fn.return_type->kind == TypeKind::Void)
+        out_ << "    i64.const 0\n";
+      else if (fn.return_type->kind == TypeKind::Real)
+        out_ << "    i64.reinterpret_f64\n";
+      return expr->type;
+    }
+    auto it = std::find(task_functions_.begin(), task_functions_.end(),
+                        call->base->text);
+    size_t id = it - task_functions_.begin();
+    if (it == task_functions_.end())
+      task_functions_.push_back(call->base->text);
+    std::string task = "$spawn" + std::to_string(spawn_depth_++);
+    out_ << "    i64.const " << kTaskArgs + 8 * fn.params.size() << "\n";
+    out_ << "    call $alloc\n";
+    out_ << "    local.set " << task << "\n";
+    for (size_t k = 0; k < call->args.size(); ++k) {
+      out_ << "    local.get " << task << "\n    i32.wrap_i64\n";
+      EmitCoerce(fn.params[k], EmitExpr(call->args[k], env));
+      out_ << "    " << WasmType(fn.params[k]) << ".store offset="
+           << kTaskArgs + 8 * k << "\n";
+    }
+    // The heap is fresh memory, so the state starts out pending.
+    out_ << "    local.get " << task << "\n    i32.wrap_i64\n";
+    out_ << "    i32.const " << id << "\n";
+    out_ << "    i32.store offset=" << kTaskId << "\n";
+    out_ << "    local.get " << task << "\n    i32.wrap_i64\n";
+    out_ << "    call $task_spawn\n";
+    out_ << "    local.get " << task << "\n";
+    --spawn_depth_;
+    return expr->type;
+  }
+
+  // join(t): the result of the spawned call, waiting for it (and running
+  // other tasks meanwhile) with --threads.
+  std::shared_ptr<Type> EmitJoin(const ExprPtr &expr, Env &env) {
+    auto result = EmitExpr(expr->args[0], env)->element;
+    if (options_.threads)
+      out_ << "    i32.wrap_i64\n    call $task_join\n";
+    if (result->kind == TypeKind::Void)
+      out_ << "    drop\n";
+    else if (result->kind == TypeKind::Real)
+      out_ << "    f64.reinterpret_i64\n";
+    return result;
+  }
+
+  // $task<id>(task): runs the spawned function on the arguments stored in
+  // the task block and stores its result there.
+  void EmitTaskFunctions() {
+    for (size_t id = 0; id < task_functions_.size(); ++id) {
+      const FunctionInfo &fn = functions_.at(task_functions_[id]);
+      bool result = fn.return_type->kind != TypeKind::Void;
+      out_ << "  (func $task" << id << " (param $task i32)\n";
+      if (result)
+        out_ << "    local.get $task\n";
+      for (size_t k = 0; k < fn.params.size(); ++k) {
+        out_ << "    local.get $task\n";
+        out_ << "    " << WasmType(fn.params[k]) << ".load offset="
+             << kTaskArgs + 8 * k << "\n";
+      }
+      out_ << "    call " << fn.wasm_name << "\n";
+      if (result)
+        out_ << "    " << WasmType(fn.return_type) << ".store offset="
+             << kTaskResult << "\n";
+      out_ << "  )\n";
+    }
+  }
+
+  static std::shared_ptr<Type> GeneratorType(const FunctionInfo &info) {
+    return info.return_type->kind == TypeKind::Gen ? info.return_type
+                                                   : nullptr;
+  }
+
+  const GeneratorFrame *FindGenerator(const std::string &wasm_name) const {
+    for (const auto &frame : generators_) {
+      if (functions_.at(frame.function).wasm_name == wasm_name)
+        return &frame;
+    }
+    return nullptr;
+  }
+
+  // Every function returning gen[T] gets a frame cell for each param and
+  // local: those are what a suspended generator has to keep.
+  void LayoutGenerators() {
+    std::vector<std::string> names;
+    for (const auto &fn : program_.functions)
+      names.push_back(fn.name);
+    for (const auto &def : program_.structs) {
+      for (const auto &method : def.methods)
+        names.push_back(def.name + "." + method.name);
+    }
+    for (const auto &name : names) {
+      const FunctionInfo &info = functions_.at(name);
+      if (!GeneratorType(info))
+        continue;
+      if (GcTarget())
+        throw CompileError("generators need linear memory and are not "
+                           "available with --target=wasm-gc");
+      GeneratorFrame frame;
+      frame.function = name;
+      for (size_t k = 0; k < info.params.size(); ++k) {
+        std::string pname = "$p" + std::to_string(k);
+        if (info.decl->is_method && k == 0)
+          pname = "$this";
+        frame.slots.push_back(LocalInfo{pname, info.params[k]});
+      }
+      Env scratch;
+      std::vector<LocalInfo> locals;
+      CollectLocals(info.decl->body, scratch, locals);
+      for (const auto &local : locals) {
+        bool seen = false;
+        for (const auto &slot : frame.slots)
+          seen = seen || slot.wasm_name == local.wasm_name;
+        if (!seen)
+          frame.slots.push_back(local);
+      }
+      for (const auto &slot : frame.slots) {
+        frame.offsets.push_back(frame.size);
+        frame.size += slot.type->kind == TypeKind::Vector ? 16 : 8;
+      }
+      generators_.push_back(frame);
+    }
+  }
+
+  // Calling a generator function only allocates its frame, at resume point
+  // 0 with the arguments in their cells. The body becomes $gen<id>(frame),
+  // which reloads the cells, skips ahead to the yield it stopped at and
+  // runs to the next one (see EmitStmts, EmitCondition and EmitYield).
+  void EmitGenerator(const FunctionInfo &info, const GeneratorFrame &frame,
+                     Env &env) {
+    int id = static_cast<int>(&frame - generators_.data());
+    PlanLoops(Function(), env);
+    EmitLocalDecls({}, {});
+    if (options_.gc) {
+      EmitGcEnter(info, {});
+    }
+    out_ << "    i64.const " << frame.size << "\n";
+    if (options_.gc)
+      out_ << "    i32.const " << frame.gc_type << "\n    call $gc_alloc\n";
+    else
+      out_ << "    call $alloc\n";
+    out_ << "    local.set $tmp0\n";
+    out_ << "    local.get $tmp0\n    i32.wrap_i64\n";
+    out_ << "    i64.const " << (static_cast<int64_t>(id) << 32) << "\n";
+    out_ << "    i64.store offset=" << kGenState << "\n";
+    for (size_t k = 0; k < info.params.size(); ++k) {
+      const LocalInfo &slot = frame.slots[k];
+      out_ << "    local.get $tmp0\n    i32.wrap_i64\n";
+      out_ << "    local.get " << slot.wasm_name << "\n";
+      out_ << "    " << WasmType(slot.type) << ".store offset="
+           << frame.offsets[k] << "\n";
+    }
+    EmitGcLeave();
+    out_ << "    local.get $tmp0\n  )\n";
+
+    const Function &decl = *info.decl;
+    generator_ = &frame;
+    yield_ranges_.clear();
+    int next = 1;
+    NumberYields(decl.body, next);
+    std::vector<LocalInfo> locals;
+    CollectLocals(decl.body, env, locals);
+    // --gc: the frame is a root of its own while the body runs.
+    std::vector<LocalInfo> cells = frame.slots;
+    if (options_.gc)
+      cells.push_back(LocalInfo{"$gen_frame", info.return_type});
+    out_ << "  (func $gen" << id
+         << " (param $frame i32) (result i32) (local $resume i32)";
+    PlanLoops(decl, env);
+    EmitLocalDecls(decl.body, cells);
+    out_ << "    local.get $frame\n    i32.load offset=" << kGenState << "\n";
+    out_ << "    local.tee $resume\n";
+    out_ << "    i32.const " << kGenDone << "\n    i32.eq\n";
+    out_ << "    if\n    i32.const 0\n    return\n    end\n";
+    if (options_.gc) {
+      EmitGcEnter(FunctionInfo(), cells);
+      out_ << "    local.get $frame\n    i64.extend_i32_u\n";
+      EmitLocalSet(cells.back());
+    }
+    for (size_t k = 0; k < frame.slots.size(); ++k) {
+      out_ << "    local.get $frame\n";
+      out_ << "    " << WasmType(frame.slots[k].type)
+           << ".load offset=" << frame.offsets[k] << "\n";
+      EmitLocalSet(frame.slots[k]);
+    }
+    EmitStmts(decl.body, env);
+    EmitGeneratorDone();
+    out_ << "    i32.const 0\n  )\n";
+    generator_ = nullptr;
+    yield_ranges_.clear();
+  }
+
+  // The generator has finished: next() keeps returning false.
+  void EmitGeneratorDone() {
+    out_ << "    local.get $frame\n    i32.const " << kGenDone << "\n";
+    out_ << "    i32.store offset=" << kGenState << "\n";
+    EmitGcLeave();
+  }
+
+  void NumberYields(const std::vector<StmtPtr> &stmts, int &next) {
+    for (const auto &s : stmts) {
+      int first = next;
+      if (s->kind == StmtKind::Yield)
+        ++next;
+      NumberYields(s->then_body, next);
+      NumberYields(s->else_body, next);
+      NumberYields(s->body, next);
+      if (next > first)
+        yield_ranges_[s.get()] = {first, next - 1};
+    }
+  }
+
+  // [first, last] yield inside the statements; first > last when none is.
+  std::pair<int, int> YieldRange(const std::vector<StmtPtr> &stmts) const {
+    std::pair<int, int> range{1, 0};
+    for (const auto &s : stmts) {
+      auto it = yield_ranges_.find(s.get());
+      if (it == yield_ranges_.end())
+        continue;
+      if (range.first > range.second)
+        range.first = it->second.first;
+      range.second = it->second.second;
     }
+    return range;
+  }
+
+  // Leaves whether the yield being resumed at is in `range`, as i32.
+  void EmitResumeIn(std::pair<int, int> range) {
+    out_ << "    local.get $resume\n    i32.const " << range.first << "\n";
+    out_ << "    i32.sub\n    i32.const " << (range.second - range.first + 1)
+         << "\n    i32.lt_u\n";
+  }
+
+  // A condition as i32. When a generator resumes at a yield in `resume`,
+  // the branch or loop body holding it is taken without evaluating the
+  // condition again.
+  void EmitCondition(const ExprPtr &cond, std::pair<int, int> resume,
+                     Env &env) {
+    if (!generator_ || resume.first > resume.second) {
+      EmitExpr(cond, env);
+      out_ << "    i32.wrap_i64\n";
+      return;
+    }
+    out_ << "    local.get $resume\n    if (result i32)\n";
+    EmitResumeIn(resume);
+    out_ << "    else\n";
+    EmitExpr(cond, env);
+    out_ << "    i32.wrap_i64\n    end\n";
+  }
+
+  // Suspends: the value, the resume point and every cell go to the frame
+  // and $gen<id> returns 1. Resuming here only clears $resume.
+  void EmitYield(const Stmt &stmt, Env &env) {
+    auto elem = current_fn_->return_type->element;
+    out_ << "    local.get $resume\n    if\n";
+    out_ << "    i32.const 0\n    local.set $resume\n    else\n";
+    out_ << "    local.get $frame\n";
+    EmitCoerce(elem, EmitExpr(stmt.expr, env));
+    out_ << "    " << WasmType(elem) << ".store offset=" << kGenValue << "\n";
+    out_ << "    local.get $frame\n";
+    out_ << "    i32.const " << yield_ranges_.at(&stmt).first << "\n";
+    out_ << "    i32.store offset=" << kGenState << "\n";
+    for (size_t k = 0; k < generator_->slots.size(); ++k) {
+      const LocalInfo &slot = generator_->slots[k];
+      out_ << "    local.get $frame\n    local.get " << slot.wasm_name << "\n";
+      out_ << "    " << WasmType(slot.type)
+           << ".store offset=" << generator_->offsets[k] << "\n";
+    }
+    EmitGcLeave();
+    out_ << "    i32.const 1\n    return\n    end\n";
+  }
+
+  // g.next() runs the generator to its next yield through $gen_resume;
+  // g.value() reads what that yield left in the frame.
+  std::shared_ptr<Type> EmitGenMethod(const ExprPtr &expr, Env &env) {
+    auto elem = EmitExpr(expr->base->base, env)->element;
+    out_ << "    i32.wrap_i64\n";
+    if (expr->base->field == "next")
+      out_ << "    call $gen_resume\n    i64.extend_i32_u\n";
+    else
+      out_ << "    " << WasmType(elem) << ".load offset=" << kGenValue
+           << "\n";
+    return expr->type;
   }
 
   std::shared_ptr<Type> EmitExpr(const ExprPtr &expr, Env &env) {
@@ -351,7 +2418,10 @@ private:
       return ResolveType(TypeSpec{"int", 0, false}, structs_);
     }
     if (expr->kind == ExprKind::RealLit) {
-      out_ << "    f64.const " << expr->real_value << "\n";
+      // 17 significant digits so the literal survives the text round trip.
+      std::ostringstream lit;
+      lit << std::setprecision(17) << expr->real_value;
+      out_ << "    f64.const " << lit.str() << "\n";
       return ResolveType(TypeSpec{"real", 0, false}, structs_);
     }
     if (expr->kind == ExprKind::BoolLit) {
@@ -366,6 +2436,17 @@ private:
     if (expr->kind == ExprKind::Var) {
       return EmitVar(expr, env);
     }
+    if (options_.gc && expr->kind != ExprKind::NewExpr) {
+      // Pointers produced mid-expression are rooted until the statement ends.
+      auto type = EmitValue(expr, env);
+      if (IsGcRef(type))
+        out_ << "    call $gc_push\n";
+      return type;
+    }
+    return EmitValue(expr, env);
+  }
+
+  std::shared_ptr<Type> EmitValue(const ExprPtr &expr, Env &env) {
     if (expr->kind == ExprKind::Binary) {
       return EmitBinary(expr, env);
     }
@@ -381,9 +2462,15 @@ private:
     if (expr->kind == ExprKind::Index) {
       return EmitIndex(expr, env);
     }
+    if (expr->kind == ExprKind::Slice) {
+      return EmitSlice(expr, env);
+    }
     if (expr->kind == ExprKind::NewExpr) {
       return EmitNew(expr, env);
     }
+    if (expr->kind == ExprKind::Spawn) {
+      return EmitSpawn(expr, env);
+    }
     return nullptr;
   }
 
@@ -396,17 +2483,35 @@ private:
       out_ << "    local.get " << res->local->wasm_name << "\n";
       return res->local->type;
     }
+    if (res->kind == LookupResult::Kind::Field && GcTarget()) {
+      out_ << "    local.get $this\n";
+      out_ << "    struct.get" << HeapGetSuffix(res->field->type) << " $"
+           << env.current_struct << " "
+           << FieldIndex(env.current_struct, res->field->name) << "\n";
+      EmitFromStorage(res->field->type);
+      return res->field->type;
+    }
     if (res->kind == LookupResult::Kind::Field) {
       out_ << "    local.get $this\n";
       out_ << "    i64.const " << res->field->offset << "\n";
       out_ << "    i64.add\n";
       EmitLoad(res->field->type);
+      if (options_.gc && IsGcRef(res->field->type))
+        out_ << "    call $gc_push\n";
       return res->field->type;
     }
     return nullptr;
   }
 
   std::shared_ptr<Type> EmitBinary(const ExprPtr &expr, Env &env) {
+    if (expr->type && expr->type->kind == TypeKind::Vector) {
+      EmitVectorOperand(expr->left, expr->type, env);
+      EmitVectorOperand(expr->right, expr->type, env);
+      out_ << "    " << VectorShape(expr->type) << SimdOp(expr->op) << "\n";
+      return expr->type;
+    }
+    if (expr->left->type && expr->left->type->kind == TypeKind::String)
+      return EmitStringBinary(expr, env);
     auto left = EmitExpr(expr->left, env);
     // Conversion logic if needed
     // For simplicity assuming strict types or simple auto-casting if
@@ -484,10 +2589,41 @@ private:
     return left;
   }
 
+  // a + b concatenates; comparisons turn $string_compare's -1/0/1 into the
+  // same comparison against 0.
+  std::shared_ptr<Type> EmitStringBinary(const ExprPtr &expr, Env &env) {
+    EmitExpr(expr->left, env);
+    EmitExpr(expr->right, env);
+    const std::string &op = expr->op;
+    if (op == "+") {
+      out_ << "    call $string_concat\n";
+      return expr->type;
+    }
+    if (op == "==" || op == "!=") {
+      out_ << "    call $string_equals\n";
+      if (op == "!=")
+        out_ << "    i64.eqz\n    i64.extend_i32_u\n";
+      return expr->type;
+    }
+    out_ << "    call $string_compare\n    i64.const 0\n";
+    if (op == "<")
+      out_ << "    i64.lt_s\n";
+    else if (op == "<=")
+      out_ << "    i64.le_s\n";
+    else if (op == ">")
+      out_ << "    i64.gt_s\n";
+    else
+      out_ << "    i64.ge_s\n";
+    out_ << "    i64.extend_i32_u\n";
+    return expr->type;
+  }
+
   std::shared_ptr<Type> EmitUnary(const ExprPtr &expr, Env &env) {
     auto type = EmitExpr(expr->left, env);
     if (expr->op == "-") {
-      if (type->kind == TypeKind::Real)
+      if (type->kind == TypeKind::Vector)
+        out_ << "    " << VectorShape(type) << ".neg\n";
+      else if (type->kind == TypeKind::Real)
         out_ << "    f64.neg\n";
       else {
         out_ << "    i64.const -1\n    i64.mul\n";
@@ -498,29 +2634,260 @@ private:
     return type;
   }
 
+  static bool ContainsCall(const ExprPtr &expr) {
+    if (!expr)
+      return false;
+    if (expr->kind == ExprKind::Call)
+      return true;
+    if (ContainsCall(expr->left) || ContainsCall(expr->right) ||
+        ContainsCall(expr->base) || ContainsCall(expr->new_size))
+      return true;
+    for (const auto &arg : expr->args) {
+      if (ContainsCall(arg))
+        return true;
+    }
+    return false;
+  }
+
+  // Largest number of values passed to one print(fmt, ...) call; sizes the
+  // $fmt<k> spill locals and the runtime-format argument area.
+  static int MaxPrintArgs(const ExprPtr &expr) {
+    if (!expr)
+      return 0;
+    int max = 0;
+    if (expr->kind == ExprKind::Call && expr->base &&
+        expr->base->kind == ExprKind::Var && expr->base->text == "print" &&
+        !expr->args.empty())
+      max = static_cast<int>(expr->args.size()) - 1;
+    for (const auto &child :
+         {expr->left, expr->right, expr->base, expr->new_size})
+      max = std::max(max, MaxPrintArgs(child));
+    for (const auto &arg : expr->args)
+      max = std::max(max, MaxPrintArgs(arg));
+    return max;
+  }
+
+  static int MaxPrintArgs(const std::vector<StmtPtr> &body) {
+    int max = 0;
+    for (const auto &stmt : body) {
+      if (!stmt)
+        continue;
+      max = std::max({max, MaxPrintArgs(stmt->expr),
+                      MaxPrintArgs(stmt->target),
+                      MaxPrintArgs(stmt->then_body),
+                      MaxPrintArgs(stmt->else_body),
+                      MaxPrintArgs(stmt->body)});
+    }
+    return max;
+  }
+
+  // Evaluates the print arguments that contain calls into $fmt<k> / $fmtf<k>
+  // up front, in order, so output they produce precedes this line. Returns
+  // the types of the spilled arguments (nullptr for the others).
+  std::vector<std::shared_ptr<Type>> SpillPrintArgs(const ExprPtr &expr,
+                                                    Env &env) {
+    std::vector<std::shared_ptr<Type>> spilled(expr->args.size() - 1);
+    for (size_t k = 0; k < spilled.size(); ++k) {
+      if (!ContainsCall(expr->args[k + 1]))
+        continue;
+      spilled[k] = EmitExpr(expr->args[k + 1], env);
+      out_ << "    local.set " << PrintSpillLocal(spilled[k], k) << "\n";
+    }
+    return spilled;
+  }
+
+  static std::string PrintSpillLocal(const std::shared_ptr<Type> &type,
+                                     size_t k) {
+    return (type->kind == TypeKind::Real ? "$fmtf" : "$fmt") +
+           std::to_string(k);
+  }
+
+  std::shared_ptr<Type>
+  EmitPrintArg(const ExprPtr &expr, size_t k,
+               const std::vector<std::shared_ptr<Type>> &spilled, Env &env) {
+    if (!spilled[k])
+      return EmitExpr(expr->args[k + 1], env);
+    out_ << "    local.get " << PrintSpillLocal(spilled[k], k) << "\n";
+    return spilled[k];
+  }
+
+  // print("...", args) with a literal format: the format is split at compile
+  // time into direct calls to the raw printers, precision included.
+  void EmitFormatLiteral(const ExprPtr &expr, Env &env) {
+    auto pieces = ParseFormat(expr->args[0]->text);
+    size_t specs = 0;
+    for (const auto &piece : pieces) {
+      if (piece.spec)
+        specs++;
+    }
+    if (specs != expr->args.size() - 1)
+      throw CompileError("print format expects " + std::to_string(specs) +
+                         " arguments, got " +
+                         std::to_string(expr->args.size() - 1) + " at line " +
+                         std::to_string(expr->line));
+    auto spilled = SpillPrintArgs(expr, env);
+    size_t k = 0;
+    for (const auto &piece : pieces) {
+      if (!piece.spec) {
+        if (piece.text.size() == 1) {
+          out_ << "    i32.const "
+               << static_cast<int>(static_cast<unsigned char>(piece.text[0]))
+               << "\n";
+          out_ << "    call $write_byte\n";
+        } else {
+          out_ << "    i32.const "
+               << string_table_.Offsets().at(piece.text) + 8 << "\n";
+          out_ << "    i32.const " << piece.text.size() << "\n";
+          out_ << "    call $write_bytes\n";
+        }
+        continue;
+      }
+      auto type = EmitPrintArg(expr, k++, spilled, env);
+      TypeKind want = piece.spec == 'i'   ? TypeKind::Int
+                      : piece.spec == 'b' ? TypeKind::Bool
+                      : piece.spec == 's' ? TypeKind::String
+                                          : TypeKind::Real;
+      if (want == TypeKind::Real && type->kind == TypeKind::Int) {
+        out_ << "    f64.convert_i64_s\n";
+      } else if (type->kind != want) {
+        throw CompileError(std::string("print format %") + piece.spec +
+                           " does not match argument " + std::to_string(k) +
+                           " at line " + std::to_string(expr->line));
+      }
+      if (piece.spec == 'i') {
+        out_ << "    call $print_i64_raw\n";
+      } else if (piece.spec == 'b') {
+        out_ << "    call $print_bool_raw\n";
+      } else if (piece.spec == 's') {
+        out_ << "    call $print_string_raw\n";
+      } else if (piece.spec == 'r' && piece.precision < 0) {
+        out_ << "    call $print_f64_raw\n";
+      } else {
+        out_ << "    i32.const " << piece.precision << "\n";
+        out_ << "    call "
+             << (piece.spec == 'r' ? "$print_f64_prec" : "$print_f64_sci")
+             << "\n";
+      }
+    }
+  }
+
+  // print(fmt, args) with a runtime format string: the arguments are staged
+  // in a fixed area for $print_format, so nothing is allocated.
+  void EmitRuntimeFormat(const ExprPtr &expr, Env &env) {
+    EmitExpr(expr->args[0], env);
+    out_ << "    local.set $tmp3\n";
+    auto spilled = SpillPrintArgs(expr, env);
+    for (size_t k = 0; k < spilled.size(); ++k) {
+      out_ << ScratchAddress(format_args_ptr_ + 8 * k, options_);
+      auto type = EmitPrintArg(expr, k, spilled, env);
+      out_ << (type->kind == TypeKind::Real ? "    f64.store\n"
+                                            : "    i64.store\n");
+    }
+    out_ << "    local.get $tmp3\n";
+    out_ << ScratchAddress(format_args_ptr_, options_);
+    out_ << "    i64.extend_i32_u\n";
+    out_ << "    i32.const " << spilled.size() << "\n";
+    out_ << "    call $print_format\n";
+  }
+
+  // The user function or method a call expression resolves to; nullptr for
+  // builtins and anything else EmitCall lowers inline.
+  const FunctionInfo *TailCallee(const ExprPtr &expr) {
+    if (expr->kind != ExprKind::Call || !expr->base)
+      return nullptr;
+    std::string name;
+    if (expr->base->kind == ExprKind::Var) {
+      name = expr->base->text;
+      if (name == "flush" || name == "print" || name == "sqrt" ||
+          IsPipeline(expr))
+        return nullptr;
+    } else if (expr->base->kind == ExprKind::Field) {
+      auto base_type = expr->base->base->type;
+      if (!base_type || base_type->kind != TypeKind::Struct)
+        return nullptr;
+      name = base_type->name + "." + expr->base->field;
+    } else {
+      return nullptr;
+    }
+    auto it = functions_.find(name);
+    return it == functions_.end() ? nullptr : &it->second;
+  }
+
+  bool HasSelfTailCall(const std::vector<StmtPtr> &stmts) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::Return && s->expr &&
+          TailCallee(s->expr) == current_fn_)
+        return true;
+      if (HasSelfTailCall(s->then_body) || HasSelfTailCall(s->else_body) ||
+          HasSelfTailCall(s->body))
+        return true;
+    }
+    return false;
+  }
+
+  // `return f(...)`: nothing runs after the call but popping the --gc frame,
+  // so the caller's frame is dropped first and the callee reuses its stack
+  // slot. Under --tail-loops a self call instead rebinds the params and
+  // branches back to the top of the body.
+  void EmitTailCall(const ExprPtr &expr, Env &env) {
+    const FunctionInfo *callee = TailCallee(expr);
+    bool method = expr->base->kind == ExprKind::Field;
+    if (method)
+      EmitExpr(expr->base->base, env);
+    EmitCallArgs(expr, *callee, method ? 1 : 0, env);
+    if (options_.tail_loops && callee == current_fn_) {
+      for (size_t k = current_params_.size(); k-- > 0;)
+        EmitLocalSet(current_params_[k]);
+      out_ << "    br $tail\n";
+      return;
+    }
+    EmitGcLeave();
+    out_ << "    return_call " << callee->wasm_name << "\n";
+  }
+
+  // Arguments converted to the callee's param types; methods skip $this.
+  void EmitCallArgs(const ExprPtr &expr, const FunctionInfo &callee,
+                    size_t first_param, Env &env) {
+    for (size_t k = 0; k < expr->args.size(); ++k) {
+      auto type = EmitExpr(expr->args[k], env);
+      if (first_param + k < callee.params.size())
+        EmitCoerce(callee.params[first_param + k], type);
+    }
+  }
+
+  // Whether a `from` value must be converted before it can be a `to`.
+  static bool NeedsCoerce(const std::shared_ptr<Type> &to,
+                          const std::shared_ptr<Type> &from) {
+    if (!to || !from)
+      return false;
+    return (to->kind == TypeKind::Real && from->kind == TypeKind::Int) ||
+           (IsNarrow(to) && to->name != from->name);
+  }
+
   std::shared_ptr<Type> EmitCall(const ExprPtr &expr, Env &env) {
     if (!expr->base)
       return nullptr;
     if (expr->base->kind == ExprKind::Var) {
       std::string name = expr->base->text;
+      if (name == "flush") {
+        out_ << "    call $flush\n";
+        return ResolveType(TypeSpec{"void", 0, true}, structs_);
+      }
       if (name == "print") {
         if (expr->args.empty()) {
           return ResolveType(TypeSpec{"void", 0, true}, structs_);
         }
+        const auto &fmt = expr->args[0];
+        if (fmt->kind == ExprKind::StringLit &&
+            (expr->args.size() > 1 || NeedsFormatLiteral(fmt->text))) {
+          EmitFormatLiteral(expr, env);
+          return ResolveType(TypeSpec{"void", 0, true}, structs_);
+        }
         if (expr->args.size() == 1) {
           const auto &arg = expr->args[0];
           auto type = EmitExpr(arg, env);
           if (type->kind == TypeKind::String) {
-            if (arg->kind == ExprKind::StringLit &&
-                NeedsFormatLiteral(arg->text)) {
-              out_ << "    local.set $tmp3\n";
-              out_ << "    local.get $tmp3\n";
-              out_ << "    i64.const 0\n";
-              out_ << "    i32.const 0\n";
-              out_ << "    call $print_format\n";
-            } else {
-              out_ << "    call $print_string\n";
-            }
+            out_ << "    call $print_string\n";
             return ResolveType(TypeSpec{"void", 0, true}, structs_);
           }
           if (type->kind == TypeKind::Int)
@@ -533,45 +2900,42 @@ private:
             out_ << "    call $print_string\n";
           return ResolveType(TypeSpec{"void", 0, true}, structs_);
         }
-        const auto &fmt = expr->args[0];
-        EmitExpr(fmt, env);
-        out_ << "    local.set $tmp3\n";
-        int arg_count = static_cast<int>(expr->args.size()) - 1;
-        if (arg_count > 0) {
-          out_ << "    i64.const " << (arg_count * 8) << "\n";
-          out_ << "    call $alloc\n";
-          out_ << "    local.set $tmp4\n";
-          for (int i = 0; i < arg_count; ++i) {
-            out_ << "    local.get $tmp4\n";
-            out_ << "    i64.const " << (i * 8) << "\n";
-            out_ << "    i64.add\n";
-            out_ << "    local.set $tmp2\n";
-            auto type = EmitExpr(expr->args[i + 1], env);
-            EmitStore(type);
-          }
-          out_ << "    local.get $tmp3\n";
-          out_ << "    local.get $tmp4\n";
-          out_ << "    i32.const " << arg_count << "\n";
-          out_ << "    call $print_format\n";
-        } else {
-          out_ << "    local.get $tmp3\n";
-          out_ << "    i64.const 0\n";
-          out_ << "    i32.const 0\n";
-          out_ << "    call $print_format\n";
-        }
+        EmitRuntimeFormat(expr, env);
         return ResolveType(TypeSpec{"void", 0, true}, structs_);
       }
+      if (name == "join" && expr->args.size() == 1 &&
+          expr->args[0]->type->kind == TypeKind::Task)
+        return EmitJoin(expr, env);
       if (name == "sqrt") {
         auto type = EmitExpr(expr->args[0], env);
+        if (type->kind == TypeKind::Vector) {
+          out_ << "    f64x2.sqrt\n";
+          return type;
+        }
         if (type->kind == TypeKind::Int)
           out_ << "    f64.convert_i64_s\n";
         out_ << "    f64.sqrt\n";
         return ResolveType(TypeSpec{"real", 0, false}, structs_);
       }
+      if (IsPipeline(expr))
+        return EmitPipeline(expr, env);
+      if (IsVectorBuiltin(name) && !functions_.count(name)) {
+        return EmitVectorBuiltin(expr, name, env);
+      }
+      if (IsArrayBuiltin(name) && !functions_.count(name)) {
+        return EmitArrayBuiltin(expr, name, env);
+      }
+      if (IsStringBuiltin(name) && !functions_.count(name)) {
+        auto type = EmitExpr(expr->args[0], env);
+        if (name == "hash")
+          out_ << "    call $string_hash\n";
+        else
+          out_ << "    call $string_from_" << RuntimeSuffix(type) << "\n";
+        return expr->type;
+      }
       auto it = functions_.find(name);
       if (it != functions_.end()) {
-        for (auto &a : expr->args)
-          EmitExpr(a, env);
+        EmitCallArgs(expr, it->second, 0, env);
         out_ << "    call " << it->second.wasm_name << "\n";
         return it->second.return_type;
       }
@@ -579,12 +2943,33 @@ private:
     }
     if (expr->base->kind == ExprKind::Field) {
       auto field = expr->base;
+      if (field->base->type &&
+          field->base->type->kind == TypeKind::StringBuilder)
+        return EmitBuilderMethod(expr, env);
+      if (field->base->type && field->base->type->kind == TypeKind::Map)
+        return EmitMapMethod(expr, env);
+      if (field->base->type && field->base->type->kind == TypeKind::Vec)
+        return EmitVecMethod(expr, env);
+      if (field->base->type && field->base->type->kind == TypeKind::Gen)
+        return EmitGenMethod(expr, env);
+      if (field->field == "length" && Sliceable(field->base->type)) {
+        EmitLength(field->base, env);
+        return ResolveType(TypeSpec{"int", 0, false}, structs_);
+      }
       auto base_type = EmitExpr(field->base, env);
+      if (GcTarget() && base_type->kind == TypeKind::Array &&
+          field->field == "length") {
+        out_ << "    array.len\n    i64.extend_i32_u\n";
+        return ResolveType(TypeSpec{"int", 0, false}, structs_);
+      }
       if ((base_type->kind == TypeKind::Array ||
            base_type->kind == TypeKind::String) &&
           field->field == "length") {
         out_ << "    i32.wrap_i64\n";
-        out_ << "    i64.load\n";
+        out_ << "    i64.load";
+        if (!expr->args.empty() && expr->args[0]->int_value != 0)
+          out_ << " offset=" << 8 * expr->args[0]->int_value;
+        out_ << "\n";
         return ResolveType(TypeSpec{"int", 0, false}, structs_);
       }
       if (base_type->kind != TypeKind::Struct)
@@ -593,8 +2978,7 @@ private:
       auto it = functions_.find(method_name);
       if (it == functions_.end())
         return nullptr;
-      for (auto &a : expr->args)
-        EmitExpr(a, env);
+      EmitCallArgs(expr, it->second, 1, env);
       out_ << "    call " << it->second.wasm_name << "\n";
       return it->second.return_type;
     }
@@ -602,7 +2986,19 @@ private:
   }
 
   std::shared_ptr<Type> EmitField(const ExprPtr &expr, Env &env) {
+    if (IsSoaElement(expr->base)) {
+      auto type = EmitAddress(expr, env);
+      EmitLoad(type);
+      return type;
+    }
     auto base = EmitExpr(expr->base, env);
+    if (GcTarget()) {
+      auto type = structs_.at(base->name).field_map.at(expr->field).type;
+      out_ << "    struct.get" << HeapGetSuffix(type) << " $" << base->name
+           << " " << FieldIndex(base->name, expr->field) << "\n";
+      EmitFromStorage(type);
+      return type;
+    }
     auto fit = structs_[base->name].field_map.find(expr->field);
     out_ << "    i64.const " << fit->second.offset << "\n    i64.add\n";
     EmitLoad(fit->second.type);
@@ -610,12 +3006,54 @@ private:
   }
 
   std::shared_ptr<Type> EmitIndex(const ExprPtr &expr, Env &env) {
+    if (expr->base->type->kind == TypeKind::Vector) {
+      auto vec = EmitExpr(expr->base, env);
+      out_ << "    " << VectorShape(vec) << ".extract_lane "
+           << expr->left->int_value << "\n";
+      return vec->element;
+    }
+    if (GcTarget()) {
+      auto base = EmitExpr(expr->base, env);
+      EmitExpr(expr->left, env);
+      out_ << "    i32.wrap_i64\n";
+      out_ << "    array.get" << HeapGetSuffix(base->element) << " "
+           << HeapTypeName(base) << "\n";
+      EmitFromStorage(base->element);
+      return base->element;
+    }
     auto type = EmitAddress(expr, env);
     EmitLoad(type);
     return type;
   }
 
+  bool IsSoaElement(const ExprPtr &expr) {
+    return expr->kind == ExprKind::Index &&
+           IsSoaArray(expr->base->type, structs_);
+  }
+
   std::shared_ptr<Type> EmitAddress(const ExprPtr &expr, Env &env) {
+    if (expr->kind == ExprKind::Field && IsSoaElement(expr->base)) {
+      const ExprPtr &elem = expr->base;
+      auto &field = structs_.at(elem->type->name).field_map.at(expr->field);
+      EmitExpr(elem->base, env);
+      EmitExpr(elem->left, env);
+      out_ << "    local.set $tmp1\n    local.set $tmp0\n";
+      if (BoundsChecked() && !ProvenInBounds(elem, env))
+        EmitBoundsCheck("    local.get $tmp1\n", "$tmp0", elem->line);
+
+      // base + 8 + len * offset (the column) + idx * size
+      out_ << "    local.get $tmp0\n";
+      out_ << "    i64.const 8\n    i64.add\n";
+      if (field.offset != 0) {
+        out_ << "    local.get $tmp0\n    i32.wrap_i64\n    i64.load\n";
+        out_ << "    i64.const " << field.offset << "\n    i64.mul\n";
+        out_ << "    i64.add\n";
+      }
+      out_ << "    local.get $tmp1\n";
+      out_ << "    i64.const " << GetTypeSize(field.type)
+           << "\n    i64.mul\n    i64.add\n";
+      return field.type;
+    }
     if (expr->kind == ExprKind::Field) {
       auto base = EmitExpr(expr->base, env);
       auto &info = structs_.at(base->name);
@@ -623,11 +3061,18 @@ private:
       out_ << "    i64.const " << field.offset << "\n    i64.add\n";
       return field.type;
     }
+    if (expr->kind == ExprKind::Index && !expr->args.empty())
+      return EmitGridAddress(expr, env);
     if (expr->kind == ExprKind::Index) {
       auto base = EmitExpr(expr->base, env);
-      out_ << "    local.set $tmp0\n";
-      auto idx_type = EmitExpr(expr->left, env);
-      out_ << "    local.set $tmp1\n";
+      if (base->kind == TypeKind::Vec)
+        out_ << "    i32.wrap_i64\n    i64.load offset=" << kVecBufOffset
+             << "\n";
+      EmitExpr(expr->left, env);
+      // Set both only now: an index like b[i] goes through here as well.
+      out_ << "    local.set $tmp1\n    local.set $tmp0\n";
+      if (BoundsChecked() && !ProvenInBounds(expr, env))
+        EmitBoundsCheck("    local.get $tmp1\n", "$tmp0", expr->line);
 
       // base + 8 + idx * size
       int64_t size = GetTypeSize(base->element);
@@ -640,20 +3085,274 @@ private:
     return nullptr;
   }
 
+  // a[i, j, ...]: a + 8 * dims + ((i * d1 + j) * d2 + ...) * size, or
+  // $row + last * size when the row was hoisted. Array and indices go to
+  // $dim0, $dim1, ... only after all are evaluated, as for a[i].
+  std::shared_ptr<Type> EmitGridAddress(const ExprPtr &expr, Env &env) {
+    auto type = expr->base->type;
+    int64_t size = GetTypeSize(type->element);
+    std::string last = "$dim" + std::to_string(type->dims);
+    auto row = row_plan_.ids.find(expr.get());
+    bool hoisted = row != row_plan_.ids.end();
+    if (hoisted && !BoundsChecked()) {
+      EmitExpr(expr->args.back(), env);
+      out_ << "    i64.const " << size << "\n    i64.mul\n";
+      out_ << "    local.get $row" << row->second << "\n    i64.add\n";
+      return type->element;
+    }
+    EmitExpr(expr->base, env);
+    EmitExpr(expr->left, env);
+    for (const auto &arg : expr->args)
+      EmitExpr(arg, env);
+    for (int k = type->dims; k >= 0; --k)
+      out_ << "    local.set $dim" << k << "\n";
+    if (BoundsChecked()) {
+      for (int k = 1; k <= type->dims; ++k)
+        EmitBoundsCheck("    local.get $dim" + std::to_string(k) + "\n",
+                        "$dim0", expr->line, 8 * (k - 1));
+    }
+    if (hoisted) {
+      out_ << "    local.get " << last << "\n";
+      out_ << "    i64.const " << size << "\n    i64.mul\n";
+      out_ << "    local.get $row" << row->second << "\n    i64.add\n";
+      return type->element;
+    }
+    out_ << "    local.get $dim1\n";
+    for (int k = 1; k < type->dims; ++k) {
+      EmitDim(k);
+      out_ << "    i64.mul\n";
+      out_ << "    local.get $dim" << k + 1 << "\n    i64.add\n";
+    }
+    out_ << "    i64.const " << size << "\n    i64.mul\n";
+    out_ << "    local.get $dim0\n    i64.add\n";
+    out_ << "    i64.const " << 8 * type->dims << "\n    i64.add\n";
+    return type->element;
+  }
+
+  bool ProvenInBounds(const ExprPtr &expr, Env &env) {
+    if (expr->base->kind != ExprKind::Var || expr->left->kind != ExprKind::Var)
+      return false;
+    if (!bounds_facts_.count({expr->left->text, expr->base->text}))
+      return false;
+    // The facts only track locals; a field of the same name may shadow none.
+    auto index = FindIdentifier(expr->left->text, env, structs_);
+    auto array = FindIdentifier(expr->base->text, env, structs_);
+    return index && index->kind != LookupResult::Kind::Field && array &&
+           array->kind != LookupResult::Kind::Field;
+  }
+
+  // Suffix of the runtime helper formatting a scalar: i64, f64 or bool.
+  static std::string RuntimeSuffix(const std::shared_ptr<Type> &type) {
+    if (type->kind == TypeKind::Real)
+      return "f64";
+    return type->kind == TypeKind::Bool ? "bool" : "i64";
+  }
+
+  // string_builder is [1][buf][len]: length() reads len inline.
+  std::shared_ptr<Type> EmitBuilderMethod(const ExprPtr &expr, Env &env) {
+    const std::string &name = expr->base->field;
+    EmitExpr(expr->base->base, env);
+    if (name == "length") {
+      out_ << "    i32.wrap_i64\n    i64.load offset=16\n";
+    } else if (name == "to_string") {
+      out_ << "    call $sb_to_string\n";
+    } else {
+      auto type = EmitExpr(expr->args[0], env);
+      if (type->kind == TypeKind::String)
+        out_ << "    call $sb_append\n";
+      else
+        out_ << "    call $sb_append_" << RuntimeSuffix(type) << "\n";
+    }
+    return expr->type;
+  }
+
+  // map[K, V] methods call the runtime specialized for the key kind and the
+  // value's Wasm type; length() reads the count inline.
+  std::shared_ptr<Type> EmitMapMethod(const ExprPtr &expr, Env &env) {
+    const std::string &name = expr->base->field;
+    auto map = expr->base->base->type;
+    std::string key = map->key->kind == TypeKind::String ? "string" : "int";
+    if (GcTarget() && (map->element->kind == TypeKind::Struct ||
+                       map->element->kind == TypeKind::Array))
+      throw CompileError("map values are stored in linear memory and cannot "
+                         "be structs or arrays with --target=wasm-gc at "
+                         "line " +
+                         std::to_string(expr->line));
+    std::string value = WasmType(map->element);
+    EmitExpr(expr->base->base, env);
+    if (name == "length") {
+      out_ << "    i32.wrap_i64\n    i64.load offset=" << kMapLenOffset
+           << "\n";
+      return expr->type;
+    }
+    if (name == "keys" || name == "values") {
+      if (GcTarget())
+        throw CompileError("map." + name + "() is not available with "
+                           "--target=wasm-gc at line " +
+                           std::to_string(expr->line));
+      auto elem = expr->type->element;
+      out_ << "    i32.const " << (name == "keys" ? 16 : 24) << "\n";
+      out_ << "    i32.const " << GetTypeSize(elem) << "\n";
+      out_ << "    i32.const "
+           << (IsGcRef(elem) ? kGcRefArrayType : kGcRawType) << "\n";
+      out_ << "    call $map_collect\n";
+      return expr->type;
+    }
+    EmitExpr(expr->args[0], env);
+    if (expr->args.size() == 2)
+      EmitCoerce(map->element, EmitExpr(expr->args[1], env));
+    std::string fn = name == "get" && expr->args.size() == 2 ? "get_or" : name;
+    out_ << "    call $map_" << fn << "_" << key;
+    if (name == "put" || name == "get")
+      out_ << "_" << value;
+    out_ << "\n";
+    return expr->type;
+  }
+
+  // vec[T] methods: push and pop get the element's address from the runtime
+  // and store or load it inline; length() reads the buffer's length word.
+  std::shared_ptr<Type> EmitVecMethod(const ExprPtr &expr, Env &env) {
+    const std::string &name = expr->base->field;
+    auto elem = expr->base->base->type->element;
+    if (GcTarget())
+      HeapTypeName(expr->base->base->type); // throws
+    EmitExpr(expr->base->base, env);
+    if (name == "length") {
+      out_ << "    i32.wrap_i64\n    i64.load offset=" << kVecBufOffset
+           << "\n    i32.wrap_i64\n    i64.load\n";
+    } else if (name == "push") {
+      // The value is computed first: it may read the vec itself.
+      EmitCoerce(elem, EmitExpr(expr->args[0], env), false);
+      std::string tmp = elem->kind == TypeKind::Real ? "$tmpf" : "$tmp1";
+      out_ << "    local.set " << tmp << "\n    call $vec_slot\n";
+      out_ << "    local.get " << tmp << "\n" << StoreOp(elem);
+    } else if (name == "pop") {
+      out_ << "    call $vec_pop\n" << LoadOp(elem);
+    } else if (name == "reserve") {
+      EmitExpr(expr->args[0], env);
+      out_ << "    call $vec_reserve\n";
+    } else {
+      out_ << "    call $vec_view\n";
+    }
+    return expr->type;
+  }
+
+  // Strings and linear-memory 1-D arrays may be slices. Rectangular and
+  // soa arrays keep reading their header.
+  bool Sliceable(const std::shared_ptr<Type> &type) const {
+    if (!type)
+      return false;
+    if (type->kind == TypeKind::String)
+      return true;
+    return type->kind == TypeKind::Array && !GcTarget() && type->dims == 1 &&
+           !IsSoaArray(type, structs_);
+  }
+
+  // s.length(): inline for a local, through $array_length otherwise.
+  void EmitLength(const ExprPtr &value, Env &env) {
+    if (value->kind == ExprKind::Var) {
+      auto res = FindIdentifier(value->text, env, structs_);
+      if (res && res->kind != LookupResult::Kind::Field) {
+        out_ << ArrayLength(res->local->wasm_name);
+        return;
+      }
+    }
+    EmitExpr(value, env);
+    out_ << "    call $array_length\n";
+  }
+
+  // a[lo:hi] is one i64: the address of element lo less the 8-byte header
+  // in the low 32 bits, so a[i] addresses it like any array, and
+  // hi - lo + 1 in the high 32 bits. Bounds are checked under
+  // --bounds-check only, as for a[i].
+  std::shared_ptr<Type> EmitSlice(const ExprPtr &expr, Env &env) {
+    auto type = expr->type;
+    if (!Sliceable(type))
+      throw CompileError("Array slices need linear-memory arrays and are not "
+                         "available with --target=wasm-gc at line " +
+                         std::to_string(expr->line));
+    int64_t size =
+        type->kind == TypeKind::String ? 1 : GetTypeSize(type->element);
+    EmitExpr(expr->base, env);
+    if (expr->left)
+      EmitExpr(expr->left, env);
+    else
+      out_ << "    i64.const 0\n";
+    if (expr->right) {
+      EmitExpr(expr->right, env);
+      out_ << "    local.set $slice2\n";
+    }
+    out_ << "    local.set $slice1\n    local.set $slice0\n";
+    if (!expr->right)
+      out_ << ArrayLength("$slice0") << "    local.set $slice2\n";
+    if (BoundsChecked()) {
+      out_ << "    local.get $slice0\n    local.get $slice1\n";
+      out_ << "    local.get $slice2\n    local.get $slice1\n    i64.sub\n";
+      out_ << "    i64.const " << expr->line << "\n    call $bounds_range\n";
+    }
+    out_ << "    local.get $slice2\n    local.get $slice1\n    i64.sub\n";
+    out_ << "    i64.const 1\n    i64.add\n    i64.const 32\n    i64.shl\n";
+    out_ << "    local.get $slice0\n    i32.wrap_i64\n    i64.extend_i32_u\n";
+    out_ << "    local.get $slice1\n    i64.const " << size << "\n";
+    out_ << "    i64.mul\n    i64.add\n    i64.or\n";
+    return type;
+  }
+
+  // Length of the array or slice in a wasm local, as $array_length computes
+  // it: a slice holds length + 1 in the high 32 bits.
+  static std::string ArrayLength(const std::string &local) {
+    std::string get = "    local.get " + local + "\n";
+    return get + "    i64.const 32\n    i64.shr_u\n    i64.const 1\n" +
+           "    i64.sub\n" + get + "    i32.wrap_i64\n    i64.load\n" + get +
+           "    i64.const 32\n    i64.shr_u\n    i32.wrap_i64\n    select\n";
+  }
+
+  // Traps via $bounds_fail unless 0 <= index < length; the unsigned compare
+  // covers both ends. `index` is WAT pushing the i64 index; `dim` is the
+  // byte offset of the length in the header (a dimension of a[i, j]).
+  void EmitBoundsCheck(const std::string &index, const std::string &array,
+                       int line, int64_t dim = 0) {
+    std::string length = dim ? "    local.get " + array +
+                                   "\n    i32.wrap_i64\n    i64.load offset=" +
+                                   std::to_string(dim) + "\n"
+                             : ArrayLength(array);
+    out_ << index << length;
+    out_ << "    i64.ge_u\n    if\n";
+    out_ << index << length;
+    out_ << "    i64.const " << line << "\n    call $bounds_fail\n    end\n";
+  }
+
   std::shared_ptr<Type> EmitNew(const ExprPtr &expr, Env &env) {
     if (expr->new_size) {
       // Array
       auto base = ResolveType(expr->new_type, structs_);
       auto type = std::make_shared<Type>(Type{TypeKind::Array, "", base});
+      if (!expr->args.empty())
+        return EmitNewGrid(expr, base, env);
 
       EmitExpr(expr->new_size, env);
+      if (GcTarget()) {
+        out_ << "    i32.wrap_i64\n";
+        out_ << "    array.new_default " << HeapTypeName(type) << "\n";
+        return type;
+      }
       out_ << "    local.set $tmp0\n"; // size count
 
-      int64_t elem_size = GetTypeSize(base);
+      // A soa array holds every column inline, so an element costs the
+      // whole struct.
+      bool soa = IsSoaArray(type, structs_);
+      int64_t elem_size = soa ? structs_.at(base->name).size : GetTypeSize(base);
       out_ << "    local.get $tmp0\n";
       out_ << "    i64.const " << elem_size << "\n    i64.mul\n";
       out_ << "    i64.const 8\n    i64.add\n";
-      out_ << "    call $alloc\n";
+      if (options_.gc) {
+        out_ << "    i32.const "
+             << (IsGcRef(base) && !soa ? kGcRefArrayType : kGcRawType)
+             << "\n";
+        out_ << "    call $gc_alloc\n    call $gc_push\n";
+      } else {
+        out_ << "    call $alloc\n";
+      }
       out_ << "    local.set $tmp1\n";
 
       // store size
@@ -665,57 +3364,313 @@ private:
     }
     // Struct
     auto type = ResolveType(expr->new_type, structs_);
+    if (type->kind == TypeKind::StringBuilder) {
+      // A linear-memory object on every target, like strings.
+      out_ << "    call $sb_new\n";
+      if (options_.gc)
+        out_ << "    call $gc_push\n";
+      return type;
+    }
+    if (type->kind == TypeKind::Vec) {
+      if (GcTarget())
+        HeapTypeName(type); // throws
+      out_ << "    i32.const " << GetTypeSize(type->element) << "\n";
+      out_ << "    i32.const "
+           << (IsGcRef(type->element) ? kGcRefArrayType : kGcRawType) << "\n";
+      out_ << "    call $vec_new\n";
+      if (options_.gc)
+        out_ << "    call $gc_push\n";
+      return type;
+    }
+    if (type->kind == TypeKind::Map) {
+      int32_t flags = 0;
+      if (type->key->kind == TypeKind::String)
+        flags |= kMapRefKeys;
+      if (IsGcRef(type->element))
+        flags |= kMapRefValues;
+      out_ << "    i32.const " << flags << "\n";
+      out_ << "    call $map_new\n";
+      if (options_.gc)
+        out_ << "    call $gc_push\n";
+      return type;
+    }
+    if (GcTarget()) {
+      out_ << "    struct.new_default $" << type->name << "\n";
+      out_ << "    call $init_" << type->name << "\n";
+      return type;
+    }
     int64_t size = structs_.at(type->name).size;
-    out_ << "    i64.const " << size << "\n    call $alloc\n";
+    out_ << "    i64.const " << size << "\n";
+    if (options_.gc) {
+      // Rooted before $init_ runs: nested struct fields allocate.
+      out_ << "    i32.const " << gc_type_ids_.at(type->name) << "\n";
+      out_ << "    call $gc_alloc\n    call $gc_push\n";
+    } else {
+      out_ << "    call $alloc\n";
+    }
     out_ << "    local.set $tmp0\n";
     out_ << "    local.get $tmp0\n    call $init_" << type->name << "\n";
     out_ << "    local.get $tmp0\n";
     return type;
   }
 
+  // new T[d0, d1, ...]: one zeroed block [d0][d1]...[elements], with the
+  // dimensions in $dim0.. while the total is computed.
+  std::shared_ptr<Type> EmitNewGrid(const ExprPtr &expr,
+                                    const std::shared_ptr<Type> &base,
+                                    Env &env) {
+    auto type = expr->type;
+    int dims = type->dims;
+    if (GcTarget())
+      HeapTypeName(type); // throws: no wasm-gc form
+    EmitExpr(expr->new_size, env);
+    for (const auto &arg : expr->args)
+      EmitExpr(arg, env);
+    for (int k = dims - 1; k >= 0; --k)
+      out_ << "    local.set $dim" << k << "\n";
+    out_ << "    local.get $dim0\n";
+    for (int k = 1; k < dims; ++k)
+      out_ << "    local.get $dim" << k << "\n    i64.mul\n";
+    out_ << "    i64.const " << GetTypeSize(base) << "\n    i64.mul\n";
+    out_ << "    i64.const " << 8 * dims << "\n    i64.add\n";
+    if (options_.gc) {
+      out_ << "    i32.const " << kGcRawType << "\n";
+      out_ << "    call $gc_alloc\n    call $gc_push\n";
+    } else {
+      out_ << "    call $alloc\n";
+    }
+    out_ << "    local.set $dim" << dims << "\n";
+    for (int k = 0; k < dims; ++k) {
+      out_ << "    local.get $dim" << dims << "\n    i32.wrap_i64\n";
+      out_ << "    local.get $dim" << k << "\n    i64.store";
+      if (k != 0)
+        out_ << " offset=" << 8 * k;
+      out_ << "\n";
+    }
+    out_ << "    local.get $dim" << dims << "\n";
+    return type;
+  }
+
   void EmitAssignment(const ExprPtr &target, const ExprPtr &value, Env &env) {
+    if (target->kind == ExprKind::Index &&
+        target->base->type->kind == TypeKind::Vector) {
+      // v[k] = x on a local vector: rebuild it with lane k replaced.
+      auto vec = target->base->type;
+      auto res = FindIdentifier(target->base->text, env, structs_);
+      out_ << "    local.get " << res->local->wasm_name << "\n";
+      auto type = EmitExpr(value, env);
+      if (vec->element->kind == TypeKind::Real && type->kind == TypeKind::Int)
+        out_ << "    f64.convert_i64_s\n";
+      out_ << "    " << VectorShape(vec) << ".replace_lane "
+           << target->left->int_value << "\n";
+      EmitLocalSet(*res->local);
+      return;
+    }
     if (target->kind == ExprKind::Var) {
       auto res = FindIdentifier(target->text, env, structs_);
       if (res->kind == LookupResult::Kind::Local ||
           res->kind == LookupResult::Kind::Param) {
-        EmitExpr(value, env);
-        out_ << "    local.set " << res->local->wasm_name << "\n";
+        EmitCoerce(res->local->type, EmitExpr(value, env));
+        EmitLocalSet(*res->local);
+        return;
+      }
+      if (res->kind == LookupResult::Kind::Field && GcTarget()) {
+        out_ << "    local.get $this\n";
+        EmitCoerce(res->field->type, EmitExpr(value, env), false);
+        EmitToStorage(res->field->type);
+        out_ << "    struct.set $" << env.current_struct << " "
+             << FieldIndex(env.current_struct, res->field->name) << "\n";
         return;
       }
       if (res->kind == LookupResult::Kind::Field) {
         out_ << "    local.get $this\n";
         out_ << "    i64.const " << res->field->offset << "\n    i64.add\n";
         out_ << "    local.set $tmp2\n";
-        auto type = EmitExpr(value, env);
-        EmitStore(type);
+        EmitCoerce(res->field->type, EmitExpr(value, env), false);
+        EmitStore(res->field->type);
         return;
       }
     }
-    EmitAddress(target, env);
+    if (GcTarget()) {
+      auto base = EmitExpr(target->base, env);
+      if (target->kind == ExprKind::Field) {
+        auto type = structs_.at(base->name).field_map.at(target->field).type;
+        EmitCoerce(type, EmitExpr(value, env), false);
+        EmitToStorage(type);
+        out_ << "    struct.set $" << base->name << " "
+             << FieldIndex(base->name, target->field) << "\n";
+      } else {
+        EmitExpr(target->left, env);
+        out_ << "    i32.wrap_i64\n";
+        EmitCoerce(base->element, EmitExpr(value, env), false);
+        EmitToStorage(base->element);
+        out_ << "    array.set " << HeapTypeName(base) << "\n";
+      }
+      return;
+    }
+    auto type = EmitAddress(target, env);
     out_ << "    local.set $tmp2\n";
-    auto type = EmitExpr(value, env);
+    EmitCoerce(type, EmitExpr(value, env), false);
     EmitStore(type);
   }
 
   void EmitStore(const std::shared_ptr<Type> &type) {
-    if (type->kind == TypeKind::Real) {
+    if (type->kind == TypeKind::Vector) {
+      out_ << "    local.set $tmpv\n    local.get $tmp2\n    i32.wrap_i64\n    "
+              "local.get $tmpv\n    v128.store align=8\n";
+    } else if (type->kind == TypeKind::Real) {
       out_ << "    local.set $tmpf\n    local.get $tmp2\n    i32.wrap_i64\n    "
-              "local.get $tmpf\n    f64.store\n";
+              "local.get $tmpf\n" << StoreOp(type);
     } else {
       out_ << "    local.set $tmp1\n    local.get $tmp2\n    i32.wrap_i64\n    "
-              "local.get $tmp1\n    i64.store\n";
+              "local.get $tmp1\n" << StoreOp(type);
     }
   }
 
   void EmitLoad(const std::shared_ptr<Type> &type) {
     out_ << "    i32.wrap_i64\n";
+    if (type->kind == TypeKind::Vector)
+      out_ << "    v128.load align=8\n";
+    else
+      out_ << LoadOp(type);
+  }
+
+  // Scalar memory access at the type's storage width. Narrow values are
+  // widened on load and truncated (f32: rounded) on store.
+  static std::string LoadOp(const std::shared_ptr<Type> &type) {
+    if (type->kind == TypeKind::Real)
+      return type->name == "f32" ? "    f32.load\n    f64.promote_f32\n"
+                                 : "    f64.load\n";
+    switch (GetTypeSize(type)) {
+    case 1:
+      return "    i64.load8_u\n";
+    case 4:
+      return "    i64.load32_s\n";
+    default:
+      return "    i64.load\n";
+    }
+  }
+
+  static std::string StoreOp(const std::shared_ptr<Type> &type) {
     if (type->kind == TypeKind::Real)
-      out_ << "    f64.load\n";
+      return type->name == "f32" ? "    f32.demote_f64\n    f32.store\n"
+                                 : "    f64.store\n";
+    switch (GetTypeSize(type)) {
+    case 1:
+      return "    i64.store8\n";
+    case 4:
+      return "    i64.store32\n";
+    default:
+      return "    i64.store\n";
+    }
+  }
+
+  // A value of type `from` on the stack becomes a `to`: ints widen to real,
+  // and with `narrow` the value is wrapped (byte, i32) or rounded (f32) the
+  // way storing it would. Memory and wasm-gc stores narrow by themselves.
+  void EmitCoerce(const std::shared_ptr<Type> &to,
+                  const std::shared_ptr<Type> &from, bool narrow = true) {
+    if (!to || !from)
+      return;
+    if (to->kind == TypeKind::Real && from->kind == TypeKind::Int)
+      out_ << "    f64.convert_i64_s\n";
+    if (!narrow || !IsNarrow(to))
+      return;
+    if (to->name == "byte")
+      out_ << "    i64.const 255\n    i64.and\n";
+    else if (to->name == "i32")
+      out_ << "    i32.wrap_i64\n    i64.extend_i32_s\n";
     else
-      out_ << "    i64.load\n";
+      out_ << "    f32.demote_f64\n    f64.promote_f32\n";
+  }
+
+  // --target=wasm-gc field and element storage: bool and byte pack into
+  // i8, i32 and f32 keep their width, everything else is its value type.
+  std::string StorageType(const std::shared_ptr<Type> &type) {
+    if (type->kind == TypeKind::Bool || type->name == "byte")
+      return "i8";
+    if (type->name == "i32" || type->name == "f32")
+      return type->name;
+    return WasmType(type);
+  }
+
+  std::string HeapGetSuffix(const std::shared_ptr<Type> &type) {
+    return StorageType(type) == "i8" ? "_u" : "";
+  }
+
+  void EmitFromStorage(const std::shared_ptr<Type> &type) {
+    std::string storage = StorageType(type);
+    if (storage == "i8")
+      out_ << "    i64.extend_i32_u\n";
+    else if (storage == "i32")
+      out_ << "    i64.extend_i32_s\n";
+    else if (storage == "f32")
+      out_ << "    f64.promote_f32\n";
+  }
+
+  void EmitToStorage(const std::shared_ptr<Type> &type) {
+    std::string storage = StorageType(type);
+    if (storage == "i8" || storage == "i32")
+      out_ << "    i32.wrap_i64\n";
+    else if (storage == "f32")
+      out_ << "    f32.demote_f64\n";
+  }
+
+  // --target=wasm-gc: struct.new_default zeroes every field, so only nested
+  // structs (allocated eagerly, as in linear memory) and strings need setup.
+  void EmitHeapStructInit(const StructDef &def) {
+    const auto &info = structs_.at(def.name);
+    std::string self = "$" + def.name;
+    out_ << "  (func $init_" << def.name << " (param $ptr (ref null " << self
+         << ")) (result (ref null " << self << "))\n";
+    for (size_t i = 0; i < info.fields.size(); ++i) {
+      const auto &field = info.fields[i];
+      if (field.type->kind == TypeKind::Struct) {
+        out_ << "    local.get $ptr\n";
+        out_ << "    struct.new_default $" << field.type->name << "\n";
+        out_ << "    call $init_" << field.type->name << "\n";
+        out_ << "    struct.set " << self << " " << i << "\n";
+      } else if (field.type->kind == TypeKind::String) {
+        out_ << "    local.get $ptr\n";
+        out_ << "    i64.const " << string_table_.Offsets().at("") << "\n";
+        out_ << "    struct.set " << self << " " << i << "\n";
+      }
+    }
+    out_ << "    local.get $ptr\n";
+    out_ << "  )\n";
+  }
+
+  // Copies the linear-memory string[] built by $build_args into a GC array.
+  void EmitArgsToHeapArray(const std::shared_ptr<Type> &type) {
+    std::string array = HeapTypeName(type);
+    out_ << "  (func $args_to_gc (param $src i64) (result (ref null " << array
+         << "))\n";
+    out_ << "    (local $dst (ref null " << array
+         << ")) (local $i i32) (local $n i32)\n";
+    out_ << "    local.get $src\n    i32.wrap_i64\n    i64.load\n";
+    out_ << "    i32.wrap_i64\n    local.set $n\n";
+    out_ << "    local.get $n\n    array.new_default " << array << "\n";
+    out_ << "    local.set $dst\n";
+    out_ << "    block\n      loop\n";
+    out_ << "        local.get $i\n        local.get $n\n";
+    out_ << "        i32.ge_u\n        br_if 1\n";
+    out_ << "        local.get $dst\n        local.get $i\n";
+    out_ << "        local.get $src\n        i32.wrap_i64\n";
+    out_ << "        local.get $i\n        i32.const 8\n        i32.mul\n";
+    out_ << "        i32.add\n        i64.load offset=8\n";
+    out_ << "        array.set " << array << "\n";
+    out_ << "        local.get $i\n        i32.const 1\n        i32.add\n";
+    out_ << "        local.set $i\n        br 0\n";
+    out_ << "      end\n    end\n";
+    out_ << "    local.get $dst\n";
+    out_ << "  )\n";
   }
 
   void EmitStructInit(const StructDef &def) {
+    if (GcTarget()) {
+      EmitHeapStructInit(def);
+      return;
+    }
     const auto &info = structs_.at(def.name);
     out_ << "  (func $init_" << def.name
          << " (param $ptr i64) (local $tmp1 i64) (local $tmp2 i64) (local "
@@ -728,7 +3683,12 @@ private:
       if (field.type->kind == TypeKind::Struct) {
         int64_t size = structs_.at(field.type->name).size;
         out_ << "    i64.const " << size << "\n";
-        out_ << "    call $alloc\n";
+        if (options_.gc) {
+          out_ << "    i32.const " << gc_type_ids_.at(field.type->name) << "\n";
+          out_ << "    call $gc_alloc\n";
+        } else {
+          out_ << "    call $alloc\n";
+        }
         out_ << "    local.set $tmp1\n";
         out_ << "    local.get $tmp2\n";
         out_ << "    i32.wrap_i64\n";
@@ -742,7 +3702,12 @@ private:
         out_ << "    local.get $tmp2\n";
         out_ << "    i32.wrap_i64\n";
         out_ << "    local.get $tmpf\n";
-        out_ << "    f64.store\n";
+        out_ << StoreOp(field.type);
+      } else if (field.type->kind == TypeKind::Vector) {
+        out_ << "    local.get $tmp2\n";
+        out_ << "    i32.wrap_i64\n";
+        out_ << "    v128.const i64x2 0 0\n";
+        out_ << "    v128.store align=8\n";
       } else if (field.type->kind == TypeKind::String) {
         out_ << "    local.get $tmp2\n";
         out_ << "    i32.wrap_i64\n";
@@ -752,7 +3717,7 @@ private:
         out_ << "    local.get $tmp2\n";
         out_ << "    i32.wrap_i64\n";
         out_ << "    i64.const 0\n";
-        out_ << "    i64.store\n";
+        out_ << StoreOp(field.type);
       }
     }
     out_ << "  )\n";
@@ -769,22 +3734,31 @@ private:
           info.params[0]->element->kind == TypeKind::String) {
         needs_args = true;
       }
+      if (needs_args && GcTarget())
+        EmitArgsToHeapArray(info.params[0]);
       out_ << "  (func $_start (export \"_start\")\n";
+      if (options_.gc) {
+        out_ << "    call $gc_init\n";
+      }
       if (needs_args) {
         out_ << "    call $build_args\n";
+        if (GcTarget())
+          out_ << "    call $args_to_gc\n";
       }
       out_ << "    call " << info.wasm_name << "\n";
       if (info.return_type && info.return_type->kind != TypeKind::Void) {
         out_ << "    drop\n";
       }
+      out_ << "    call $flush\n";
       out_ << "  )\n";
     }
   }
 };
 
 std::string GenerateWasm(const Program &program,
-                         const std::unordered_set<std::string> &type_names) {
+                         const std::unordered_set<std::string> &type_names,
+                         const CodegenOptions &options) {
   (void)type_names;
-  CodeGen cg(program);
+  CodeGen cg(program, options);
   return cg.Generate();
 }
@@ -13,5 +13,28 @@
 
 #include "ast.h"
 
+enum class Target { Wasm, WasmGc };
+
+struct CodegenOptions {
+  // Precise mark-sweep collector with shadow-stack roots (--gc).
+  bool gc = false;
+  // Wasm: structs/arrays laid out in linear memory. WasmGc: structs/arrays
+  // lowered to Wasm GC heap types (--target=wasm-gc).
+  Target target = Target::Wasm;
+  // Counted array loops emitted as i64x2/f64x2 SIMD128 code (--simd).
+  bool simd = false;
+  // Self tail calls become a branch back to the top of the function instead
+  // of a return_call (--tail-loops).
+  bool tail_loops = false;
+  // Trap on out-of-range array indices (--bounds-check). Accesses proven in
+  // range by the loop/branch guards around them are left unchecked.
+  bool bounds_check = false;
+  // `parallel while` loops share their iterations among this many threads:
+  // wasi-threads workers on a shared memory (--threads[=N]). 0 runs them on
+  // the main thread like any other loop.
+  int threads = 0;
+};
+
 std::string GenerateWasm(const Program &program,
-                         const std::unordered_set<std::string> &type_names);
+                         const std::unordered_set<std::string> &type_names,
+                         const CodegenOptions &options = CodegenOptions{});
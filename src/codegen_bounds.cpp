@@ -0,0 +1,280 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_bounds.h"
+
+#include "semantics.h"
+
+namespace {
+
+using Structs = std::unordered_map<std::string, StructInfo>;
+
+// Locals and params only: a field can change behind a method call.
+const LocalInfo *Local(const ExprPtr &expr, const Env &env,
+                       const Structs &structs) {
+  if (!expr || expr->kind != ExprKind::Var)
+    return nullptr;
+  auto res = FindIdentifier(expr->text, env, structs);
+  if (!res || res->kind == LookupResult::Kind::Field)
+    return nullptr;
+  return res->local;
+}
+
+bool IsKind(const LocalInfo *local, TypeKind kind) {
+  return local && local->type && local->type->kind == kind;
+}
+
+// `a.length()` on a local array; returns the array name.
+std::string LengthOf(const ExprPtr &expr, const Env &env,
+                     const Structs &structs) {
+  if (!expr || expr->kind != ExprKind::Call || !expr->args.empty() ||
+      !expr->base || expr->base->kind != ExprKind::Field ||
+      expr->base->field != "length")
+    return "";
+  const LocalInfo *array = Local(expr->base->base, env, structs);
+  return IsKind(array, TypeKind::Array) ? expr->base->base->text : "";
+}
+
+bool IsLength(const ExprPtr &expr) {
+  return expr && expr->kind == ExprKind::Call && expr->args.empty() &&
+         expr->base && expr->base->kind == ExprKind::Field &&
+         expr->base->field == "length";
+}
+
+bool NonNegative(const ExprPtr &expr,
+                 const std::unordered_set<std::string> &nonneg) {
+  if (!expr)
+    return true; // `int i` starts at 0
+  switch (expr->kind) {
+  case ExprKind::IntLit:
+    return expr->int_value >= 0;
+  case ExprKind::Var:
+    return nonneg.count(expr->text) > 0;
+  case ExprKind::Call:
+    return IsLength(expr);
+  case ExprKind::Binary:
+    return (expr->op == "+" || expr->op == "*" || expr->op == "/" ||
+            expr->op == "%") &&
+           NonNegative(expr->left, nonneg) && NonNegative(expr->right, nonneg);
+  default:
+    return false;
+  }
+}
+
+struct Definitions {
+  std::unordered_map<std::string, std::vector<ExprPtr>> values;
+  std::unordered_set<std::string> int_decls;
+  std::unordered_map<std::string, int> counts;
+
+  void Collect(const std::vector<StmtPtr> &stmts) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::VarDecl) {
+        values[s->var_name].push_back(s->expr);
+        counts[s->var_name]++;
+        if (s->var_type.name == "int" && s->var_type.array_depth == 0)
+          int_decls.insert(s->var_name);
+      } else if (s->kind == StmtKind::Assign &&
+                 s->target->kind == ExprKind::Var) {
+        values[s->target->text].push_back(s->expr);
+        counts[s->target->text]++;
+      }
+      Collect(s->then_body);
+      Collect(s->else_body);
+      Collect(s->body);
+    }
+  }
+};
+
+void CollectIndexed(const ExprPtr &expr, const std::string &index,
+                    std::vector<ExprPtr> &out) {
+  if (!expr)
+    return;
+  if (expr->kind == ExprKind::Index && expr->args.empty() && expr->left &&
+      expr->left->kind == ExprKind::Var && expr->left->text == index)
+    out.push_back(expr);
+  CollectIndexed(expr->left, index, out);
+  CollectIndexed(expr->right, index, out);
+  CollectIndexed(expr->base, index, out);
+  for (const auto &a : expr->args)
+    CollectIndexed(a, index, out);
+}
+
+void CollectIndexed(const std::vector<StmtPtr> &stmts,
+                    const std::string &index, std::vector<ExprPtr> &out) {
+  for (const auto &s : stmts) {
+    CollectIndexed(s->expr, index, out);
+    CollectIndexed(s->target, index, out);
+    CollectIndexed(s->then_body, index, out);
+    CollectIndexed(s->else_body, index, out);
+    CollectIndexed(s->body, index, out);
+  }
+}
+
+// Every write to `index` in the loop is `index = index + k` with k >= 0.
+bool OnlyGrows(const std::vector<StmtPtr> &stmts, const std::string &index) {
+  for (const auto &s : stmts) {
+    if (s->kind == StmtKind::VarDecl && s->var_name == index)
+      return false;
+    if (s->kind == StmtKind::Assign && s->target->kind == ExprKind::Var &&
+        s->target->text == index) {
+      const ExprPtr &e = s->expr;
+      if (e->kind != ExprKind::Binary || e->op != "+" || !e->left ||
+          e->left->kind != ExprKind::Var || e->left->text != index ||
+          e->right->kind != ExprKind::IntLit || e->right->int_value < 0)
+        return false;
+    }
+    if (!OnlyGrows(s->then_body, index) || !OnlyGrows(s->else_body, index) ||
+        !OnlyGrows(s->body, index))
+      return false;
+  }
+  return true;
+}
+
+void Conjuncts(const ExprPtr &cond, std::vector<ExprPtr> &out) {
+  if (cond && cond->kind == ExprKind::Binary && cond->op == "and") {
+    Conjuncts(cond->left, out);
+    Conjuncts(cond->right, out);
+  } else if (cond) {
+    out.push_back(cond);
+  }
+}
+
+} // namespace
+
+BoundsScope AnalyzeBounds(const Function &fn, const Env &env,
+                          const Structs &structs) {
+  Definitions defs;
+  defs.Collect(fn.body);
+  BoundsScope scope;
+  scope.nonneg = defs.int_decls;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = scope.nonneg.begin(); it != scope.nonneg.end();) {
+      bool ok = true;
+      for (const auto &value : defs.values[*it])
+        ok = ok && NonNegative(value, scope.nonneg);
+      if (ok) {
+        ++it;
+      } else {
+        it = scope.nonneg.erase(it);
+        changed = true;
+      }
+    }
+  }
+  for (const auto &entry : defs.values) {
+    const std::string &name = entry.first;
+    if (defs.counts[name] != 1 || !defs.int_decls.count(name))
+      continue;
+    std::string array = LengthOf(entry.second[0], env, structs);
+    if (!array.empty() && defs.counts[array] <= 1)
+      scope.lengths[name] = array;
+  }
+  return scope;
+}
+
+BoundsFacts GuardFacts(const ExprPtr &cond, const BoundsScope &scope,
+                       const Env &env, const Structs &structs) {
+  BoundsFacts facts;
+  std::vector<ExprPtr> terms;
+  Conjuncts(cond, terms);
+  for (const auto &term : terms) {
+    if (term->kind != ExprKind::Binary)
+      continue;
+    ExprPtr index = term->left;
+    ExprPtr limit = term->right;
+    if (term->op == ">")
+      std::swap(index, limit);
+    else if (term->op != "<")
+      continue;
+    const LocalInfo *local = Local(index, env, structs);
+    if (!IsKind(local, TypeKind::Int) || !scope.nonneg.count(index->text))
+      continue;
+    std::string array = LengthOf(limit, env, structs);
+    if (array.empty() && limit->kind == ExprKind::Var &&
+        scope.lengths.count(limit->text))
+      array = scope.lengths.at(limit->text);
+    if (!array.empty())
+      facts.insert({index->text, array});
+  }
+  return facts;
+}
+
+void AssignedNames(const std::vector<StmtPtr> &stmts,
+                   std::unordered_set<std::string> &names) {
+  for (const auto &s : stmts)
+    AssignedNames(s, names);
+}
+
+void AssignedNames(const StmtPtr &stmt,
+                   std::unordered_set<std::string> &names) {
+  if (stmt->kind == StmtKind::VarDecl)
+    names.insert(stmt->var_name);
+  else if (stmt->kind == StmtKind::Assign &&
+           stmt->target->kind == ExprKind::Var)
+    names.insert(stmt->target->text);
+  AssignedNames(stmt->then_body, names);
+  AssignedNames(stmt->else_body, names);
+  AssignedNames(stmt->body, names);
+}
+
+void KillFacts(BoundsFacts &facts,
+               const std::unordered_set<std::string> &names) {
+  for (auto it = facts.begin(); it != facts.end();) {
+    if (names.count(it->first) || names.count(it->second))
+      it = facts.erase(it);
+    else
+      ++it;
+  }
+}
+
+std::optional<BoundsVersion>
+MatchBoundsVersion(const Stmt &loop, const BoundsFacts &known,
+                   const BoundsScope &scope, const Env &env,
+                   const Structs &structs) {
+  std::unordered_set<std::string> assigned;
+  AssignedNames(loop.body, assigned);
+  std::vector<ExprPtr> terms;
+  Conjuncts(loop.expr, terms);
+  for (const auto &term : terms) {
+    if (term->kind != ExprKind::Binary || term->op != "<")
+      continue;
+    const ExprPtr &index = term->left;
+    const ExprPtr &limit = term->right;
+    if (!IsKind(Local(index, env, structs), TypeKind::Int))
+      continue;
+    bool invariant =
+        limit->kind == ExprKind::IntLit ||
+        (IsKind(Local(limit, env, structs), TypeKind::Int) &&
+         limit->text != index->text && !assigned.count(limit->text));
+    if (!invariant || !OnlyGrows(loop.body, index->text))
+      continue;
+    BoundsVersion version;
+    version.index = index->text;
+    version.check_index = !scope.nonneg.count(index->text);
+    version.limit = limit;
+    std::vector<ExprPtr> accesses;
+    CollectIndexed(loop.body, index->text, accesses);
+    for (const auto &access : accesses) {
+      const ExprPtr &base = access->base;
+      if (!IsKind(Local(base, env, structs), TypeKind::Array) ||
+          assigned.count(base->text) ||
+          known.count({index->text, base->text}))
+        continue;
+      bool seen = false;
+      for (const auto &a : version.arrays)
+        seen = seen || a == base->text;
+      if (!seen)
+        version.arrays.push_back(base->text);
+    }
+    if (!version.arrays.empty())
+      return version;
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,66 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "codegen_types.h"
+
+// Range facts for --bounds-check. A fact (i, a) means 0 <= i < a.length()
+// holds for the local int i and the local array a at the current point.
+using BoundsFacts = std::set<std::pair<std::string, std::string>>;
+
+// Per-function knowledge the facts are derived from.
+struct BoundsScope {
+  // Int locals whose every definition is non-negative (literals >= 0,
+  // .length(), and sums/products of such values).
+  std::unordered_set<std::string> nonneg;
+  // n -> a for `int n = a.length()` where neither n nor a is reassigned.
+  std::unordered_map<std::string, std::string> lengths;
+};
+
+// A `while i < n` loop whose a[i] accesses are all in range when
+// i >= 0 and n <= a.length() on entry (i only grows inside the loop). The
+// code generator tests that once and runs an unchecked copy of the loop.
+struct BoundsVersion {
+  std::string index;
+  bool check_index = false;
+  ExprPtr limit;
+  std::vector<std::string> arrays;
+};
+
+BoundsScope
+AnalyzeBounds(const Function &fn, const Env &env,
+              const std::unordered_map<std::string, StructInfo> &structs);
+
+// Facts implied by a branch or loop condition being true.
+BoundsFacts GuardFacts(const ExprPtr &cond, const BoundsScope &scope,
+                       const Env &env,
+                       const std::unordered_map<std::string, StructInfo> &structs);
+
+// Names assigned or declared anywhere inside the statements.
+void AssignedNames(const std::vector<StmtPtr> &stmts,
+                   std::unordered_set<std::string> &names);
+void AssignedNames(const StmtPtr &stmt, std::unordered_set<std::string> &names);
+
+// Drops every fact mentioning one of the names.
+void KillFacts(BoundsFacts &facts,
+               const std::unordered_set<std::string> &names);
+
+std::optional<BoundsVersion>
+MatchBoundsVersion(const Stmt &loop, const BoundsFacts &known,
+                   const BoundsScope &scope, const Env &env,
+                   const std::unordered_map<std::string, StructInfo> &structs);
@@ -0,0 +1,1514 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_float.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+const int kPow5TableSize = 326;
+const int kPow5InvTableSize = 342;
+const int kPow5Bits = 125;
+// Scratch in low memory (see kLowScratchSize) for the digits of one
+// decimal: at most 17 from Ryu, up to 768 for the exact expansion (767
+// significant digits at most, plus the sticky one), whose bignum limbs
+// follow.
+const int kDigitBufPtr = 64;
+const int kDigitBufSize = 800;
+const int kLimbPtr = kDigitBufPtr + kDigitBufSize;
+// 32-bit limbs: 2^1024 and a 1074-bit fraction both fit in 34.
+const int kLimbBytes = 36 * 4;
+static_assert(kLimbPtr + kLimbBytes <= kLowScratchSize,
+              "float scratch exceeds the low scratch");
+
+// Little-endian base 2^32 unsigned integer, just enough to build the tables.
+using BigInt = std::vector<uint32_t>;
+
+void MulSmall(BigInt &value, uint32_t factor) {
+  uint64_t carry = 0;
+  for (auto &limb : value) {
+    uint64_t product = static_cast<uint64_t>(limb) * factor + carry;
+    limb = static_cast<uint32_t>(product);
+    carry = product >> 32;
+  }
+  if (carry)
+    value.push_back(static_cast<uint32_t>(carry));
+}
+
+int BitLength(const BigInt &value) {
+  for (int i = static_cast<int>(value.size()) - 1; i >= 0; --i) {
+    if (value[i]) {
+      int bits = 32;
+      while (!(value[i] >> (bits - 1)))
+        --bits;
+      return i * 32 + bits;
+    }
+  }
+  return 0;
+}
+
+bool Bit(const BigInt &value, int bit) {
+  if (bit < 0 || bit / 32 >= static_cast<int>(value.size()))
+    return false;
+  return (value[bit / 32] >> (bit % 32)) & 1;
+}
+
+bool Less(const BigInt &a, const BigInt &b) {
+  size_t n = std::max(a.size(), b.size());
+  for (size_t i = n; i-- > 0;) {
+    uint32_t x = i < a.size() ? a[i] : 0;
+    uint32_t y = i < b.size() ? b[i] : 0;
+    if (x != y)
+      return x < y;
+  }
+  return false;
+}
+
+void Sub(BigInt &a, const BigInt &b) {
+  int64_t borrow = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    int64_t diff = static_cast<int64_t>(a[i]) - borrow -
+                   (i < b.size() ? static_cast<int64_t>(b[i]) : 0);
+    borrow = diff < 0;
+    a[i] = static_cast<uint32_t>(diff + (borrow ? (int64_t{1} << 32) : 0));
+  }
+}
+
+void ShiftLeftOne(BigInt &value, bool low_bit) {
+  uint32_t carry = low_bit;
+  for (auto &limb : value) {
+    uint32_t next = limb >> 31;
+    limb = (limb << 1) | carry;
+    carry = next;
+  }
+  if (carry)
+    value.push_back(carry);
+}
+
+void AppendEntry(std::string &table, uint64_t lo, uint64_t hi) {
+  for (uint64_t half : {lo, hi}) {
+    for (int b = 0; b < 8; ++b)
+      table.push_back(static_cast<char>((half >> (b * 8)) & 0xFF));
+  }
+}
+
+} // namespace
+
+std::string Pow5SplitTable() {
+  std::string table;
+  BigInt pow5{1};
+  for (int i = 0; i < kPow5TableSize; ++i) {
+    // Top kPow5Bits bits of 5^i (zero-extended when shorter).
+    int shift = BitLength(pow5) - kPow5Bits;
+    uint64_t words[2] = {0, 0};
+    for (int bit = 0; bit < 128; ++bit) {
+      if (Bit(pow5, bit + shift))
+        words[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+    AppendEntry(table, words[0], words[1]);
+    MulSmall(pow5, 5);
+  }
+  return table;
+}
+
+std::string Pow5InvSplitTable() {
+  std::string table;
+  BigInt pow5{1};
+  for (int i = 0; i < kPow5InvTableSize; ++i) {
+    // floor(2^j / 5^i) + 1 with j = bitlength(5^i) - 1 + kPow5Bits, by
+    // binary long division; the quotient fits in 128 bits.
+    int j = BitLength(pow5) - 1 + kPow5Bits;
+    BigInt rem{0};
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    for (int bit = j; bit >= 0; --bit) {
+      ShiftLeftOne(rem, bit == j);
+      hi = (hi << 1) | (lo >> 63);
+      lo <<= 1;
+      if (!Less(rem, pow5)) {
+        Sub(rem, pow5);
+        lo |= 1;
+      }
+    }
+    lo += 1;
+    if (lo == 0)
+      hi += 1;
+    AppendEntry(table, lo, hi);
+    MulSmall(pow5, 5);
+  }
+  return table;
+}
+
+void EmitFloatRuntime(std::ostream &out, const RuntimeLayout &layout,
+                      const CodegenOptions &options) {
+  out << "  (global $fp_exp (mut i32) (i32.const 0))\n";
+  out << "  (global $big_rest (mut i32) (i32.const 0))\n";
+
+  // High 64 bits of an unsigned 64x64 multiply, from 32-bit partial products.
+  out << "  (func $umulh (param $a i64) (param $b i64) (result i64)\n";
+  out << "    (local $p10 i64) (local $mid i64)\n";
+  out << "    local.get $a\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $b\n";
+  out << "    i64.const 4294967295\n";
+  out << "    i64.and\n";
+  out << "    i64.mul\n";
+  out << "    local.set $p10\n";
+  out << "    local.get $a\n";
+  out << "    i64.const 4294967295\n";
+  out << "    i64.and\n";
+  out << "    local.get $b\n";
+  out << "    i64.const 4294967295\n";
+  out << "    i64.and\n";
+  out << "    i64.mul\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $p10\n";
+  out << "    i64.const 4294967295\n";
+  out << "    i64.and\n";
+  out << "    i64.add\n";
+  out << "    local.get $a\n";
+  out << "    i64.const 4294967295\n";
+  out << "    i64.and\n";
+  out << "    local.get $b\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.mul\n";
+  out << "    i64.add\n";
+  out << "    local.set $mid\n";
+  out << "    local.get $a\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $b\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.mul\n";
+  out << "    local.get $p10\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.add\n";
+  out << "    local.get $mid\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.add\n";
+  out << "  )\n";
+
+  // (m * mul) >> j for a 128-bit table entry mul = [lo, hi], 64 < j < 128.
+  out << "  (func $mul_shift64 (param $m i64) (param $mul i32) (param $j i32) (result i64)\n";
+  out << "    (local $low i64) (local $sum i64) (local $high i64)\n";
+  out << "    local.get $m\n";
+  out << "    local.get $mul\n";
+  out << "    i64.load\n";
+  out << "    call $umulh\n";
+  out << "    local.set $low\n";
+  out << "    local.get $m\n";
+  out << "    local.get $mul\n";
+  out << "    i64.load offset=8\n";
+  out << "    i64.mul\n";
+  out << "    local.get $low\n";
+  out << "    i64.add\n";
+  out << "    local.set $sum\n";
+  out << "    local.get $m\n";
+  out << "    local.get $mul\n";
+  out << "    i64.load offset=8\n";
+  out << "    call $umulh\n";
+  out << "    local.get $sum\n";
+  out << "    local.get $low\n";
+  out << "    i64.lt_u\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.add\n";
+  out << "    local.set $high\n";
+  out << "    local.get $j\n";
+  out << "    i32.const 64\n";
+  out << "    i32.sub\n";
+  out << "    local.set $j\n";
+  out << "    local.get $sum\n";
+  out << "    local.get $j\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $high\n";
+  out << "    i32.const 64\n";
+  out << "    local.get $j\n";
+  out << "    i32.sub\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.shl\n";
+  out << "    i64.or\n";
+  out << "  )\n";
+
+  out << "  (func $pow5_factor (param $val i64) (result i32)\n";
+  out << "    (local $count i32)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $val\n";
+  out << "        i64.const 5\n";
+  out << "        i64.rem_u\n";
+  out << "        i64.const 0\n";
+  out << "        i64.ne\n";
+  out << "        br_if 1\n";
+  out << "        local.get $val\n";
+  out << "        i64.const 5\n";
+  out << "        i64.div_u\n";
+  out << "        local.set $val\n";
+  out << "        local.get $count\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $count\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $count\n";
+  out << "  )\n";
+
+  // Ryu: shortest decimal that round-trips to $val (finite, >= 0). Writes the
+  // digits as ASCII at kDigitBufPtr, sets $fp_exp to the decimal exponent of
+  // the first digit and returns the digit count (0 for zero).
+  out << "  (func $f64_decimal (param $val f64) (result i32)\n";
+  out << "    (local $bits i64) (local $mant i64) (local $ex i32) (local $e2 i32) (local $m2 i64)\n";
+  out << "    (local $accept i32) (local $mv i64) (local $mm_shift i32) (local $q i32) (local $i i32)\n";
+  out << "    (local $j i32) (local $mul i32) (local $vr i64) (local $vp i64) (local $vm i64)\n";
+  out << "    (local $e10 i32) (local $vm_tz i32) (local $vr_tz i32) (local $last i64) (local $up i32)\n";
+  out << "    (local $n i32)\n";
+  out << "    local.get $val\n";
+  out << "    f64.const 0\n";
+  out << "    f64.eq\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      global.set $fp_exp\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    i64.reinterpret_f64\n";
+  out << "    local.tee $bits\n";
+  out << "    i64.const 4503599627370495\n";
+  out << "    i64.and\n";
+  out << "    local.set $mant\n";
+  out << "    local.get $bits\n";
+  out << "    i64.const 52\n";
+  out << "    i64.shr_u\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 2047\n";
+  out << "    i32.and\n";
+  out << "    local.tee $ex\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      i32.const -1076\n";
+  out << "      local.set $e2\n";
+  out << "      local.get $mant\n";
+  out << "      local.set $m2\n";
+  out << "    else\n";
+  out << "      local.get $ex\n";
+  out << "      i32.const 1077\n";
+  out << "      i32.sub\n";
+  out << "      local.set $e2\n";
+  out << "      local.get $mant\n";
+  out << "      i64.const 4503599627370496\n";
+  out << "      i64.or\n";
+  out << "      local.set $m2\n";
+  out << "    end\n";
+  out << "    local.get $m2\n";
+  out << "    i64.const 1\n";
+  out << "    i64.and\n";
+  out << "    i64.eqz\n";
+  out << "    local.set $accept\n";
+  out << "    local.get $m2\n";
+  out << "    i64.const 2\n";
+  out << "    i64.shl\n";
+  out << "    local.set $mv\n";
+  out << "    local.get $mant\n";
+  out << "    i64.const 0\n";
+  out << "    i64.ne\n";
+  out << "    local.get $ex\n";
+  out << "    i32.const 1\n";
+  out << "    i32.le_u\n";
+  out << "    i32.or\n";
+  out << "    local.set $mm_shift\n";
+  out << "    local.get $e2\n";
+  out << "    i32.const 0\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  out << "      local.get $e2\n";
+  out << "      i32.const 78913\n";
+  out << "      i32.mul\n";
+  out << "      i32.const 18\n";
+  out << "      i32.shr_u\n";
+  out << "      local.get $e2\n";
+  out << "      i32.const 3\n";
+  out << "      i32.gt_s\n";
+  out << "      i32.sub\n";
+  out << "      local.tee $q\n";
+  out << "      local.set $e10\n";
+  out << "      local.get $q\n";
+  out << "      local.get $e2\n";
+  out << "      i32.sub\n";
+  out << "      local.get $q\n";
+  out << "      i32.const 1217359\n";
+  out << "      i32.mul\n";
+  out << "      i32.const 19\n";
+  out << "      i32.shr_u\n";
+  out << "      i32.const 125\n";
+  out << "      i32.add\n";
+  out << "      i32.add\n";
+  out << "      local.set $j\n";
+  out << "      local.get $q\n";
+  out << "      i32.const 4\n";
+  out << "      i32.shl\n";
+  out << "      i32.const " << layout.pow5_inv_split_ptr << "\n";
+  out << "      i32.add\n";
+  out << "      local.set $mul\n";
+  out << "    else\n";
+  out << "      i32.const 0\n";
+  out << "      local.get $e2\n";
+  out << "      i32.sub\n";
+  out << "      local.tee $i\n";
+  out << "      i32.const 732923\n";
+  out << "      i32.mul\n";
+  out << "      i32.const 20\n";
+  out << "      i32.shr_u\n";
+  out << "      local.get $i\n";
+  out << "      i32.const 1\n";
+  out << "      i32.gt_s\n";
+  out << "      i32.sub\n";
+  out << "      local.tee $q\n";
+  out << "      local.get $e2\n";
+  out << "      i32.add\n";
+  out << "      local.set $e10\n";
+  out << "      local.get $i\n";
+  out << "      local.get $q\n";
+  out << "      i32.sub\n";
+  out << "      local.set $i\n";
+  out << "      local.get $q\n";
+  out << "      i32.const 124\n";
+  out << "      i32.add\n";
+  out << "      local.get $i\n";
+  out << "      i32.const 1217359\n";
+  out << "      i32.mul\n";
+  out << "      i32.const 19\n";
+  out << "      i32.shr_u\n";
+  out << "      i32.sub\n";
+  out << "      local.set $j\n";
+  out << "      local.get $i\n";
+  out << "      i32.const 4\n";
+  out << "      i32.shl\n";
+  out << "      i32.const " << layout.pow5_split_ptr << "\n";
+  out << "      i32.add\n";
+  out << "      local.set $mul\n";
+  out << "    end\n";
+  out << "    local.get $mv\n";
+  out << "    local.get $mul\n";
+  out << "    local.get $j\n";
+  out << "    call $mul_shift64\n";
+  out << "    local.set $vr\n";
+  out << "    local.get $mv\n";
+  out << "    i64.const 2\n";
+  out << "    i64.add\n";
+  out << "    local.get $mul\n";
+  out << "    local.get $j\n";
+  out << "    call $mul_shift64\n";
+  out << "    local.set $vp\n";
+  out << "    local.get $mv\n";
+  out << "    i64.const 1\n";
+  out << "    i64.sub\n";
+  out << "    local.get $mm_shift\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.sub\n";
+  out << "    local.get $mul\n";
+  out << "    local.get $j\n";
+  out << "    call $mul_shift64\n";
+  out << "    local.set $vm\n";
+  out << "    local.get $e2\n";
+  out << "    i32.const 0\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  out << "      local.get $q\n";
+  out << "      i32.const 21\n";
+  out << "      i32.le_u\n";
+  out << "      if\n";
+  out << "        local.get $mv\n";
+  out << "        i64.const 5\n";
+  out << "        i64.rem_u\n";
+  out << "        i64.eqz\n";
+  out << "        if\n";
+  out << "          local.get $mv\n";
+  out << "          call $pow5_factor\n";
+  out << "          local.get $q\n";
+  out << "          i32.ge_u\n";
+  out << "          local.set $vr_tz\n";
+  out << "        else\n";
+  out << "          local.get $accept\n";
+  out << "          if\n";
+  out << "            local.get $mv\n";
+  out << "            i64.const 1\n";
+  out << "            i64.sub\n";
+  out << "            local.get $mm_shift\n";
+  out << "            i64.extend_i32_u\n";
+  out << "            i64.sub\n";
+  out << "            call $pow5_factor\n";
+  out << "            local.get $q\n";
+  out << "            i32.ge_u\n";
+  out << "            local.set $vm_tz\n";
+  out << "          else\n";
+  out << "            local.get $vp\n";
+  out << "            local.get $mv\n";
+  out << "            i64.const 2\n";
+  out << "            i64.add\n";
+  out << "            call $pow5_factor\n";
+  out << "            local.get $q\n";
+  out << "            i32.ge_u\n";
+  out << "            i64.extend_i32_u\n";
+  out << "            i64.sub\n";
+  out << "            local.set $vp\n";
+  out << "          end\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "    else\n";
+  out << "      local.get $q\n";
+  out << "      i32.const 1\n";
+  out << "      i32.le_u\n";
+  out << "      if\n";
+  out << "        i32.const 1\n";
+  out << "        local.set $vr_tz\n";
+  out << "        local.get $accept\n";
+  out << "        if\n";
+  out << "          local.get $mm_shift\n";
+  out << "          local.set $vm_tz\n";
+  out << "        else\n";
+  out << "          local.get $vp\n";
+  out << "          i64.const 1\n";
+  out << "          i64.sub\n";
+  out << "          local.set $vp\n";
+  out << "        end\n";
+  out << "      else\n";
+  out << "        local.get $q\n";
+  out << "        i32.const 63\n";
+  out << "        i32.lt_u\n";
+  out << "        if\n";
+  out << "          local.get $mv\n";
+  out << "          i64.const 1\n";
+  out << "          local.get $q\n";
+  out << "          i64.extend_i32_u\n";
+  out << "          i64.shl\n";
+  out << "          i64.const 1\n";
+  out << "          i64.sub\n";
+  out << "          i64.and\n";
+  out << "          i64.eqz\n";
+  out << "          local.set $vr_tz\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $vm_tz\n";
+  out << "    local.get $vr_tz\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $vp\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.get $vm\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          i64.le_u\n";
+  out << "          br_if 1\n";
+  out << "          local.get $vm_tz\n";
+  out << "          local.get $vm\n";
+  out << "          i64.const 10\n";
+  out << "          i64.rem_u\n";
+  out << "          i64.eqz\n";
+  out << "          i32.and\n";
+  out << "          local.set $vm_tz\n";
+  out << "          local.get $vr_tz\n";
+  out << "          local.get $last\n";
+  out << "          i64.eqz\n";
+  out << "          i32.and\n";
+  out << "          local.set $vr_tz\n";
+  out << "          local.get $vr\n";
+  out << "          i64.const 10\n";
+  out << "          i64.rem_u\n";
+  out << "          local.set $last\n";
+  out << "          local.get $vr\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vr\n";
+  out << "          local.get $vp\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vp\n";
+  out << "          local.get $vm\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vm\n";
+  out << "          local.get $e10\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          local.set $e10\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "      local.get $vm_tz\n";
+  out << "      if\n";
+  out << "        block\n";
+  out << "          loop\n";
+  out << "            local.get $vm\n";
+  out << "            i64.const 10\n";
+  out << "            i64.rem_u\n";
+  out << "            i64.const 0\n";
+  out << "            i64.ne\n";
+  out << "            br_if 1\n";
+  out << "            local.get $vr_tz\n";
+  out << "            local.get $last\n";
+  out << "            i64.eqz\n";
+  out << "            i32.and\n";
+  out << "            local.set $vr_tz\n";
+  out << "            local.get $vr\n";
+  out << "            i64.const 10\n";
+  out << "            i64.rem_u\n";
+  out << "            local.set $last\n";
+  out << "            local.get $vr\n";
+  out << "            i64.const 10\n";
+  out << "            i64.div_u\n";
+  out << "            local.set $vr\n";
+  out << "            local.get $vp\n";
+  out << "            i64.const 10\n";
+  out << "            i64.div_u\n";
+  out << "            local.set $vp\n";
+  out << "            local.get $vm\n";
+  out << "            i64.const 10\n";
+  out << "            i64.div_u\n";
+  out << "            local.set $vm\n";
+  out << "            local.get $e10\n";
+  out << "            i32.const 1\n";
+  out << "            i32.add\n";
+  out << "            local.set $e10\n";
+  out << "            br 0\n";
+  out << "          end\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "      local.get $vr_tz\n";
+  out << "      local.get $last\n";
+  out << "      i64.const 5\n";
+  out << "      i64.eq\n";
+  out << "      i32.and\n";
+  out << "      local.get $vr\n";
+  out << "      i64.const 1\n";
+  out << "      i64.and\n";
+  out << "      i64.eqz\n";
+  out << "      i32.and\n";
+  out << "      if\n";
+  out << "        i64.const 4\n";
+  out << "        local.set $last\n";
+  out << "      end\n";
+  out << "      local.get $vr\n";
+  out << "      local.get $vr\n";
+  out << "      local.get $vm\n";
+  out << "      i64.eq\n";
+  out << "      local.get $accept\n";
+  out << "      i32.eqz\n";
+  out << "      local.get $vm_tz\n";
+  out << "      i32.eqz\n";
+  out << "      i32.or\n";
+  out << "      i32.and\n";
+  out << "      local.get $last\n";
+  out << "      i64.const 5\n";
+  out << "      i64.ge_u\n";
+  out << "      i32.or\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.add\n";
+  out << "      local.set $vr\n";
+  out << "    else\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $vp\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.get $vm\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          i64.le_u\n";
+  out << "          br_if 1\n";
+  out << "          local.get $vr\n";
+  out << "          i64.const 10\n";
+  out << "          i64.rem_u\n";
+  out << "          i64.const 5\n";
+  out << "          i64.ge_u\n";
+  out << "          local.set $up\n";
+  out << "          local.get $vr\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vr\n";
+  out << "          local.get $vp\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vp\n";
+  out << "          local.get $vm\n";
+  out << "          i64.const 10\n";
+  out << "          i64.div_u\n";
+  out << "          local.set $vm\n";
+  out << "          local.get $e10\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          local.set $e10\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "      local.get $vr\n";
+  out << "      local.get $vr\n";
+  out << "      local.get $vm\n";
+  out << "      i64.eq\n";
+  out << "      local.get $up\n";
+  out << "      i32.or\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.add\n";
+  out << "      local.set $vr\n";
+  out << "    end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $vr\n";
+  out << "        i64.const 10\n";
+  out << "        i64.rem_u\n";
+  out << "        i64.const 0\n";
+  out << "        i64.ne\n";
+  out << "        br_if 1\n";
+  out << "        local.get $vr\n";
+  out << "        i64.const 10\n";
+  out << "        i64.div_u\n";
+  out << "        local.set $vr\n";
+  out << "        local.get $e10\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $e10\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $vr\n";
+  out << "    call $count_digits\n";
+  out << "    local.set $n\n";
+  out << "    local.get $vr\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "    local.get $n\n";
+  out << "    i32.add\n";
+  out << "    call $write_digits\n";
+  out << "    local.get $e10\n";
+  out << "    local.get $n\n";
+  out << "    i32.add\n";
+  out << "    i32.const 1\n";
+  out << "    i32.sub\n";
+  out << "    global.set $fp_exp\n";
+  out << "    local.get $n\n";
+  out << "  )\n";
+
+  // Divides the $n limbs at kLimbPtr by 10^9 in place; returns the remainder.
+  out << "  (func $big_div1e9 (param $n i32) (result i64)\n";
+  out << "    (local $rem i64) (local $cur i64) (local $p i32)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $n\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $n\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.tee $n\n";
+  out << "        i32.const 2\n";
+  out << "        i32.shl\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "        i32.add\n";
+  out << "        local.tee $p\n";
+  out << "        local.get $rem\n";
+  out << "        i64.const 32\n";
+  out << "        i64.shl\n";
+  out << "        local.get $p\n";
+  out << "        i64.load32_u\n";
+  out << "        i64.or\n";
+  out << "        local.tee $cur\n";
+  out << "        i64.const 1000000000\n";
+  out << "        i64.div_u\n";
+  out << "        i64.store32\n";
+  out << "        local.get $cur\n";
+  out << "        i64.const 1000000000\n";
+  out << "        i64.rem_u\n";
+  out << "        local.set $rem\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $rem\n";
+  out << "  )\n";
+
+  // Multiplies the $n limbs at kLimbPtr by 10 in place and returns the carry
+  // out: the next decimal digit of a fraction left-aligned in them. Sets
+  // $big_rest to whether anything is left.
+  out << "  (func $big_mul10 (param $n i32) (result i32)\n";
+  out << "    (local $p i32) (local $end i32) (local $c i64) (local $rest i32)\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "    local.tee $p\n";
+  out << "    local.get $n\n";
+  out << "    i32.const 2\n";
+  out << "    i32.shl\n";
+  out << "    i32.add\n";
+  out << "    local.set $end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $p\n";
+  out << "        local.get $end\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $p\n";
+  out << "        local.get $p\n";
+  out << "        i64.load32_u\n";
+  out << "        i64.const 10\n";
+  out << "        i64.mul\n";
+  out << "        local.get $c\n";
+  out << "        i64.add\n";
+  out << "        local.tee $c\n";
+  out << "        i64.store32\n";
+  out << "        local.get $rest\n";
+  out << "        local.get $c\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.or\n";
+  out << "        local.set $rest\n";
+  out << "        local.get $c\n";
+  out << "        i64.const 32\n";
+  out << "        i64.shr_u\n";
+  out << "        local.set $c\n";
+  out << "        local.get $p\n";
+  out << "        i32.const 4\n";
+  out << "        i32.add\n";
+  out << "        local.set $p\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $rest\n";
+  out << "    global.set $big_rest\n";
+  out << "    local.get $c\n";
+  out << "    i32.wrap_i64\n";
+  out << "  )\n";
+
+  // The exact decimal expansion of $val (finite, >= 0) for precision
+  // printing, in the layout $f64_decimal uses. An integer part of 2^e2 * m
+  // is converted through limbs 10^9 at a time; fraction digits come from
+  // multiplying the fraction bits by 10. Digits stop once $sig significant
+  // ones or the 10^-$pos place are written; if the rest is not zero, a '1'
+  // is appended for it so $round_digits sees ties exactly.
+  out << "  (func $f64_exact (param $val f64) (param $sig i32) (param $pos i32) (result i32)\n";
+  out << "    (local $bits i64) (local $m2 i64) (local $e2 i32) (local $k i32) (local $n i32)\n";
+  out << "    (local $int i64) (local $rem i64) (local $end i32) (local $len i32) (local $d i32)\n";
+  out << "    (local $fp i32)\n";
+  out << "    local.get $val\n";
+  out << "    f64.const 0\n";
+  out << "    f64.eq\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      global.set $fp_exp\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    i64.reinterpret_f64\n";
+  out << "    local.tee $bits\n";
+  out << "    i64.const 4503599627370495\n";
+  out << "    i64.and\n";
+  out << "    local.set $m2\n";
+  out << "    local.get $bits\n";
+  out << "    i64.const 52\n";
+  out << "    i64.shr_u\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.tee $e2\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      i32.const -1074\n";
+  out << "      local.set $e2\n";
+  out << "    else\n";
+  out << "      local.get $m2\n";
+  out << "      i64.const 4503599627370496\n";
+  out << "      i64.or\n";
+  out << "      local.set $m2\n";
+  out << "      local.get $e2\n";
+  out << "      i32.const 1075\n";
+  out << "      i32.sub\n";
+  out << "      local.set $e2\n";
+  out << "    end\n";
+  out << "    local.get $e2\n";
+  out << "    i32.const 0\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  // An integer: m2 << e2 into the limbs, then 9-digit groups right to left
+  // ending at the end of the digit buffer (a group is written as
+  // 10^9 + group, the leading 1 landing under the next one).
+  out << ScratchAddress(kLimbPtr, options);
+  out << "      i32.const 0\n";
+  out << "      i32.const " << kLimbBytes << "\n";
+  out << "      memory.fill\n";
+  out << "      local.get $e2\n";
+  out << "      i32.const 5\n";
+  out << "      i32.shr_u\n";
+  out << "      local.tee $n\n";
+  out << "      i32.const 2\n";
+  out << "      i32.shl\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "      i32.add\n";
+  out << "      local.tee $end\n";
+  out << "      local.get $m2\n";
+  out << "      local.get $e2\n";
+  out << "      i32.const 31\n";
+  out << "      i32.and\n";
+  out << "      local.tee $k\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.shl\n";
+  out << "      i64.store\n";
+  out << "      local.get $end\n";
+  out << "      local.get $m2\n";
+  out << "      i64.const 1\n";
+  out << "      i64.shr_u\n";
+  out << "      i32.const 63\n";
+  out << "      local.get $k\n";
+  out << "      i32.sub\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.shr_u\n";
+  out << "      i64.store32 offset=8\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 3\n";
+  out << "      i32.add\n";
+  out << "      local.set $n\n";
+  out << ScratchAddress(kDigitBufPtr + kDigitBufSize, options);
+  out << "      local.set $end\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $n\n";
+  out << "          call $big_div1e9\n";
+  out << "          local.set $rem\n";
+  out << "          block\n";
+  out << "            loop\n";
+  out << "              local.get $n\n";
+  out << "              i32.eqz\n";
+  out << "              br_if 1\n";
+  out << "              local.get $n\n";
+  out << "              i32.const 2\n";
+  out << "              i32.shl\n";
+  out << ScratchAddress(kLimbPtr - 4, options);
+  out << "              i32.add\n";
+  out << "              i32.load\n";
+  out << "              br_if 1\n";
+  out << "              local.get $n\n";
+  out << "              i32.const 1\n";
+  out << "              i32.sub\n";
+  out << "              local.set $n\n";
+  out << "              br 0\n";
+  out << "            end\n";
+  out << "          end\n";
+  out << "          local.get $n\n";
+  out << "          i32.eqz\n";
+  out << "          br_if 1\n";
+  out << "          local.get $rem\n";
+  out << "          i64.const 1000000000\n";
+  out << "          i64.add\n";
+  out << "          local.get $end\n";
+  out << "          call $write_digits\n";
+  out << "          local.get $end\n";
+  out << "          i32.const 9\n";
+  out << "          i32.sub\n";
+  out << "          local.set $end\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "      local.get $rem\n";
+  out << "      local.get $end\n";
+  out << "      call $write_digits\n";
+  out << "      local.get $end\n";
+  out << "      local.get $rem\n";
+  out << "      call $count_digits\n";
+  out << "      i32.sub\n";
+  out << "      local.set $end\n";
+  out << ScratchAddress(kDigitBufPtr + kDigitBufSize, options);
+  out << "      local.get $end\n";
+  out << "      i32.sub\n";
+  out << "      local.set $len\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "      local.get $end\n";
+  out << "      local.get $len\n";
+  out << "      memory.copy\n";
+  out << "      local.get $len\n";
+  out << "      i32.const 1\n";
+  out << "      i32.sub\n";
+  out << "      global.set $fp_exp\n";
+  out << "    else\n";
+  // 2^-k * m2: the integer part fits in an i64, the k fraction bits go
+  // left-aligned into n = ceil(k / 32) limbs.
+  out << "      i32.const 0\n";
+  out << "      local.get $e2\n";
+  out << "      i32.sub\n";
+  out << "      local.tee $k\n";
+  out << "      i32.const 64\n";
+  out << "      i32.lt_u\n";
+  out << "      if\n";
+  out << "        local.get $m2\n";
+  out << "        local.get $k\n";
+  out << "        i64.extend_i32_u\n";
+  out << "        i64.shr_u\n";
+  out << "        local.set $int\n";
+  out << "        local.get $m2\n";
+  out << "        i64.const 1\n";
+  out << "        local.get $k\n";
+  out << "        i64.extend_i32_u\n";
+  out << "        i64.shl\n";
+  out << "        i64.const 1\n";
+  out << "        i64.sub\n";
+  out << "        i64.and\n";
+  out << "        local.set $m2\n";
+  out << "      end\n";
+  out << "      local.get $int\n";
+  out << "      i64.eqz\n";
+  out << "      i32.eqz\n";
+  out << "      if\n";
+  out << "        local.get $int\n";
+  out << "        call $count_digits\n";
+  out << "        local.set $len\n";
+  out << "        local.get $int\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "        local.get $len\n";
+  out << "        i32.add\n";
+  out << "        call $write_digits\n";
+  out << "        local.get $len\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        global.set $fp_exp\n";
+  out << "      end\n";
+  out << "      local.get $k\n";
+  out << "      i32.const 31\n";
+  out << "      i32.add\n";
+  out << "      i32.const 5\n";
+  out << "      i32.shr_u\n";
+  out << "      local.set $n\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "      i32.const 0\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 2\n";
+  out << "      i32.shl\n";
+  out << "      memory.fill\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 5\n";
+  out << "      i32.shl\n";
+  out << "      local.get $k\n";
+  out << "      i32.sub\n";
+  out << "      local.set $k\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "      local.get $m2\n";
+  out << "      local.get $k\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.shl\n";
+  out << "      i64.store\n";
+  out << ScratchAddress(kLimbPtr, options);
+  out << "      local.get $m2\n";
+  out << "      i64.const 1\n";
+  out << "      i64.shr_u\n";
+  out << "      i32.const 63\n";
+  out << "      local.get $k\n";
+  out << "      i32.sub\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      i64.shr_u\n";
+  out << "      i64.store32 offset=8\n";
+  out << "      local.get $m2\n";
+  out << "      i64.const 0\n";
+  out << "      i64.ne\n";
+  out << "      global.set $big_rest\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          global.get $big_rest\n";
+  out << "          i32.eqz\n";
+  out << "          br_if 1\n";
+  out << "          local.get $fp\n";
+  out << "          local.get $pos\n";
+  out << "          i32.ge_s\n";
+  out << "          local.get $len\n";
+  out << "          local.get $sig\n";
+  out << "          i32.ge_s\n";
+  out << "          i32.or\n";
+  out << "          if\n";
+  out << "            local.get $len\n";
+  out << "            i32.eqz\n";
+  out << "            if\n";
+  out << "              i32.const -1\n";
+  out << "              local.get $fp\n";
+  out << "              i32.sub\n";
+  out << "              global.set $fp_exp\n";
+  out << "            end\n";
+  out << "            local.get $len\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "            i32.add\n";
+  out << "            i32.const 49\n";
+  out << "            i32.store8\n";
+  out << "            local.get $len\n";
+  out << "            i32.const 1\n";
+  out << "            i32.add\n";
+  out << "            return\n";
+  out << "          end\n";
+  out << "          local.get $n\n";
+  out << "          call $big_mul10\n";
+  out << "          local.set $d\n";
+  out << "          local.get $fp\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          local.set $fp\n";
+  out << "          local.get $len\n";
+  out << "          local.get $d\n";
+  out << "          i32.or\n";
+  out << "          if\n";
+  out << "            local.get $len\n";
+  out << "            i32.eqz\n";
+  out << "            if\n";
+  out << "              i32.const 0\n";
+  out << "              local.get $fp\n";
+  out << "              i32.sub\n";
+  out << "              global.set $fp_exp\n";
+  out << "            end\n";
+  out << "            local.get $len\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "            i32.add\n";
+  out << "            local.get $d\n";
+  out << "            i32.const 48\n";
+  out << "            i32.add\n";
+  out << "            i32.store8\n";
+  out << "            local.get $len\n";
+  out << "            i32.const 1\n";
+  out << "            i32.add\n";
+  out << "            local.set $len\n";
+  out << "          end\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $len\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $len\n";
+  out << ScratchAddress(kDigitBufPtr - 1, options);
+  out << "        i32.add\n";
+  out << "        i32.load8_u\n";
+  out << "        i32.const 48\n";
+  out << "        i32.ne\n";
+  out << "        br_if 1\n";
+  out << "        local.get $len\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.set $len\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $len\n";
+  out << "  )\n";
+
+  // Rounds the digit buffer to $keep significant digits, to nearest with
+  // ties to even; the digits must be exact (see $f64_exact). Digits past the
+  // returned count are implicitly '0'.
+  out << "  (func $round_digits (param $n i32) (param $keep i32) (result i32)\n";
+  out << "    (local $i i32) (local $ch i32)\n";
+  out << "    local.get $keep\n";
+  out << "    local.get $n\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  out << "      local.get $n\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $keep\n";
+  out << "    i32.const 0\n";
+  out << "    i32.lt_s\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $keep\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "    i32.add\n";
+  out << "    i32.load8_u\n";
+  out << "    i32.const 53\n";
+  out << "    i32.lt_u\n";
+  out << "    if\n";
+  out << "      local.get $keep\n";
+  out << "      return\n";
+  out << "    end\n";
+  // A final 5 is an exact tie: round down when the kept digit is even.
+  out << "    local.get $keep\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    i32.eq\n";
+  out << "    local.get $keep\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "    i32.add\n";
+  out << "    i32.load8_u\n";
+  out << "    i32.const 53\n";
+  out << "    i32.eq\n";
+  out << "    i32.and\n";
+  out << "    if\n";
+  out << "      local.get $keep\n";
+  out << "      i32.eqz\n";
+  out << "      if\n";
+  out << "        i32.const 0\n";
+  out << "        return\n";
+  out << "      end\n";
+  out << "      local.get $keep\n";
+  out << ScratchAddress(kDigitBufPtr - 1, options);
+  out << "      i32.add\n";
+  out << "      i32.load8_u\n";
+  out << "      i32.const 1\n";
+  out << "      i32.and\n";
+  out << "      i32.eqz\n";
+  out << "      if\n";
+  out << "        local.get $keep\n";
+  out << "        return\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $keep\n";
+  out << "    local.set $i\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $i\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $i\n";
+  out << ScratchAddress(kDigitBufPtr - 1, options);
+  out << "        i32.add\n";
+  out << "        local.tee $ch\n";
+  out << "        i32.load8_u\n";
+  out << "        i32.const 57\n";
+  out << "        i32.ne\n";
+  out << "        if\n";
+  out << "          local.get $ch\n";
+  out << "          local.get $ch\n";
+  out << "          i32.load8_u\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          i32.store8\n";
+  out << "          local.get $i\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $i\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.set $i\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << ScratchAddress(kDigitBufPtr, options);
+  out << "    i32.const 49\n";
+  out << "    i32.store8\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    global.set $fp_exp\n";
+  out << "    i32.const 1\n";
+  out << "  )\n";
+
+  out << "  (func $digit_at (param $n i32) (param $idx i32) (result i32)\n";
+  out << "    local.get $idx\n";
+  out << "    i32.const 0\n";
+  out << "    i32.ge_s\n";
+  out << "    local.get $idx\n";
+  out << "    local.get $n\n";
+  out << "    i32.lt_s\n";
+  out << "    i32.and\n";
+  out << "    if (result i32)\n";
+  out << "      local.get $idx\n";
+  if (options.threads)
+    out << "      global.get $tls\n      i32.add\n";
+  out << "      i32.load8_u offset=" << kDigitBufPtr << "\n";
+  out << "    else\n";
+  out << "      i32.const 48\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  out << "  (func $print_fixed_digits (param $n i32) (param $frac i32)\n";
+  out << "    (local $idx i32) (local $end i32)\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const 0\n";
+  out << "    i32.lt_s\n";
+  out << "    if\n";
+  out << "      i32.const 48\n";
+  out << "      call $write_byte\n";
+  out << "    else\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $idx\n";
+  out << "          global.get $fp_exp\n";
+  out << "          i32.gt_s\n";
+  out << "          br_if 1\n";
+  out << "          local.get $n\n";
+  out << "          local.get $idx\n";
+  out << "          call $digit_at\n";
+  out << "          call $write_byte\n";
+  out << "          local.get $idx\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          local.set $idx\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $frac\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const 46\n";
+  out << "    call $write_byte\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    local.tee $idx\n";
+  out << "    local.get $frac\n";
+  out << "    i32.add\n";
+  out << "    local.set $end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $idx\n";
+  out << "        local.get $end\n";
+  out << "        i32.ge_s\n";
+  out << "        br_if 1\n";
+  out << "        local.get $n\n";
+  out << "        local.get $idx\n";
+  out << "        call $digit_at\n";
+  out << "        call $write_byte\n";
+  out << "        local.get $idx\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $idx\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  out << "  (func $print_sci_digits (param $n i32) (param $frac i32)\n";
+  out << "    (local $idx i32) (local $exp i32)\n";
+  out << "    local.get $n\n";
+  out << "    i32.const 0\n";
+  out << "    call $digit_at\n";
+  out << "    call $write_byte\n";
+  out << "    local.get $frac\n";
+  out << "    if\n";
+  out << "      i32.const 46\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 1\n";
+  out << "      local.set $idx\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $idx\n";
+  out << "          local.get $frac\n";
+  out << "          i32.gt_s\n";
+  out << "          br_if 1\n";
+  out << "          local.get $n\n";
+  out << "          local.get $idx\n";
+  out << "          call $digit_at\n";
+  out << "          call $write_byte\n";
+  out << "          local.get $idx\n";
+  out << "          i32.const 1\n";
+  out << "          i32.add\n";
+  out << "          local.set $idx\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    i32.const 101\n";
+  out << "    call $write_byte\n";
+  out << "    global.get $fp_exp\n";
+  out << "    local.set $exp\n";
+  out << "    local.get $exp\n";
+  out << "    i32.const 0\n";
+  out << "    i32.lt_s\n";
+  out << "    if\n";
+  out << "      i32.const 45\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 0\n";
+  out << "      local.get $exp\n";
+  out << "      i32.sub\n";
+  out << "      local.set $exp\n";
+  out << "    else\n";
+  out << "      i32.const 43\n";
+  out << "      call $write_byte\n";
+  out << "    end\n";
+  out << "    local.get $exp\n";
+  out << "    i32.const 10\n";
+  out << "    i32.lt_s\n";
+  out << "    if\n";
+  out << "      i32.const 48\n";
+  out << "      call $write_byte\n";
+  out << "    end\n";
+  out << "    local.get $exp\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    call $print_i64_raw\n";
+  out << "  )\n";
+
+  // Writes the sign, or the whole value for nan/inf (returns 1).
+  out << "  (func $print_f64_sign (param $val f64) (result i32)\n";
+  out << "    local.get $val\n";
+  out << "    i64.reinterpret_f64\n";
+  out << "    i64.const 0\n";
+  out << "    i64.lt_s\n";
+  out << "    local.get $val\n";
+  out << "    local.get $val\n";
+  out << "    f64.eq\n";
+  out << "    i32.and\n";
+  out << "    if\n";
+  out << "      i32.const 45\n";
+  out << "      call $write_byte\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    local.get $val\n";
+  out << "    f64.ne\n";
+  out << "    if\n";
+  out << "      i32.const 110\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 97\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 110\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 1\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    i64.reinterpret_f64\n";
+  out << "    i64.const 9218868437227405312\n";
+  out << "    i64.and\n";
+  out << "    i64.const 9218868437227405312\n";
+  out << "    i64.eq\n";
+  out << "    if\n";
+  out << "      i32.const 105\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 110\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 102\n";
+  out << "      call $write_byte\n";
+  out << "      i32.const 1\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const 0\n";
+  out << "  )\n";
+
+  // Shortest round-trip form: fixed for exponents -4..15, scientific
+  // otherwise; fixed output always keeps one fractional digit.
+  out << "  (func $print_f64_raw (param $val f64)\n";
+  out << "    (local $n i32)\n";
+  out << "    local.get $val\n";
+  out << "    call $print_f64_sign\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    f64.abs\n";
+  out << "    call $f64_decimal\n";
+  out << "    local.set $n\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const -4\n";
+  out << "    i32.lt_s\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const 16\n";
+  out << "    i32.ge_s\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      local.get $n\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 1\n";
+  out << "      i32.sub\n";
+  out << "      i32.const 0\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 1\n";
+  out << "      i32.gt_s\n";
+  out << "      select\n";
+  out << "      call $print_sci_digits\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $n\n";
+  out << "    local.get $n\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.sub\n";
+  out << "    i32.const 1\n";
+  out << "    i32.sub\n";
+  out << "    local.tee $n\n";
+  out << "    i32.const 1\n";
+  out << "    local.get $n\n";
+  out << "    i32.const 1\n";
+  out << "    i32.gt_s\n";
+  out << "    select\n";
+  out << "    call $print_fixed_digits\n";
+  out << "  )\n";
+
+  out << "  (func $print_f64_prec (param $val f64) (param $prec i32)\n";
+  out << "    local.get $val\n";
+  out << "    call $print_f64_sign\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    f64.abs\n";
+  out << "    i32.const 2147483647\n";
+  out << "    local.get $prec\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    call $f64_exact\n";
+  out << "    global.get $fp_exp\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    local.get $prec\n";
+  out << "    i32.add\n";
+  out << "    call $round_digits\n";
+  out << "    local.get $prec\n";
+  out << "    call $print_fixed_digits\n";
+  out << "  )\n";
+
+  // $prec < 0 selects the shortest round-trip digits.
+  out << "  (func $print_f64_sci (param $val f64) (param $prec i32)\n";
+  out << "    (local $n i32)\n";
+  out << "    local.get $prec\n";
+  out << "    i32.const 0\n";
+  out << "    i32.lt_s\n";
+  out << "    if\n";
+  out << "      local.get $val\n";
+  out << "      call $print_f64_sign\n";
+  out << "      if\n";
+  out << "        return\n";
+  out << "      end\n";
+  out << "      local.get $val\n";
+  out << "      f64.abs\n";
+  out << "      call $f64_decimal\n";
+  out << "      local.tee $n\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 1\n";
+  out << "      i32.sub\n";
+  out << "      i32.const 0\n";
+  out << "      local.get $n\n";
+  out << "      i32.const 1\n";
+  out << "      i32.gt_s\n";
+  out << "      select\n";
+  out << "      call $print_sci_digits\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    call $print_f64_sign\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $val\n";
+  out << "    f64.abs\n";
+  out << "    local.get $prec\n";
+  out << "    i32.const 2\n";
+  out << "    i32.add\n";
+  out << "    i32.const 2147483647\n";
+  out << "    call $f64_exact\n";
+  out << "    local.get $prec\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    call $round_digits\n";
+  out << "    local.get $prec\n";
+  out << "    call $print_sci_digits\n";
+  out << "  )\n";
+}
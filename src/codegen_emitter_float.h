@@ -0,0 +1,27 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include "codegen_emitter_runtime.h"
+
+// Ryu multiplier tables, 16 bytes ([lo, hi] as i64) per entry:
+// 5^i and 2^k / 5^i, each normalised to 125 significant bits.
+std::string Pow5SplitTable();
+std::string Pow5InvSplitTable();
+
+// Float formatting on top of $write_byte / $print_i64_raw: shortest
+// round-trip digits for $print_f64_raw and $print_f64_sci without a
+// precision, the exact value correctly rounded for $print_f64_prec and
+// $print_f64_sci with one.
+void EmitFloatRuntime(std::ostream &out, const RuntimeLayout &layout,
+                      const CodegenOptions &options);
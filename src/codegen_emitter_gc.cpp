@@ -0,0 +1,780 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_gc.h"
+
+#include <cstdint>
+#include <ostream>
+
+void EmitGcRuntime(std::ostream &out, int64_t type_map_ptr) {
+  const int64_t kGcShadowStackBytes = 1 << 20;
+  const int64_t kGcMarkStackBytes = 256 << 10;
+  const int64_t kGcMinThreshold = 1 << 20;
+  // One i32 per 4KiB card of the 32-bit address space: the header of the
+  // block covering the card's first byte.
+  const int64_t kGcCardShift = 12;
+  const int64_t kGcCardTableBytes = (int64_t{1} << (32 - kGcCardShift)) * 4;
+  const int32_t kGcTypeMask = 0x7FFFFFFF;
+  const int32_t kGcMarkBit = INT32_MIN;
+  const int32_t kGcFreeType = kGcTypeMask;
+
+  out << "  (global $gc_on (mut i32) (i32.const 0))\n";
+  out << "  (global $gc_base (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_sp (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_ss_base (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_ss_end (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_mark_base (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_cards (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_mark_sp (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_mark_end (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_overflow (mut i32) (i32.const 0))\n";
+  out << "  (global $gc_free (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_allocated (mut i64) (i64.const 0))\n";
+  out << "  (global $gc_next (mut i64) (i64.const " << kGcMinThreshold << "))\n";
+  out << "  (func $gc_init\n";
+  out << "    i64.const " << kGcShadowStackBytes << "\n";
+  out << "    call $alloc\n";
+  out << "    global.set $gc_ss_base\n";
+  out << "    global.get $gc_ss_base\n";
+  out << "    global.set $gc_sp\n";
+  out << "    global.get $gc_ss_base\n";
+  out << "    i64.const " << kGcShadowStackBytes << "\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_ss_end\n";
+  out << "    i64.const " << kGcMarkStackBytes << "\n";
+  out << "    call $alloc\n";
+  out << "    global.set $gc_mark_base\n";
+  out << "    global.get $gc_mark_base\n";
+  out << "    global.set $gc_mark_sp\n";
+  out << "    global.get $gc_mark_base\n";
+  out << "    i64.const " << kGcMarkStackBytes << "\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_mark_end\n";
+  out << "    i64.const " << kGcCardTableBytes << "\n";
+  out << "    call $alloc\n";
+  out << "    global.set $gc_cards\n";
+  out << "    global.get $heap\n";
+  out << "    call $gc_ensure\n";
+  out << "    global.get $heap\n";
+  out << "    global.set $gc_base\n";
+  out << "    i32.const 1\n";
+  out << "    global.set $gc_on\n";
+  out << "  )\n";
+  out << "  (func $gc_push (param $ptr i64) (result i64)\n";
+  out << "    global.get $gc_sp\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.store\n";
+  out << "    global.get $gc_sp\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_sp\n";
+  out << "    global.get $gc_sp\n";
+  out << "    global.get $gc_ss_end\n";
+  out << "    i64.gt_u\n";
+  out << "    if\n";
+  out << "      unreachable\n";
+  out << "    end\n";
+  out << "    local.get $ptr\n";
+  out << "  )\n";
+  out << "  (func $gc_enter (param $slots i32) (result i64)\n";
+  out << "    (local $frame i64) (local $bytes i32)\n";
+  out << "    global.get $gc_sp\n";
+  out << "    local.set $frame\n";
+  out << "    local.get $slots\n";
+  out << "    i32.const 8\n";
+  out << "    i32.mul\n";
+  out << "    local.set $bytes\n";
+  out << "    local.get $frame\n";
+  out << "    local.get $bytes\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_sp\n";
+  out << "    global.get $gc_sp\n";
+  out << "    global.get $gc_ss_end\n";
+  out << "    i64.gt_u\n";
+  out << "    if\n";
+  out << "      unreachable\n";
+  out << "    end\n";
+  out << "    local.get $frame\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 0\n";
+  out << "    local.get $bytes\n";
+  out << "    memory.fill\n";
+  out << "    local.get $frame\n";
+  out << "  )\n";
+  out << "  (func $gc_ensure (param $end i64)\n";
+  out << "    (local $have i64)\n";
+  out << "    memory.size\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.const 16\n";
+  out << "    i64.shl\n";
+  out << "    local.set $have\n";
+  out << "    local.get $end\n";
+  out << "    local.get $have\n";
+  out << "    i64.gt_u\n";
+  out << "    if\n";
+  out << "      local.get $end\n";
+  out << "      local.get $have\n";
+  out << "      i64.sub\n";
+  out << "      i64.const 65535\n";
+  out << "      i64.add\n";
+  out << "      i64.const 16\n";
+  out << "      i64.shr_u\n";
+  out << "      i32.wrap_i64\n";
+  out << "      memory.grow\n";
+  out << "      i32.const -1\n";
+  out << "      i32.eq\n";
+  out << "      if\n";
+  out << "        unreachable\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  // Points every card starting inside [start, end) at the block header at
+  // start. Allocation, splitting and sweeping call it for each new block.
+  out << "  (func $gc_cover (param $start i64) (param $end i64)\n";
+  out << "    (local $card i64)\n";
+  out << "    local.get $start\n";
+  out << "    i64.const " << ((int64_t{1} << kGcCardShift) - 1) << "\n";
+  out << "    i64.add\n";
+  out << "    i64.const " << kGcCardShift << "\n";
+  out << "    i64.shr_u\n";
+  out << "    local.set $card\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $card\n";
+  out << "        i64.const " << kGcCardShift << "\n";
+  out << "        i64.shl\n";
+  out << "        local.get $end\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        global.get $gc_cards\n";
+  out << "        local.get $card\n";
+  out << "        i64.const 4\n";
+  out << "        i64.mul\n";
+  out << "        i64.add\n";
+  out << "        i32.wrap_i64\n";
+  out << "        local.get $start\n";
+  out << "        i64.store32\n";
+  out << "        local.get $card\n";
+  out << "        i64.const 1\n";
+  out << "        i64.add\n";
+  out << "        local.set $card\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  out << "  (func $gc_take_free (param $need i64) (result i64)\n";
+  out << "    (local $prev i64) (local $cur i64) (local $next i64) (local $size i64) (local $rest i64)\n";
+  out << "    global.get $gc_free\n";
+  out << "    local.set $cur\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $cur\n";
+  out << "        i64.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $cur\n";
+  out << "        i64.const 8\n";
+  out << "        i64.sub\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load32_u\n";
+  out << "        local.set $size\n";
+  out << "        local.get $cur\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load\n";
+  out << "        local.set $next\n";
+  out << "        local.get $size\n";
+  out << "        local.get $need\n";
+  out << "        i64.ge_u\n";
+  out << "        if\n";
+  out << "          local.get $size\n";
+  out << "          local.get $need\n";
+  out << "          i64.sub\n";
+  out << "          i64.const 16\n";
+  out << "          i64.ge_u\n";
+  out << "          if\n";
+  out << "            local.get $cur\n";
+  out << "            local.get $need\n";
+  out << "            i64.add\n";
+  out << "            i64.const 8\n";
+  out << "            i64.add\n";
+  out << "            local.set $rest\n";
+  out << "            local.get $rest\n";
+  out << "            i64.const 8\n";
+  out << "            i64.sub\n";
+  out << "            i32.wrap_i64\n";
+  out << "            local.get $size\n";
+  out << "            local.get $need\n";
+  out << "            i64.sub\n";
+  out << "            i64.const 8\n";
+  out << "            i64.sub\n";
+  out << "            i64.store32\n";
+  out << "            local.get $rest\n";
+  out << "            i64.const 4\n";
+  out << "            i64.sub\n";
+  out << "            i32.wrap_i64\n";
+  out << "            i32.const " << kGcFreeType << "\n";
+  out << "            i32.store\n";
+  out << "            local.get $rest\n";
+  out << "            i32.wrap_i64\n";
+  out << "            local.get $next\n";
+  out << "            i64.store\n";
+  out << "            local.get $rest\n";
+  out << "            i64.const 8\n";
+  out << "            i64.sub\n";
+  out << "            local.get $cur\n";
+  out << "            local.get $size\n";
+  out << "            i64.add\n";
+  out << "            call $gc_cover\n";
+  out << "            local.get $rest\n";
+  out << "            local.set $next\n";
+  out << "            local.get $cur\n";
+  out << "            i64.const 8\n";
+  out << "            i64.sub\n";
+  out << "            i32.wrap_i64\n";
+  out << "            local.get $need\n";
+  out << "            i64.store32\n";
+  out << "          end\n";
+  out << "          local.get $prev\n";
+  out << "          i64.eqz\n";
+  out << "          if\n";
+  out << "            local.get $next\n";
+  out << "            global.set $gc_free\n";
+  out << "          else\n";
+  out << "            local.get $prev\n";
+  out << "            i32.wrap_i64\n";
+  out << "            local.get $next\n";
+  out << "            i64.store\n";
+  out << "          end\n";
+  out << "          local.get $cur\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $cur\n";
+  out << "        local.set $prev\n";
+  out << "        local.get $next\n";
+  out << "        local.set $cur\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    i64.const 0\n";
+  out << "  )\n";
+  out << "  (func $gc_alloc (param $size i64) (param $type i32) (result i64)\n";
+  out << "    (local $need i64) (local $ptr i64)\n";
+  out << "    local.get $size\n";
+  out << "    i64.const 7\n";
+  out << "    i64.add\n";
+  out << "    i64.const -8\n";
+  out << "    i64.and\n";
+  out << "    local.set $need\n";
+  out << "    global.get $gc_on\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      global.get $heap\n";
+  out << "      local.get $need\n";
+  out << "      i64.add\n";
+  out << "      global.set $heap\n";
+  out << "      global.get $heap\n";
+  out << "      local.get $need\n";
+  out << "      i64.sub\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $need\n";
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      i64.const 8\n";
+  out << "      local.set $need\n";
+  out << "    end\n";
+  out << "    global.get $gc_allocated\n";
+  out << "    local.get $need\n";
+  out << "    i64.add\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_allocated\n";
+  out << "    global.get $gc_allocated\n";
+  out << "    global.get $gc_next\n";
+  out << "    i64.gt_u\n";
+  out << "    if\n";
+  out << "      call $gc_collect\n";
+  out << "    end\n";
+  out << "    local.get $need\n";
+  out << "    call $gc_take_free\n";
+  out << "    local.tee $ptr\n";
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      global.get $heap\n";
+  out << "      i64.const 8\n";
+  out << "      i64.add\n";
+  out << "      local.set $ptr\n";
+  out << "      local.get $ptr\n";
+  out << "      local.get $need\n";
+  out << "      i64.add\n";
+  out << "      global.set $heap\n";
+  out << "      global.get $heap\n";
+  out << "      call $gc_ensure\n";
+  out << "      local.get $ptr\n";
+  out << "      i64.const 8\n";
+  out << "      i64.sub\n";
+  out << "      i32.wrap_i64\n";
+  out << "      local.get $need\n";
+  out << "      i64.store32\n";
+  out << "      local.get $ptr\n";
+  out << "      i64.const 8\n";
+  out << "      i64.sub\n";
+  out << "      global.get $heap\n";
+  out << "      call $gc_cover\n";
+  out << "    end\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 4\n";
+  out << "    i64.sub\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $type\n";
+  out << "    i32.store\n";
+  out << "    local.get $ptr\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 0\n";
+  out << "    local.get $need\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.fill\n";
+  out << "    local.get $ptr\n";
+  out << "  )\n";
+  // A slice (length in the high bits, see $array_length) points into the
+  // middle of its array. The card of its address names a block header at
+  // most one card before it; walk from there to the block holding it.
+  out << "  (func $gc_mark_slice (param $addr i64)\n";
+  out << "    (local $hdr i64) (local $next i64)\n";
+  out << "    local.get $addr\n";
+  out << "    global.get $gc_base\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    i64.lt_u\n";
+  out << "    local.get $addr\n";
+  out << "    global.get $heap\n";
+  out << "    i64.ge_u\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    global.get $gc_cards\n";
+  out << "    local.get $addr\n";
+  out << "    i64.const 8\n";
+  out << "    i64.sub\n";
+  out << "    i64.const " << kGcCardShift << "\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.const 4\n";
+  out << "    i64.mul\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load32_u\n";
+  out << "    local.tee $hdr\n";
+  out << "    global.get $gc_base\n";
+  out << "    local.get $hdr\n";
+  out << "    global.get $gc_base\n";
+  out << "    i64.ge_u\n";
+  out << "    select\n";
+  out << "    local.set $hdr\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $hdr\n";
+  out << "        global.get $heap\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $hdr\n";
+  out << "        local.get $hdr\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load32_u\n";
+  out << "        i64.add\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        local.set $next\n";
+  out << "        local.get $addr\n";
+  out << "        local.get $next\n";
+  out << "        i64.lt_u\n";
+  out << "        if\n";
+  out << "          local.get $addr\n";
+  out << "          local.get $hdr\n";
+  out << "          i64.const 8\n";
+  out << "          i64.add\n";
+  out << "          i64.ge_u\n";
+  out << "          if\n";
+  out << "            local.get $hdr\n";
+  out << "            i64.const 8\n";
+  out << "            i64.add\n";
+  out << "            call $gc_mark\n";
+  out << "          end\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $next\n";
+  out << "        local.set $hdr\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  out << "  (func $gc_mark (param $ptr i64)\n";
+  out << "    (local $word i32)\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.eqz\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      local.get $ptr\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i64.extend_i32_u\n";
+  out << "      call $gc_mark_slice\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $ptr\n";
+  out << "    global.get $gc_base\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    i64.lt_u\n";
+  out << "    local.get $ptr\n";
+  out << "    global.get $heap\n";
+  out << "    i64.ge_u\n";
+  out << "    i32.or\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 7\n";
+  out << "    i64.and\n";
+  out << "    i64.const 0\n";
+  out << "    i64.ne\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 4\n";
+  out << "    i64.sub\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.load\n";
+  out << "    local.tee $word\n";
+  out << "    i32.const " << kGcMarkBit << "\n";
+  out << "    i32.and\n";
+  out << "    local.get $word\n";
+  out << "    i32.const " << kGcFreeType << "\n";
+  out << "    i32.eq\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 4\n";
+  out << "    i64.sub\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $word\n";
+  out << "    i32.const " << kGcMarkBit << "\n";
+  out << "    i32.or\n";
+  out << "    i32.store\n";
+  out << "    global.get $gc_mark_sp\n";
+  out << "    global.get $gc_mark_end\n";
+  out << "    i64.ge_u\n";
+  out << "    if\n";
+  out << "      i32.const 1\n";
+  out << "      global.set $gc_overflow\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    global.get $gc_mark_sp\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.store\n";
+  out << "    global.get $gc_mark_sp\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_mark_sp\n";
+  out << "  )\n";
+  out << "  (func $gc_scan (param $ptr i64)\n";
+  out << "    (local $type i32) (local $desc i32) (local $i i64) (local $count i64)\n";
+  out << "    local.get $ptr\n";
+  out << "    i64.const 4\n";
+  out << "    i64.sub\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.load\n";
+  out << "    i32.const " << kGcTypeMask << "\n";
+  out << "    i32.and\n";
+  out << "    local.set $type\n";
+  out << "    local.get $type\n";
+  out << "    i32.const " << kGcRefArrayType << "\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      local.get $ptr\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i64.load\n";
+  out << "      local.set $count\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $i\n";
+  out << "          local.get $count\n";
+  out << "          i64.ge_u\n";
+  out << "          br_if 1\n";
+  out << "          local.get $ptr\n";
+  out << "          i64.const 8\n";
+  out << "          i64.add\n";
+  out << "          local.get $i\n";
+  out << "          i64.const 8\n";
+  out << "          i64.mul\n";
+  out << "          i64.add\n";
+  out << "          i32.wrap_i64\n";
+  out << "          i64.load\n";
+  out << "          call $gc_mark\n";
+  out << "          local.get $i\n";
+  out << "          i64.const 1\n";
+  out << "          i64.add\n";
+  out << "          local.set $i\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $type\n";
+  out << "    i32.const " << kGcFirstStructType << "\n";
+  out << "    i32.lt_u\n";
+  out << "    local.get $type\n";
+  out << "    i32.const " << kGcFreeType << "\n";
+  out << "    i32.eq\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const " << type_map_ptr << "\n";
+  out << "    local.get $type\n";
+  out << "    i32.const 4\n";
+  out << "    i32.mul\n";
+  out << "    i32.add\n";
+  out << "    i32.load\n";
+  out << "    i32.const " << type_map_ptr << "\n";
+  out << "    i32.add\n";
+  out << "    local.tee $desc\n";
+  out << "    i64.load32_u\n";
+  out << "    local.set $count\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $i\n";
+  out << "        local.get $count\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $ptr\n";
+  out << "        local.get $desc\n";
+  out << "        i32.const 4\n";
+  out << "        i32.add\n";
+  out << "        local.get $i\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.const 4\n";
+  out << "        i32.mul\n";
+  out << "        i32.add\n";
+  out << "        i64.load32_u\n";
+  out << "        i64.add\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load\n";
+  out << "        call $gc_mark\n";
+  out << "        local.get $i\n";
+  out << "        i64.const 1\n";
+  out << "        i64.add\n";
+  out << "        local.set $i\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  out << "  (func $gc_drain\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        global.get $gc_mark_sp\n";
+  out << "        global.get $gc_mark_base\n";
+  out << "        i64.le_u\n";
+  out << "        br_if 1\n";
+  out << "        global.get $gc_mark_sp\n";
+  out << "        i64.const 8\n";
+  out << "        i64.sub\n";
+  out << "        global.set $gc_mark_sp\n";
+  out << "        global.get $gc_mark_sp\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load\n";
+  out << "        call $gc_scan\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  out << "  (func $gc_free_run (param $start i64) (param $end i64)\n";
+  out << "    local.get $start\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $end\n";
+  out << "    local.get $start\n";
+  out << "    i64.sub\n";
+  out << "    i64.const 8\n";
+  out << "    i64.sub\n";
+  out << "    i64.store32\n";
+  out << "    local.get $start\n";
+  out << "    i64.const 4\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const " << kGcFreeType << "\n";
+  out << "    i32.store\n";
+  out << "    local.get $start\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    global.get $gc_free\n";
+  out << "    i64.store\n";
+  out << "    local.get $start\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    global.set $gc_free\n";
+  out << "    local.get $start\n";
+  out << "    local.get $end\n";
+  out << "    call $gc_cover\n";
+  out << "  )\n";
+  out << "  (func $gc_sweep\n";
+  out << "    (local $hdr i64) (local $run i64) (local $word i32) (local $live i64) (local $next i64)\n";
+  out << "    i64.const 0\n";
+  out << "    global.set $gc_free\n";
+  out << "    global.get $gc_base\n";
+  out << "    local.set $hdr\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $hdr\n";
+  out << "        global.get $heap\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $hdr\n";
+  out << "        local.get $hdr\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load32_u\n";
+  out << "        i64.add\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        local.set $next\n";
+  out << "        local.get $hdr\n";
+  out << "        i64.const 4\n";
+  out << "        i64.add\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.load\n";
+  out << "        local.tee $word\n";
+  out << "        i32.const " << kGcMarkBit << "\n";
+  out << "        i32.and\n";
+  out << "        if\n";
+  out << "          local.get $hdr\n";
+  out << "          i64.const 4\n";
+  out << "          i64.add\n";
+  out << "          i32.wrap_i64\n";
+  out << "          local.get $word\n";
+  out << "          i32.const " << kGcTypeMask << "\n";
+  out << "          i32.and\n";
+  out << "          i32.store\n";
+  out << "          local.get $live\n";
+  out << "          local.get $next\n";
+  out << "          i64.add\n";
+  out << "          local.get $hdr\n";
+  out << "          i64.sub\n";
+  out << "          local.set $live\n";
+  out << "          local.get $run\n";
+  out << "          i64.eqz\n";
+  out << "          i32.eqz\n";
+  out << "          if\n";
+  out << "            local.get $run\n";
+  out << "            local.get $hdr\n";
+  out << "            call $gc_free_run\n";
+  out << "            i64.const 0\n";
+  out << "            local.set $run\n";
+  out << "          end\n";
+  out << "        else\n";
+  out << "          local.get $run\n";
+  out << "          i64.eqz\n";
+  out << "          if\n";
+  out << "            local.get $hdr\n";
+  out << "            local.set $run\n";
+  out << "          end\n";
+  out << "        end\n";
+  out << "        local.get $next\n";
+  out << "        local.set $hdr\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $run\n";
+  out << "    i64.eqz\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      local.get $run\n";
+  out << "      global.set $heap\n";
+  out << "    end\n";
+  out << "    i64.const 0\n";
+  out << "    global.set $gc_allocated\n";
+  out << "    local.get $live\n";
+  out << "    i64.const " << kGcMinThreshold << "\n";
+  out << "    local.get $live\n";
+  out << "    i64.const " << kGcMinThreshold << "\n";
+  out << "    i64.gt_u\n";
+  out << "    select\n";
+  out << "    global.set $gc_next\n";
+  out << "  )\n";
+  out << "  (func $gc_collect\n";
+  out << "    (local $slot i64) (local $hdr i64)\n";
+  out << "    global.get $gc_ss_base\n";
+  out << "    local.set $slot\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $slot\n";
+  out << "        global.get $gc_sp\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $slot\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i64.load\n";
+  out << "        call $gc_mark\n";
+  out << "        local.get $slot\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        local.set $slot\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    call $gc_drain\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        global.get $gc_overflow\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        i32.const 0\n";
+  out << "        global.set $gc_overflow\n";
+  out << "        global.get $gc_base\n";
+  out << "        local.set $hdr\n";
+  out << "        block\n";
+  out << "          loop\n";
+  out << "            local.get $hdr\n";
+  out << "            global.get $heap\n";
+  out << "            i64.ge_u\n";
+  out << "            br_if 1\n";
+  out << "            local.get $hdr\n";
+  out << "            i64.const 4\n";
+  out << "            i64.add\n";
+  out << "            i32.wrap_i64\n";
+  out << "            i32.load\n";
+  out << "            i32.const " << kGcMarkBit << "\n";
+  out << "            i32.and\n";
+  out << "            if\n";
+  out << "              local.get $hdr\n";
+  out << "              i64.const 8\n";
+  out << "              i64.add\n";
+  out << "              call $gc_scan\n";
+  out << "              call $gc_drain\n";
+  out << "            end\n";
+  out << "            local.get $hdr\n";
+  out << "            local.get $hdr\n";
+  out << "            i32.wrap_i64\n";
+  out << "            i64.load32_u\n";
+  out << "            i64.add\n";
+  out << "            i64.const 8\n";
+  out << "            i64.add\n";
+  out << "            local.set $hdr\n";
+  out << "            br 0\n";
+  out << "          end\n";
+  out << "        end\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    call $gc_sweep\n";
+  out << "  )\n";
+}
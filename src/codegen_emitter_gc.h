@@ -0,0 +1,26 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Object header type ids written by $gc_alloc. Struct ids start at
+// kGcFirstStructType and index the type map emitted by the code generator.
+const int32_t kGcRawType = 0;
+const int32_t kGcRefArrayType = 1;
+const int32_t kGcFirstStructType = 2;
+
+// Emits the mark-sweep collector used with --gc. Every collected object has an
+// 8-byte header in front of its payload ([size:i32][type|mark:i32]); roots are
+// the shadow stack slots between $gc_ss_base and $gc_sp. The type map at
+// type_map_ptr holds one i32 descriptor offset per type id; each descriptor is
+// [count:i32][field offset:i32]*count of the pointer fields of a struct.
+void EmitGcRuntime(std::ostream &out, int64_t type_map_ptr);
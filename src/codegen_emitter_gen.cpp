@@ -0,0 +1,34 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_gen.h"
+
+void EmitGeneratorDispatch(std::ostream &out, int generators) {
+  out << "  (func $gen_resume (param $frame i32) (result i32)\n";
+  if (generators == 0) {
+    out << "    unreachable\n";
+    out << "  )\n";
+    return;
+  }
+  for (int k = 0; k < generators; ++k)
+    out << "    block\n";
+  out << "    local.get $frame\n";
+  out << "    i32.load offset=" << kGenId << "\n";
+  out << "    br_table";
+  for (int k = 0; k < generators; ++k)
+    out << " " << k;
+  out << "\n";
+  for (int k = 0; k < generators; ++k) {
+    out << "    end\n";
+    out << "    local.get $frame\n";
+    out << "    call $gen" << k << "\n";
+    out << "    return\n";
+  }
+  out << "  )\n";
+}
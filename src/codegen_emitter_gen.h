@@ -0,0 +1,28 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// A gen[T] value is a frame allocated by the call of the generator function:
+//   [resume point:i32][generator id:i32][last value][params and locals]
+// The resume point is 0 before the first next(), k while suspended at the
+// k-th yield and kGenDone once the body has returned. Params and locals
+// get one 8-byte cell each (16 for int2/real2), in declaration order.
+constexpr int64_t kGenState = 0;
+constexpr int64_t kGenId = 4;
+constexpr int64_t kGenValue = 8;
+constexpr int64_t kGenSlots = 16;
+constexpr int32_t kGenDone = -1;
+
+// $gen_resume(frame) runs the frame's generator function $gen<id> up to its
+// next yield: 1 when it yielded a value, 0 once it has finished.
+void EmitGeneratorDispatch(std::ostream &out, int generators);
@@ -0,0 +1,796 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_map.h"
+
+#include <string>
+
+#include "codegen_emitter_gc.h"
+
+namespace {
+
+const int kCtrlEmpty = 128;   // 0x80
+const int kCtrlDeleted = 254; // 0xFE; full slots hold 0..127
+const char *kLsbs = "72340172838076673";     // 0x0101010101010101
+const char *kMsbs = "-9187201950435737472";  // 0x8080808080808080
+const char *kMix1 = "-49064778989728563";    // 0xff51afd7ed558ccd
+const char *kMix2 = "-4265267296055464877";  // 0xc4ceb9fe1a85ec53
+
+// Header fields, see codegen_emitter_map.h.
+const int kCtrl = 8;
+const int kKeys = 16;
+const int kVals = 24;
+const int kMask = 40;
+const int kGrowth = 48;
+const int kFlags = 56;
+const int kHeaderSize = 64;
+
+struct KeyKind {
+  const char *name; // suffix of the runtime functions
+  const char *hash; // (i64) -> i64
+  const char *eq;   // two keys on the stack -> i32
+};
+
+const KeyKind kKeyKinds[] = {
+    {"int", "call $map_hash_int", "i64.eq"},
+    {"string", "call $string_hash", "call $string_equals\ni32.wrap_i64"},
+};
+
+// One instruction per line of `code`.
+void Code(std::ostream &out, const char *pad, const std::string &code) {
+  size_t start = 0;
+  while (start <= code.size()) {
+    size_t end = code.find('\n', start);
+    if (end == std::string::npos)
+      end = code.size();
+    out << pad << code.substr(start, end - start) << "\n";
+    start = end + 1;
+  }
+}
+
+void Field(std::ostream &out, const char *pad, int offset) {
+  out << pad << "local.get $m\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i64.load offset=" << offset << "\n";
+}
+
+// Byte masks of the 8 control bytes in $w (bit 7 of each byte): bytes with
+// the high bit set and bit `shift` clear. Shift 6 finds empty slots, shift
+// 7 empty or deleted ones.
+void Unfilled(std::ostream &out, const char *pad, int shift) {
+  out << pad << "local.get $w\n";
+  out << pad << "local.get $w\n";
+  out << pad << "i64.const " << shift << "\n";
+  out << pad << "i64.shl\n";
+  out << pad << "i64.const -1\n";
+  out << pad << "i64.xor\n";
+  out << pad << "i64.and\n";
+  out << pad << "i64.const " << kMsbs << "\n";
+  out << pad << "i64.and\n";
+}
+
+// Address of cell $slot of the [cap][cells] array at `base`, or at the
+// i32 already on the stack.
+void Cell(std::ostream &out, const char *pad, const std::string &base) {
+  if (!base.empty())
+    out << pad << base << "\n";
+  out << pad << "local.get $slot\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i32.const 3\n";
+  out << pad << "i32.shl\n";
+  out << pad << "i32.add\n";
+}
+
+void EmitTableRuntime(std::ostream &out, const CodegenOptions &options) {
+  // Murmur3's finalizer; int keys are often dense, so every bit must mix
+  // into both the probe position and the 7 control bits.
+  out << "  (func $map_hash_int (param $h i64) (result i64)\n";
+  for (const char *mix : {kMix1, kMix2, ""}) {
+    out << "    local.get $h\n";
+    out << "    local.get $h\n";
+    out << "    i64.const 33\n";
+    out << "    i64.shr_u\n";
+    out << "    i64.xor\n";
+    if (*mix) {
+      out << "    i64.const " << mix << "\n";
+      out << "    i64.mul\n";
+    }
+    out << "    local.set $h\n";
+  }
+  out << "    local.get $h\n";
+  out << "  )\n";
+
+  // A fresh empty table of $cap slots (a power of two, at least 8).
+  auto cells = [&out, &options](const char *local, int32_t flag) {
+    out << "    local.get $cap\n";
+    out << "    i64.const 3\n";
+    out << "    i64.shl\n";
+    out << "    i64.const 8\n";
+    out << "    i64.add\n";
+    if (options.gc) {
+      out << "    i32.const " << kGcRefArrayType << "\n";
+      out << "    i32.const " << kGcRawType << "\n";
+      out << "    local.get $flags\n";
+      out << "    i32.const " << flag << "\n";
+      out << "    i32.and\n";
+      out << "    select\n";
+      out << "    call $gc_alloc\n";
+      out << "    call $gc_push\n";
+    } else {
+      out << "    call $alloc\n";
+    }
+    out << "    local.tee " << local << "\n";
+    out << "    i32.wrap_i64\n";
+    out << "    local.get $cap\n";
+    out << "    i64.store\n";
+  };
+  out << "  (func $map_table (param $m i64) (param $cap i64)\n";
+  out << "    (local $ctrl i64) (local $keys i64) (local $vals i64) (local "
+         "$flags i32)\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.load offset=" << kFlags << "\n";
+  out << "    local.set $flags\n";
+  out << "    local.get $cap\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    call $alloc\n";
+  if (options.gc)
+    out << "    call $gc_push\n";
+  out << "    local.tee $ctrl\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const " << kCtrlEmpty << "\n";
+  out << "    local.get $cap\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    memory.fill\n";
+  cells("$keys", kMapRefKeys);
+  cells("$vals", kMapRefValues);
+  const std::pair<const char *, int> stores[] = {
+      {"$ctrl", kCtrl}, {"$keys", kKeys}, {"$vals", kVals}};
+  for (const auto &store : stores) {
+    out << "    local.get $m\n";
+    out << "    i32.wrap_i64\n";
+    out << "    local.get " << store.first << "\n";
+    out << "    i64.store offset=" << store.second << "\n";
+  }
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 0\n";
+  out << "    i64.store offset=" << kMapLenOffset << "\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $cap\n";
+  out << "    i64.const 1\n";
+  out << "    i64.sub\n";
+  out << "    i64.store offset=" << kMask << "\n";
+  // Load factor 7/8: every probe sequence meets an empty slot.
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $cap\n";
+  out << "    local.get $cap\n";
+  out << "    i64.const 3\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.sub\n";
+  out << "    i64.store offset=" << kGrowth << "\n";
+  out << "  )\n";
+
+  out << "  (func $map_new (param $flags i32) (result i64)\n";
+  out << "    (local $m i64)\n";
+  out << "    i64.const " << kHeaderSize << "\n";
+  if (options.gc) {
+    out << "    i32.const " << kGcRefArrayType << "\n";
+    out << "    call $gc_alloc\n";
+    out << "    call $gc_push\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "    local.tee $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 3\n";
+  out << "    i64.store\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $flags\n";
+  out << "    i32.store offset=" << kFlags << "\n";
+  out << "    local.get $m\n";
+  out << "    i64.const 8\n";
+  out << "    call $map_table\n";
+  out << "    local.get $m\n";
+  out << "  )\n";
+
+  // Control byte of $slot, and its mirror past the end for slots 0..7.
+  out << "  (func $map_set_ctrl (param $m i64) (param $slot i64) (param $c "
+         "i32)\n";
+  out << "    (local $ctrl i32)\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.tee $ctrl\n";
+  out << "    local.get $slot\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.add\n";
+  out << "    local.get $c\n";
+  out << "    i32.store8\n";
+  out << "    local.get $slot\n";
+  out << "    i64.const 8\n";
+  out << "    i64.lt_u\n";
+  out << "    if\n";
+  out << "      local.get $ctrl\n";
+  Field(out, "      ", kMask);
+  out << "      local.get $slot\n";
+  out << "      i64.add\n";
+  out << "      i64.const 1\n";
+  out << "      i64.add\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.add\n";
+  out << "      local.get $c\n";
+  out << "      i32.store8\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Takes the first empty or deleted slot on the probe sequence of $h and
+  // returns it. Only an empty slot uses up growth.
+  out << "  (func $map_claim (param $m i64) (param $h i64) (result i64)\n";
+  out << "    (local $ctrl i32) (local $mask i64) (local $pos i64) (local "
+         "$step i64)\n";
+  out << "    (local $w i64) (local $bits i64) (local $slot i64)\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $ctrl\n";
+  Field(out, "    ", kMask);
+  out << "    local.set $mask\n";
+  out << "    local.get $h\n";
+  out << "    i64.const 7\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $mask\n";
+  out << "    i64.and\n";
+  out << "    local.set $pos\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $ctrl\n";
+  out << "        local.get $pos\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.add\n";
+  out << "        i64.load\n";
+  out << "        local.set $w\n";
+  Unfilled(out, "        ", 7);
+  out << "        local.tee $bits\n";
+  out << "        i64.const 0\n";
+  out << "        i64.ne\n";
+  out << "        br_if 1\n";
+  out << "        local.get $step\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        local.tee $step\n";
+  out << "        local.get $pos\n";
+  out << "        i64.add\n";
+  out << "        local.get $mask\n";
+  out << "        i64.and\n";
+  out << "        local.set $pos\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $pos\n";
+  out << "    local.get $bits\n";
+  out << "    i64.ctz\n";
+  out << "    i64.const 3\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.add\n";
+  out << "    local.get $mask\n";
+  out << "    i64.and\n";
+  out << "    local.set $slot\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  Field(out, "    ", kGrowth);
+  out << "    local.get $ctrl\n";
+  out << "    local.get $slot\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.add\n";
+  out << "    i32.load8_u\n";
+  out << "    i32.const " << kCtrlEmpty << "\n";
+  out << "    i32.eq\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.sub\n";
+  out << "    i64.store offset=" << kGrowth << "\n";
+  out << "    local.get $m\n";
+  out << "    local.get $slot\n";
+  out << "    local.get $h\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 127\n";
+  out << "    i32.and\n";
+  out << "    call $map_set_ctrl\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  Field(out, "    ", kMapLenOffset);
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    i64.store offset=" << kMapLenOffset << "\n";
+  out << "    local.get $slot\n";
+  out << "  )\n";
+
+  // Keys ($off 16) or values ($off 24) of the full slots in table order, as
+  // an array of $size-byte elements (8, or 1 for bool).
+  out << "  (func $map_collect (param $m i64) (param $off i32) (param $size "
+         "i32) (param $type i32) (result i64)\n";
+  out << "    (local $arr i64) (local $ctrl i32) (local $cells i32) (local "
+         "$at i32)\n";
+  out << "    (local $cap i64) (local $slot i64)\n";
+  Field(out, "    ", kMapLenOffset);
+  out << "    local.get $size\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.mul\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  if (options.gc) {
+    out << "    local.get $type\n";
+    out << "    call $gc_alloc\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "    local.tee $arr\n";
+  out << "    i32.wrap_i64\n";
+  Field(out, "    ", kMapLenOffset);
+  out << "    i64.store\n";
+  out << "    local.get $arr\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.set $at\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $ctrl\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $off\n";
+  out << "    i32.add\n";
+  out << "    i64.load\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.set $cells\n";
+  Field(out, "    ", kMask);
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    local.set $cap\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $slot\n";
+  out << "        local.get $cap\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $ctrl\n";
+  out << "        local.get $slot\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.add\n";
+  out << "        i32.load8_u\n";
+  out << "        i32.const " << kCtrlEmpty << "\n";
+  out << "        i32.lt_u\n";
+  out << "        if\n";
+  auto copy = [&out](const char *store) {
+    out << "            local.get $at\n";
+    Cell(out, "            ", "local.get $cells");
+    out << "            i64.load\n";
+    out << "            " << store << "\n";
+  };
+  out << "          local.get $size\n";
+  out << "          i32.const 1\n";
+  out << "          i32.eq\n";
+  out << "          if\n";
+  copy("i64.store8");
+  out << "          else\n";
+  copy("i64.store");
+  out << "          end\n";
+  out << "          local.get $at\n";
+  out << "          local.get $size\n";
+  out << "          i32.add\n";
+  out << "          local.set $at\n";
+  out << "        end\n";
+  out << "        local.get $slot\n";
+  out << "        i64.const 1\n";
+  out << "        i64.add\n";
+  out << "        local.set $slot\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $arr\n";
+  out << "  )\n";
+}
+
+void EmitKeyRuntime(std::ostream &out, const KeyKind &key) {
+  std::string suffix = key.name;
+
+  // Address of the value cell of $k, or 0. Each group load compares 8
+  // control bytes against the key's 7 hash bits at once; a match is only a
+  // candidate (the bit trick can flag a byte above a true match) and is
+  // confirmed against the key. A group with an empty slot ends the probe.
+  out << "  (func $map_find_" << suffix
+      << " (param $m i64) (param $k i64) (param $h i64) (result i32)\n";
+  out << "    (local $ctrl i32) (local $keys i32) (local $mask i64) (local "
+         "$pos i64)\n";
+  out << "    (local $step i64) (local $w i64) (local $x i64) (local $bits "
+         "i64)\n";
+  out << "    (local $slot i64) (local $splat i64)\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $ctrl\n";
+  Field(out, "    ", kKeys);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $keys\n";
+  Field(out, "    ", kMask);
+  out << "    local.set $mask\n";
+  out << "    local.get $h\n";
+  out << "    i64.const 127\n";
+  out << "    i64.and\n";
+  out << "    i64.const " << kLsbs << "\n";
+  out << "    i64.mul\n";
+  out << "    local.set $splat\n";
+  out << "    local.get $h\n";
+  out << "    i64.const 7\n";
+  out << "    i64.shr_u\n";
+  out << "    local.get $mask\n";
+  out << "    i64.and\n";
+  out << "    local.set $pos\n";
+  out << "    loop\n";
+  out << "      local.get $ctrl\n";
+  out << "      local.get $pos\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.add\n";
+  out << "      i64.load\n";
+  out << "      local.tee $w\n";
+  out << "      local.get $splat\n";
+  out << "      i64.xor\n";
+  out << "      local.tee $x\n";
+  out << "      i64.const " << kLsbs << "\n";
+  out << "      i64.sub\n";
+  out << "      local.get $x\n";
+  out << "      i64.const -1\n";
+  out << "      i64.xor\n";
+  out << "      i64.and\n";
+  out << "      i64.const " << kMsbs << "\n";
+  out << "      i64.and\n";
+  out << "      local.set $bits\n";
+  out << "      block\n";
+  out << "        loop\n";
+  out << "          local.get $bits\n";
+  out << "          i64.eqz\n";
+  out << "          br_if 1\n";
+  out << "          local.get $pos\n";
+  out << "          local.get $bits\n";
+  out << "          i64.ctz\n";
+  out << "          i64.const 3\n";
+  out << "          i64.shr_u\n";
+  out << "          i64.add\n";
+  out << "          local.get $mask\n";
+  out << "          i64.and\n";
+  out << "          local.set $slot\n";
+  Cell(out, "          ", "local.get $keys");
+  out << "          i64.load offset=8\n";
+  out << "          local.get $k\n";
+  Code(out, "          ", key.eq);
+  out << "          if\n";
+  Field(out, "            ", kVals);
+  out << "            i32.wrap_i64\n";
+  out << "            i32.const 8\n";
+  out << "            i32.add\n";
+  Cell(out, "            ", "");
+  out << "            return\n";
+  out << "          end\n";
+  out << "          local.get $bits\n";
+  out << "          local.get $bits\n";
+  out << "          i64.const 1\n";
+  out << "          i64.sub\n";
+  out << "          i64.and\n";
+  out << "          local.set $bits\n";
+  out << "          br 0\n";
+  out << "        end\n";
+  out << "      end\n";
+  Unfilled(out, "      ", 6);
+  out << "      i64.eqz\n";
+  out << "      i32.eqz\n";
+  out << "      if\n";
+  out << "        i32.const 0\n";
+  out << "        return\n";
+  out << "      end\n";
+  out << "      local.get $step\n";
+  out << "      i64.const 8\n";
+  out << "      i64.add\n";
+  out << "      local.tee $step\n";
+  out << "      local.get $pos\n";
+  out << "      i64.add\n";
+  out << "      local.get $mask\n";
+  out << "      i64.and\n";
+  out << "      local.set $pos\n";
+  out << "      br 0\n";
+  out << "    end\n";
+  out << "    i32.const 0\n";
+  out << "  )\n";
+
+  // Moves every entry into a new table: twice the size, or the same size
+  // when deleted slots rather than live entries used up the growth.
+  out << "  (func $map_rehash_" << suffix << " (param $m i64)\n";
+  out << "    (local $ctrl i32) (local $keys i32) (local $vals i32) (local "
+         "$cap i64)\n";
+  out << "    (local $i i64) (local $k i64) (local $slot i64)\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $ctrl\n";
+  Field(out, "    ", kKeys);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $keys\n";
+  Field(out, "    ", kVals);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $vals\n";
+  Field(out, "    ", kMask);
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    local.set $cap\n";
+  out << "    local.get $m\n";
+  out << "    local.get $cap\n";
+  out << "    i64.const 1\n";
+  out << "    i64.shl\n";
+  out << "    local.get $cap\n";
+  Field(out, "    ", kMapLenOffset);
+  out << "    i64.const 16\n";
+  out << "    i64.mul\n";
+  out << "    local.get $cap\n";
+  out << "    i64.const 7\n";
+  out << "    i64.mul\n";
+  out << "    i64.ge_u\n";
+  out << "    select\n";
+  out << "    call $map_table\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $i\n";
+  out << "        local.get $cap\n";
+  out << "        i64.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $ctrl\n";
+  out << "        local.get $i\n";
+  out << "        i32.wrap_i64\n";
+  out << "        i32.add\n";
+  out << "        i32.load8_u\n";
+  out << "        i32.const " << kCtrlEmpty << "\n";
+  out << "        i32.lt_u\n";
+  out << "        if\n";
+  out << "          local.get $keys\n";
+  out << "          local.get $i\n";
+  out << "          i32.wrap_i64\n";
+  out << "          i32.const 3\n";
+  out << "          i32.shl\n";
+  out << "          i32.add\n";
+  out << "          i64.load offset=8\n";
+  out << "          local.set $k\n";
+  out << "          local.get $m\n";
+  out << "          local.get $k\n";
+  Code(out, "          ", key.hash);
+  out << "          call $map_claim\n";
+  out << "          local.set $slot\n";
+  Field(out, "          ", kKeys);
+  out << "          i32.wrap_i64\n";
+  Cell(out, "          ", "");
+  out << "          local.get $k\n";
+  out << "          i64.store offset=8\n";
+  Field(out, "          ", kVals);
+  out << "          i32.wrap_i64\n";
+  Cell(out, "          ", "");
+  out << "          local.get $vals\n";
+  out << "          local.get $i\n";
+  out << "          i32.wrap_i64\n";
+  out << "          i32.const 3\n";
+  out << "          i32.shl\n";
+  out << "          i32.add\n";
+  out << "          i64.load offset=8\n";
+  out << "          i64.store offset=8\n";
+  out << "        end\n";
+  out << "        local.get $i\n";
+  out << "        i64.const 1\n";
+  out << "        i64.add\n";
+  out << "        local.set $i\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Value cell of $k, inserting the key (value 0) when it is new.
+  out << "  (func $map_slot_" << suffix
+      << " (param $m i64) (param $k i64) (result i32)\n";
+  out << "    (local $h i64) (local $at i32) (local $slot i64)\n";
+  out << "    local.get $m\n";
+  out << "    local.get $k\n";
+  out << "    local.get $k\n";
+  Code(out, "    ", key.hash);
+  out << "    local.tee $h\n";
+  out << "    call $map_find_" << suffix << "\n";
+  out << "    local.tee $at\n";
+  out << "    if\n";
+  out << "      local.get $at\n";
+  out << "      return\n";
+  out << "    end\n";
+  Field(out, "    ", kGrowth);
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      local.get $m\n";
+  out << "      call $map_rehash_" << suffix << "\n";
+  out << "    end\n";
+  out << "    local.get $m\n";
+  out << "    local.get $h\n";
+  out << "    call $map_claim\n";
+  out << "    local.set $slot\n";
+  Field(out, "    ", kKeys);
+  out << "    i32.wrap_i64\n";
+  Cell(out, "    ", "");
+  out << "    local.get $k\n";
+  out << "    i64.store offset=8\n";
+  Field(out, "    ", kVals);
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  Cell(out, "    ", "");
+  out << "  )\n";
+
+  // A deleted slot goes back to empty when no group of 8 around it was ever
+  // full: no probe sequence can have passed over it.
+  out << "  (func $map_remove_" << suffix
+      << " (param $m i64) (param $k i64) (result i64)\n";
+  out << "    (local $at i32) (local $slot i64) (local $ctrl i32) (local $w "
+         "i64) (local $c i32)\n";
+  out << "    local.get $m\n";
+  out << "    local.get $k\n";
+  out << "    local.get $k\n";
+  Code(out, "    ", key.hash);
+  out << "    call $map_find_" << suffix << "\n";
+  out << "    local.tee $at\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      i64.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $at\n";
+  Field(out, "    ", kVals);
+  out << "    i32.wrap_i64\n";
+  out << "    i32.sub\n";
+  out << "    i32.const 8\n";
+  out << "    i32.sub\n";
+  out << "    i32.const 3\n";
+  out << "    i32.shr_u\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    local.set $slot\n";
+  Field(out, "    ", kCtrl);
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $ctrl\n";
+  out << "    i32.const " << kCtrlDeleted << "\n";
+  out << "    local.set $c\n";
+  out << "    local.get $ctrl\n";
+  out << "    local.get $slot\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.add\n";
+  out << "    i64.load\n";
+  out << "    local.set $w\n";
+  Unfilled(out, "    ", 6);
+  out << "    i64.ctz\n";
+  out << "    local.get $ctrl\n";
+  out << "    local.get $slot\n";
+  out << "    i64.const 8\n";
+  out << "    i64.sub\n";
+  Field(out, "    ", kMask);
+  out << "    i64.and\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.add\n";
+  out << "    i64.load\n";
+  out << "    local.set $w\n";
+  Unfilled(out, "    ", 6);
+  out << "    i64.clz\n";
+  out << "    i64.const -8\n";
+  out << "    i64.and\n";
+  out << "    local.set $w\n";
+  out << "    i64.const -8\n";
+  out << "    i64.and\n";
+  out << "    local.get $w\n";
+  out << "    i64.add\n";
+  out << "    i64.const 64\n";
+  out << "    i64.lt_u\n";
+  out << "    if\n";
+  out << "      i32.const " << kCtrlEmpty << "\n";
+  out << "      local.set $c\n";
+  out << "      local.get $m\n";
+  out << "      i32.wrap_i64\n";
+  Field(out, "      ", kGrowth);
+  out << "      i64.const 1\n";
+  out << "      i64.add\n";
+  out << "      i64.store offset=" << kGrowth << "\n";
+  out << "    end\n";
+  out << "    local.get $m\n";
+  out << "    local.get $slot\n";
+  out << "    local.get $c\n";
+  out << "    call $map_set_ctrl\n";
+  // Cleared so --gc does not keep the old key and value alive.
+  Field(out, "    ", kKeys);
+  out << "    i32.wrap_i64\n";
+  Cell(out, "    ", "");
+  out << "    i64.const 0\n";
+  out << "    i64.store offset=8\n";
+  out << "    local.get $at\n";
+  out << "    i64.const 0\n";
+  out << "    i64.store\n";
+  out << "    local.get $m\n";
+  out << "    i32.wrap_i64\n";
+  Field(out, "    ", kMapLenOffset);
+  out << "    i64.const 1\n";
+  out << "    i64.sub\n";
+  out << "    i64.store offset=" << kMapLenOffset << "\n";
+  out << "    i64.const 1\n";
+  out << "  )\n";
+
+  out << "  (func $map_contains_" << suffix
+      << " (param $m i64) (param $k i64) (result i64)\n";
+  out << "    local.get $m\n";
+  out << "    local.get $k\n";
+  out << "    local.get $k\n";
+  Code(out, "    ", key.hash);
+  out << "    call $map_find_" << suffix << "\n";
+  out << "    i32.const 0\n";
+  out << "    i32.ne\n";
+  out << "    i64.extend_i32_u\n";
+  out << "  )\n";
+
+  for (const char *type : {"i64", "f64"}) {
+    std::string name = suffix + "_" + type;
+    out << "  (func $map_put_" << name << " (param $m i64) (param $k i64) "
+        << "(param $v " << type << ")\n";
+    out << "    local.get $m\n";
+    out << "    local.get $k\n";
+    out << "    call $map_slot_" << suffix << "\n";
+    out << "    local.get $v\n";
+    out << "    " << type << ".store\n";
+    out << "  )\n";
+    // A missing key flushes stdout and traps, like a failed bounds check.
+    out << "  (func $map_get_" << name << " (param $m i64) (param $k i64) "
+        << "(result " << type << ")\n";
+    out << "    (local $at i32)\n";
+    out << "    local.get $m\n";
+    out << "    local.get $k\n";
+    out << "    local.get $k\n";
+    Code(out, "    ", key.hash);
+    out << "    call $map_find_" << suffix << "\n";
+    out << "    local.tee $at\n";
+    out << "    i32.eqz\n";
+    out << "    if\n";
+    out << "      call $flush\n";
+    out << "      unreachable\n";
+    out << "    end\n";
+    out << "    local.get $at\n";
+    out << "    " << type << ".load\n";
+    out << "  )\n";
+    out << "  (func $map_get_or_" << name << " (param $m i64) (param $k i64) "
+        << "(param $d " << type << ") (result " << type << ")\n";
+    out << "    (local $at i32)\n";
+    out << "    local.get $m\n";
+    out << "    local.get $k\n";
+    out << "    local.get $k\n";
+    Code(out, "    ", key.hash);
+    out << "    call $map_find_" << suffix << "\n";
+    out << "    local.tee $at\n";
+    out << "    if (result " << type << ")\n";
+    out << "      local.get $at\n";
+    out << "      " << type << ".load\n";
+    out << "    else\n";
+    out << "      local.get $d\n";
+    out << "    end\n";
+    out << "  )\n";
+  }
+}
+
+} // namespace
+
+void EmitMapRuntime(std::ostream &out, const CodegenOptions &options) {
+  EmitTableRuntime(out, options);
+  for (const auto &key : kKeyKinds)
+    EmitKeyRuntime(out, key);
+}
@@ -0,0 +1,32 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+#include "codegen.h"
+
+// map[K, V] is an open-addressing table in linear memory, probed the
+// SwissTable way: one control byte per slot (empty, deleted, or the low 7
+// hash bits of its key), matched a group of 8 slots per i64 load. The map is
+// a pointer array of three elements so --gc scans the table blocks:
+//   [3][ctrl][keys][vals][len][mask][growth_left][flags]
+// ctrl holds capacity + 8 bytes, the last 8 mirroring the first so a group
+// load never wraps; keys and vals are [capacity][8-byte cells] arrays.
+constexpr int64_t kMapLenOffset = 32;
+// flags bits: keys / values are pointers, so their arrays are scanned.
+constexpr int32_t kMapRefKeys = 1;
+constexpr int32_t kMapRefValues = 2;
+
+// $map_new, and per key kind (int, string) $map_{find,slot,contains,remove}_<K>
+// plus $map_{put,get,get_or}_<K>_<i64|f64>: the value travels unboxed in its
+// own Wasm type. $map_collect copies the keys or values out in table order.
+void EmitMapRuntime(std::ostream &out, const CodegenOptions &options);
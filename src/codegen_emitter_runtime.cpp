@@ -14,13 +14,351 @@
 #include <string>
 #include <unordered_map>
 
+#include "codegen_emitter_float.h"
+#include "codegen_emitter_gc.h"
+#include "codegen_emitter_map.h"
+#include "codegen_emitter_sort.h"
+#include "codegen_emitter_string.h"
+#include "codegen_emitter_thread.h"
+#include "codegen_emitter_vec.h"
+
+std::string ScratchAddress(int64_t addr, const CodegenOptions &options) {
+  if (!options.threads)
+    return "    i32.const " + std::to_string(addr) + "\n";
+  return "    global.get $tls\n    i32.const " + std::to_string(addr) +
+         "\n    i32.add\n";
+}
+
+std::string DigitPairTable() {
+  std::string table;
+  for (int i = 0; i < 100; ++i) {
+    table.push_back(static_cast<char>('0' + i / 10));
+    table.push_back(static_cast<char>('0' + i % 10));
+  }
+  return table;
+}
+
+std::string Pow10Table() {
+  std::string table;
+  uint64_t value = 1;
+  for (int i = 0; i < 20; ++i) {
+    for (int b = 0; b < 8; ++b)
+      table.push_back(static_cast<char>((value >> (b * 8)) & 0xFF));
+    value *= 10;
+  }
+  return table;
+}
+
+// copy/fill/equals/resize helpers for linear-memory arrays ([len:i64]
+// [payload] with 8-, 4- or 1-byte elements). fill stores one element and
+// then doubles the filled prefix with memory.copy, so every builtin runs at
+// memcpy speed.
+static void EmitArrayRuntime(std::ostream &out, const CodegenOptions &options) {
+  // Length of an array or string. A slice holds its length + 1 in the high
+  // 32 bits and points 8 bytes before its first element, so element
+  // addresses come out the same; plain values read the header.
+  out << "  (func $array_length (param $v i64) (result i64)\n";
+  out << "    local.get $v\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i64.const 1\n";
+  out << "    i64.sub\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load\n";
+  out << "    local.get $v\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shr_u\n";
+  out << "    i32.wrap_i64\n";
+  out << "    select\n";
+  out << "  )\n";
+
+  // $size is the element width (8, 4 or 1); $value holds its low bytes.
+  out << "  (func $array_fill (param $arr i64) (param $value i64) (param $size "
+         "i64)\n";
+  out << "    (local $n i64) (local $done i64) (local $chunk i64)\n";
+  out << "    local.get $arr\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $n\n";
+  out << "    i64.const 1\n";
+  out << "    i64.lt_s\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  const char *stores[][2] = {{"8", "i64.store"}, {"4", "i64.store32"}};
+  for (const auto &store : stores) {
+    out << "    local.get $size\n";
+    out << "    i64.const " << store[0] << "\n";
+    out << "    i64.eq\n";
+    out << "    if\n";
+    out << "      local.get $arr\n";
+    out << "      i32.wrap_i64\n";
+    out << "      local.get $value\n";
+    out << "      " << store[1] << " offset=8\n";
+    out << "    end\n";
+  }
+  out << "    local.get $size\n";
+  out << "    i64.const 1\n";
+  out << "    i64.eq\n";
+  out << "    if\n";
+  out << "      local.get $arr\n";
+  out << "      i32.wrap_i64\n";
+  out << "      local.get $value\n";
+  out << "      i64.store8 offset=8\n";
+  out << "    end\n";
+  out << "    i64.const 1\n";
+  out << "    local.set $done\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $done\n";
+  out << "        local.get $n\n";
+  out << "        i64.ge_s\n";
+  out << "        br_if 1\n";
+  out << "        local.get $done\n";
+  out << "        local.get $n\n";
+  out << "        local.get $done\n";
+  out << "        i64.sub\n";
+  out << "        local.tee $chunk\n";
+  out << "        local.get $done\n";
+  out << "        local.get $chunk\n";
+  out << "        i64.lt_s\n";
+  out << "        select\n";
+  out << "        local.set $chunk\n";
+  out << "        local.get $arr\n";
+  out << "        local.get $done\n";
+  out << "        local.get $size\n";
+  out << "        i64.mul\n";
+  out << "        i64.add\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        i32.wrap_i64\n";
+  out << "        local.get $arr\n";
+  out << "        i64.const 8\n";
+  out << "        i64.add\n";
+  out << "        i32.wrap_i64\n";
+  out << "        local.get $chunk\n";
+  out << "        local.get $size\n";
+  out << "        i64.mul\n";
+  out << "        i32.wrap_i64\n";
+  out << "        memory.copy\n";
+  out << "        local.get $done\n";
+  out << "        local.get $chunk\n";
+  out << "        i64.add\n";
+  out << "        local.set $done\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Element-wise ==: $real compares as f64/f32 (nan differs, -0.0 == 0.0),
+  // integers by value at their $size-byte width.
+  out << "  (func $array_equals (param $a i64) (param $b i64) (param $real i32) "
+         "(param $size i32) (result i64)\n";
+  out << "    (local $p i32) (local $end i32) (local $d i32)\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    local.get $b\n";
+  out << "    call $array_length\n";
+  out << "    i64.ne\n";
+  out << "    if\n";
+  out << "      i64.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $a\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.tee $p\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $size\n";
+  out << "    i32.mul\n";
+  out << "    i32.add\n";
+  out << "    local.set $end\n";
+  out << "    local.get $b\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $p\n";
+  out << "    i32.sub\n";
+  out << "    local.set $d\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $p\n";
+  out << "        local.get $end\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  // Elements at $p and $p + $d as an i32 "differ" flag.
+  auto compare = [&out](const std::string &pad, const char *load,
+                        const char *ne) {
+    out << pad << "local.get $p\n";
+    out << pad << load << " offset=8\n";
+    out << pad << "local.get $p\n";
+    out << pad << "local.get $d\n";
+    out << pad << "i32.add\n";
+    out << pad << load << " offset=8\n";
+    out << pad << ne << "\n";
+  };
+  auto size_is = [&out](const std::string &pad, int size) {
+    out << pad << "local.get $size\n";
+    out << pad << "i32.const " << size << "\n";
+    out << pad << "i32.eq\n";
+    out << pad << "if (result i32)\n";
+  };
+  out << "        local.get $real\n";
+  out << "        if (result i32)\n";
+  size_is("          ", 8);
+  compare("            ", "f64.load", "f64.ne");
+  out << "          else\n";
+  compare("            ", "f32.load", "f32.ne");
+  out << "          end\n";
+  out << "        else\n";
+  size_is("          ", 8);
+  compare("            ", "i64.load", "i64.ne");
+  out << "          else\n";
+  size_is("            ", 4);
+  compare("              ", "i32.load", "i32.ne");
+  out << "            else\n";
+  compare("              ", "i32.load8_u", "i32.ne");
+  out << "            end\n";
+  out << "          end\n";
+  out << "        end\n";
+  out << "        if\n";
+  out << "          i64.const 0\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $p\n";
+  out << "        local.get $size\n";
+  out << "        i32.add\n";
+  out << "        local.set $p\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    i64.const 1\n";
+  out << "  )\n";
+
+  // A fresh zeroed array of length $n holding the first min(len, n)
+  // elements; $type is the --gc header type (raw or pointer array).
+  out << "  (func $array_resize (param $arr i64) (param $n i64) (param $type "
+         "i32) (param $size i64) (result i64)\n";
+  out << "    (local $new i64) (local $keep i64)\n";
+  out << "    local.get $n\n";
+  out << "    local.get $size\n";
+  out << "    i64.mul\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  if (options.gc) {
+    out << "    local.get $type\n";
+    out << "    call $gc_alloc\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "    local.tee $new\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $n\n";
+  out << "    i64.store\n";
+  out << "    local.get $arr\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $keep\n";
+  out << "    local.get $n\n";
+  out << "    local.get $keep\n";
+  out << "    local.get $n\n";
+  out << "    i64.lt_s\n";
+  out << "    select\n";
+  out << "    local.set $keep\n";
+  out << "    local.get $new\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $arr\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $keep\n";
+  out << "    local.get $size\n";
+  out << "    i64.mul\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.copy\n";
+  out << "    local.get $new\n";
+  out << "  )\n";
+}
+
+std::string BoundsFailText() {
+  return std::string("index out of bounds: ") + " (length " + ") at line ";
+}
+
+// Flushes stdout, reports the bad index on stderr and traps.
+static void EmitBoundsRuntime(std::ostream &out, const RuntimeLayout &layout) {
+  const int64_t kIndexText = 21;
+  const int64_t kLengthText = 9;
+  const int64_t kLineText = 10;
+  int64_t text = layout.bounds_text_ptr;
+  out << "  (func $bounds_fail (param $index i64) (param $len i64) (param "
+         "$line i64)\n";
+  out << "    call $flush\n";
+  out << "    i32.const 2\n";
+  out << "    global.set $out_fd\n";
+  out << "    i32.const " << text << "\n";
+  out << "    i32.const " << kIndexText << "\n";
+  out << "    call $write_bytes\n";
+  out << "    local.get $index\n";
+  out << "    call $print_i64_raw\n";
+  out << "    i32.const " << (text + kIndexText) << "\n";
+  out << "    i32.const " << kLengthText << "\n";
+  out << "    call $write_bytes\n";
+  out << "    local.get $len\n";
+  out << "    call $print_i64_raw\n";
+  out << "    i32.const " << (text + kIndexText + kLengthText) << "\n";
+  out << "    i32.const " << kLineText << "\n";
+  out << "    call $write_bytes\n";
+  out << "    local.get $line\n";
+  out << "    call $print_i64_raw\n";
+  out << "    i32.const 10\n";
+  out << "    call $write_byte\n";
+  out << "    call $flush\n";
+  out << "    unreachable\n";
+  out << "  )\n";
+  // copy(): elements [off, off + n) of arr; reports the first bad index.
+  out << "  (func $bounds_range (param $arr i64) (param $off i64) (param $n "
+         "i64) (param $line i64)\n";
+  out << "    (local $len i64)\n";
+  out << "    local.get $arr\n";
+  out << "    call $array_length\n";
+  out << "    local.set $len\n";
+  out << "    local.get $off\n";
+  out << "    i64.const 0\n";
+  out << "    i64.lt_s\n";
+  out << "    if\n";
+  out << "      local.get $off\n";
+  out << "      local.get $len\n";
+  out << "      local.get $line\n";
+  out << "      call $bounds_fail\n";
+  out << "    end\n";
+  out << "    local.get $n\n";
+  out << "    i64.const 0\n";
+  out << "    i64.lt_s\n";
+  out << "    local.get $off\n";
+  out << "    local.get $n\n";
+  out << "    i64.add\n";
+  out << "    local.get $len\n";
+  out << "    i64.gt_u\n";
+  out << "    i32.or\n";
+  out << "    if\n";
+  out << "      local.get $off\n";
+  out << "      local.get $n\n";
+  out << "      i64.add\n";
+  out << "      i64.const 1\n";
+  out << "      i64.sub\n";
+  out << "      local.get $len\n";
+  out << "      local.get $line\n";
+  out << "      call $bounds_fail\n";
+  out << "    end\n";
+  out << "  )\n";
+}
+
 void
 EmitRuntime(std::ostream &out,
-            const std::unordered_map<std::string, int64_t> &string_offsets) {
+            const std::unordered_map<std::string, int64_t> &string_offsets,
+            const RuntimeLayout &layout, const CodegenOptions &options) {
   const int kIovecPtr = 0;
   const int kNwrittenPtr = 8;
-  const int kBufPtr = 64;
-  const int kFracBufPtr = 192;
   int64_t nl_ptr = string_offsets.at("\n");
   (void)string_offsets.at(".");
   (void)string_offsets.at("-");
@@ -30,35 +368,90 @@ EmitRuntime(std::ostream &out,
   int64_t true_ptr = string_offsets.at("true");
   int64_t false_ptr = string_offsets.at("false");
 
-  out << "  (func $write_bytes (param $ptr i32) (param $len i32)\n";
-  out << "    i32.const " << kIovecPtr << "\n";
+  out << "  (global $out_len (mut i32) (i32.const 0))\n";
+  out << "  (global $out_fd (mut i32) (i32.const 1))\n";
+
+  out << "  (func $write_out (param $ptr i32) (param $len i32)\n";
+  out << ScratchAddress(kIovecPtr, options);
   out << "    local.get $ptr\n";
   out << "    i32.store\n";
-  out << "    i32.const " << (kIovecPtr + 4) << "\n";
+  out << ScratchAddress(kIovecPtr + 4, options);
   out << "    local.get $len\n";
   out << "    i32.store\n";
+  out << "    global.get $out_fd\n";
+  out << ScratchAddress(kIovecPtr, options);
   out << "    i32.const 1\n";
-  out << "    i32.const " << kIovecPtr << "\n";
-  out << "    i32.const 1\n";
-  out << "    i32.const " << kNwrittenPtr << "\n";
+  out << ScratchAddress(kNwrittenPtr, options);
   out << "    call $fd_write\n";
   out << "    drop\n";
   out << "  )\n";
 
+  out << "  (func $flush\n";
+  out << "    global.get $out_len\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << ScratchAddress(layout.out_buf_ptr, options);
+  out << "    global.get $out_len\n";
+  out << "    call $write_out\n";
+  out << "    i32.const 0\n";
+  out << "    global.set $out_len\n";
+  out << "  )\n";
+
+  // Appends to the stdout buffer; writes larger than the buffer bypass it.
+  out << "  (func $write_bytes (param $ptr i32) (param $len i32)\n";
+  out << "    global.get $out_len\n";
+  out << "    local.get $len\n";
+  out << "    i32.add\n";
+  out << "    i32.const " << kOutBufSize << "\n";
+  out << "    i32.gt_u\n";
+  out << "    if\n";
+  out << "      call $flush\n";
+  out << "    end\n";
+  out << "    local.get $len\n";
+  out << "    i32.const " << kOutBufSize << "\n";
+  out << "    i32.ge_u\n";
+  out << "    if\n";
+  out << "      local.get $ptr\n";
+  out << "      local.get $len\n";
+  out << "      call $write_out\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    global.get $out_len\n";
+  out << ScratchAddress(layout.out_buf_ptr, options);
+  out << "    i32.add\n";
+  out << "    local.get $ptr\n";
+  out << "    local.get $len\n";
+  out << "    memory.copy\n";
+  out << "    global.get $out_len\n";
+  out << "    local.get $len\n";
+  out << "    i32.add\n";
+  out << "    global.set $out_len\n";
+  out << "  )\n";
+
   out << "  (func $write_byte (param $val i32)\n";
-  out << "    i32.const "<< kBufPtr << "\n";
+  out << "    global.get $out_len\n";
+  out << "    i32.const " << kOutBufSize << "\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      call $flush\n";
+  out << "    end\n";
+  out << "    global.get $out_len\n";
+  out << ScratchAddress(layout.out_buf_ptr, options);
+  out << "    i32.add\n";
   out << "    local.get $val\n";
   out << "    i32.store8\n";
-  out << "    i32.const " << kBufPtr << "\n";
+  out << "    global.get $out_len\n";
   out << "    i32.const 1\n";
-  out << "    call $write_bytes\n";
+  out << "    i32.add\n";
+  out << "    global.set $out_len\n";
   out << "  )\n";
 
   out << "  (func $print_string_raw (param $ptr i64)\n";
   out << "    (local $len i64)\n";
   out << "    local.get $ptr\n";
-  out << "    i32.wrap_i64\n";
-  out << "    i64.load\n";
+  out << "    call $array_length\n";
   out << "    local.set $len\n";
   out << "    local.get $ptr\n";
   out << "    i64.const 8\n";
@@ -100,181 +493,160 @@ EmitRuntime(std::ostream &out,
   out << "    call $write_bytes\n";
   out << "  )\n";
 
-  out << "  (func $print_i64_raw (param $val i64)\n";
-  out << "    (local $tmp i64) (local $pos i32) (local $neg i32) (local $digit i64)\n";
-  out << "    i32.const " << (kBufPtr + 63) << "\n";
-  out << "    local.set $pos\n";
+  // Decimal digit count of an unsigned value: estimate from the bit length
+  // (log10(2) ~ 1233/4096), then correct with one pow10 table compare. Or-ing
+  // in the low bit makes 0 count as one digit and never crosses a power of 10.
+  out << "  (func $count_digits (param $val i64) (result i32)\n";
+  out << "    (local $t i32)\n";
   out << "    local.get $val\n";
-  out << "    i64.const 0\n";
-  out << "    i64.lt_s\n";
-  out << "    if\n";
-  out << "      i32.const 1\n local.set $neg\n";
-  out << "      local.get $val\n i64.const -1\n i64.mul\n local.set $tmp\n";
-  out << "    else\n";
-  out << "      i32.const 0\n local.set $neg\n";
-  out << "      local.get $val\n local.set $tmp\n";
-  out << "    end\n";
-  out << "    local.get $tmp\n i64.const 0\n i64.eq\n";
-  out << "    if\n";
-  out << "      local.get $pos\n i32.const 48\n i32.store8\n";
-  out << "      local.get $pos\n i32.const 1\n i32.sub\n local.set $pos\n";
-  out << "    else\n";
-  out << "      block\n loop\n";
-  out << "          local.get $tmp\n i64.const 0\n i64.eq\n br_if 1\n";
-  out << "          local.get $tmp\n i64.const 10\n i64.rem_u\n local.set $digit\n";
-  out << "          local.get $pos\n local.get $digit\n i64.const 48\n i64.add\n i32.wrap_i64\n i32.store8\n";
-  out << "          local.get $pos\n i32.const 1\n i32.sub\n local.set $pos\n";
-  out << "          local.get $tmp\n i64.const 10\n i64.div_u\n local.set $tmp\n";
-  out << "          br 0\n";
-  out << "      end\n end\n";
-  out << "    end\n";
-  out << "    local.get $neg\n i32.const 0\n i32.ne\n";
-  out << "    if\n";
-  out << "      local.get $pos\n i32.const 45\n i32.store8\n";
-  out << "      local.get $pos\n i32.const 1\n i32.sub\n local.set $pos\n";
-  out << "    end\n";
-  out << "    local.get $pos\n i32.const 1\n i32.add\n local.set $pos\n";
-  out << "    i32.const " << (kBufPtr + 63) << "\n";
-  out << "    local.get $pos\n i32.sub\n i32.const 1\n i32.add\n local.set $neg\n";
-  out << "    local.get $pos\n local.get $neg\n call $write_bytes\n";
-  out << "  )\n";
-
-  out << "  (func $print_i64 (param $val i64)\n";
+  out << "    i64.const 1\n";
+  out << "    i64.or\n";
+  out << "    local.set $val\n";
+  out << "    i32.const 64\n";
   out << "    local.get $val\n";
-  out << "    call $print_i64_raw\n";
-  out << "    i32.const " << (nl_ptr + 8) << "\n";
+  out << "    i64.clz\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.sub\n";
+  out << "    i32.const 1233\n";
+  out << "    i32.mul\n";
+  out << "    i32.const 12\n";
+  out << "    i32.shr_u\n";
+  out << "    local.set $t\n";
+  out << "    local.get $t\n";
   out << "    i32.const 1\n";
-  out << "    call $write_bytes\n";
+  out << "    i32.add\n";
+  out << "    local.get $val\n";
+  out << "    local.get $t\n";
+  out << "    i32.const 3\n";
+  out << "    i32.shl\n";
+  out << "    i64.load offset=" << layout.pow10_ptr << "\n";
+  out << "    i64.lt_u\n";
+  out << "    i32.sub\n";
   out << "  )\n";
 
-  out << "  (func $pow10_i64 (param $n i32) (result i64)\n";
-  out << "    (local $res i64) (local $i i32)\n";
-  out << "    i64.const 1\n";
-  out << "    local.set $res\n";
-  out << "    i32.const 0\n";
-  out << "    local.set $i\n";
+  // Writes the digits of $val right-to-left ending just before $end, two at
+  // a time from the digit pair table.
+  out << "  (func $write_digits (param $val i64) (param $end i32)\n";
+  out << "    (local $q i64)\n";
   out << "    block\n";
   out << "      loop\n";
-  out << "        local.get $i\n";
-  out << "        local.get $n\n";
-  out << "        i32.ge_u\n";
-  out << "        br_if 1\n";
-  out << "        local.get $res\n";
-  out << "        i64.const 10\n";
-  out << "        i64.mul\n";
-  out << "        local.set $res\n";
-  out << "        local.get $i\n";
-  out << "        i32.const 1\n";
-  out << "        i32.add\n";
-  out << "        local.set $i\n";
-  out << "        br 0\n";
-  out << "      end\n";
-  out << "    end\n";
-  out << "    local.get $res\n";
-  out << "  )\n";
-
-  out << "  (func $print_fixed (param $val i64) (param $prec i32)\n";
-  out << "    (local $i i32) (local $pos i32) (local $digit i64)\n";
-  out << "    local.get $prec\n";
-  out << "    i32.eqz\n";
-  out << "    if\n";
-  out << "      return\n";
-  out << "    end\n";
-  out << "    local.get $prec\n";
-  out << "    i32.const 1\n";
-  out << "    i32.sub\n";
-  out << "    i32.const " << kFracBufPtr << "\n";
-  out << "    i32.add\n";
-  out << "    local.set $pos\n";
-  out << "    i32.const 0\n";
-  out << "    local.set $i\n";
-  out << "    block\n";
-  out << "      loop\n";
-  out << "        local.get $i\n";
-  out << "        local.get $prec\n";
-  out << "        i32.ge_u\n";
-  out << "        br_if 1\n";
   out << "        local.get $val\n";
-  out << "        i64.const 10\n";
-  out << "        i64.rem_u\n";
-  out << "        local.set $digit\n";
-  out << "        local.get $pos\n";
-  out << "        local.get $digit\n";
-  out << "        i64.const 48\n";
-  out << "        i64.add\n";
-  out << "        i32.wrap_i64\n";
-  out << "        i32.store8\n";
+  out << "        i64.const 100\n";
+  out << "        i64.lt_u\n";
+  out << "        br_if 1\n";
   out << "        local.get $val\n";
-  out << "        i64.const 10\n";
+  out << "        i64.const 100\n";
   out << "        i64.div_u\n";
-  out << "        local.set $val\n";
-  out << "        local.get $pos\n";
-  out << "        i32.const 1\n";
+  out << "        local.set $q\n";
+  out << "        local.get $end\n";
+  out << "        i32.const 2\n";
   out << "        i32.sub\n";
-  out << "        local.set $pos\n";
-  out << "        local.get $i\n";
+  out << "        local.tee $end\n";
+  out << "        local.get $val\n";
+  out << "        local.get $q\n";
+  out << "        i64.const 100\n";
+  out << "        i64.mul\n";
+  out << "        i64.sub\n";
+  out << "        i32.wrap_i64\n";
   out << "        i32.const 1\n";
-  out << "        i32.add\n";
-  out << "        local.set $i\n";
+  out << "        i32.shl\n";
+  out << "        i32.load16_u offset=" << layout.digit_pairs_ptr << "\n";
+  out << "        i32.store16\n";
+  out << "        local.get $q\n";
+  out << "        local.set $val\n";
   out << "        br 0\n";
   out << "      end\n";
   out << "    end\n";
-  out << "    i32.const " << kFracBufPtr << "\n";
-  out << "    local.get $prec\n";
-  out << "    call $write_bytes\n";
-  out << "  )\n";
-
-  out << "  (func $print_f64_prec (param $val f64) (param $prec i32)\n";
-  out << "    (local $scale i64) (local $scaled i64) (local $int i64) (local $frac i64)\n";
   out << "    local.get $val\n";
-  out << "    f64.const 0\n";
-  out << "    f64.lt\n";
+  out << "    i64.const 10\n";
+  out << "    i64.lt_u\n";
   out << "    if\n";
-  out << "      i32.const 45\n";
-  out << "      call $write_byte\n";
+  out << "      local.get $end\n";
+  out << "      i32.const 1\n";
+  out << "      i32.sub\n";
+  out << "      local.get $val\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.const 48\n";
+  out << "      i32.add\n";
+  out << "      i32.store8\n";
+  out << "    else\n";
+  out << "      local.get $end\n";
+  out << "      i32.const 2\n";
+  out << "      i32.sub\n";
   out << "      local.get $val\n";
-  out << "      f64.neg\n";
-  out << "      local.set $val\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.const 1\n";
+  out << "      i32.shl\n";
+  out << "      i32.load16_u offset=" << layout.digit_pairs_ptr << "\n";
+  out << "      i32.store16\n";
   out << "    end\n";
-  out << "    local.get $prec\n";
-  out << "    call $pow10_i64\n";
-  out << "    local.set $scale\n";
+  out << "  )\n";
+
+  // Formats straight into the stdout buffer. The magnitude is taken as an
+  // unsigned value so i64 min prints correctly.
+  out << "  (func $print_i64_raw (param $val i64)\n";
+  out << "    (local $mag i64) (local $neg i32) (local $len i32) (local $start i32)\n";
   out << "    local.get $val\n";
-  out << "    local.get $scale\n";
-  out << "    f64.convert_i64_s\n";
-  out << "    f64.mul\n";
-  out << "    f64.const 0.5\n";
-  out << "    f64.add\n";
-  out << "    i64.trunc_f64_s\n";
-  out << "    local.set $scaled\n";
-  out << "    local.get $scaled\n";
-  out << "    local.get $scale\n";
-  out << "    i64.div_u\n";
-  out << "    local.set $int\n";
-  out << "    local.get $scaled\n";
-  out << "    local.get $scale\n";
-  out << "    i64.rem_u\n";
-  out << "    local.set $frac\n";
-  out << "    local.get $int\n";
-  out << "    call $print_i64_raw\n";
-  out << "    local.get $prec\n";
-  out << "    i32.eqz\n";
+  out << "    i64.const 0\n";
+  out << "    i64.lt_s\n";
+  out << "    local.set $neg\n";
+  out << "    i64.const 0\n";
+  out << "    local.get $val\n";
+  out << "    i64.sub\n";
+  out << "    local.get $val\n";
+  out << "    local.get $neg\n";
+  out << "    select\n";
+  out << "    local.set $mag\n";
+  out << "    local.get $mag\n";
+  out << "    call $count_digits\n";
+  out << "    local.get $neg\n";
+  out << "    i32.add\n";
+  out << "    local.set $len\n";
+  out << "    global.get $out_len\n";
+  out << "    local.get $len\n";
+  out << "    i32.add\n";
+  out << "    i32.const " << kOutBufSize << "\n";
+  out << "    i32.gt_u\n";
   out << "    if\n";
-  out << "    else\n";
-  out << "      i32.const 46\n";
-  out << "      call $write_byte\n";
-  out << "      local.get $frac\n";
-  out << "      local.get $prec\n";
-  out << "      call $print_fixed\n";
+  out << "      call $flush\n";
+  out << "    end\n";
+  out << "    global.get $out_len\n";
+  out << ScratchAddress(layout.out_buf_ptr, options);
+  out << "    i32.add\n";
+  out << "    local.set $start\n";
+  out << "    local.get $neg\n";
+  out << "    if\n";
+  out << "      local.get $start\n";
+  out << "      i32.const 45\n";
+  out << "      i32.store8\n";
   out << "    end\n";
+  out << "    local.get $mag\n";
+  out << "    local.get $start\n";
+  out << "    local.get $len\n";
+  out << "    i32.add\n";
+  out << "    call $write_digits\n";
+  out << "    global.get $out_len\n";
+  out << "    local.get $len\n";
+  out << "    i32.add\n";
+  out << "    global.set $out_len\n";
   out << "  )\n";
 
-  out << "  (func $print_f64_raw (param $val f64)\n";
+  out << "  (func $print_i64 (param $val i64)\n";
   out << "    local.get $val\n";
-  out << "    i32.const 6\n";
-  out << "    call $print_f64_prec\n";
+  out << "    call $print_i64_raw\n";
+  out << "    i32.const " << (nl_ptr + 8) << "\n";
+  out << "    i32.const 1\n";
+  out << "    call $write_bytes\n";
   out << "  )\n";
 
+  EmitFloatRuntime(out, layout, options);
+  EmitStringRuntime(out, layout, options);
+  EmitMapRuntime(out, options);
+  EmitVecRuntime(out, options);
+  EmitSortRuntime(out);
+  if (options.threads)
+    EmitThreadRuntime(out, layout, options);
+
   out << "  (func $print_f64 (param $val f64)\n";
   out << "    local.get $val\n";
   out << "    call $print_f64_raw\n";
@@ -283,105 +655,11 @@ EmitRuntime(std::ostream &out,
   out << "    call $write_bytes\n";
   out << "  )\n";
 
-  out << "  (func $print_f64_sci (param $val f64) (param $prec i32)\n";
-  out << "    (local $exp i32)\n";
-  out << "    local.get $val\n";
-  out << "    f64.const 0\n";
-  out << "    f64.lt\n";
-  out << "    if\n";
-  out << "      i32.const 45\n";
-  out << "      call $write_byte\n";
-  out << "      local.get $val\n";
-  out << "      f64.neg\n";
-  out << "      local.set $val\n";
-  out << "    end\n";
-  out << "    local.get $val\n";
-  out << "    f64.const 0\n";
-  out << "    f64.eq\n";
-  out << "    if\n";
-  out << "      f64.const 0\n";
-  out << "      local.get $prec\n";
-  out << "      call $print_f64_prec\n";
-  out << "      i32.const 101\n";
-  out << "      call $write_byte\n";
-  out << "      i32.const 43\n";
-  out << "      call $write_byte\n";
-  out << "      i64.const 0\n";
-  out << "      i32.const 2\n";
-  out << "      call $print_fixed\n";
-  out << "      return\n";
-  out << "    end\n";
-  out << "    i32.const 0\n";
-  out << "    local.set $exp\n";
-  out << "    block\n";
-  out << "      loop\n";
-  out << "        local.get $val\n";
-  out << "        f64.const 10\n";
-  out << "        f64.ge\n";
-  out << "        if\n";
-  out << "          local.get $val\n";
-  out << "          f64.const 10\n";
-  out << "          f64.div\n";
-  out << "          local.set $val\n";
-  out << "          local.get $exp\n";
-  out << "          i32.const 1\n";
-  out << "          i32.add\n";
-  out << "          local.set $exp\n";
-  out << "          br 1\n";
-  out << "        end\n";
-  out << "        br 1\n";
-  out << "      end\n";
-  out << "    end\n";
-  out << "    block\n";
-  out << "      loop\n";
-  out << "        local.get $val\n";
-  out << "        f64.const 1\n";
-  out << "        f64.lt\n";
-  out << "        if\n";
-  out << "          local.get $val\n";
-  out << "          f64.const 10\n";
-  out << "          f64.mul\n";
-  out << "          local.set $val\n";
-  out << "          local.get $exp\n";
-  out << "          i32.const 1\n";
-  out << "          i32.sub\n";
-  out << "          local.set $exp\n";
-  out << "          br 1\n";
-  out << "        end\n";
-  out << "        br 1\n";
-  out << "      end\n";
-  out << "    end\n";
-  out << "    local.get $val\n";
-  out << "    local.get $prec\n";
-  out << "    call $print_f64_prec\n";
-  out << "    i32.const 101\n";
-  out << "    call $write_byte\n";
-  out << "    local.get $exp\n";
-  out << "    i32.const 0\n";
-  out << "    i32.lt_s\n";
-  out << "    if\n";
-  out << "      i32.const 45\n";
-  out << "      call $write_byte\n";
-  out << "      local.get $exp\n";
-  out << "      i32.const -1\n";
-  out << "      i32.mul\n";
-  out << "      local.set $exp\n";
-  out << "    else\n";
-  out << "      i32.const 43\n";
-  out << "      call $write_byte\n";
-  out << "    end\n";
-  out << "    local.get $exp\n";
-  out << "    i64.extend_i32_u\n";
-  out << "    i32.const 2\n";
-  out << "    call $print_fixed\n";
-  out << "  )\n";
-
   out << "  (func $print_format (param $fmt i64) (param $args i64) (param $count i32)\n";
   out << "    (local $len i32) (local $pos i32) (local $i i32) (local $arg_ptr i64)\n";
   out << "    (local $ch i32) (local $spec i32) (local $prec i32) (local $tmp i32)\n";
   out << "    local.get $fmt\n";
-  out << "    i32.wrap_i64\n";
-  out << "    i64.load\n";
+  out << "    call $array_length\n";
   out << "    i32.wrap_i64\n";
   out << "    local.set $len\n";
   out << "    local.get $fmt\n";
@@ -428,7 +706,7 @@ EmitRuntime(std::ostream &out,
   out << "            i32.const 37\n";
   out << "            call $write_byte\n";
   out << "          else\n";
-  out << "            i32.const 6\n";
+  out << "            i32.const -1\n";
   out << "            local.set $prec\n";
   out << "            local.get $spec\n";
   out << "            i32.const 114\n";
@@ -532,11 +810,21 @@ EmitRuntime(std::ostream &out,
   out << "                  i32.const 114\n";
   out << "                  i32.eq\n";
   out << "                  if\n";
-  out << "                    local.get $arg_ptr\n";
-  out << "                    i32.wrap_i64\n";
-  out << "                    f64.load\n";
   out << "                    local.get $prec\n";
-  out << "                    call $print_f64_prec\n";
+  out << "                    i32.const 0\n";
+  out << "                    i32.lt_s\n";
+  out << "                    if\n";
+  out << "                      local.get $arg_ptr\n";
+  out << "                      i32.wrap_i64\n";
+  out << "                      f64.load\n";
+  out << "                      call $print_f64_raw\n";
+  out << "                    else\n";
+  out << "                      local.get $arg_ptr\n";
+  out << "                      i32.wrap_i64\n";
+  out << "                      f64.load\n";
+  out << "                      local.get $prec\n";
+  out << "                      call $print_f64_prec\n";
+  out << "                    end\n";
   out << "                    local.get $arg_ptr\n";
   out << "                    i64.const 8\n";
   out << "                    i64.add\n";
@@ -614,11 +902,18 @@ EmitRuntime(std::ostream &out,
   out << "    i32.mul\n";
   out << "    i64.extend_i32_u\n";
   out << "    call $alloc\n";
+  if (options.gc) {
+    // argv/buf are read while the strings below allocate; keep them rooted.
+    out << "    call $gc_push\n";
+  }
   out << "    i32.wrap_i64\n";
   out << "    local.set $argv\n";
   out << "    local.get $buf_size\n";
   out << "    i64.extend_i32_u\n";
   out << "    call $alloc\n";
+  if (options.gc) {
+    out << "    call $gc_push\n";
+  }
   out << "    i32.wrap_i64\n";
   out << "    local.set $buf\n";
   out << "    local.get $argv\n";
@@ -631,7 +926,14 @@ EmitRuntime(std::ostream &out,
   out << "    i32.const 8\n";
   out << "    i32.add\n";
   out << "    i64.extend_i32_u\n";
-  out << "    call $alloc\n";
+  if (options.gc) {
+    // The args array stays rooted for the whole run; it holds heap strings.
+    out << "    i32.const " << kGcRefArrayType << "\n";
+    out << "    call $gc_alloc\n";
+    out << "    call $gc_push\n";
+  } else {
+    out << "    call $alloc\n";
+  }
   out << "    local.set $arr\n";
   out << "    local.get $arr\n";
   out << "    i32.wrap_i64\n";
@@ -730,7 +1032,18 @@ EmitRuntime(std::ostream &out,
   out << "    local.get $arr\n";
   out << "  )\n";
 
+  EmitArrayRuntime(out, options);
+  if (options.bounds_check)
+    EmitBoundsRuntime(out, layout);
+
   out << "  (func $alloc (param $size i64) (result i64)\n";
+  if (options.gc) {
+    out << "    local.get $size\n";
+    out << "    i32.const " << kGcRawType << "\n";
+    out << "    call $gc_alloc\n";
+    out << "  )\n";
+    return;
+  }
   out << "    (local $aligned i64)\n";
   out << "    local.get $size\n";
   out << "    i64.const 7\n";
@@ -738,6 +1051,16 @@ EmitRuntime(std::ostream &out,
   out << "    i64.const -8\n";
   out << "    i64.and\n";
   out << "    local.set $aligned\n";
+  if (options.threads) {
+    // $heap stays the heap start; threads bump the shared cursor.
+    out << "    i32.const " << layout.pool_ptr + kPoolHeap << "\n";
+    out << "    local.get $aligned\n";
+    out << "    i64.atomic.rmw.add\n";
+    out << "    global.get $heap\n";
+    out << "    i64.add\n";
+    out << "  )\n";
+    return;
+  }
   out << "    global.get $heap\n";
   out << "    local.get $aligned\n";
   out << "    i64.add\n";
@@ -14,6 +14,49 @@
 #include <string>
 #include <unordered_map>
 
+#include "codegen.h"
+
+// Size of the stdout buffer; $write_bytes/$write_byte append to it and $flush
+// hands it to fd_write in one call.
+constexpr int64_t kOutBufSize = 16384;
+
+// Bytes of low memory the runtime uses as scratch: the fd_write iovec and
+// the digits of one decimal with the bignum limbs behind them (see
+// codegen_emitter_float.cpp). With --threads every $tls block starts with a
+// private copy of them.
+constexpr int64_t kLowScratchSize = 1024;
+
+// Linear-memory addresses the runtime needs besides the string literals.
+struct RuntimeLayout {
+  int64_t out_buf_ptr = 0;     // stdout buffer, kOutBufSize bytes
+  int64_t digit_pairs_ptr = 0; // "00" .. "99", 200 bytes
+  int64_t pow10_ptr = 0;       // 10^0 .. 10^19 as i64, 160 bytes
+  int64_t pow5_split_ptr = 0;  // Ryu tables, see codegen_emitter_float.h
+  int64_t pow5_inv_split_ptr = 0;
+  int64_t bounds_text_ptr = 0; // BoundsFailText(), with --bounds-check only
+  // --threads: the low scratch, the print arguments and the stdout buffer
+  // (out_buf_ptr is then an offset) form a tls_size block per thread; the
+  // main thread's is at main_tls_ptr. pool_ptr holds the shared heap cursor
+  // and the work queue, deques_ptr one task deque per thread, see
+  // codegen_emitter_thread.h.
+  int64_t tls_size = 0;
+  int64_t main_tls_ptr = 0;
+  int64_t pool_ptr = 0;
+  int64_t deques_ptr = 0;
+};
+
+// Pushes the i32 address of per-thread scratch memory: `addr` itself, or
+// with --threads `addr` bytes into the calling thread's $tls block.
+std::string ScratchAddress(int64_t addr, const CodegenOptions &options);
+
+// Contents of the digit_pairs / pow10 data segments.
+std::string DigitPairTable();
+std::string Pow10Table();
+// "index out of bounds: " " (length " ") at line " back to back; the pieces
+// of the message $bounds_fail writes to stderr before trapping.
+std::string BoundsFailText();
+
 void EmitRuntime(std::ostream &out,
-                 const std::unordered_map<std::string, int64_t> &string_offsets);
+                 const std::unordered_map<std::string, int64_t> &string_offsets,
+                 const RuntimeLayout &layout, const CodegenOptions &options);
 
@@ -0,0 +1,343 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_sort.h"
+
+#include "type_system.h"
+
+namespace {
+
+// Ranges this short are finished by insertion sort.
+const int kInsertionLimit = 16;
+// Flips the magnitude bits of negative doubles, which turns the IEEE order
+// into two's complement order; applying it twice restores the value.
+const char *kMagnitude = "9223372036854775807"; // 0x7fffffffffffffff
+
+struct SortKey {
+  const char *name; // suffix of the runtime functions
+  const char *load; // field load from the address on the stack; "" = direct
+  bool real;        // the loaded i64 holds the bits of a double
+};
+
+const SortKey kSortKeys[] = {
+    {"i64", "", false},
+    {"by_i64", "i64.load", false},
+    {"by_i32", "i64.load32_s", false},
+    {"by_u8", "i64.load8_u", false},
+    {"by_f64", "i64.load", true},
+    {"by_f32", "f32.load\nf64.promote_f32\ni64.reinterpret_f64", true},
+};
+
+class SortEmitter {
+public:
+  SortEmitter(std::ostream &out, const SortKey &key) : out_(out), key_(key) {}
+
+  void Emit() {
+    EmitInsertion();
+    EmitSift();
+    EmitHeap();
+    EmitRange();
+    EmitEntry();
+  }
+
+private:
+  std::string Fn(const char *part) const {
+    return std::string("$sort_") + part + "_" + key_.name;
+  }
+
+  void Line(const std::string &pad, const std::string &code) {
+    size_t start = 0;
+    while (start <= code.size()) {
+      size_t end = code.find('\n', start);
+      if (end == std::string::npos)
+        end = code.size();
+      out_ << pad << code.substr(start, end - start) << "\n";
+      start = end + 1;
+    }
+  }
+
+  // i32 address of element `index` (WAT pushing an i32).
+  void Addr(const std::string &pad, const std::string &index) {
+    Line(pad, "local.get $base\n" + index + "\ni32.const 3\ni32.shl\ni32.add");
+  }
+
+  // The i64 key of the element value on the stack.
+  void KeyOf(const std::string &pad) {
+    if (*key_.load)
+      Line(pad, std::string("i32.wrap_i64\nlocal.get $off\ni32.add\n") +
+                    key_.load);
+    if (key_.real)
+      Flip(pad);
+  }
+
+  void Flip(const std::string &pad) {
+    Line(pad, std::string("local.tee $k\nlocal.get $k\ni64.const 63\n") +
+                  "i64.shr_s\ni64.const " + kMagnitude + "\ni64.and\ni64.xor");
+  }
+
+  void Key(const std::string &pad, const std::string &index) {
+    Addr(pad, index);
+    Line(pad, "i64.load");
+    KeyOf(pad);
+  }
+
+  void Swap(const std::string &pad, const std::string &i,
+            const std::string &j) {
+    Addr(pad, i);
+    Line(pad, "i64.load\nlocal.set $t");
+    Addr(pad, i);
+    Addr(pad, j);
+    Line(pad, "i64.load\ni64.store");
+    Addr(pad, j);
+    Line(pad, "local.get $t\ni64.store");
+  }
+
+  static std::string Get(const char *local) {
+    return std::string("local.get ") + local;
+  }
+
+  // Sorts [lo, hi) by shifting each element left past larger keys.
+  void EmitInsertion() {
+    out_ << "  (func " << Fn("insert") << " (param $base i32) (param $lo i32) "
+         << "(param $hi i32) (param $off i32)\n";
+    out_ << "    (local $i i32) (local $j i32) (local $v i64) (local $kv i64) "
+            "(local $k i64)\n";
+    Line("    ", "local.get $lo\nlocal.set $i");
+    Line("    ", "block\nloop");
+    Line("      ", "local.get $i\ni32.const 1\ni32.add\nlocal.tee $i\n"
+                   "local.get $hi\ni32.ge_s\nbr_if 1");
+    Addr("      ", Get("$i"));
+    Line("      ", "i64.load\nlocal.tee $v");
+    KeyOf("      ");
+    Line("      ", "local.set $kv\nlocal.get $i\nlocal.set $j");
+    Line("      ", "block\nloop");
+    Line("        ", "local.get $j\nlocal.get $lo\ni32.le_s\nbr_if 1");
+    Key("        ", "local.get $j\ni32.const 1\ni32.sub");
+    Line("        ", "local.get $kv\ni64.le_s\nbr_if 1");
+    Addr("        ", Get("$j"));
+    Addr("        ", "local.get $j\ni32.const 1\ni32.sub");
+    Line("        ", "i64.load\ni64.store");
+    Line("        ", "local.get $j\ni32.const 1\ni32.sub\nlocal.set $j\nbr 0");
+    Line("      ", "end\nend");
+    Addr("      ", Get("$j"));
+    Line("      ", "local.get $v\ni64.store\nbr 0");
+    Line("    ", "end\nend");
+    out_ << "  )\n";
+  }
+
+  // Moves element lo + $root down the max-heap [lo, lo + $end).
+  void EmitSift() {
+    out_ << "  (func " << Fn("sift") << " (param $base i32) (param $lo i32) "
+         << "(param $root i32) (param $end i32) (param $off i32)\n";
+    out_ << "    (local $child i32) (local $t i64) (local $k i64)\n";
+    Line("    ", "block\nloop");
+    Line("      ", "local.get $root\ni32.const 1\ni32.shl\ni32.const 1\n"
+                   "i32.add\nlocal.tee $child\nlocal.get $end\ni32.ge_s\n"
+                   "br_if 1");
+    Line("      ", "local.get $child\ni32.const 1\ni32.add\nlocal.get $end\n"
+                   "i32.lt_s\nif");
+    Key("        ", "local.get $lo\nlocal.get $child\ni32.add");
+    Key("        ", "local.get $lo\nlocal.get $child\ni32.add\ni32.const 1\n"
+                   "i32.add");
+    Line("        ", "i64.lt_s\nif\n  local.get $child\n  i32.const 1\n"
+                     "  i32.add\n  local.set $child\nend");
+    Line("      ", "end");
+    Key("      ", "local.get $lo\nlocal.get $root\ni32.add");
+    Key("      ", "local.get $lo\nlocal.get $child\ni32.add");
+    Line("      ", "i64.ge_s\nbr_if 1");
+    Swap("      ", "local.get $lo\nlocal.get $root\ni32.add",
+         "local.get $lo\nlocal.get $child\ni32.add");
+    Line("      ", "local.get $child\nlocal.set $root\nbr 0");
+    Line("    ", "end\nend");
+    out_ << "  )\n";
+  }
+
+  // Heapsort of [lo, hi): the worst-case bound once quicksort degrades.
+  void EmitHeap() {
+    out_ << "  (func " << Fn("heap") << " (param $base i32) (param $lo i32) "
+         << "(param $hi i32) (param $off i32)\n";
+    out_ << "    (local $n i32) (local $i i32) (local $t i64)\n";
+    Line("    ", "local.get $hi\nlocal.get $lo\ni32.sub\nlocal.tee $n\n"
+                 "i32.const 1\ni32.shr_s\nlocal.set $i");
+    Line("    ", "block\nloop");
+    Line("      ", "local.get $i\ni32.eqz\nbr_if 1\nlocal.get $i\ni32.const 1\n"
+                   "i32.sub\nlocal.set $i");
+    Line("      ", "local.get $base\nlocal.get $lo\nlocal.get $i\n"
+                   "local.get $n\nlocal.get $off\ncall " + Fn("sift"));
+    Line("      ", "br 0");
+    Line("    ", "end\nend");
+    Line("    ", "block\nloop");
+    Line("      ", "local.get $n\ni32.const 1\ni32.sub\nlocal.tee $n\n"
+                   "i32.const 1\ni32.lt_s\nbr_if 1");
+    Swap("      ", "local.get $lo", "local.get $lo\nlocal.get $n\ni32.add");
+    Line("      ", "local.get $base\nlocal.get $lo\ni32.const 0\n"
+                   "local.get $n\nlocal.get $off\ncall " + Fn("sift"));
+    Line("      ", "br 0");
+    Line("    ", "end\nend");
+    out_ << "  )\n";
+  }
+
+  // Quicksort of [lo, hi) with a median-of-three pivot and Hoare partition.
+  // It recurses into the smaller side and loops on the larger, so the stack
+  // stays O(log n); $depth running out hands the range to heapsort.
+  void EmitRange() {
+    out_ << "  (func " << Fn("range") << " (param $base i32) (param $lo i32) "
+         << "(param $hi i32) (param $depth i32) (param $off i32)\n";
+    out_ << "    (local $mid i32) (local $i i32) (local $j i32) (local $p i64) "
+            "(local $t i64) (local $k i64)\n";
+    Line("    ", "loop $again");
+    Line("      ", "local.get $hi\nlocal.get $lo\ni32.sub\ni32.const " +
+                       std::to_string(kInsertionLimit) + "\ni32.le_s\nif");
+    Line("        ", "local.get $base\nlocal.get $lo\nlocal.get $hi\n"
+                     "local.get $off\ncall " + Fn("insert") + "\nreturn");
+    Line("      ", "end");
+    Line("      ", "local.get $depth\ni32.eqz\nif");
+    Line("        ", "local.get $base\nlocal.get $lo\nlocal.get $hi\n"
+                     "local.get $off\ncall " + Fn("heap") + "\nreturn");
+    Line("      ", "end");
+    Line("      ", "local.get $depth\ni32.const 1\ni32.sub\nlocal.set $depth");
+    Line("      ", "local.get $hi\nlocal.get $lo\ni32.sub\ni32.const 1\n"
+                   "i32.shr_u\nlocal.get $lo\ni32.add\nlocal.set $mid");
+    // Order lo <= mid <= hi - 1 by key; mid then holds the median.
+    auto order = [this](const std::string &a, const std::string &b) {
+      Key("      ", b);
+      Key("      ", a);
+      Line("      ", "i64.lt_s\nif");
+      Swap("        ", a, b);
+      Line("      ", "end");
+    };
+    std::string last = "local.get $hi\ni32.const 1\ni32.sub";
+    order(Get("$lo"), Get("$mid"));
+    order(Get("$mid"), last);
+    order(Get("$lo"), Get("$mid"));
+    Key("      ", Get("$mid"));
+    Line("      ", "local.set $p");
+    Line("      ", "local.get $lo\ni32.const 1\ni32.sub\nlocal.set $i\n"
+                   "local.get $hi\nlocal.set $j");
+    Line("      ", "block\nloop");
+    Line("        ", "loop");
+    Line("          ", "local.get $i\ni32.const 1\ni32.add\nlocal.set $i");
+    Key("          ", Get("$i"));
+    Line("          ", "local.get $p\ni64.lt_s\nbr_if 0");
+    Line("        ", "end");
+    Line("        ", "loop");
+    Line("          ", "local.get $j\ni32.const 1\ni32.sub\nlocal.set $j");
+    Key("          ", Get("$j"));
+    Line("          ", "local.get $p\ni64.gt_s\nbr_if 0");
+    Line("        ", "end");
+    Line("        ", "local.get $i\nlocal.get $j\ni32.ge_s\nbr_if 1");
+    Swap("        ", Get("$i"), Get("$j"));
+    Line("        ", "br 0");
+    Line("      ", "end\nend");
+    // [lo, j] <= p <= [j + 1, hi)
+    Line("      ", "local.get $j\ni32.const 1\ni32.add\nlocal.tee $j\n"
+                   "local.get $lo\ni32.sub\nlocal.get $hi\nlocal.get $j\n"
+                   "i32.sub\ni32.lt_s\nif");
+    Line("        ", "local.get $base\nlocal.get $lo\nlocal.get $j\n"
+                     "local.get $depth\nlocal.get $off\ncall " + Fn("range") +
+                         "\nlocal.get $j\nlocal.set $lo");
+    Line("      ", "else");
+    Line("        ", "local.get $base\nlocal.get $j\nlocal.get $hi\n"
+                     "local.get $depth\nlocal.get $off\ncall " + Fn("range") +
+                         "\nlocal.get $j\nlocal.set $hi");
+    Line("      ", "end");
+    Line("      ", "br $again");
+    Line("    ", "end");
+    out_ << "  )\n";
+  }
+
+  // $sort_<key>(a[, offset]): elements start 8 bytes into the array or
+  // slice; the depth limit is 2 * log2(n).
+  void EmitEntry() {
+    bool direct = !*key_.load;
+    out_ << "  (func $sort_" << key_.name << " (param $a i64)"
+         << (direct ? "" : " (param $off i32)") << "\n";
+    out_ << "    (local $n i32)\n";
+    Line("    ", "local.get $a\ncall $array_length\ni32.wrap_i64\n"
+                 "local.set $n");
+    Line("    ", "local.get $a\ni32.wrap_i64\ni32.const 8\ni32.add\n"
+                 "i32.const 0\nlocal.get $n\ni32.const 64\nlocal.get $n\n"
+                 "i32.clz\ni32.const 1\ni32.shl\ni32.sub");
+    Line("    ", direct ? "i32.const 0" : "local.get $off");
+    Line("    ", "call " + Fn("range"));
+    out_ << "  )\n";
+  }
+
+  std::ostream &out_;
+  const SortKey &key_;
+};
+
+} // namespace
+
+std::string SortKeySuffix(const std::shared_ptr<Type> &field) {
+  if (field->kind == TypeKind::Real)
+    return field->name == "f32" ? "by_f32" : "by_f64";
+  switch (GetTypeSize(field)) {
+  case 1:
+    return "by_u8";
+  case 4:
+    return "by_i32";
+  default:
+    return "by_i64";
+  }
+}
+
+void EmitSortRuntime(std::ostream &out) {
+  for (const auto &key : kSortKeys)
+    SortEmitter(out, key).Emit();
+
+  // real[]: flipped to ordered i64s, sorted as int[], and flipped back.
+  out << "  (func $sort_flip (param $a i64)\n";
+  out << "    (local $p i32) (local $end i32) (local $k i64)\n";
+  out << "    local.get $a\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.tee $p\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 3\n";
+  out << "    i32.shl\n";
+  out << "    i32.add\n";
+  out << "    local.set $end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $p\n";
+  out << "        local.get $end\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $p\n";
+  out << "        local.get $p\n";
+  out << "        i64.load\n";
+  out << "        local.tee $k\n";
+  out << "        local.get $k\n";
+  out << "        i64.const 63\n";
+  out << "        i64.shr_s\n";
+  out << "        i64.const " << kMagnitude << "\n";
+  out << "        i64.and\n";
+  out << "        i64.xor\n";
+  out << "        i64.store\n";
+  out << "        local.get $p\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.set $p\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  out << "  (func $sort_f64 (param $a i64)\n";
+  out << "    local.get $a\n";
+  out << "    call $sort_flip\n";
+  out << "    local.get $a\n";
+  out << "    call $sort_i64\n";
+  out << "    local.get $a\n";
+  out << "    call $sort_flip\n";
+  out << "  )\n";
+}
@@ -0,0 +1,27 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include "ast.h"
+
+// sort() runtime: an in-place introsort (median-of-three quicksort, heapsort
+// past 2 log n levels, insertion sort below 16 elements) over 8-byte
+// elements, so it needs no scratch memory. Keys compare as signed i64; real
+// keys are first mapped to i64s in the same order (-NaN < -inf < ... < -0 <
+// 0 < ... < inf < NaN).
+//   $sort_i64(a) / $sort_f64(a)  int[] / real[] (slices included)
+//   $sort_by_<key>(a, offset)    struct pointers by the field at offset
+void EmitSortRuntime(std::ostream &out);
+
+// Suffix of the $sort_by_ function for a struct field of type `field`.
+std::string SortKeySuffix(const std::shared_ptr<Type> &field);
@@ -0,0 +1,566 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_string.h"
+
+#include <cstdint>
+#include <ostream>
+
+#include "codegen_emitter_gc.h"
+
+// Room $format_begin keeps free in the stdout buffer: the longest number
+// $print_f64_raw writes is 24 bytes, so nothing flushes mid-format.
+static const int64_t kFormatRoom = 64;
+
+static void EmitCompareRuntime(std::ostream &out) {
+  // Offset of the first differing byte of [p, p + n) and [q, q + n), or n.
+  // Whole words are compared first; the lowest set bit of their xor is the
+  // first differing byte, since wasm loads are little-endian.
+  out << "  (func $string_mismatch (param $p i32) (param $q i32) (param $n "
+         "i32) (result i32)\n";
+  out << "    (local $i i32) (local $x i64)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $i\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.get $n\n";
+  out << "        i32.gt_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $p\n";
+  out << "        local.get $i\n";
+  out << "        i32.add\n";
+  out << "        i64.load\n";
+  out << "        local.get $q\n";
+  out << "        local.get $i\n";
+  out << "        i32.add\n";
+  out << "        i64.load\n";
+  out << "        i64.xor\n";
+  out << "        local.tee $x\n";
+  out << "        i64.const 0\n";
+  out << "        i64.ne\n";
+  out << "        if\n";
+  out << "          local.get $i\n";
+  out << "          local.get $x\n";
+  out << "          i64.ctz\n";
+  out << "          i32.wrap_i64\n";
+  out << "          i32.const 3\n";
+  out << "          i32.shr_u\n";
+  out << "          i32.add\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $i\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.set $i\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $i\n";
+  out << "        local.get $n\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $p\n";
+  out << "        local.get $i\n";
+  out << "        i32.add\n";
+  out << "        i32.load8_u\n";
+  out << "        local.get $q\n";
+  out << "        local.get $i\n";
+  out << "        i32.add\n";
+  out << "        i32.load8_u\n";
+  out << "        i32.ne\n";
+  out << "        if\n";
+  out << "          local.get $i\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $i\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $i\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $n\n";
+  out << "  )\n";
+
+  out << "  (func $string_equals (param $a i64) (param $b i64) (result i64)\n";
+  out << "    (local $n i64)\n";
+  out << "    local.get $a\n";
+  out << "    local.get $b\n";
+  out << "    i64.eq\n";
+  out << "    if\n";
+  out << "      i64.const 1\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $n\n";
+  out << "    local.get $b\n";
+  out << "    call $array_length\n";
+  out << "    i64.ne\n";
+  out << "    if\n";
+  out << "      i64.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $a\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $b\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    i32.wrap_i64\n";
+  out << "    call $string_mismatch\n";
+  out << "    local.get $n\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.eq\n";
+  out << "    i64.extend_i32_u\n";
+  out << "  )\n";
+
+  // Byte-wise order: -1, 0 or 1, a proper prefix first.
+  out << "  (func $string_compare (param $a i64) (param $b i64) (result i64)\n";
+  out << "    (local $na i64) (local $nb i64) (local $n i32) (local $m i32)\n";
+  out << "    (local $x i32) (local $y i32)\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    local.set $na\n";
+  out << "    local.get $b\n";
+  out << "    call $array_length\n";
+  out << "    local.set $nb\n";
+  out << "    local.get $na\n";
+  out << "    local.get $nb\n";
+  out << "    local.get $na\n";
+  out << "    local.get $nb\n";
+  out << "    i64.lt_s\n";
+  out << "    select\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.set $n\n";
+  out << "    local.get $a\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $b\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    call $string_mismatch\n";
+  out << "    local.tee $m\n";
+  out << "    local.get $n\n";
+  out << "    i32.lt_u\n";
+  out << "    if\n";
+  out << "      local.get $a\n";
+  out << "      i32.wrap_i64\n";
+  out << "      local.get $m\n";
+  out << "      i32.add\n";
+  out << "      i32.load8_u offset=8\n";
+  out << "      local.set $x\n";
+  out << "      local.get $b\n";
+  out << "      i32.wrap_i64\n";
+  out << "      local.get $m\n";
+  out << "      i32.add\n";
+  out << "      i32.load8_u offset=8\n";
+  out << "      local.set $y\n";
+  out << "      local.get $x\n";
+  out << "      local.get $y\n";
+  out << "      i32.gt_u\n";
+  out << "      local.get $x\n";
+  out << "      local.get $y\n";
+  out << "      i32.lt_u\n";
+  out << "      i32.sub\n";
+  out << "      i64.extend_i32_s\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $na\n";
+  out << "    local.get $nb\n";
+  out << "    i64.gt_s\n";
+  out << "    local.get $na\n";
+  out << "    local.get $nb\n";
+  out << "    i64.lt_s\n";
+  out << "    i32.sub\n";
+  out << "    i64.extend_i32_s\n";
+  out << "  )\n";
+}
+
+static void EmitHashRuntime(std::ostream &out) {
+  // Golden-ratio seed and the two murmur3 fmix64 multipliers, as signed i64.
+  const char *kSeed = "-7046029254386353131";
+  const char *kMix1 = "-49064778989728563";
+  const char *kMix2 = "-4265267296055464877";
+  auto shift_xor = [&out](const char *pad, int bits) {
+    out << pad << "local.get $h\n";
+    out << pad << "local.get $h\n";
+    out << pad << "i64.const " << bits << "\n";
+    out << pad << "i64.shr_u\n";
+    out << pad << "i64.xor\n";
+    out << pad << "local.set $h\n";
+  };
+  auto mul = [&out](const char *pad, const char *k) {
+    out << pad << "local.get $h\n";
+    out << pad << "i64.const " << k << "\n";
+    out << pad << "i64.mul\n";
+    out << pad << "local.set $h\n";
+  };
+
+  // One multiply per 8 bytes; the 0-7 byte tail is packed into one more
+  // word. The length seeds the state, so "a" and "a\0" differ.
+  out << "  (func $string_hash (param $s i64) (result i64)\n";
+  out << "    (local $h i64) (local $w i64) (local $p i32) (local $end i32)\n";
+  out << "    local.get $s\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $h\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.tee $p\n";
+  out << "    i32.add\n";
+  out << "    local.set $end\n";
+  mul("    ", kSeed);
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $end\n";
+  out << "        local.get $p\n";
+  out << "        i32.sub\n";
+  out << "        i32.const 8\n";
+  out << "        i32.lt_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $h\n";
+  out << "        local.get $p\n";
+  out << "        i64.load\n";
+  out << "        i64.xor\n";
+  out << "        local.set $h\n";
+  mul("        ", kMix1);
+  shift_xor("        ", 32);
+  out << "        local.get $p\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.set $p\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $end\n";
+  out << "        local.get $p\n";
+  out << "        i32.le_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $end\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.tee $end\n";
+  out << "        i64.load8_u\n";
+  out << "        local.get $w\n";
+  out << "        i64.const 8\n";
+  out << "        i64.shl\n";
+  out << "        i64.or\n";
+  out << "        local.set $w\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $h\n";
+  out << "    local.get $w\n";
+  out << "    i64.xor\n";
+  out << "    local.set $h\n";
+  mul("    ", kMix1);
+  shift_xor("    ", 33);
+  mul("    ", kMix1);
+  shift_xor("    ", 33);
+  mul("    ", kMix2);
+  shift_xor("    ", 33);
+  out << "    local.get $h\n";
+  out << "  )\n";
+}
+
+static void EmitBuildRuntime(std::ostream &out, const RuntimeLayout &layout,
+                             const CodegenOptions &options) {
+  // [n][n uninitialized bytes]; collected as raw data under --gc.
+  out << "  (func $string_alloc (param $n i64) (result i64)\n";
+  out << "    (local $s i64)\n";
+  out << "    local.get $n\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  out << "    call $alloc\n";
+  out << "    local.tee $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $n\n";
+  out << "    i64.store\n";
+  out << "    local.get $s\n";
+  out << "  )\n";
+
+  // Strings are immutable, so an empty side returns the other unchanged.
+  out << "  (func $string_concat (param $a i64) (param $b i64) (result i64)\n";
+  out << "    (local $na i64) (local $nb i64) (local $s i64)\n";
+  out << "    local.get $a\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $na\n";
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      local.get $b\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $b\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $nb\n";
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      local.get $a\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $na\n";
+  out << "    local.get $nb\n";
+  out << "    i64.add\n";
+  out << "    call $string_alloc\n";
+  out << "    local.tee $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $a\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $na\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.copy\n";
+  out << "    local.get $s\n";
+  out << "    local.get $na\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $b\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $nb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.copy\n";
+  out << "    local.get $s\n";
+  out << "  )\n";
+
+  // Numbers are formatted by the print routines at the end of the stdout
+  // buffer and taken back out: $format_begin returns where the text will
+  // start, $format_take copies it into a string and truncates the buffer.
+  out << "  (func $format_begin (result i32)\n";
+  out << "    global.get $out_len\n";
+  out << "    i32.const " << (kOutBufSize - kFormatRoom) << "\n";
+  out << "    i32.gt_u\n";
+  out << "    if\n";
+  out << "      call $flush\n";
+  out << "    end\n";
+  out << "    global.get $out_len\n";
+  out << "  )\n";
+  out << "  (func $format_take (param $start i32) (result i64)\n";
+  out << "    (local $n i32) (local $s i64)\n";
+  out << "    global.get $out_len\n";
+  out << "    local.get $start\n";
+  out << "    i32.sub\n";
+  out << "    local.tee $n\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    call $string_alloc\n";
+  out << "    local.tee $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $start\n";
+  out << ScratchAddress(layout.out_buf_ptr, options);
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    memory.copy\n";
+  out << "    local.get $start\n";
+  out << "    global.set $out_len\n";
+  out << "    local.get $s\n";
+  out << "  )\n";
+  auto from = [&out](const char *name, const char *param, const char *print) {
+    out << "  (func $string_from_" << name << " (param $v " << param
+        << ") (result i64)\n";
+    out << "    (local $start i32)\n";
+    out << "    call $format_begin\n";
+    out << "    local.set $start\n";
+    out << "    local.get $v\n";
+    out << "    call " << print << "\n";
+    out << "    local.get $start\n";
+    out << "    call $format_take\n";
+    out << "  )\n";
+  };
+  from("i64", "i64", "$print_i64_raw");
+  from("f64", "f64", "$print_f64_raw");
+  from("bool", "i64", "$print_bool_raw");
+
+  out << "  (func $sb_new (result i64)\n";
+  out << "    (local $sb i64)\n";
+  out << "    i64.const 24\n";
+  if (options.gc) {
+    out << "    i32.const " << kGcRefArrayType << "\n";
+    out << "    call $gc_alloc\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "    local.tee $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 1\n";
+  out << "    i64.store\n";
+  out << "    local.get $sb\n";
+  out << "  )\n";
+
+  // Makes room for $n more bytes and returns where they go. The buffer at
+  // least doubles when it grows, so appends are amortized O(1).
+  out << "  (func $sb_reserve (param $sb i64) (param $n i64) (result i32)\n";
+  out << "    (local $buf i64) (local $len i64) (local $cap i64)\n";
+  out << "    (local $need i64) (local $new i64)\n";
+  out << "    local.get $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=8\n";
+  out << "    local.set $buf\n";
+  out << "    local.get $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=16\n";
+  out << "    local.tee $len\n";
+  out << "    local.get $n\n";
+  out << "    i64.add\n";
+  out << "    local.set $need\n";
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load\n";
+  out << "    i64.const 0\n";
+  out << "    local.get $buf\n";
+  out << "    i64.const 0\n";
+  out << "    i64.ne\n";
+  out << "    select\n";
+  out << "    local.tee $cap\n";
+  out << "    local.get $need\n";
+  out << "    i64.lt_u\n";
+  out << "    if\n";
+  out << "      local.get $cap\n";
+  out << "      i64.const 1\n";
+  out << "      i64.shl\n";
+  out << "      local.tee $cap\n";
+  out << "      local.get $need\n";
+  out << "      local.get $cap\n";
+  out << "      local.get $need\n";
+  out << "      i64.gt_u\n";
+  out << "      select\n";
+  out << "      local.tee $cap\n";
+  out << "      i64.const 16\n";
+  out << "      local.get $cap\n";
+  out << "      i64.const 16\n";
+  out << "      i64.gt_u\n";
+  out << "      select\n";
+  out << "      call $string_alloc\n";
+  out << "      local.tee $new\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.const 8\n";
+  out << "      i32.add\n";
+  out << "      local.get $buf\n";
+  out << "      i32.wrap_i64\n";
+  out << "      i32.const 8\n";
+  out << "      i32.add\n";
+  out << "      local.get $len\n";
+  out << "      i32.wrap_i64\n";
+  out << "      memory.copy\n";
+  out << "      local.get $sb\n";
+  out << "      i32.wrap_i64\n";
+  out << "      local.get $new\n";
+  out << "      local.tee $buf\n";
+  out << "      i64.store offset=8\n";
+  out << "    end\n";
+  out << "    local.get $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $len\n";
+  out << "    local.get $n\n";
+  out << "    i64.add\n";
+  out << "    i64.store offset=16\n";
+  out << "    local.get $buf\n";
+  out << "    local.get $len\n";
+  out << "    i64.add\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "  )\n";
+
+  out << "  (func $sb_append (param $sb i64) (param $s i64)\n";
+  out << "    (local $n i64)\n";
+  out << "    local.get $sb\n";
+  out << "    local.get $s\n";
+  out << "    call $array_length\n";
+  out << "    local.tee $n\n";
+  out << "    call $sb_reserve\n";
+  out << "    local.get $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.copy\n";
+  out << "  )\n";
+  auto append = [&out, &layout, &options](const char *name,
+                                          const char *param,
+                                          const char *print) {
+    out << "  (func $sb_append_" << name << " (param $sb i64) (param $v "
+        << param << ")\n";
+    out << "    (local $start i32) (local $n i32)\n";
+    out << "    call $format_begin\n";
+    out << "    local.set $start\n";
+    out << "    local.get $v\n";
+    out << "    call " << print << "\n";
+    out << "    local.get $sb\n";
+    out << "    global.get $out_len\n";
+    out << "    local.get $start\n";
+    out << "    i32.sub\n";
+    out << "    local.tee $n\n";
+    out << "    i64.extend_i32_u\n";
+    out << "    call $sb_reserve\n";
+    out << "    local.get $start\n";
+    out << ScratchAddress(layout.out_buf_ptr, options);
+    out << "    i32.add\n";
+    out << "    local.get $n\n";
+    out << "    memory.copy\n";
+    out << "    local.get $start\n";
+    out << "    global.set $out_len\n";
+    out << "  )\n";
+  };
+  append("i64", "i64", "$print_i64_raw");
+  append("f64", "f64", "$print_f64_raw");
+  append("bool", "i64", "$print_bool_raw");
+
+  out << "  (func $sb_to_string (param $sb i64) (result i64)\n";
+  out << "    (local $n i64) (local $s i64)\n";
+  out << "    local.get $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=16\n";
+  out << "    local.tee $n\n";
+  out << "    call $string_alloc\n";
+  out << "    local.tee $s\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $sb\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=8\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.const 8\n";
+  out << "    i32.add\n";
+  out << "    local.get $n\n";
+  out << "    i32.wrap_i64\n";
+  out << "    memory.copy\n";
+  out << "    local.get $s\n";
+  out << "  )\n";
+}
+
+void EmitStringRuntime(std::ostream &out, const RuntimeLayout &layout,
+                       const CodegenOptions &options) {
+  EmitCompareRuntime(out);
+  EmitHashRuntime(out);
+  EmitBuildRuntime(out, layout, options);
+}
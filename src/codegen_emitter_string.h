@@ -0,0 +1,25 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <ostream>
+
+#include "codegen_emitter_runtime.h"
+
+// String operations on [len][bytes] values (slices included):
+//   $string_equals / $string_compare  word-at-a-time, via $string_mismatch
+//   $string_hash                      8 bytes per multiply, murmur finalizer
+//   $string_concat                    one exact allocation
+//   $string_from_i64 / _f64 / _bool   format into the stdout buffer, then copy
+// and the string_builder runtime ($sb_*). A builder is a pointer array of one
+// element, [1][buf][len], so --gc scans buf; buf is a [capacity][bytes] block
+// that doubles when an append does not fit.
+void EmitStringRuntime(std::ostream &out, const RuntimeLayout &layout,
+                       const CodegenOptions &options);
@@ -0,0 +1,633 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_thread.h"
+
+namespace {
+
+// Chunks per thread and job: enough to even out uneven iterations without
+// making the shared counter hot.
+const int kChunksPerThread = 4;
+// Longest sleep in join() before looking for work again.
+const int64_t kJoinWaitNs = 1000000;
+
+void EmitFold(std::ostream &out, const char *type, const char *op) {
+  out << "  (func $par_fold_" << type << "_" << op
+      << " (param $ptr i32) (param $n i32) (param $acc " << type
+      << ") (result " << type << ")\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $n\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $acc\n";
+  out << "        local.get $ptr\n";
+  out << "        " << type << ".load\n";
+  out << "        " << type << "." << op << "\n";
+  out << "        local.set $acc\n";
+  out << "        local.get $ptr\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.set $ptr\n";
+  out << "        local.get $n\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.set $n\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $acc\n";
+  out << "  )\n";
+}
+
+// $d = the deque of thread slot `slot_expr` (WAT pushing an i32).
+void EmitDequeAddress(std::ostream &out, const RuntimeLayout &layout,
+                      const char *slot_expr) {
+  out << "    i32.const " << layout.deques_ptr << "\n";
+  out << "    " << slot_expr << "\n";
+  out << "    i32.const " << kDequeStride << "\n";
+  out << "    i32.mul\n";
+  out << "    i32.add\n";
+  out << "    local.set $d\n";
+}
+
+// Pushes the address of ring entry `index_local` of deque $d.
+void EmitDequeEntry(std::ostream &out, const char *index_local) {
+  out << "    local.get $d\n";
+  out << "    local.get " << index_local << "\n";
+  out << "    i32.const " << kDequeCapacity - 1 << "\n";
+  out << "    i32.and\n";
+  out << "    i32.const 4\n";
+  out << "    i32.mul\n";
+  out << "    i32.add\n";
+}
+
+void EmitPoolRuntime(std::ostream &out, const RuntimeLayout &layout,
+                     const CodegenOptions &options) {
+  const int64_t pool = layout.pool_ptr;
+  out << "  (global $tls (mut i32) (i32.const " << layout.main_tls_ptr
+      << "))\n";
+  // Nonzero while this thread runs chunks: nested loops run inline.
+  out << "  (global $par_depth (mut i32) (i32.const 0))\n";
+  // This thread's partial result slot and deque; 0 on the main thread.
+  out << "  (global $par_slot (mut i32) (i32.const 0))\n";
+  // The last job this worker took part in.
+  out << "  (global $par_seen (mut i32) (i32.const 0))\n";
+
+  // Workers take slots 1 .. threads-1.
+  out << "  (func $par_start\n";
+  out << "    (local $k i32) (local $n i32)\n";
+  out << "    i32.const " << pool + kPoolStarted << "\n";
+  out << "    i32.load\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const " << pool + kPoolStarted << "\n";
+  out << "    i32.const 1\n";
+  out << "    i32.store\n";
+  out << "    i32.const 1\n";
+  out << "    local.set $k\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $k\n";
+  out << "        i32.const " << options.threads << "\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        local.get $k\n";
+  out << "        call $thread_spawn\n";
+  out << "        i32.const 0\n";
+  out << "        i32.gt_s\n";
+  out << "        local.get $n\n";
+  out << "        i32.add\n";
+  out << "        local.set $n\n";
+  out << "        local.get $k\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $k\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    i32.const " << pool + kPoolWorkers << "\n";
+  out << "    local.get $n\n";
+  out << "    i32.store\n";
+  out << "  )\n";
+
+  // Wakes up to $count idle workers (-1: all of them).
+  out << "  (func $par_wake (param $count i32)\n";
+  out << "    i32.const " << pool + kPoolWake << "\n";
+  out << "    i32.const 1\n";
+  out << "    i32.atomic.rmw.add\n";
+  out << "    drop\n";
+  out << "    i32.const " << pool + kPoolWake << "\n";
+  out << "    local.get $count\n";
+  out << "    memory.atomic.notify\n";
+  out << "    drop\n";
+  out << "  )\n";
+
+  out << "  (func $par_chunks (param $slot i32)\n";
+  out << "    (local $lo i64) (local $hi i64)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        i32.const " << pool + kPoolNext << "\n";
+  out << "        i32.const " << pool + kPoolChunk << "\n";
+  out << "        i64.load\n";
+  out << "        i64.atomic.rmw.add\n";
+  out << "        local.tee $lo\n";
+  out << "        i32.const " << pool + kPoolHi << "\n";
+  out << "        i64.load\n";
+  out << "        i64.ge_s\n";
+  out << "        br_if 1\n";
+  out << "        local.get $lo\n";
+  out << "        i32.const " << pool + kPoolChunk << "\n";
+  out << "        i64.load\n";
+  out << "        i64.add\n";
+  out << "        local.tee $hi\n";
+  out << "        i32.const " << pool + kPoolHi << "\n";
+  out << "        i64.load\n";
+  out << "        i64.gt_s\n";
+  out << "        if\n";
+  out << "          i32.const " << pool + kPoolHi << "\n";
+  out << "          i64.load\n";
+  out << "          local.set $hi\n";
+  out << "        end\n";
+  out << "        i32.const " << pool + kPoolSite << "\n";
+  out << "        i32.load\n";
+  out << "        local.get $lo\n";
+  out << "        local.get $hi\n";
+  out << "        i32.const " << pool + kPoolCtx << "\n";
+  out << "        i32.load\n";
+  out << "        local.get $slot\n";
+  out << "        call $par_dispatch\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // A worker takes part in each job once: runs chunks, then checks out.
+  out << "  (func $par_help (result i32)\n";
+  out << "    (local $job i32)\n";
+  out << "    global.get $par_slot\n";
+  out << "    i32.eqz\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const " << pool + kPoolJob << "\n";
+  out << "    i32.atomic.load\n";
+  out << "    local.tee $job\n";
+  out << "    global.get $par_seen\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $job\n";
+  out << "    global.set $par_seen\n";
+  out << "    global.get $par_slot\n";
+  out << "    call $par_chunks\n";
+  out << "    call $flush\n";
+  out << "    i32.const " << pool + kPoolActive << "\n";
+  out << "    i32.const 1\n";
+  out << "    i32.atomic.rmw.sub\n";
+  out << "    i32.const 1\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      i32.const " << pool + kPoolActive << "\n";
+  out << "      i32.const 1\n";
+  out << "      memory.atomic.notify\n";
+  out << "      drop\n";
+  out << "    end\n";
+  out << "    i32.const 1\n";
+  out << "  )\n";
+
+  out << "  (func $par_run (param $site i32) (param $ctx i32) (param $lo i64) "
+         "(param $hi i64)\n";
+  out << "    (local $active i32)\n";
+  out << "    global.get $par_depth\n";
+  out << "    if\n";
+  out << "      local.get $site\n";
+  out << "      local.get $lo\n";
+  out << "      local.get $hi\n";
+  out << "      local.get $ctx\n";
+  out << "      i32.const 0\n";
+  out << "      call $par_dispatch\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    call $par_start\n";
+  // Output printed before the loop goes out before the workers' output.
+  out << "    call $flush\n";
+  out << "    i32.const " << pool + kPoolSite << "\n";
+  out << "    local.get $site\n";
+  out << "    i32.store\n";
+  out << "    i32.const " << pool + kPoolCtx << "\n";
+  out << "    local.get $ctx\n";
+  out << "    i32.store\n";
+  out << "    i32.const " << pool + kPoolHi << "\n";
+  out << "    local.get $hi\n";
+  out << "    i64.store\n";
+  out << "    i32.const " << pool + kPoolChunk << "\n";
+  out << "    local.get $hi\n";
+  out << "    local.get $lo\n";
+  out << "    i64.sub\n";
+  out << "    i32.const " << pool + kPoolWorkers << "\n";
+  out << "    i32.load\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    i32.const " << kChunksPerThread << "\n";
+  out << "    i32.mul\n";
+  out << "    i64.extend_i32_u\n";
+  out << "    i64.div_s\n";
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    i64.store\n";
+  out << "    i32.const " << pool + kPoolNext << "\n";
+  out << "    local.get $lo\n";
+  out << "    i64.atomic.store\n";
+  out << "    i32.const " << pool + kPoolActive << "\n";
+  out << "    i32.const " << pool + kPoolWorkers << "\n";
+  out << "    i32.load\n";
+  out << "    i32.atomic.store\n";
+  out << "    i32.const " << pool + kPoolJob << "\n";
+  out << "    i32.const 1\n";
+  out << "    i32.atomic.rmw.add\n";
+  out << "    drop\n";
+  out << "    i32.const -1\n";
+  out << "    call $par_wake\n";
+  out << "    i32.const 1\n";
+  out << "    global.set $par_depth\n";
+  out << "    i32.const 0\n";
+  out << "    call $par_chunks\n";
+  out << "    i32.const 0\n";
+  out << "    global.set $par_depth\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        i32.const " << pool + kPoolActive << "\n";
+  out << "        i32.atomic.load\n";
+  out << "        local.tee $active\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        i32.const " << pool + kPoolActive << "\n";
+  out << "        local.get $active\n";
+  out << "        i64.const -1\n";
+  out << "        memory.atomic.wait32\n";
+  out << "        drop\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Looks for work forever; the process ends with _start. A worker counts
+  // itself as a sleeper before its last look, so a spawn that sees no
+  // sleepers is sure to be seen by that look.
+  out << "  (func $wasi_thread_start (export \"wasi_thread_start\") "
+         "(param $tid i32) (param $slot i32)\n";
+  out << "    (local $wake i32)\n";
+  out << "    i64.const " << layout.tls_size << "\n";
+  out << "    call $alloc\n";
+  out << "    i32.wrap_i64\n";
+  out << "    global.set $tls\n";
+  out << "    i32.const 1\n";
+  out << "    global.set $par_depth\n";
+  out << "    local.get $slot\n";
+  out << "    global.set $par_slot\n";
+  out << "    loop\n";
+  out << "      call $task_help\n";
+  out << "      br_if 0\n";
+  out << "      i32.const " << pool + kPoolSleepers << "\n";
+  out << "      i32.const 1\n";
+  out << "      i32.atomic.rmw.add\n";
+  out << "      drop\n";
+  out << "      i32.const " << pool + kPoolWake << "\n";
+  out << "      i32.atomic.load\n";
+  out << "      local.set $wake\n";
+  out << "      call $task_help\n";
+  out << "      i32.eqz\n";
+  out << "      if\n";
+  out << "        i32.const " << pool + kPoolWake << "\n";
+  out << "        local.get $wake\n";
+  out << "        i64.const -1\n";
+  out << "        memory.atomic.wait32\n";
+  out << "        drop\n";
+  out << "      end\n";
+  out << "      i32.const " << pool + kPoolSleepers << "\n";
+  out << "      i32.const 1\n";
+  out << "      i32.atomic.rmw.sub\n";
+  out << "      drop\n";
+  out << "      br 0\n";
+  out << "    end\n";
+  out << "  )\n";
+}
+
+void EmitTaskRuntime(std::ostream &out, const RuntimeLayout &layout,
+                     const CodegenOptions &options) {
+  const int64_t pool = layout.pool_ptr;
+  out << "  (func $task_spawn (param $task i32)\n";
+  out << "    (local $d i32) (local $b i32)\n";
+  out << "    call $par_start\n";
+  // As with parallel loops: earlier output first.
+  out << "    call $flush\n";
+  EmitDequeAddress(out, layout, "global.get $par_slot");
+  out << "    local.get $d\n";
+  out << "    i32.load offset=" << kDequeBottom << "\n";
+  out << "    local.tee $b\n";
+  out << "    local.get $d\n";
+  out << "    i32.atomic.load offset=" << kDequeTop << "\n";
+  out << "    i32.sub\n";
+  out << "    i32.const " << kDequeCapacity << "\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  out << "      local.get $task\n";
+  out << "      call $task_run\n";
+  out << "      return\n";
+  out << "    end\n";
+  EmitDequeEntry(out, "$b");
+  out << "    local.get $task\n";
+  out << "    i32.store offset=" << kDequeTasks << "\n";
+  out << "    local.get $d\n";
+  out << "    local.get $b\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    i32.atomic.store offset=" << kDequeBottom << "\n";
+  out << "    i32.const " << pool + kPoolSleepers << "\n";
+  out << "    i32.atomic.load\n";
+  out << "    if\n";
+  out << "      i32.const 1\n";
+  out << "      call $par_wake\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Takes the newest task of this thread's deque; the top index decides a
+  // race with a thief for the last one.
+  out << "  (func $task_pop (result i32)\n";
+  out << "    (local $d i32) (local $b i32) (local $t i32) (local $x i32)\n";
+  EmitDequeAddress(out, layout, "global.get $par_slot");
+  out << "    local.get $d\n";
+  out << "    i32.load offset=" << kDequeBottom << "\n";
+  out << "    i32.const 1\n";
+  out << "    i32.sub\n";
+  out << "    local.set $b\n";
+  out << "    local.get $d\n";
+  out << "    local.get $b\n";
+  out << "    i32.atomic.store offset=" << kDequeBottom << "\n";
+  out << "    local.get $d\n";
+  out << "    i32.atomic.load offset=" << kDequeTop << "\n";
+  out << "    local.tee $t\n";
+  out << "    local.get $b\n";
+  out << "    i32.gt_s\n";
+  out << "    if\n";
+  out << "      local.get $d\n";
+  out << "      local.get $b\n";
+  out << "      i32.const 1\n";
+  out << "      i32.add\n";
+  out << "      i32.atomic.store offset=" << kDequeBottom << "\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  EmitDequeEntry(out, "$b");
+  out << "    i32.load offset=" << kDequeTasks << "\n";
+  out << "    local.set $x\n";
+  out << "    local.get $t\n";
+  out << "    local.get $b\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      local.get $d\n";
+  out << "      local.get $t\n";
+  out << "      local.get $t\n";
+  out << "      i32.const 1\n";
+  out << "      i32.add\n";
+  out << "      i32.atomic.rmw.cmpxchg offset=" << kDequeTop << "\n";
+  out << "      local.get $t\n";
+  out << "      i32.ne\n";
+  out << "      if\n";
+  out << "        i32.const 0\n";
+  out << "        local.set $x\n";
+  out << "      end\n";
+  out << "      local.get $d\n";
+  out << "      local.get $b\n";
+  out << "      i32.const 1\n";
+  out << "      i32.add\n";
+  out << "      i32.atomic.store offset=" << kDequeBottom << "\n";
+  out << "    end\n";
+  out << "    local.get $x\n";
+  out << "  )\n";
+
+  // Takes the oldest task of another thread's deque, or 0.
+  out << "  (func $task_steal (param $victim i32) (result i32)\n";
+  out << "    (local $d i32) (local $t i32) (local $x i32)\n";
+  EmitDequeAddress(out, layout, "local.get $victim");
+  out << "    local.get $d\n";
+  out << "    i32.atomic.load offset=" << kDequeTop << "\n";
+  out << "    local.tee $t\n";
+  out << "    local.get $d\n";
+  out << "    i32.atomic.load offset=" << kDequeBottom << "\n";
+  out << "    i32.ge_s\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  EmitDequeEntry(out, "$t");
+  out << "    i32.load offset=" << kDequeTasks << "\n";
+  out << "    local.set $x\n";
+  out << "    local.get $d\n";
+  out << "    local.get $t\n";
+  out << "    local.get $t\n";
+  out << "    i32.const 1\n";
+  out << "    i32.add\n";
+  out << "    i32.atomic.rmw.cmpxchg offset=" << kDequeTop << "\n";
+  out << "    local.get $t\n";
+  out << "    i32.ne\n";
+  out << "    if\n";
+  out << "      i32.const 0\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $x\n";
+  out << "  )\n";
+
+  out << "  (func $task_run (param $task i32)\n";
+  out << "    local.get $task\n";
+  out << "    i32.load offset=" << kTaskId << "\n";
+  out << "    local.get $task\n";
+  out << "    call $task_dispatch\n";
+  // A worker's output goes out before join() returns.
+  out << "    global.get $par_slot\n";
+  out << "    if\n";
+  out << "      call $flush\n";
+  out << "    end\n";
+  out << "    local.get $task\n";
+  out << "    i32.const 1\n";
+  out << "    i32.atomic.rmw.xchg offset=" << kTaskState << "\n";
+  out << "    i32.const 2\n";
+  out << "    i32.eq\n";
+  out << "    if\n";
+  out << "      local.get $task\n";
+  out << "      i32.const -1\n";
+  out << "      memory.atomic.notify offset=" << kTaskState << "\n";
+  out << "      drop\n";
+  out << "    end\n";
+  out << "  )\n";
+
+  // Runs one piece of work if there is any: a parallel loop job (workers
+  // only), the newest task of this thread, or the oldest of another.
+  out << "  (func $task_help (result i32)\n";
+  out << "    (local $x i32) (local $k i32)\n";
+  out << "    call $par_help\n";
+  out << "    if\n";
+  out << "      i32.const 1\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    call $task_pop\n";
+  out << "    local.tee $x\n";
+  out << "    if\n";
+  out << "      local.get $x\n";
+  out << "      call $task_run\n";
+  out << "      i32.const 1\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    i32.const 1\n";
+  out << "    local.set $k\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $k\n";
+  out << "        i32.const " << options.threads << "\n";
+  out << "        i32.ge_u\n";
+  out << "        br_if 1\n";
+  out << "        global.get $par_slot\n";
+  out << "        local.get $k\n";
+  out << "        i32.add\n";
+  out << "        i32.const " << options.threads << "\n";
+  out << "        i32.rem_u\n";
+  out << "        call $task_steal\n";
+  out << "        local.tee $x\n";
+  out << "        if\n";
+  out << "          local.get $x\n";
+  out << "          call $task_run\n";
+  out << "          i32.const 1\n";
+  out << "          return\n";
+  out << "        end\n";
+  out << "        local.get $k\n";
+  out << "        i32.const 1\n";
+  out << "        i32.add\n";
+  out << "        local.set $k\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    i32.const 0\n";
+  out << "  )\n";
+
+  // Sleeps at most kJoinWaitNs at a time: new work may show up meanwhile.
+  out << "  (func $task_join (param $task i32) (result i64)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $task\n";
+  out << "        i32.atomic.load offset=" << kTaskState << "\n";
+  out << "        i32.const 1\n";
+  out << "        i32.eq\n";
+  out << "        br_if 1\n";
+  out << "        call $task_help\n";
+  out << "        br_if 0\n";
+  out << "        local.get $task\n";
+  out << "        i32.const 0\n";
+  out << "        i32.const 2\n";
+  out << "        i32.atomic.rmw.cmpxchg offset=" << kTaskState << "\n";
+  out << "        drop\n";
+  out << "        local.get $task\n";
+  out << "        i32.const 2\n";
+  out << "        i64.const " << kJoinWaitNs << "\n";
+  out << "        memory.atomic.wait32 offset=" << kTaskState << "\n";
+  out << "        drop\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "    local.get $task\n";
+  out << "    i64.load offset=" << kTaskResult << "\n";
+  out << "  )\n";
+}
+
+} // namespace
+
+void EmitThreadRuntime(std::ostream &out, const RuntimeLayout &layout,
+                       const CodegenOptions &options) {
+  EmitPoolRuntime(out, layout, options);
+  EmitTaskRuntime(out, layout, options);
+  out << "  (func $par_fill (param $ptr i32) (param $n i32) (param $value i64)\n";
+  out << "    block\n";
+  out << "      loop\n";
+  out << "        local.get $n\n";
+  out << "        i32.eqz\n";
+  out << "        br_if 1\n";
+  out << "        local.get $ptr\n";
+  out << "        local.get $value\n";
+  out << "        i64.store\n";
+  out << "        local.get $ptr\n";
+  out << "        i32.const 8\n";
+  out << "        i32.add\n";
+  out << "        local.set $ptr\n";
+  out << "        local.get $n\n";
+  out << "        i32.const 1\n";
+  out << "        i32.sub\n";
+  out << "        local.set $n\n";
+  out << "        br 0\n";
+  out << "      end\n";
+  out << "    end\n";
+  out << "  )\n";
+  for (const char *type : {"i64", "f64"}) {
+    EmitFold(out, type, "add");
+    EmitFold(out, type, "mul");
+  }
+}
+
+void EmitParallelDispatch(std::ostream &out, int sites) {
+  out << "  (func $par_dispatch (param $site i32) (param $lo i64) (param $hi "
+         "i64) (param $ctx i32) (param $slot i32)\n";
+  if (sites == 0) {
+    out << "    unreachable\n";
+    out << "  )\n";
+    return;
+  }
+  for (int k = 0; k < sites; ++k)
+    out << "    block\n";
+  out << "    local.get $site\n";
+  out << "    br_table";
+  for (int k = 0; k < sites; ++k)
+    out << " " << k;
+  out << "\n";
+  for (int k = 0; k < sites; ++k) {
+    out << "    end\n";
+    out << "    local.get $lo\n";
+    out << "    local.get $hi\n";
+    out << "    local.get $ctx\n";
+    out << "    local.get $slot\n";
+    out << "    call $par" << k << "\n";
+    out << "    return\n";
+  }
+  out << "  )\n";
+}
+
+void EmitTaskDispatch(std::ostream &out, int tasks) {
+  out << "  (func $task_dispatch (param $id i32) (param $task i32)\n";
+  if (tasks == 0) {
+    out << "    unreachable\n";
+    out << "  )\n";
+    return;
+  }
+  for (int k = 0; k < tasks; ++k)
+    out << "    block\n";
+  out << "    local.get $id\n";
+  out << "    br_table";
+  for (int k = 0; k < tasks; ++k)
+    out << " " << k;
+  out << "\n";
+  for (int k = 0; k < tasks; ++k) {
+    out << "    end\n";
+    out << "    local.get $task\n";
+    out << "    call $task" << k << "\n";
+    out << "    return\n";
+  }
+  out << "  )\n";
+}
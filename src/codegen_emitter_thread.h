@@ -0,0 +1,73 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+#include "codegen_emitter_runtime.h"
+
+// --threads: shared state at RuntimeLayout::pool_ptr. The heap cursor counts
+// the bytes handed out past the heap start, bumped with one atomic add; the
+// rest is the job the workers pick chunks from and the sleep/wake counters.
+constexpr int64_t kPoolHeap = 0;      // i64
+constexpr int64_t kPoolJob = 8;       // i32 job generation
+constexpr int64_t kPoolActive = 12;   // i32 workers still on the current job
+constexpr int64_t kPoolWorkers = 16;  // i32 workers spawned
+constexpr int64_t kPoolStarted = 20;  // i32
+constexpr int64_t kPoolSite = 24;     // i32 parallel loop being run
+constexpr int64_t kPoolCtx = 28;      // i32 its captures and partial results
+constexpr int64_t kPoolNext = 32;     // i64 first index nobody has taken yet
+constexpr int64_t kPoolHi = 40;       // i64
+constexpr int64_t kPoolChunk = 48;    // i64
+constexpr int64_t kPoolWake = 56;     // i32 bumped for new work, idle workers
+                                      //     wait on it
+constexpr int64_t kPoolSleepers = 60; // i32 workers about to wait
+constexpr int64_t kPoolSize = 64;
+
+// One work-stealing deque per thread at RuntimeLayout::deques_ptr, slot 0
+// being the main thread's: [top i32][bottom i32][kDequeCapacity task
+// addresses]. The owner pushes and pops at the bottom, other threads steal
+// from the top (Chase-Lev, over a fixed ring).
+constexpr int64_t kDequeTop = 0;
+constexpr int64_t kDequeBottom = 4;
+constexpr int64_t kDequeTasks = 8;
+constexpr int64_t kDequeCapacity = 1024;
+constexpr int64_t kDequeStride = kDequeTasks + 4 * kDequeCapacity;
+
+// A spawned task: [state i32][task id i32][result][arguments, 8 bytes each].
+// State 0 is pending, 1 done, 2 pending with a thread waiting in join.
+constexpr int64_t kTaskState = 0;
+constexpr int64_t kTaskId = 4;
+constexpr int64_t kTaskResult = 8;
+constexpr int64_t kTaskArgs = 16;
+
+// The worker pool. $par_run(site, ctx, lo, hi) spawns options.threads - 1
+// workers (wasi-threads) the first time work shows up, then hands out
+// [lo, hi) in chunks through one atomic counter; the caller takes chunks as
+// well and returns once every worker is done. A worker thread gets its own
+// $tls block and flushes its stdout buffer after each job and task. Called
+// from a worker or from inside a chunk, $par_run runs the whole range
+// itself. $par_fill / $par_fold_<i64|f64>_<add|mul> set and combine the
+// per-thread partial results of reductions.
+//
+// Tasks: $task_spawn(task) pushes a task on the calling thread's deque (or
+// runs it right away when the deque is full) and wakes an idle worker.
+// $task_join(task) returns the result bits once the task is done; until
+// then the thread runs tasks of its own deque, steals from the others and
+// helps with parallel loops, sleeping briefly when there is nothing to do.
+void EmitThreadRuntime(std::ostream &out, const RuntimeLayout &layout,
+                       const CodegenOptions &options);
+
+// $par_dispatch(site, lo, hi, ctx, slot) calls the worker function $par<site>.
+void EmitParallelDispatch(std::ostream &out, int sites);
+
+// $task_dispatch(id, task) calls the task function $task<id>.
+void EmitTaskDispatch(std::ostream &out, int tasks);
@@ -0,0 +1,212 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_emitter_vec.h"
+
+#include "codegen_emitter_gc.h"
+
+namespace {
+
+// Header fields, see codegen_emitter_vec.h.
+const int kCap = 16;
+const int kSize = 24;
+const int kType = 28;
+const int kHeaderSize = 32;
+// The first growth of an empty vec.
+const int kMinCapacity = 4;
+
+// Pushes the i32 address of element $n of the buffer in $buf.
+void Element(std::ostream &out, const char *pad) {
+  out << pad << "local.get $buf\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i32.const 8\n";
+  out << pad << "i32.add\n";
+  out << pad << "local.get $n\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "local.get $v\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i32.load offset=" << kSize << "\n";
+  out << pad << "i32.mul\n";
+  out << pad << "i32.add\n";
+}
+
+void LoadBuffer(std::ostream &out, const char *pad) {
+  out << pad << "local.get $v\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i64.load offset=" << kVecBufOffset << "\n";
+  out << pad << "local.tee $buf\n";
+  out << pad << "i32.wrap_i64\n";
+  out << pad << "i64.load\n";
+  out << pad << "local.set $n\n";
+}
+
+} // namespace
+
+void EmitVecRuntime(std::ostream &out, const CodegenOptions &options) {
+  // An empty buffer of $cap elements, allocated as the vec's header says.
+  out << "  (func $vec_alloc (param $v i64) (param $cap i64) (result i64)\n";
+  out << "    local.get $cap\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load32_u offset=" << kSize << "\n";
+  out << "    i64.mul\n";
+  out << "    i64.const 8\n";
+  out << "    i64.add\n";
+  if (options.gc) {
+    out << "    local.get $v\n";
+    out << "    i32.wrap_i64\n";
+    out << "    i32.load offset=" << kType << "\n";
+    out << "    call $gc_alloc\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "  )\n";
+
+  out << "  (func $vec_new (param $size i32) (param $type i32) (result i64)\n";
+  out << "    (local $v i64) (local $buf i64)\n";
+  out << "    i64.const " << kHeaderSize << "\n";
+  if (options.gc) {
+    out << "    i32.const " << kGcRefArrayType << "\n";
+    out << "    call $gc_alloc\n";
+    // Rooted while the buffer is allocated.
+    out << "    call $gc_push\n";
+  } else {
+    out << "    call $alloc\n";
+  }
+  out << "    local.tee $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 1\n";
+  out << "    i64.store\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $size\n";
+  out << "    i32.store offset=" << kSize << "\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $type\n";
+  out << "    i32.store offset=" << kType << "\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 0\n";
+  out << "    i64.store offset=" << kCap << "\n";
+  out << "    local.get $v\n";
+  out << "    i64.const 0\n";
+  out << "    call $vec_alloc\n";
+  out << "    local.set $buf\n";
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.const 0\n";
+  out << "    i64.store\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $buf\n";
+  out << "    i64.store offset=" << kVecBufOffset << "\n";
+  out << "    local.get $v\n";
+  out << "  )\n";
+
+  // Moves the elements to a buffer of $cap slots unless there are that many
+  // already. One memory.copy carries the length word along.
+  out << "  (func $vec_reserve (param $v i64) (param $cap i64)\n";
+  out << "    (local $buf i64) (local $n i64) (local $new i64)\n";
+  out << "    local.get $cap\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=" << kCap << "\n";
+  out << "    i64.le_s\n";
+  out << "    if\n";
+  out << "      return\n";
+  out << "    end\n";
+  out << "    local.get $v\n";
+  out << "    local.get $cap\n";
+  out << "    call $vec_alloc\n";
+  out << "    local.set $new\n";
+  LoadBuffer(out, "    ");
+  out << "    local.get $new\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  Element(out, "    ");
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i32.sub\n";
+  out << "    memory.copy\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $new\n";
+  out << "    i64.store offset=" << kVecBufOffset << "\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $cap\n";
+  out << "    i64.store offset=" << kCap << "\n";
+  out << "  )\n";
+
+  // A full vec doubles, so a push is amortized O(1).
+  out << "  (func $vec_slot (param $v i64) (result i32)\n";
+  out << "    (local $buf i64) (local $n i64)\n";
+  LoadBuffer(out, "    ");
+  out << "    local.get $n\n";
+  out << "    local.get $v\n";
+  out << "    i32.wrap_i64\n";
+  out << "    i64.load offset=" << kCap << "\n";
+  out << "    i64.eq\n";
+  out << "    if\n";
+  out << "      local.get $v\n";
+  out << "      local.get $n\n";
+  out << "      i64.const 1\n";
+  out << "      i64.shl\n";
+  out << "      i64.const " << kMinCapacity << "\n";
+  out << "      local.get $n\n";
+  out << "      i64.const " << kMinCapacity / 2 << "\n";
+  out << "      i64.ge_s\n";
+  out << "      select\n";
+  out << "      call $vec_reserve\n";
+  LoadBuffer(out, "      ");
+  out << "    end\n";
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $n\n";
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    i64.store\n";
+  Element(out, "    ");
+  out << "  )\n";
+
+  // An empty vec flushes stdout and traps, like a failed bounds check.
+  out << "  (func $vec_pop (param $v i64) (result i32)\n";
+  out << "    (local $buf i64) (local $n i64)\n";
+  LoadBuffer(out, "    ");
+  out << "    local.get $n\n";
+  out << "    i64.eqz\n";
+  out << "    if\n";
+  out << "      call $flush\n";
+  out << "      unreachable\n";
+  out << "    end\n";
+  out << "    local.get $buf\n";
+  out << "    i32.wrap_i64\n";
+  out << "    local.get $n\n";
+  out << "    i64.const 1\n";
+  out << "    i64.sub\n";
+  out << "    local.tee $n\n";
+  out << "    i64.store\n";
+  Element(out, "    ");
+  out << "  )\n";
+
+  // buf[0:length]: shares the elements until the next growth moves them.
+  out << "  (func $vec_view (param $v i64) (result i64)\n";
+  out << "    (local $buf i64) (local $n i64)\n";
+  LoadBuffer(out, "    ");
+  out << "    local.get $n\n";
+  out << "    i64.const 1\n";
+  out << "    i64.add\n";
+  out << "    i64.const 32\n";
+  out << "    i64.shl\n";
+  out << "    local.get $buf\n";
+  out << "    i64.or\n";
+  out << "  )\n";
+}
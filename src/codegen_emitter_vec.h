@@ -0,0 +1,27 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+#include "codegen.h"
+
+// vec[T] is a pointer array of one element so --gc scans its buffer:
+//   [1][buf][capacity][elem size:i32][buf gc type:i32]
+// buf is an ordinary T[] whose length word is the vec's length, so v[i]
+// indexes it like an array and --gc scans only the live elements.
+constexpr int64_t kVecBufOffset = 8;
+
+// $vec_new(size, type), $vec_reserve(v, n), $vec_slot(v) (grows when full,
+// appends an element and returns its address), $vec_pop(v) (the address of
+// the removed last element; traps when empty) and $vec_view(v) (a slice of
+// the live elements).
+void EmitVecRuntime(std::ostream &out, const CodegenOptions &options);
@@ -0,0 +1,186 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_parallel.h"
+
+#include <algorithm>
+#include <set>
+#include <unordered_set>
+
+#include "common.h"
+#include "semantics.h"
+
+namespace {
+
+using Structs = std::unordered_map<std::string, StructInfo>;
+
+bool IsVar(const ExprPtr &expr, const std::string &name) {
+  return expr && expr->kind == ExprKind::Var && expr->text == name;
+}
+
+int CountUses(const ExprPtr &expr, const std::string &name) {
+  if (!expr)
+    return 0;
+  int n = IsVar(expr, name) ? 1 : 0;
+  n += CountUses(expr->left, name) + CountUses(expr->right, name) +
+       CountUses(expr->base, name) + CountUses(expr->new_size, name);
+  for (const auto &a : expr->args)
+    n += CountUses(a, name);
+  return n;
+}
+
+int CountUses(const std::vector<StmtPtr> &stmts, const std::string &name) {
+  int n = 0;
+  for (const auto &s : stmts) {
+    n += CountUses(s->expr, name) + CountUses(s->target, name);
+    n += CountUses(s->then_body, name) + CountUses(s->else_body, name) +
+         CountUses(s->body, name);
+  }
+  return n;
+}
+
+struct Scan {
+  const Env &env;
+  const Structs &structs;
+  const Stmt &loop;
+  std::unordered_set<std::string> declared;
+  std::set<std::string> reads;
+  // Reduction name -> op, and how many statements fold into it.
+  std::unordered_map<std::string, std::string> folds;
+  std::unordered_map<std::string, int> fold_counts;
+
+  [[noreturn]] void Fail(const std::string &what, int line) const {
+    throw CompileError(what + " in parallel while at line " +
+                       std::to_string(line ? line : loop.line));
+  }
+
+  void Declared(const std::vector<StmtPtr> &stmts) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::VarDecl)
+        declared.insert(s->var_name);
+      Declared(s->then_body);
+      Declared(s->else_body);
+      Declared(s->body);
+    }
+  }
+
+  void Reads(const ExprPtr &expr) {
+    if (!expr)
+      return;
+    if (expr->kind == ExprKind::Var && !declared.count(expr->text)) {
+      auto res = FindIdentifier(expr->text, env, structs);
+      if (res && res->kind != LookupResult::Kind::Field)
+        reads.insert(expr->text);
+    }
+    Reads(expr->left);
+    Reads(expr->right);
+    Reads(expr->base);
+    Reads(expr->new_size);
+    for (const auto &a : expr->args)
+      Reads(a);
+  }
+
+  void Stmts(const std::vector<StmtPtr> &stmts, const StmtPtr &step) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::Return)
+        Fail("Return is not allowed", s->line);
+      if (s->kind == StmtKind::Yield)
+        Fail("yield is not allowed", s->line);
+      Reads(s->expr);
+      Reads(s->target);
+      if (s->kind == StmtKind::Assign && s != step)
+        Assign(*s);
+      Stmts(s->then_body, step);
+      Stmts(s->else_body, step);
+      Stmts(s->body, step);
+    }
+  }
+
+  // Stores to elements and fields go to shared memory; an outer local may
+  // only be folded into.
+  void Assign(const Stmt &s) {
+    if (s.target->kind != ExprKind::Var || declared.count(s.target->text))
+      return;
+    const std::string &name = s.target->text;
+    auto res = FindIdentifier(name, env, structs);
+    if (!res || res->kind == LookupResult::Kind::Field)
+      return;
+    const ExprPtr &e = s.expr;
+    std::string op;
+    if (e->kind == ExprKind::Binary && name != loop.expr->left->text &&
+        (res->local->type->kind == TypeKind::Int ||
+         res->local->type->kind == TypeKind::Real)) {
+      if (IsVar(e->left, name) &&
+          (e->op == "+" || e->op == "-" || e->op == "*"))
+        op = e->op == "*" ? "*" : "+";
+      else if (IsVar(e->right, name) && (e->op == "+" || e->op == "*"))
+        op = e->op;
+    }
+    if (op.empty())
+      Fail("Only the index and reductions like " + name + " = " + name +
+               " + ... may assign " + name,
+           s.line);
+    auto it = folds.find(name);
+    if (it != folds.end() && it->second != op)
+      Fail("Reduction " + name + " mixes + and *", s.line);
+    folds[name] = op;
+    fold_counts[name]++;
+  }
+};
+
+} // namespace
+
+ParallelLoop MatchParallelLoop(const Stmt &loop, const Env &env,
+                               const Structs &structs) {
+  Scan scan{env, structs, loop, {}, {}, {}, {}};
+  const ExprPtr &cond = loop.expr;
+  if (cond->kind != ExprKind::Binary || cond->op != "<" ||
+      cond->left->kind != ExprKind::Var)
+    scan.Fail("Expected an `i < n` condition", 0);
+  auto index = FindIdentifier(cond->left->text, env, structs);
+  if (!index || index->kind == LookupResult::Kind::Field ||
+      index->local->type->kind != TypeKind::Int)
+    scan.Fail("The index must be an int local", 0);
+
+  ParallelLoop plan;
+  plan.index = cond->left->text;
+  plan.limit = cond->right;
+  const StmtPtr step = loop.body.empty() ? nullptr : loop.body.back();
+  if (!step || step->kind != StmtKind::Assign ||
+      !IsVar(step->target, plan.index) ||
+      step->expr->kind != ExprKind::Binary || step->expr->op != "+" ||
+      !IsVar(step->expr->left, plan.index) ||
+      step->expr->right->kind != ExprKind::IntLit ||
+      step->expr->right->int_value != 1)
+    scan.Fail("Expected the body to end with " + plan.index + " = " +
+                  plan.index + " + 1",
+              0);
+
+  scan.Declared(loop.body);
+  scan.Stmts(loop.body, step);
+  for (const auto &fold : scan.folds) {
+    // The target and the left/right operand of each fold, nothing else.
+    if (CountUses(loop.body, fold.first) != 2 * scan.fold_counts[fold.first] ||
+        CountUses(cond, fold.first) != 0)
+      scan.Fail("Reduction " + fold.first + " is read", 0);
+    plan.reductions.push_back({fold.first, fold.second});
+  }
+  std::sort(plan.reductions.begin(), plan.reductions.end(),
+            [](const ParallelReduction &a, const ParallelReduction &b) {
+              return a.name < b.name;
+            });
+  if (CountUses(plan.limit, plan.index) != 0)
+    scan.Fail("The limit reads the index", 0);
+
+  scan.reads.insert(plan.index);
+  if (!env.current_struct.empty())
+    scan.reads.insert("this");
+  plan.captures.assign(scan.reads.begin(), scan.reads.end());
+  return plan;
+}
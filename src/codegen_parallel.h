@@ -0,0 +1,41 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "codegen_types.h"
+
+// An outer local the body folds into with `acc = acc op value` (or
+// `value op acc` for + and *). `-` folds like `+`, so op is "+" or "*".
+struct ParallelReduction {
+  std::string name;
+  std::string op;
+};
+
+// A `parallel while i < limit ... i = i + 1` loop. Its body runs in a worker
+// function over chunks of the index range (--threads): captures are the
+// outer locals and params the body reads, copied in by value, plus "this"
+// in methods. Besides array elements and fields, the body may only assign
+// its own locals, the index (in the final step) and the reductions.
+struct ParallelLoop {
+  std::string index;
+  ExprPtr limit;
+  std::vector<std::string> captures;
+  std::vector<ParallelReduction> reductions;
+};
+
+// Checks the loop shape and collects its captures; throws a CompileError
+// naming the offending variable otherwise.
+ParallelLoop
+MatchParallelLoop(const Stmt &loop, const Env &env,
+                  const std::unordered_map<std::string, StructInfo> &structs);
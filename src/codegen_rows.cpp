@@ -0,0 +1,125 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_rows.h"
+
+#include <unordered_set>
+
+#include "codegen_bounds.h"
+#include "semantics.h"
+
+namespace {
+
+using Structs = std::unordered_map<std::string, StructInfo>;
+
+struct Planner {
+  const Env &env;
+  const Structs &structs;
+  RowPlan plan;
+
+  // Locals and literals the loop leaves alone, combined with + - *. Fields
+  // are out: a method call in the loop can change them.
+  bool Invariant(const ExprPtr &expr,
+                 const std::unordered_set<std::string> &assigned) const {
+    switch (expr->kind) {
+    case ExprKind::IntLit:
+      return true;
+    case ExprKind::Var: {
+      auto res = FindIdentifier(expr->text, env, structs);
+      return res && res->kind != LookupResult::Kind::Field &&
+             !assigned.count(expr->text);
+    }
+    case ExprKind::Binary:
+      return (expr->op == "+" || expr->op == "-" || expr->op == "*") &&
+             Invariant(expr->left, assigned) &&
+             Invariant(expr->right, assigned);
+    default:
+      return false;
+    }
+  }
+
+  static std::string Key(const ExprPtr &expr) {
+    switch (expr->kind) {
+    case ExprKind::IntLit:
+      return std::to_string(expr->int_value);
+    case ExprKind::Var:
+      return expr->text;
+    default:
+      return "(" + Key(expr->left) + expr->op + Key(expr->right) + ")";
+    }
+  }
+
+  void Collect(const ExprPtr &expr, const Stmt &loop,
+               const std::unordered_set<std::string> &assigned,
+               std::unordered_map<std::string, int> &rows) {
+    if (!expr)
+      return;
+    Collect(expr->left, loop, assigned, rows);
+    Collect(expr->right, loop, assigned, rows);
+    Collect(expr->base, loop, assigned, rows);
+    for (const auto &a : expr->args)
+      Collect(a, loop, assigned, rows);
+    if (expr->kind != ExprKind::Index || expr->args.empty() ||
+        plan.ids.count(expr.get()) || !Invariant(expr->base, assigned))
+      return;
+    // Every index but the last picks the row.
+    std::string key = expr->base->text;
+    std::vector<ExprPtr> leading{expr->left};
+    leading.insert(leading.end(), expr->args.begin(), expr->args.end() - 1);
+    for (const auto &index : leading) {
+      if (!Invariant(index, assigned))
+        return;
+      key += "," + Key(index);
+    }
+    auto it = rows.find(key);
+    if (it == rows.end()) {
+      it = rows.emplace(key, plan.count++).first;
+      plan.hoisted[&loop].push_back(RowPlan::Row{it->second, expr});
+    }
+    plan.ids[expr.get()] = it->second;
+  }
+
+  void Collect(const std::vector<StmtPtr> &stmts, const Stmt &loop,
+               const std::unordered_set<std::string> &assigned,
+               std::unordered_map<std::string, int> &rows) {
+    for (const auto &s : stmts) {
+      Collect(s->expr, loop, assigned, rows);
+      Collect(s->target, loop, assigned, rows);
+      Collect(s->then_body, loop, assigned, rows);
+      Collect(s->else_body, loop, assigned, rows);
+      Collect(s->body, loop, assigned, rows);
+    }
+  }
+
+  // Outer loops first, so a row lands in the outermost loop it is
+  // invariant in.
+  void Walk(const std::vector<StmtPtr> &stmts) {
+    for (const auto &s : stmts) {
+      if (s->kind == StmtKind::While) {
+        std::unordered_set<std::string> assigned;
+        AssignedNames(s->body, assigned);
+        std::unordered_map<std::string, int> rows;
+        Collect(s->expr, *s, assigned, rows);
+        Collect(s->body, *s, assigned, rows);
+      }
+      Walk(s->then_body);
+      Walk(s->else_body);
+      Walk(s->body);
+    }
+  }
+};
+
+} // namespace
+
+RowPlan PlanRowAddresses(const std::vector<StmtPtr> &body, const Env &env,
+                         const Structs &structs) {
+  Planner planner{env, structs, {}};
+  planner.Walk(body);
+  return planner.plan;
+}
@@ -0,0 +1,35 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "codegen_types.h"
+
+// Row addresses of rectangular arrays hoisted out of loops. In a[i, j]
+// inside `while` where a and i do not change, the row start
+// a + header + i * d1 * size is loop-invariant: the code generator computes
+// it once into $row<id> before the outermost such loop and each access adds
+// j * size. Accesses with the same array and leading indices share a row.
+struct RowPlan {
+  struct Row {
+    int id = 0;
+    ExprPtr access; // one a[i, j] naming the row
+  };
+  std::unordered_map<const Expr *, int> ids;
+  std::unordered_map<const Stmt *, std::vector<Row>> hoisted;
+  int count = 0;
+};
+
+RowPlan PlanRowAddresses(
+    const std::vector<StmtPtr> &body, const Env &env,
+    const std::unordered_map<std::string, StructInfo> &structs);
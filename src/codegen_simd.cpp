@@ -0,0 +1,237 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#include "codegen_simd.h"
+
+#include <unordered_set>
+
+#include "semantics.h"
+#include "type_system.h"
+
+namespace {
+
+using Structs = std::unordered_map<std::string, StructInfo>;
+
+struct Matcher {
+  const Env &env;
+  const Structs &structs;
+  std::string index;
+  std::unordered_set<std::string> assigned;
+
+  const LocalInfo *Local(const ExprPtr &expr) const {
+    if (!expr || expr->kind != ExprKind::Var)
+      return nullptr;
+    auto res = FindIdentifier(expr->text, env, structs);
+    if (!res || res->kind == LookupResult::Kind::Field)
+      return nullptr;
+    return res->local;
+  }
+
+  // Arrays whose elements fill one 8-byte lane of an i64x2/f64x2 vector.
+  const LocalInfo *Array(const ExprPtr &expr) const {
+    const LocalInfo *local = Local(expr);
+    if (!local || !local->type || local->type->kind != TypeKind::Array ||
+        local->type->dims != 1 || assigned.count(expr->text))
+      return nullptr;
+    auto elem = local->type->element;
+    if (!elem || (elem->name != "int" && elem->name != "real"))
+      return nullptr;
+    return local;
+  }
+
+  // `a[i].f` on a soa array: the column of an int or real field is an
+  // 8-byte element array of its own.
+  const LocalInfo *Column(const ExprPtr &expr) const {
+    if (!expr || expr->kind != ExprKind::Field || !expr->type ||
+        (expr->type->name != "int" && expr->type->name != "real"))
+      return nullptr;
+    const ExprPtr &elem = expr->base;
+    if (elem->kind != ExprKind::Index || !IsIndex(elem->left))
+      return nullptr;
+    return SoaArray(elem->base);
+  }
+
+  const LocalInfo *SoaArray(const ExprPtr &expr) const {
+    const LocalInfo *local = Local(expr);
+    if (!local || !IsSoaArray(local->type, structs) ||
+        assigned.count(expr->text))
+      return nullptr;
+    return local;
+  }
+
+  bool IsIndex(const ExprPtr &expr) const {
+    return expr && expr->kind == ExprKind::Var && expr->text == index &&
+           Local(expr);
+  }
+
+  bool IsLength(const ExprPtr &expr) const {
+    return expr->kind == ExprKind::Call && expr->args.empty() && expr->base &&
+           expr->base->kind == ExprKind::Field &&
+           expr->base->field == "length" &&
+           (Array(expr->base->base) || SoaArray(expr->base->base));
+  }
+
+  bool Invariant(const ExprPtr &expr) const {
+    if (!expr || !expr->type)
+      return false;
+    switch (expr->kind) {
+    case ExprKind::IntLit:
+    case ExprKind::RealLit:
+      return true;
+    case ExprKind::Var:
+      return expr->text != index && !assigned.count(expr->text) &&
+             Local(expr) &&
+             (expr->type->kind == TypeKind::Int ||
+              expr->type->kind == TypeKind::Real);
+    case ExprKind::Call:
+      return IsLength(expr);
+    default:
+      return false;
+    }
+  }
+
+  // Element-wise values produce one lane per index: every leaf and operator
+  // must have the same scalar kind, since the vector ops do not convert.
+  bool Elementwise(const ExprPtr &expr, TypeKind kind) const {
+    if (!expr || !expr->type || expr->type->kind != kind)
+      return false;
+    if (IsIndex(expr) || Invariant(expr))
+      return true;
+    if (expr->kind == ExprKind::Index) {
+      const LocalInfo *array = Array(expr->base);
+      return array && array->type->element->kind == kind &&
+             IsIndex(expr->left);
+    }
+    if (expr->kind == ExprKind::Field)
+      return Column(expr) != nullptr;
+    if (expr->kind == ExprKind::Unary)
+      return expr->op == "-" && Elementwise(expr->left, kind);
+    if (expr->kind == ExprKind::Binary) {
+      bool ok = expr->op == "+" || expr->op == "-" || expr->op == "*" ||
+                (expr->op == "/" && kind == TypeKind::Real);
+      return ok && Elementwise(expr->left, kind) &&
+             Elementwise(expr->right, kind);
+    }
+    return false;
+  }
+};
+
+bool IsVar(const ExprPtr &expr, const std::string &name) {
+  return expr && expr->kind == ExprKind::Var && expr->text == name;
+}
+
+int CountUses(const ExprPtr &expr, const std::string &name) {
+  if (!expr)
+    return 0;
+  int n = IsVar(expr, name) ? 1 : 0;
+  n += CountUses(expr->left, name) + CountUses(expr->right, name) +
+       CountUses(expr->base, name) + CountUses(expr->new_size, name);
+  for (const auto &a : expr->args)
+    n += CountUses(a, name);
+  return n;
+}
+
+} // namespace
+
+int64_t ColumnOffset(const ExprPtr &field, const Structs &structs) {
+  const auto &info = structs.at(field->base->type->name);
+  return info.field_map.at(field->field).offset;
+}
+
+std::optional<SimdLoop> MatchSimdLoop(const Stmt &loop, const Env &env,
+                                      const Structs &structs) {
+  Matcher m{env, structs, "", {}};
+  const ExprPtr &cond = loop.expr;
+  if (!cond || cond->kind != ExprKind::Binary || cond->op != "<" ||
+      !cond->left || cond->left->kind != ExprKind::Var)
+    return std::nullopt;
+  m.index = cond->left->text;
+  const LocalInfo *index = m.Local(cond->left);
+  if (!index || !index->type || index->type->kind != TypeKind::Int)
+    return std::nullopt;
+
+  // The body is straight-line assignments ending in `i = i + 1`.
+  const auto &body = loop.body;
+  if (body.size() < 2)
+    return std::nullopt;
+  for (const auto &s : body) {
+    if (s->kind != StmtKind::Assign)
+      return std::nullopt;
+    if (s->target->kind == ExprKind::Var)
+      m.assigned.insert(s->target->text);
+  }
+  const StmtPtr &step = body.back();
+  if (!IsVar(step->target, m.index) || step->expr->kind != ExprKind::Binary ||
+      step->expr->op != "+" || !IsVar(step->expr->left, m.index) ||
+      step->expr->right->kind != ExprKind::IntLit ||
+      step->expr->right->int_value != 1)
+    return std::nullopt;
+  m.assigned.erase(m.index);
+  if (!m.Invariant(cond->right) || cond->right->type->kind != TypeKind::Int)
+    return std::nullopt;
+
+  SimdLoop plan;
+  plan.index_name = m.index;
+  plan.index = *index;
+  plan.limit = cond->right;
+  for (size_t k = 0; k + 1 < body.size(); ++k) {
+    const Stmt &s = *body[k];
+    SimdStep simd;
+    if (s.target->kind == ExprKind::Index) {
+      const LocalInfo *array = m.Array(s.target->base);
+      if (!array || !m.IsIndex(s.target->left) ||
+          !m.Elementwise(s.expr, array->type->element->kind))
+        return std::nullopt;
+      simd.array = *array;
+      simd.value = s.expr;
+      plan.steps.push_back(simd);
+      continue;
+    }
+    if (s.target->kind == ExprKind::Field) {
+      const LocalInfo *array = m.Column(s.target);
+      if (!array || !m.Elementwise(s.expr, s.target->type->kind))
+        return std::nullopt;
+      simd.array = *array;
+      simd.column = ColumnOffset(s.target, structs);
+      simd.value = s.expr;
+      plan.steps.push_back(simd);
+      continue;
+    }
+    // Reductions: the accumulator appears nowhere else in the loop.
+    const std::string &name = s.target->kind == ExprKind::Var
+                                  ? s.target->text
+                                  : std::string();
+    const LocalInfo *acc = m.Local(s.target);
+    const ExprPtr &e = s.expr;
+    if (!acc || name == m.index || !acc->type ||
+        e->kind != ExprKind::Binary ||
+        (acc->type->name != "int" && acc->type->name != "real"))
+      return std::nullopt;
+    ExprPtr value;
+    if (IsVar(e->left, name) &&
+        (e->op == "+" || e->op == "-" || e->op == "*"))
+      value = e->right;
+    else if (IsVar(e->right, name) && (e->op == "+" || e->op == "*"))
+      value = e->left;
+    if (!value || !m.Elementwise(value, acc->type->kind) ||
+        CountUses(cond, name) != 0)
+      return std::nullopt;
+    int uses = 0;
+    for (const auto &other : body)
+      uses += CountUses(other->target, name) + CountUses(other->expr, name);
+    if (uses != 2)
+      return std::nullopt;
+    simd.reduction = true;
+    simd.acc = *acc;
+    simd.op = e->op;
+    simd.value = value;
+    plan.steps.push_back(simd);
+  }
+  return plan;
+}
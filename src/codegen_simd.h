@@ -0,0 +1,53 @@
+// THE BEER LICENSE (with extra fizz)
+//
+// Author: OpenAI Codex (controlled by jens@bennerhq.com)
+// This code is open source with no restrictions. Wild, right?
+// If this code helps, buy Jens a beer. Or two. Or a keg.
+// If it fails, keep the beer and blame the LLM gremlins.
+//
+// Cheers!
+
+#pragma once
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "codegen_types.h"
+
+// One statement of a vectorizable loop body, in source order. A reduction is
+// `acc = acc op value` on a scalar local; a store is `array[i] = value`, or
+// `array[i].f = value` on a soa array whose column f starts at
+// len * column bytes past the elements.
+struct SimdStep {
+  bool reduction = false;
+  LocalInfo acc;
+  std::string op;
+  LocalInfo array;
+  int64_t column = 0;
+  ExprPtr value;
+};
+
+// A counted loop `while i < limit ... i = i + 1` over int[]/real[] elements
+// (or int/real columns of soa arrays) at index i (--simd). Lanes are i64x2 or f64x2, one per step's value kind.
+struct SimdLoop {
+  int id = 0;
+  std::string index_name;
+  LocalInfo index;
+  ExprPtr limit;
+  std::vector<SimdStep> steps;
+};
+
+// Returns the vector plan for a While statement, or nullopt when the loop is
+// not in the recognized shape. Element values may read arrays at exactly i,
+// i itself, loop-invariant locals and literals, combined with + - * (and /
+// for real); every other construct keeps the loop scalar.
+std::optional<SimdLoop>
+MatchSimdLoop(const Stmt &loop, const Env &env,
+              const std::unordered_map<std::string, StructInfo> &structs);
+
+// Field offset of `a[i].f`, which scales to the column offset of a soa array.
+int64_t
+ColumnOffset(const ExprPtr &field,
+             const std::unordered_map<std::string, StructInfo> &structs);
@@ -29,6 +29,7 @@ struct StructInfo {
   std::unordered_map<std::string, FieldInfo> field_map;
   std::unordered_map<std::string, Function *> methods;
   int64_t size = 0;
+  bool soa = false;
 };
 
 struct FunctionInfo {
@@ -47,4 +48,6 @@ struct Env {
   std::unordered_map<std::string, LocalInfo> locals;
   std::unordered_map<std::string, LocalInfo> params;
   std::string current_struct;
+  // The gen[T] returned by the generator function being checked, if any.
+  std::shared_ptr<Type> generator;
 };
@@ -132,7 +132,8 @@ void Lexer::LexLine(const std::string &line, int line_no, std::vector<Token> &to
             while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) {
                 i++;
             }
-            if (i < line.size() && line[i] == '.') {
+            // 0..n is a range, not the real 0.
+            if (i + 1 < line.size() && line[i] == '.' && line[i + 1] != '.') {
                 is_real = true;
                 i++;
                 while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) {
@@ -195,6 +196,11 @@ void Lexer::LexLine(const std::string &line, int line_no, std::vector<Token> &to
                 i++;
                 break;
             case '.':
+                if (i + 1 < line.size() && line[i + 1] == '.') {
+                    tokens.push_back({TokenType::DotDot, "..", line_no});
+                    i += 2;
+                    break;
+                }
                 tokens.push_back({TokenType::Dot, ".", line_no});
                 i++;
                 break;
@@ -267,7 +273,8 @@ void Lexer::LexLine(const std::string &line, int line_no, std::vector<Token> &to
 bool Lexer::IsKeyword(const std::string &word) {
     static const std::unordered_set<std::string> keywords = {
         "int", "real", "bool", "string", "void", "if", "else", "while", "return",
-        "true", "false", "new", "and", "or", "extends", "import", "as"
+        "true", "false", "new", "and", "or", "extends", "import", "as",
+        "soa", "parallel", "spawn", "yield", "match", "case", "for"
     };
     return keywords.count(word) > 0;
 }
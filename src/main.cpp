@@ -37,20 +37,57 @@ static std::string GetDirname(const std::string &path) {
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        std::cerr << "Usage: ionc <input.ion> [-o output.wat]\n";
+        std::cerr << "Usage: ionc <input.ion> [-o output.wat] [--gc] [--simd] [--bounds-check] [--tail-loops] [--threads[=N]] [--target=wasm|wasm-gc]\n";
         return 1;
     }
     std::string input_path = argv[1];
     std::string output_wat = "output.wat";
+    CodegenOptions options;
     for (int i = 2; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "-o" && i + 1 < argc) {
             output_wat = argv[++i];
+        } else if (arg == "--gc") {
+            options.gc = true;
+        } else if (arg == "--simd") {
+            options.simd = true;
+        } else if (arg == "--bounds-check") {
+            options.bounds_check = true;
+        } else if (arg == "--tail-loops") {
+            options.tail_loops = true;
+        } else if (arg == "--threads") {
+            options.threads = 4;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = std::atoi(arg.c_str() + 10);
+            if (options.threads < 1 || options.threads > 64) {
+                std::cerr << "--threads=N needs 1 <= N <= 64\n";
+                return 1;
+            }
+        } else if (arg == "--target=wasm") {
+            options.target = Target::Wasm;
+        } else if (arg == "--target=wasm-gc") {
+            options.target = Target::WasmGc;
         } else {
             std::cerr << "Unknown argument: " << arg << "\n";
             return 1;
         }
     }
+    if (options.gc && options.target == Target::WasmGc) {
+        std::cerr << "--gc cannot be combined with --target=wasm-gc (the engine collects the heap)\n";
+        return 1;
+    }
+    if (options.simd && options.target == Target::WasmGc) {
+        std::cerr << "--simd cannot be combined with --target=wasm-gc (GC arrays have no vector loads)\n";
+        return 1;
+    }
+    if (options.threads && options.gc) {
+        std::cerr << "--threads cannot be combined with --gc (the collector is single-threaded)\n";
+        return 1;
+    }
+    if (options.threads && options.target == Target::WasmGc) {
+        std::cerr << "--threads cannot be combined with --target=wasm-gc (GC heap objects cannot be shared)\n";
+        return 1;
+    }
     try {
         std::string main_dir = GetDirname(input_path);
         ModuleLoader loader(main_dir);
@@ -59,7 +96,7 @@ int main(int argc, char **argv) {
         loader.ParsePrograms(all_types);
         Program merged = loader.MergePrograms(input_path);
 
-        std::string wat = GenerateWasm(merged, all_types);
+        std::string wat = GenerateWasm(merged, all_types, options);
         WriteFile(output_wat, wat);
     } catch (const CompileError &err) {
         std::cerr << "Compile error: " << err.what() << "\n";
@@ -15,6 +15,7 @@
 
 #include "lexer.h"
 #include "parser.h"
+#include "type_system.h"
 
 ModuleLoader::ModuleLoader(const std::string &main_dir) : main_dir_(main_dir) {}
 
@@ -23,7 +24,8 @@ void ModuleLoader::Load(const std::string &input_path) {
 }
 
 std::unordered_set<std::string> ModuleLoader::CollectTypeNames() const {
-    std::unordered_set<std::string> all_types = {"int", "real", "bool", "string"};
+    std::unordered_set<std::string> all_types = {"int", "real", "bool", "string", "int2", "real2", "byte", "i32", "f32",
+                                                   "string_builder"};
     for (const auto &entry : modules_) {
         all_types.insert(entry.second.struct_names.begin(), entry.second.struct_names.end());
     }
@@ -269,6 +271,9 @@ std::unordered_set<std::string> ModuleLoader::ScanStructNames(const std::vector<
                    (tokens[first].type == TokenType::Indent || tokens[first].type == TokenType::Dedent)) {
                 first++;
             }
+            if (first < line_end && tokens[first].type == TokenType::Keyword && tokens[first].text == "soa") {
+                first++;
+            }
             bool has_paren = false;
             bool has_colon = false;
             for (size_t i = line_start; i < line_end; ++i) {
@@ -276,7 +281,8 @@ std::unordered_set<std::string> ModuleLoader::ScanStructNames(const std::vector<
                     has_paren = true;
                     break;
                 }
-                if (tokens[i].type == TokenType::Colon) {
+                // Only a trailing colon opens a struct; x = a[1:2] is a slice.
+                if (tokens[i].type == TokenType::Colon && i + 1 == line_end) {
                     has_colon = true;
                 }
             }
@@ -327,15 +333,27 @@ void ModuleLoader::RewriteExpr(const ExprPtr &expr, const std::string &module_na
     if (expr->kind != ExprKind::Call || !expr->base) {
         return;
     }
-    if (expr->base->kind == ExprKind::Var) {
-        std::string name = expr->base->text;
+    bool pipeline = expr->base->kind == ExprKind::Var && IsPipelineBuiltin(expr->base->text) &&
+                    !(qualify_local && local_functions.count(expr->base->text) > 0);
+    RewriteCallee(expr->base, module_name, qualify_local, local_functions, import_aliases);
+    if (pipeline && expr->args.size() > 1) {
+        // map(xs, f): f names a function just like a callee does.
+        RewriteCallee(expr->args[1], module_name, qualify_local, local_functions, import_aliases);
+    }
+}
+
+void ModuleLoader::RewriteCallee(ExprPtr &callee, const std::string &module_name, bool qualify_local,
+                                 const std::unordered_set<std::string> &local_functions,
+                                 const std::unordered_map<std::string, std::string> &import_aliases) {
+    if (callee->kind == ExprKind::Var) {
+        std::string name = callee->text;
         if (qualify_local && local_functions.count(name) > 0) {
-            expr->base->text = module_name + "." + name;
+            callee->text = module_name + "." + name;
         }
         return;
     }
     std::vector<std::string> parts;
-    if (!BuildFieldChain(expr->base, parts) || parts.size() < 2) {
+    if (!BuildFieldChain(callee, parts) || parts.size() < 2) {
         return;
     }
     std::string module_path;
@@ -353,8 +371,8 @@ void ModuleLoader::RewriteExpr(const ExprPtr &expr, const std::string &module_na
     auto node = std::make_shared<Expr>();
     node->kind = ExprKind::Var;
     node->text = qualified;
-    node->line = expr->line;
-    expr->base = node;
+    node->line = callee->line;
+    callee = node;
 }
 
 void ModuleLoader::RewriteStmt(const StmtPtr &stmt, const std::string &module_name, bool qualify_local,
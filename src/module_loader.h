@@ -56,6 +56,10 @@ private:
     static void RewriteExpr(const ExprPtr &expr, const std::string &module_name, bool qualify_local,
                             const std::unordered_set<std::string> &local_functions,
                             const std::unordered_map<std::string, std::string> &import_aliases);
+    // Qualifies a function named by a Var or an `alias.function` chain.
+    static void RewriteCallee(ExprPtr &callee, const std::string &module_name, bool qualify_local,
+                              const std::unordered_set<std::string> &local_functions,
+                              const std::unordered_map<std::string, std::string> &import_aliases);
     static void RewriteStmt(const StmtPtr &stmt, const std::string &module_name, bool qualify_local,
                             const std::unordered_set<std::string> &local_functions,
                             const std::unordered_map<std::string, std::string> &import_aliases);
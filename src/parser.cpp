@@ -9,9 +9,14 @@
 
 #include "parser.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
 Parser::Parser(const std::vector<Token> &tokens, const std::unordered_set<std::string> &extra_types)
     : tokens_(tokens),
-      type_names_({"int", "real", "bool", "string"}) {
+      type_names_({"int", "real", "bool", "string", "int2", "real2", "byte", "i32", "f32",
+                  "string_builder"}) {
     type_names_.insert(extra_types.begin(), extra_types.end());
     PreScanStructNames();
 }
@@ -54,6 +59,9 @@ void Parser::PreScanStructNames() {
             while (first < line_end && (tokens_[first].type == TokenType::Indent || tokens_[first].type == TokenType::Dedent)) {
                 first++;
             }
+            if (first < line_end && tokens_[first].type == TokenType::Keyword && tokens_[first].text == "soa") {
+                first++;
+            }
             bool has_paren = false;
             bool has_colon = false;
             for (size_t i = line_start; i < line_end; ++i) {
@@ -61,7 +69,8 @@ void Parser::PreScanStructNames() {
                     has_paren = true;
                     break;
                 }
-                if (tokens_[i].type == TokenType::Colon) {
+                // Only a trailing colon opens a struct; x = a[1:2] is a slice.
+                if (tokens_[i].type == TokenType::Colon && i + 1 == line_end) {
                     has_colon = true;
                 }
             }
@@ -82,6 +91,9 @@ bool Parser::IsStructDeclLine() {
     while (idx < tokens_.size() && (tokens_[idx].type == TokenType::Indent || tokens_[idx].type == TokenType::Dedent)) {
         idx++;
     }
+    if (idx < tokens_.size() && tokens_[idx].type == TokenType::Keyword && tokens_[idx].text == "soa") {
+        idx++;
+    }
     if (idx >= tokens_.size() || tokens_[idx].type != TokenType::Identifier) {
         return false;
     }
@@ -93,7 +105,10 @@ bool Parser::IsStructDeclLine() {
             has_paren = true;
             break;
         }
-        if (tokens_[idx].type == TokenType::Colon) {
+        // Only a trailing colon opens a struct; x = a[1:2] is a slice.
+        if (tokens_[idx].type == TokenType::Colon && idx + 1 < tokens_.size() &&
+            (tokens_[idx + 1].type == TokenType::Newline ||
+             tokens_[idx + 1].type == TokenType::EndOfFile)) {
             has_colon = true;
         }
         idx++;
@@ -130,6 +145,7 @@ ImportDecl Parser::ParseImport() {
 
 StructDef Parser::ParseStructDecl() {
     StructDef def;
+    def.soa = MatchKeyword("soa");
     Token name = Consume(TokenType::Identifier, "Expected struct name");
     def.name = name.text;
     def.line = name.line;
@@ -228,6 +244,28 @@ StmtPtr Parser::ParseStatement() {
     if (MatchKeyword("while")) {
         return ParseWhile();
     }
+    if (MatchKeyword("match")) {
+        return ParseMatch();
+    }
+    if (MatchKeyword("for")) {
+        return ParseFor();
+    }
+    if (MatchKeyword("parallel")) {
+        if (!MatchKeyword("while")) {
+            throw CompileError("Expected while after parallel at line " + std::to_string(Previous().line));
+        }
+        StmtPtr stmt = ParseWhile();
+        stmt->parallel = true;
+        return stmt;
+    }
+    if (MatchKeyword("yield")) {
+        auto stmt = std::make_shared<Stmt>();
+        stmt->kind = StmtKind::Yield;
+        stmt->line = Previous().line;
+        stmt->expr = ParseExpression();
+        Consume(TokenType::Newline, "Expected newline after yield");
+        return stmt;
+    }
     if (MatchKeyword("return")) {
         auto stmt = std::make_shared<Stmt>();
         stmt->kind = StmtKind::Return;
@@ -296,6 +334,153 @@ StmtPtr Parser::ParseWhile() {
     return stmt;
 }
 
+StmtPtr Parser::ParseMatch() {
+    auto stmt = std::make_shared<Stmt>();
+    stmt->kind = StmtKind::Match;
+    stmt->expr = ParseExpression();
+    stmt->line = stmt->expr->line;
+    Consume(TokenType::Newline, "Expected newline after match value");
+    Consume(TokenType::Indent, "Expected case after match");
+    bool has_else = false;
+    while (!Check(TokenType::Dedent) && !Check(TokenType::EndOfFile)) {
+        if (Match(TokenType::Newline)) {
+            continue;
+        }
+        if (has_else) {
+            throw CompileError("The else arm must come last in match at line " +
+                               std::to_string(Peek().line));
+        }
+        if (MatchKeyword("else")) {
+            Consume(TokenType::Newline, "Expected newline after else");
+            stmt->else_body = ParseBlock();
+            has_else = true;
+            continue;
+        }
+        if (!MatchKeyword("case")) {
+            throw CompileError("Expected case or else in match at line " +
+                               std::to_string(Peek().line));
+        }
+        auto arm = std::make_shared<Stmt>();
+        arm->kind = StmtKind::Case;
+        arm->line = Previous().line;
+        do {
+            bool negative = Match(TokenType::Minus);
+            Token value = Consume(TokenType::Integer, "Expected integer case value");
+            arm->cases.push_back(negative ? -std::stoll(value.text) : std::stoll(value.text));
+        } while (Match(TokenType::Comma));
+        Consume(TokenType::Newline, "Expected newline after case values");
+        arm->then_body = ParseBlock();
+        stmt->body.push_back(arm);
+    }
+    Consume(TokenType::Dedent, "Expected end of match");
+    if (stmt->body.empty()) {
+        throw CompileError("match needs at least one case at line " +
+                           std::to_string(stmt->line));
+    }
+    return stmt;
+}
+
+// for i in a..b step s becomes
+//     int i.end = b        (left out when b is a literal)
+//     int i = a
+//     while i < i.end      (i > i.end for a negative step)
+//         body
+//         i = i + s
+// so the loop analyses see an ordinary counted while; the type checker keeps
+// the body from assigning i and the code generator rotates the loop.
+StmtPtr Parser::ParseFor() {
+    int line = Previous().line;
+    Token index = Consume(TokenType::Identifier, "Expected loop variable after for");
+    if (!Check(TokenType::Identifier) || Peek().text != "in") {
+        throw CompileError("Expected 'in' after for " + index.text + " at line " +
+                           std::to_string(line));
+    }
+    Advance();
+    ExprPtr lo = ParseExpression();
+    Consume(TokenType::DotDot, "Expected '..' in for range");
+    ExprPtr hi = ParseExpression();
+    int64_t step = 1;
+    if (Check(TokenType::Identifier) && Peek().text == "step") {
+        Advance();
+        bool negative = Match(TokenType::Minus);
+        Token value = Consume(TokenType::Integer, "Expected integer step");
+        step = negative ? -std::stoll(value.text) : std::stoll(value.text);
+        if (step == 0) {
+            throw CompileError("for step cannot be 0 at line " + std::to_string(line));
+        }
+    }
+    Consume(TokenType::Newline, "Expected newline after for range");
+
+    auto var = [&](const std::string &name) {
+        auto node = std::make_shared<Expr>();
+        node->kind = ExprKind::Var;
+        node->text = name;
+        node->line = line;
+        return node;
+    };
+    auto binary = [&](const std::string &op, ExprPtr left, ExprPtr right) {
+        auto node = std::make_shared<Expr>();
+        node->kind = ExprKind::Binary;
+        node->op = op;
+        node->left = left;
+        node->right = right;
+        node->line = line;
+        return node;
+    };
+    auto decl = [&](const std::string &name, ExprPtr value) {
+        auto stmt = std::make_shared<Stmt>();
+        stmt->kind = StmtKind::VarDecl;
+        stmt->var_type = TypeSpec{"int", 0, false};
+        stmt->var_name = name;
+        stmt->expr = value;
+        stmt->line = line;
+        return stmt;
+    };
+
+    auto stmt = std::make_shared<Stmt>();
+    stmt->kind = StmtKind::For;
+    stmt->var_name = index.text;
+    stmt->step = step;
+    stmt->line = line;
+    ExprPtr limit = hi;
+    if (hi->kind != ExprKind::IntLit) {
+        stmt->body.push_back(decl(index.text + ".end", hi));
+        limit = var(index.text + ".end");
+    }
+    stmt->body.push_back(decl(index.text, lo));
+    if (lo->kind == ExprKind::IntLit && hi->kind == ExprKind::IntLit) {
+        // Unsigned, so bounds at opposite ends of the range do not overflow.
+        bool runs = step > 0 ? hi->int_value > lo->int_value : lo->int_value > hi->int_value;
+        uint64_t span = step > 0 ? static_cast<uint64_t>(hi->int_value) - static_cast<uint64_t>(lo->int_value)
+                                 : static_cast<uint64_t>(lo->int_value) - static_cast<uint64_t>(hi->int_value);
+        uint64_t stride = step > 0 ? static_cast<uint64_t>(step) : 0 - static_cast<uint64_t>(step);
+        uint64_t trips = runs ? span / stride + (span % stride != 0) : 0;
+        stmt->trip_count = static_cast<int64_t>(
+            std::min<uint64_t>(trips, std::numeric_limits<int64_t>::max()));
+    }
+
+    auto loop = std::make_shared<Stmt>();
+    loop->kind = StmtKind::While;
+    loop->var_name = index.text;
+    loop->step = step;
+    loop->trip_count = stmt->trip_count;
+    loop->expr = binary(step > 0 ? "<" : ">", var(index.text), limit);
+    loop->line = line;
+    loop->body = ParseBlock();
+    auto next = std::make_shared<Stmt>();
+    next->kind = StmtKind::Assign;
+    next->target = var(index.text);
+    auto amount = std::make_shared<Expr>();
+    amount->kind = ExprKind::IntLit;
+    amount->int_value = step > 0 ? step : -step;
+    amount->line = line;
+    next->expr = binary(step > 0 ? "+" : "-", var(index.text), amount);
+    next->line = line;
+    loop->body.push_back(next);
+    stmt->body.push_back(loop);
+    return stmt;
+}
+
 TypeSpec Parser::ParseReturnType() {
     if (MatchKeyword("void")) {
         return TypeSpec{"", 0, true};
@@ -318,10 +503,32 @@ TypeSpec Parser::ParseType() {
     } else {
         throw CompileError("Expected type name at line " + std::to_string(Peek().line));
     }
-    while (Check(TokenType::LBracket) && PeekNext().type == TokenType::RBracket) {
+    if (type.name == "map" && Match(TokenType::LBracket)) {
+        type.params.push_back(ParseType());
+        Consume(TokenType::Comma, "Expected ',' between map key and value types");
+        type.params.push_back(ParseType());
+        Consume(TokenType::RBracket, "Expected ']' after map value type");
+    } else if (type.name == "vec" && Match(TokenType::LBracket)) {
+        type.params.push_back(ParseType());
+        Consume(TokenType::RBracket, "Expected ']' after vec element type");
+    } else if (type.name == "gen" && Match(TokenType::LBracket)) {
+        type.params.push_back(ParseType());
+        Consume(TokenType::RBracket, "Expected ']' after gen value type");
+    } else if (type.name == "task" && Match(TokenType::LBracket)) {
+        type.params.push_back(ParseReturnType());
+        Consume(TokenType::RBracket, "Expected ']' after task result type");
+    }
+    while (Check(TokenType::LBracket) &&
+           (PeekNext().type == TokenType::RBracket || PeekNext().type == TokenType::Comma)) {
         Advance();
+        while (Match(TokenType::Comma)) {
+            type.dims++;
+        }
         Consume(TokenType::RBracket, "Expected ']' in array type");
         type.array_depth++;
+        if (type.dims > 1 && type.array_depth > 1) {
+            throw CompileError("Rectangular arrays cannot be nested at line " + std::to_string(Previous().line));
+        }
     }
     return type;
 }
@@ -387,6 +594,18 @@ ExprPtr Parser::ParseUnary() {
     if (Match(TokenType::Bang)) {
         return MakeUnary("!", ParseUnary());
     }
+    if (MatchKeyword("spawn")) {
+        int line = Previous().line;
+        ExprPtr call = ParsePostfix();
+        if (call->kind != ExprKind::Call) {
+            throw CompileError("Expected a function call after spawn at line " + std::to_string(line));
+        }
+        auto node = std::make_shared<Expr>();
+        node->kind = ExprKind::Spawn;
+        node->left = call;
+        node->line = line;
+        return node;
+    }
     return ParsePostfix();
 }
 
@@ -395,9 +614,28 @@ ExprPtr Parser::ParsePostfix() {
     bool keep = true;
     while (keep) {
         if (Match(TokenType::LBracket)) {
-            ExprPtr index = ParseExpression();
-            Consume(TokenType::RBracket, "Expected ']' after index");
+            ExprPtr index;
+            if (!Check(TokenType::Colon)) {
+                index = ParseExpression();
+            }
+            if (Match(TokenType::Colon)) {
+                auto node = std::make_shared<Expr>();
+                node->kind = ExprKind::Slice;
+                node->base = expr;
+                node->left = index;
+                if (!Check(TokenType::RBracket)) {
+                    node->right = ParseExpression();
+                }
+                Consume(TokenType::RBracket, "Expected ']' after slice");
+                node->line = expr->line;
+                expr = node;
+                continue;
+            }
             auto node = std::make_shared<Expr>();
+            while (Match(TokenType::Comma)) {
+                node->args.push_back(ParseExpression());
+            }
+            Consume(TokenType::RBracket, "Expected ']' after index");
             node->kind = ExprKind::Index;
             node->base = expr;
             node->left = index;
@@ -465,6 +703,9 @@ ExprPtr Parser::ParseTerm() {
         node->new_type = ParseType();
         if (Match(TokenType::LBracket)) {
             node->new_size = ParseExpression();
+            while (Match(TokenType::Comma)) {
+                node->args.push_back(ParseExpression());
+            }
             Consume(TokenType::RBracket, "Expected ']' after new size");
         }
         node->line = Previous().line;
@@ -510,7 +751,10 @@ bool Parser::IsTypeStart() {
         return kw == "int" || kw == "real" || kw == "bool" || kw == "string";
     }
     if (Check(TokenType::Identifier)) {
-        return type_names_.count(Peek().text) > 0;
+        return type_names_.count(Peek().text) > 0 ||
+               ((Peek().text == "map" || Peek().text == "vec" || Peek().text == "task" ||
+                 Peek().text == "gen") &&
+                PeekNext().type == TokenType::LBracket);
     }
     return false;
 }
@@ -36,6 +36,8 @@ private:
     StmtPtr ParseStatement();
     StmtPtr ParseIf();
     StmtPtr ParseWhile();
+    StmtPtr ParseMatch();
+    StmtPtr ParseFor();
     TypeSpec ParseReturnType();
     TypeSpec ParseType();
     ExprPtr ParseExpression();
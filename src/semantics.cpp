@@ -11,6 +11,8 @@
 #include "common.h"
 #include "type_system.h" // For ResolveType and TypeLayout utils
 
+#include <algorithm>
+
 // --- Symbol Lookup ---
 
 std::optional<LookupResult>
@@ -62,10 +64,20 @@ void ComputeStructLayouts(
         offset = parent.size;
         info.fields = parent.fields;
       }
+      // Own fields go widest first so narrow ones pack without padding;
+      // inherited fields keep the parent's layout as a prefix.
+      std::vector<FieldInfo> own;
       for (const auto &field : def.fields) {
         FieldInfo finfo;
         finfo.name = field.second;
         finfo.type = ResolveType(field.first, structs);
+        own.push_back(finfo);
+      }
+      std::stable_sort(own.begin(), own.end(),
+                       [](const FieldInfo &a, const FieldInfo &b) {
+                         return GetTypeSize(a.type) > GetTypeSize(b.type);
+                       });
+      for (auto &finfo : own) {
         finfo.offset = offset;
         offset += GetTypeSize(finfo.type); // Using TypeSystem util
         info.fields.push_back(finfo);
@@ -86,6 +98,26 @@ void ComputeStructLayouts(
       throw CompileError("Struct layout failed for " + entry.first);
     }
   }
+  // Column offsets reuse the field offsets, so a derived array stays
+  // readable as its parent's only when both are laid out as columns.
+  for (const auto &def : program.structs) {
+    const StructInfo &info = structs.at(def.name);
+    if (!def.parent.empty() && structs.at(def.parent).soa != info.soa) {
+      throw CompileError("Struct " + def.name + " and its parent " +
+                         def.parent + " must both be soa or neither");
+    }
+    if (!info.soa) {
+      continue;
+    }
+    for (const auto &field : info.fields) {
+      TypeKind kind = field.type->kind;
+      if (kind != TypeKind::Int && kind != TypeKind::Real &&
+          kind != TypeKind::Bool) {
+        throw CompileError("Field " + field.name + " of soa struct " +
+                           def.name + " must be a numeric or bool scalar");
+      }
+    }
+  }
 }
 
 // --- Function Catalog ---
@@ -37,6 +37,25 @@ void StringLiteralTable::Build(const Program &program) {
   heap_start_ = Align8(data_cursor_);
 }
 
+// Appends a raw (non-string) data segment after the literals, e.g. runtime
+// lookup tables. The heap start moves past it.
+int64_t StringLiteralTable::AddData(const std::string &bytes) {
+  int64_t offset = Align8(data_cursor_);
+  data_segments_.push_back({offset, bytes});
+  data_cursor_ = offset + static_cast<int64_t>(bytes.size());
+  heap_start_ = Align8(data_cursor_);
+  return offset;
+}
+
+// Reserves zero-initialised scratch space after the data segments (e.g. the
+// stdout buffer) without emitting a segment for it.
+int64_t StringLiteralTable::Reserve(int64_t size) {
+  int64_t offset = Align8(data_cursor_);
+  data_cursor_ = offset + size;
+  heap_start_ = Align8(data_cursor_);
+  return offset;
+}
+
 const std::unordered_map<std::string, int64_t> &
 StringLiteralTable::Offsets() const {
   return string_offsets_;
@@ -77,6 +96,7 @@ void StringLiteralTable::CollectStrings(const StmtPtr &stmt) {
   case StmtKind::Assign:
   case StmtKind::ExprStmt:
   case StmtKind::Return:
+  case StmtKind::Yield:
     CollectStrings(stmt->expr);
     CollectStrings(stmt->target);
     break;
@@ -95,6 +115,25 @@ void StringLiteralTable::CollectStrings(const StmtPtr &stmt) {
       CollectStrings(s);
     }
     break;
+  case StmtKind::Match:
+    CollectStrings(stmt->expr);
+    for (const auto &s : stmt->body) {
+      CollectStrings(s);
+    }
+    for (const auto &s : stmt->else_body) {
+      CollectStrings(s);
+    }
+    break;
+  case StmtKind::Case:
+    for (const auto &s : stmt->then_body) {
+      CollectStrings(s);
+    }
+    break;
+  case StmtKind::For:
+    for (const auto &s : stmt->body) {
+      CollectStrings(s);
+    }
+    break;
   }
 }
 
@@ -106,7 +145,13 @@ void StringLiteralTable::CollectStrings(const ExprPtr &expr) {
       expr->base->kind == ExprKind::Var && expr->base->text == "print" &&
       !expr->args.empty() && expr->args[0]->kind == ExprKind::StringLit) {
     if (expr->args.size() > 1 || NeedsFormat(expr->args[0]->text)) {
+      // Literal formats are printed piece by piece; the whole string is not
+      // needed in memory.
       AddFormatLiterals(expr->args[0]->text);
+      for (size_t i = 1; i < expr->args.size(); ++i) {
+        CollectStrings(expr->args[i]);
+      }
+      return;
     }
   }
   if (expr->kind == ExprKind::StringLit) {
@@ -149,6 +194,15 @@ int64_t StringLiteralTable::AddStringLiteral(const std::string &value) {
 }
 
 void StringLiteralTable::AddFormatLiterals(const std::string &format) {
+  for (const auto &piece : ParseFormat(format)) {
+    if (!piece.spec) {
+      AddStringLiteral(piece.text);
+    }
+  }
+}
+
+std::vector<FormatPiece> ParseFormat(const std::string &format) {
+  std::vector<FormatPiece> pieces;
   std::string literal;
   for (size_t i = 0; i < format.size(); ++i) {
     char c = format[i];
@@ -160,14 +214,16 @@ void StringLiteralTable::AddFormatLiterals(const std::string &format) {
         continue;
       }
       if (!literal.empty()) {
-        AddStringLiteral(literal);
+        pieces.push_back(FormatPiece{0, literal, -1});
         literal.clear();
       }
       if (next == 'i' || next == 'b' || next == 's') {
+        pieces.push_back(FormatPiece{next, "", -1});
         i++;
         continue;
       }
       if (next == 'r' || next == 'e') {
+        FormatPiece piece{next, "", -1};
         i++;
         if (i + 1 < format.size() && format[i + 1] == '{') {
           i += 2;
@@ -175,14 +231,17 @@ void StringLiteralTable::AddFormatLiterals(const std::string &format) {
               !std::isdigit(static_cast<unsigned char>(format[i]))) {
             throw CompileError("Format precision requires digits");
           }
+          piece.precision = 0;
           while (i < format.size() &&
                  std::isdigit(static_cast<unsigned char>(format[i]))) {
+            piece.precision = piece.precision * 10 + (format[i] - '0');
             i++;
           }
           if (i >= format.size() || format[i] != '}') {
             throw CompileError("Format precision missing '}'");
           }
         }
+        pieces.push_back(piece);
         continue;
       }
       throw CompileError("Unsupported format specifier in print");
@@ -190,8 +249,9 @@ void StringLiteralTable::AddFormatLiterals(const std::string &format) {
     literal.push_back(c);
   }
   if (!literal.empty()) {
-    AddStringLiteral(literal);
+    pieces.push_back(FormatPiece{0, literal, -1});
   }
+  return pieces;
 }
 
 bool StringLiteralTable::NeedsFormat(const std::string &format) {
@@ -16,10 +16,22 @@
 
 #include "ast.h"
 
+// One piece of a print format string: literal text (spec == 0) or a %i, %b,
+// %s, %r or %e conversion with its {precision} (-1 when absent).
+struct FormatPiece {
+    char spec = 0;
+    std::string text;
+    int precision = -1;
+};
+
+std::vector<FormatPiece> ParseFormat(const std::string &format);
+
 class StringLiteralTable {
 public:
     explicit StringLiteralTable(int64_t base_cursor = 4096);
     void Build(const Program &program);
+    int64_t AddData(const std::string &bytes);
+    int64_t Reserve(int64_t size);
     const std::unordered_map<std::string, int64_t> &Offsets() const;
     const std::vector<std::pair<int64_t, std::string>> &Segments() const;
     int64_t HeapStart() const;
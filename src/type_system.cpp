@@ -8,11 +8,13 @@
 // Cheers!
 
 #include "type_system.h"
+#include "codegen_parallel.h"
 #include "common.h"
 #include "semantics.h"
 
 #include <iostream>
 #include <optional>
+#include <unordered_set>
 
 // --- Type Resolution & Layout ---
 
@@ -22,6 +24,7 @@ void InitStructs(const Program &program,
     StructInfo info;
     info.name = def.name;
     info.parent = def.parent;
+    info.soa = def.soa;
     structs[def.name] = info;
   }
 }
@@ -34,39 +37,123 @@ ResolveType(const TypeSpec &spec,
   }
   std::cerr << "ResolveType: " << spec.name << std::endl;
   std::shared_ptr<Type> base;
-  if (spec.name == "int") {
-    base = std::make_shared<Type>(Type{TypeKind::Int, "int", nullptr});
-  } else if (spec.name == "real") {
-    base = std::make_shared<Type>(Type{TypeKind::Real, "real", nullptr});
+  if (spec.name == "int" || spec.name == "byte" || spec.name == "i32") {
+    base = std::make_shared<Type>(Type{TypeKind::Int, spec.name, nullptr});
+  } else if (spec.name == "real" || spec.name == "f32") {
+    base = std::make_shared<Type>(Type{TypeKind::Real, spec.name, nullptr});
   } else if (spec.name == "bool") {
     base = std::make_shared<Type>(Type{TypeKind::Bool, "bool", nullptr});
   } else if (spec.name == "string") {
     base = std::make_shared<Type>(Type{TypeKind::String, "string", nullptr});
+  } else if (spec.name == "string_builder") {
+    base = std::make_shared<Type>(
+        Type{TypeKind::StringBuilder, "string_builder", nullptr});
+  } else if (spec.name == "map") {
+    if (spec.params.size() != 2)
+      throw CompileError("map needs key and value types: map[K, V]");
+    auto key = ResolveType(spec.params[0], structs);
+    auto value = ResolveType(spec.params[1], structs);
+    if (key->name != "int" && key->kind != TypeKind::String)
+      throw CompileError("map keys are int or string");
+    // Every value sits in an 8-byte cell.
+    if (value->kind == TypeKind::Vector || IsNarrow(value))
+      throw CompileError("map values cannot be " + value->name);
+    base = std::make_shared<Type>(Type{TypeKind::Map, "map", value});
+    base->key = key;
+  } else if (spec.name == "vec") {
+    if (spec.params.size() != 1)
+      throw CompileError("vec needs an element type: vec[T]");
+    auto elem = ResolveType(spec.params[0], structs);
+    // as_array() views the buffer as a T[], so T must fit a plain array.
+    auto array = std::make_shared<Type>(Type{TypeKind::Array, "", elem});
+    if (elem->kind == TypeKind::Vector || IsSoaArray(array, structs))
+      throw CompileError("vec elements cannot be " + elem->name);
+    base = std::make_shared<Type>(Type{TypeKind::Vec, "vec", elem});
+  } else if (spec.name == "task") {
+    if (spec.params.size() != 1)
+      throw CompileError("task needs a result type: task[T]");
+    // The result travels in one 8-byte cell.
+    auto result = ResolveType(spec.params[0], structs);
+    if (result->kind == TypeKind::Vector)
+      throw CompileError("task results cannot be " + result->name);
+    base = std::make_shared<Type>(Type{TypeKind::Task, "task", result});
+  } else if (spec.name == "gen") {
+    if (spec.params.size() != 1)
+      throw CompileError("gen needs a value type: gen[T]");
+    // Each yielded value is parked in one 8-byte cell of the frame.
+    auto value = ResolveType(spec.params[0], structs);
+    if (value->kind == TypeKind::Vector || value->kind == TypeKind::Void)
+      throw CompileError("gen values cannot be " + value->name);
+    base = std::make_shared<Type>(Type{TypeKind::Gen, "gen", value});
+  } else if (spec.name == "int2" || spec.name == "real2") {
+    if (spec.array_depth > 0) {
+      throw CompileError("Arrays of " + spec.name +
+                         " are not supported; use load2/store2 on " +
+                         spec.name.substr(0, spec.name.size() - 1) + "[]");
+    }
+    TypeSpec lane{spec.name.substr(0, spec.name.size() - 1), 0, false};
+    base = std::make_shared<Type>(
+        Type{TypeKind::Vector, spec.name, ResolveType(lane, structs)});
   } else {
     if (structs.count(spec.name) == 0) {
       throw CompileError("Unknown type '" + spec.name + "'");
     }
     base = std::make_shared<Type>(Type{TypeKind::Struct, spec.name, nullptr});
   }
+  if (spec.dims > 1) {
+    // Elements sit inline in one block the collector scans as raw data.
+    if (base->kind != TypeKind::Int && base->kind != TypeKind::Real &&
+        base->kind != TypeKind::Bool)
+      throw CompileError("Rectangular arrays hold int, real or bool elements, "
+                         "not " + spec.name);
+    if (spec.dims > kMaxArrayDims)
+      throw CompileError("Rectangular arrays have at most " +
+                         std::to_string(kMaxArrayDims) + " dimensions");
+  }
   for (int i = 0; i < spec.array_depth; ++i) {
     base = std::make_shared<Type>(Type{TypeKind::Array, "", base});
   }
+  if (spec.array_depth > 0)
+    base->dims = spec.dims;
   std::cerr << "ResolveType returning addr: " << base.get() << std::endl;
   return base;
 }
 
 int64_t Align8(int64_t value) { return (value + 7) & ~static_cast<int64_t>(7); }
 
+bool IsNarrow(const std::shared_ptr<Type> &type) {
+  return type->name == "byte" || type->name == "i32" || type->name == "f32";
+}
+
+bool IsSoaArray(const std::shared_ptr<Type> &type,
+                const std::unordered_map<std::string, StructInfo> &structs) {
+  if (!type || type->kind != TypeKind::Array || !type->element ||
+      type->element->kind != TypeKind::Struct)
+    return false;
+  auto it = structs.find(type->element->name);
+  return it != structs.end() && it->second.soa;
+}
+
 int64_t GetTypeSize(const std::shared_ptr<Type> &type) {
-  // Basic types are 64-bit in this implementation
+  // Values live in 64-bit registers; narrow types only shrink the storage.
   switch (type->kind) {
   case TypeKind::Int:
+    return type->name == "byte" ? 1 : type->name == "i32" ? 4 : 8;
   case TypeKind::Real:
+    return type->name == "f32" ? 4 : 8;
   case TypeKind::Bool:
+    return 1;
   case TypeKind::String:
+  case TypeKind::StringBuilder:
+  case TypeKind::Map:
+  case TypeKind::Vec:
+  case TypeKind::Task:
+  case TypeKind::Gen:
   case TypeKind::Struct:
   case TypeKind::Array:
     return 8;
+  case TypeKind::Vector:
+    return 16;
   case TypeKind::Void:
     return 0;
   }
@@ -82,7 +169,36 @@ bool IsAssignable(const std::shared_ptr<Type> &expected,
     return false;
   }
   if (expected->kind == TypeKind::Array) {
-    return IsAssignable(expected->element, actual->element, structs);
+    if (expected->dims != actual->dims)
+      return false;
+    // Element storage must match exactly: byte[] is not an int[].
+    auto elem = expected->element;
+    if ((elem->kind == TypeKind::Int || elem->kind == TypeKind::Real) &&
+        elem->name != actual->element->name)
+      return false;
+    return IsAssignable(elem, actual->element, structs);
+  }
+  if (expected->kind == TypeKind::Vector) {
+    return expected->name == actual->name;
+  }
+  if (expected->kind == TypeKind::Map) {
+    // Values are read and written through the map, so they must match both
+    // ways.
+    return expected->key->name == actual->key->name &&
+           IsAssignable(expected->element, actual->element, structs) &&
+           IsAssignable(actual->element, expected->element, structs);
+  }
+  if (expected->kind == TypeKind::Vec) {
+    // Pushed and read back in place, like map values; byte is not int.
+    return expected->element->name == actual->element->name &&
+           IsAssignable(expected->element, actual->element, structs) &&
+           IsAssignable(actual->element, expected->element, structs);
+  }
+  if (expected->kind == TypeKind::Task || expected->kind == TypeKind::Gen) {
+    // join() and value() read the cell back as the declared type.
+    return expected->element->name == actual->element->name &&
+           IsAssignable(expected->element, actual->element, structs) &&
+           IsAssignable(actual->element, expected->element, structs);
   }
   if (expected->kind == TypeKind::Struct) {
     if (expected->name == actual->name) {
@@ -131,7 +247,11 @@ static std::shared_ptr<Type> CheckUnary(const ExprPtr &expr, Env &env,
                                         const TypeContext &ctx) {
   auto operand = CheckExpr(expr->left, env, ctx);
   if (expr->op == "-") {
-    if (operand->kind == TypeKind::Int || operand->kind == TypeKind::Real) {
+    if (operand->kind == TypeKind::Int || operand->kind == TypeKind::Real)
+      return ResolveType(TypeSpec{operand->kind == TypeKind::Int ? "int" : "real",
+                                  0, false},
+                         ctx.structs);
+    if (operand->kind == TypeKind::Vector) {
       return operand;
     }
     throw CompileError("Unary '-' requires int or real at line " +
@@ -148,6 +268,27 @@ static std::shared_ptr<Type> CheckUnary(const ExprPtr &expr, Env &env,
                      std::to_string(expr->line));
 }
 
+// Lane-wise arithmetic on int2/real2. A scalar operand is broadcast to both
+// lanes; int scalars widen to real for real2.
+static std::shared_ptr<Type>
+CheckVectorBinary(const ExprPtr &expr, const std::shared_ptr<Type> &left,
+                  const std::shared_ptr<Type> &right) {
+  auto vec = left->kind == TypeKind::Vector ? left : right;
+  auto other = left->kind == TypeKind::Vector ? right : left;
+  bool real = vec->element->kind == TypeKind::Real;
+  bool ok = expr->op == "+" || expr->op == "-" || expr->op == "*" ||
+            (expr->op == "/" && real);
+  if (other->kind == TypeKind::Vector)
+    ok = ok && other->name == vec->name;
+  else
+    ok = ok && (other->kind == TypeKind::Int ||
+                (real && other->kind == TypeKind::Real));
+  if (!ok)
+    throw CompileError("Invalid " + vec->name + " operation '" + expr->op +
+                       "' at line " + std::to_string(expr->line));
+  return vec;
+}
+
 static std::shared_ptr<Type> CheckBinary(const ExprPtr &expr, Env &env,
                                          const TypeContext &ctx) {
   // std::cerr << "CheckBinary: Short circuit return Int" << std::endl;
@@ -156,6 +297,16 @@ static std::shared_ptr<Type> CheckBinary(const ExprPtr &expr, Env &env,
   auto right = CheckExpr(expr->right, env, ctx);
   std::cerr << "CheckBinary: left kind " << (int)left->kind << ", right kind "
             << (int)right->kind << std::endl;
+  if (left->kind == TypeKind::Vector || right->kind == TypeKind::Vector)
+    return CheckVectorBinary(expr, left, right);
+  if (left->kind == TypeKind::String && right->kind == TypeKind::String) {
+    // Concatenation and byte-wise comparison.
+    if (expr->op == "+")
+      return left;
+    if (expr->op == "==" || expr->op == "!=" || expr->op == "<" ||
+        expr->op == "<=" || expr->op == ">" || expr->op == ">=")
+      return ResolveType(TypeSpec{"bool", 0, false}, ctx.structs);
+  }
   if (expr->op == "+" || expr->op == "-" || expr->op == "*" ||
       expr->op == "/" || expr->op == "%") {
     if (left->kind == TypeKind::Int && right->kind == TypeKind::Int) {
@@ -163,7 +314,7 @@ static std::shared_ptr<Type> CheckBinary(const ExprPtr &expr, Env &env,
       return ResolveType(TypeSpec{"int", 0, false}, ctx.structs);
     }
     if (left->kind == TypeKind::Real && right->kind == TypeKind::Real)
-      return left;
+      return ResolveType(TypeSpec{"real", 0, false}, ctx.structs);
     if ((left->kind == TypeKind::Real && right->kind == TypeKind::Int) ||
         (left->kind == TypeKind::Int && right->kind == TypeKind::Real))
       return ResolveType(TypeSpec{"real", 0, false}, ctx.structs);
@@ -195,6 +346,15 @@ static std::shared_ptr<Type> CheckBinary(const ExprPtr &expr, Env &env,
 
 static std::shared_ptr<Type> CheckField(const ExprPtr &expr, Env &env,
                                         const TypeContext &ctx) {
+  const ExprPtr &elem = expr->base;
+  if (elem->kind == ExprKind::Index && !elem->type &&
+      IsSoaArray(CheckExpr(elem->base, env, ctx), ctx.structs)) {
+    // arr[i].field on a soa array reads the column directly.
+    if (CheckExpr(elem->left, env, ctx)->kind != TypeKind::Int)
+      throw CompileError("Index must be int at line " +
+                         std::to_string(elem->line));
+    elem->type = elem->base->type->element;
+  }
   auto base_type = CheckExpr(expr->base, env, ctx);
   if (base_type->kind != TypeKind::Struct) {
     throw CompileError("Field access on non-struct at line " +
@@ -219,26 +379,466 @@ static std::shared_ptr<Type> CheckField(const ExprPtr &expr, Env &env,
 static std::shared_ptr<Type> CheckIndex(const ExprPtr &expr, Env &env,
                                         const TypeContext &ctx) {
   auto base_type = CheckExpr(expr->base, env, ctx);
-  if (base_type->kind != TypeKind::Array)
+  if (base_type->kind == TypeKind::Vector) {
+    // Lanes are instruction immediates, so only v[0] and v[1] exist.
+    CheckExpr(expr->left, env, ctx);
+    if (!expr->args.empty() || expr->left->kind != ExprKind::IntLit ||
+        (expr->left->int_value != 0 && expr->left->int_value != 1))
+      throw CompileError("Lane of " + base_type->name +
+                         " must be 0 or 1 at line " +
+                         std::to_string(expr->line));
+    return base_type->element;
+  }
+  if (base_type->kind != TypeKind::Array && base_type->kind != TypeKind::Vec)
     throw CompileError("Not an array at line " + std::to_string(expr->line));
-  auto index_type = CheckExpr(expr->left, env, ctx);
-  if (index_type->kind != TypeKind::Int)
+  if (IsSoaArray(base_type, ctx.structs))
+    throw CompileError("Elements of soa struct " + base_type->element->name +
+                       " are only accessible as arr[i].field at line " +
+                       std::to_string(expr->line));
+  if (static_cast<int>(expr->args.size()) + 1 != base_type->dims)
+    throw CompileError("Array has " + std::to_string(base_type->dims) +
+                       " dimensions but is indexed with " +
+                       std::to_string(expr->args.size() + 1) + " at line " +
+                       std::to_string(expr->line));
+  bool ints = CheckExpr(expr->left, env, ctx)->kind == TypeKind::Int;
+  for (const auto &arg : expr->args)
+    ints = CheckExpr(arg, env, ctx)->kind == TypeKind::Int && ints;
+  if (!ints)
     throw CompileError("Index must be int at line " +
                        std::to_string(expr->line));
   return base_type->element;
 }
 
+// a[lo:hi] and s[lo:hi] have the type of what they view.
+static std::shared_ptr<Type> CheckSlice(const ExprPtr &expr, Env &env,
+                                        const TypeContext &ctx) {
+  auto base_type = CheckExpr(expr->base, env, ctx);
+  bool array = base_type->kind == TypeKind::Array && base_type->dims == 1 &&
+               !IsSoaArray(base_type, ctx.structs);
+  if (!array && base_type->kind != TypeKind::String)
+    throw CompileError("Only arrays and strings can be sliced at line " +
+                       std::to_string(expr->line));
+  for (const auto &bound : {expr->left, expr->right})
+    if (bound && CheckExpr(bound, env, ctx)->kind != TypeKind::Int)
+      throw CompileError("Slice bounds must be int at line " +
+                         std::to_string(expr->line));
+  return base_type;
+}
+
+bool IsVectorBuiltin(const std::string &name) {
+  return name == "int2" || name == "real2" || name == "load2" ||
+         name == "store2" || name == "shuffle" || name == "hsum" ||
+         name == "hmin" || name == "hmax";
+}
+
+static std::shared_ptr<Type> CheckVectorBuiltin(const ExprPtr &expr,
+                                                const std::string &name,
+                                                const TypeContext &ctx) {
+  std::string line = " at line " + std::to_string(expr->line);
+  std::vector<std::shared_ptr<Type>> args;
+  for (const auto &arg : expr->args)
+    args.push_back(arg->type);
+  auto is = [&](size_t k, TypeKind kind) {
+    return k < args.size() && args[k]->kind == kind;
+  };
+  if (name == "int2" || name == "real2") {
+    bool real = name == "real2";
+    bool ok = args.size() == 1 || args.size() == 2;
+    for (const auto &t : args)
+      ok = ok && (t->kind == TypeKind::Int ||
+                  (real && t->kind == TypeKind::Real));
+    if (!ok)
+      throw CompileError(name + "() takes one or two " +
+                         (real ? "numbers" : "ints") + line);
+    return ResolveType(TypeSpec{name, 0, false}, ctx.structs);
+  }
+  if (name == "load2" || name == "store2") {
+    // load2(a, i) reads a[i] and a[i + 1]; store2(a, i, v) writes them.
+    size_t want = name == "load2" ? 2 : 3;
+    bool ok = args.size() == want && is(0, TypeKind::Array) &&
+              is(1, TypeKind::Int) &&
+              (args[0]->element->name == "int" ||
+               args[0]->element->name == "real");
+    auto vec = ok ? ResolveType(TypeSpec{args[0]->element->name + "2", 0,
+                                         false},
+                                ctx.structs)
+                  : nullptr;
+    if (ok && want == 3)
+      ok = args[2]->kind == TypeKind::Vector && args[2]->name == vec->name;
+    if (!ok)
+      throw CompileError(name + "() expects an int[] or real[], an index" +
+                         (want == 3 ? " and a matching vector" : "") + line);
+    if (want == 3)
+      return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+    return vec;
+  }
+  if (name == "shuffle") {
+    // shuffle(a, b, l0, l1): lanes 0-1 pick from a, 2-3 from b.
+    bool ok = args.size() == 4 && is(0, TypeKind::Vector) &&
+              is(1, TypeKind::Vector) && args[0]->name == args[1]->name;
+    for (size_t k = 2; ok && k < 4; ++k)
+      ok = expr->args[k]->kind == ExprKind::IntLit &&
+           expr->args[k]->int_value >= 0 && expr->args[k]->int_value <= 3;
+    if (!ok)
+      throw CompileError("shuffle() expects two vectors of the same type and "
+                         "two lane literals 0-3" +
+                         line);
+    return args[0];
+  }
+  // hsum / hmin / hmax fold both lanes into one scalar.
+  if (args.size() != 1 || !is(0, TypeKind::Vector))
+    throw CompileError(name + "() expects an int2 or real2" + line);
+  return args[0]->element;
+}
+
+bool IsStringBuiltin(const std::string &name) {
+  return name == "to_string" || name == "hash";
+}
+
+static std::shared_ptr<Type> CheckStringBuiltin(const ExprPtr &expr,
+                                                const std::string &name,
+                                                const TypeContext &ctx) {
+  std::string line = " at line " + std::to_string(expr->line);
+  const auto &args = expr->args;
+  if (name == "to_string") {
+    if (args.size() != 1 || (args[0]->type->kind != TypeKind::Int &&
+                             args[0]->type->kind != TypeKind::Real &&
+                             args[0]->type->kind != TypeKind::Bool))
+      throw CompileError("to_string() expects an int, real or bool" + line);
+    return ResolveType(TypeSpec{"string", 0, false}, ctx.structs);
+  }
+  if (args.size() != 1 || args[0]->type->kind != TypeKind::String)
+    throw CompileError("hash() expects a string" + line);
+  return ResolveType(TypeSpec{"int", 0, false}, ctx.structs);
+}
+
+// sb.append(x) for a string, int, real or bool; sb.length(); sb.to_string().
+static std::shared_ptr<Type> CheckBuilderMethod(const ExprPtr &expr,
+                                                const TypeContext &ctx) {
+  const std::string &name = expr->base->field;
+  std::string line = " at line " + std::to_string(expr->line);
+  const auto &args = expr->args;
+  if (name == "append") {
+    TypeKind kind = args.size() == 1 ? args[0]->type->kind : TypeKind::Void;
+    if (kind != TypeKind::String && kind != TypeKind::Int &&
+        kind != TypeKind::Real && kind != TypeKind::Bool)
+      throw CompileError(
+          "string_builder.append() expects a string, int, real or bool" +
+          line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if ((name == "length" || name == "to_string") && args.empty())
+    return ResolveType(
+        TypeSpec{name == "length" ? "int" : "string", 0, false}, ctx.structs);
+  throw CompileError("Unknown method string_builder." + name + line);
+}
+
+// put(k, v), get(k), get(k, default), contains(k), remove(k), length(),
+// keys() and values() on a map[K, V].
+static std::shared_ptr<Type> CheckMapMethod(const ExprPtr &expr,
+                                            const std::shared_ptr<Type> &map,
+                                            const TypeContext &ctx) {
+  const std::string &name = expr->base->field;
+  std::string line = " at line " + std::to_string(expr->line);
+  const auto &args = expr->args;
+  auto key_ok = [&]() {
+    return !args.empty() && IsAssignable(map->key, args[0]->type, ctx.structs);
+  };
+  auto value_ok = [&](size_t k) {
+    const auto &type = args[k]->type;
+    return IsAssignable(map->element, type, ctx.structs) ||
+           (map->element->kind == TypeKind::Real &&
+            type->kind == TypeKind::Int);
+  };
+  if (name == "put") {
+    if (args.size() != 2 || !key_ok() || !value_ok(1))
+      throw CompileError("map.put() expects a key and a value of the map's "
+                         "types" +
+                         line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if (name == "get") {
+    if (args.empty() || args.size() > 2 || !key_ok() ||
+        (args.size() == 2 && !value_ok(1)))
+      throw CompileError("map.get() expects a key and an optional default" +
+                         line);
+    return map->element;
+  }
+  if (name == "contains" || name == "remove") {
+    if (args.size() != 1 || !key_ok())
+      throw CompileError("map." + name + "() expects a key" + line);
+    return ResolveType(TypeSpec{"bool", 0, false}, ctx.structs);
+  }
+  if (!args.empty())
+    throw CompileError("map." + name + "() takes no arguments" + line);
+  if (name == "length")
+    return ResolveType(TypeSpec{"int", 0, false}, ctx.structs);
+  if (name == "keys" || name == "values") {
+    auto elem = name == "keys" ? map->key : map->element;
+    return std::make_shared<Type>(Type{TypeKind::Array, "", elem});
+  }
+  throw CompileError("Unknown method map." + name + line);
+}
+
+// push(x), pop(), reserve(n), length() and as_array() on a vec[T].
+static std::shared_ptr<Type> CheckVecMethod(const ExprPtr &expr,
+                                            const std::shared_ptr<Type> &vec,
+                                            const TypeContext &ctx) {
+  const std::string &name = expr->base->field;
+  std::string line = " at line " + std::to_string(expr->line);
+  const auto &args = expr->args;
+  if (name == "push") {
+    bool ok = args.size() == 1 &&
+              (IsAssignable(vec->element, args[0]->type, ctx.structs) ||
+               (vec->element->kind == TypeKind::Real &&
+                args[0]->type->kind == TypeKind::Int));
+    if (!ok)
+      throw CompileError("vec.push() expects a value of the element type" +
+                         line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if (name == "reserve") {
+    if (args.size() != 1 || args[0]->type->kind != TypeKind::Int)
+      throw CompileError("vec.reserve() expects an int capacity" + line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if (!args.empty())
+    throw CompileError("vec." + name + "() takes no arguments" + line);
+  if (name == "pop")
+    return vec->element;
+  if (name == "length")
+    return ResolveType(TypeSpec{"int", 0, false}, ctx.structs);
+  if (name == "as_array")
+    return std::make_shared<Type>(Type{TypeKind::Array, "", vec->element});
+  throw CompileError("Unknown method vec." + name + line);
+}
+
+// next() runs a generator to its next yield (false once it has finished);
+// value() is the value that yield produced.
+static std::shared_ptr<Type> CheckGenMethod(const ExprPtr &expr,
+                                            const std::shared_ptr<Type> &gen,
+                                            const TypeContext &ctx) {
+  const std::string &name = expr->base->field;
+  std::string line = " at line " + std::to_string(expr->line);
+  if (!expr->args.empty())
+    throw CompileError("gen." + name + "() takes no arguments" + line);
+  if (name == "next")
+    return ResolveType(TypeSpec{"bool", 0, false}, ctx.structs);
+  if (name == "value")
+    return gen->element;
+  throw CompileError("Unknown method gen." + name + line);
+}
+
+bool IsArrayBuiltin(const std::string &name) {
+  return name == "copy" || name == "fill" || name == "equals" ||
+         name == "resize" || name == "sort";
+}
+
+static std::shared_ptr<Type> CheckArrayBuiltin(const ExprPtr &expr,
+                                               const std::string &name,
+                                               const TypeContext &ctx) {
+  std::string line = " at line " + std::to_string(expr->line);
+  std::vector<std::shared_ptr<Type>> args;
+  for (const auto &arg : expr->args)
+    args.push_back(arg->type);
+  auto is = [&](size_t k, TypeKind kind) {
+    return k < args.size() && args[k]->kind == kind;
+  };
+  for (const auto &arg : args) {
+    if (IsSoaArray(arg, ctx.structs))
+      throw CompileError(name + "() does not accept soa arrays" + line);
+    if (arg->kind == TypeKind::Array && arg->dims > 1)
+      throw CompileError(name + "() does not accept rectangular arrays" +
+                         line);
+  }
+  if (name == "copy") {
+    // copy(dst, dst_off, src, src_off, n)
+    if (args.size() != 5 || !is(0, TypeKind::Array) || !is(1, TypeKind::Int) ||
+        !is(2, TypeKind::Array) || !is(3, TypeKind::Int) ||
+        !is(4, TypeKind::Int) || !IsAssignable(args[0], args[2], ctx.structs))
+      throw CompileError("copy() expects (dst, dst_off, src, src_off, n) with "
+                         "matching array types" +
+                         line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if (name == "fill") {
+    bool ok = args.size() == 2 && is(0, TypeKind::Array);
+    if (ok) {
+      auto elem = args[0]->element;
+      ok = IsAssignable(elem, args[1], ctx.structs) ||
+           (elem->kind == TypeKind::Real && is(1, TypeKind::Int));
+    }
+    if (!ok)
+      throw CompileError("fill() expects an array and a value of its element "
+                         "type" +
+                         line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  if (name == "equals") {
+    // Element-wise ==, so only element types that support it.
+    bool ok = args.size() == 2 && is(0, TypeKind::Array) &&
+              is(1, TypeKind::Array) &&
+              args[0]->element->kind == args[1]->element->kind &&
+              args[0]->element->name == args[1]->element->name;
+    if (ok) {
+      TypeKind kind = args[0]->element->kind;
+      ok = kind == TypeKind::Int || kind == TypeKind::Real ||
+           kind == TypeKind::Bool;
+    }
+    if (!ok)
+      throw CompileError("equals() expects two int[], real[] or bool[] arrays "
+                         "of the same type" +
+                         line);
+    return ResolveType(TypeSpec{"bool", 0, false}, ctx.structs);
+  }
+  if (name == "sort") {
+    // sort(a) for int[] / real[]; sort(a, "field") orders struct elements by
+    // an int, real or bool field named by a string literal.
+    bool ok = !args.empty() && args.size() <= 2 && is(0, TypeKind::Array);
+    if (ok && args.size() == 1) {
+      ok = args[0]->element->name == "int" || args[0]->element->name == "real";
+    } else if (ok) {
+      const auto &elem = args[0]->element;
+      const ExprPtr &key = expr->args[1];
+      ok = elem->kind == TypeKind::Struct && key->kind == ExprKind::StringLit;
+      if (ok) {
+        const auto &fields = ctx.structs.at(elem->name).field_map;
+        auto field = fields.find(key->text);
+        ok = field != fields.end() &&
+             (field->second.type->kind == TypeKind::Int ||
+              field->second.type->kind == TypeKind::Real ||
+              field->second.type->kind == TypeKind::Bool);
+      }
+    }
+    if (!ok)
+      throw CompileError("sort() expects an int[] or real[], or a struct "
+                         "array and the name of an int, real or bool field" +
+                         line);
+    return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+  }
+  // resize(arr, n): a new array of length n holding the first elements.
+  if (args.size() != 2 || !is(0, TypeKind::Array) || !is(1, TypeKind::Int))
+    throw CompileError("resize() expects an array and an int length" + line);
+  return args[0];
+}
+
+bool IsPipelineBuiltin(const std::string &name) {
+  return name == "map" || name == "filter" || name == "reduce" ||
+         name == "sum" || name == "min" || name == "max";
+}
+
+// map(a, f), filter(a, p) and reduce(a, f, init) name a function, which is
+// not checked as a value; sum(a), min(a) and max(a) take int[] or real[].
+// Mapped values and accumulators are scalars.
+static std::shared_ptr<Type> CheckPipeline(const ExprPtr &expr, Env &env,
+                                           const TypeContext &ctx) {
+  const std::string &name = expr->base->text;
+  std::string line = " at line " + std::to_string(expr->line);
+  const auto &args = expr->args;
+  size_t arity = name == "reduce" ? 3 : name == "map" || name == "filter" ? 2
+                                                                          : 1;
+  if (args.size() != arity)
+    throw CompileError(name + "() expects " + std::to_string(arity) +
+                       (arity == 1 ? " argument" : " arguments") + line);
+  auto source = CheckExpr(args[0], env, ctx);
+  if (source->kind != TypeKind::Array || source->dims != 1 ||
+      IsSoaArray(source, ctx.structs))
+    throw CompileError(name + "() expects a one-dimensional array or slice" +
+                       line);
+  auto elem = source->element;
+  if (arity == 1) {
+    if (elem->kind != TypeKind::Int && elem->kind != TypeKind::Real)
+      throw CompileError(name + "() expects an int[] or real[]" + line);
+    return ResolveType(
+        TypeSpec{elem->kind == TypeKind::Int ? "int" : "real", 0, false},
+        ctx.structs);
+  }
+  auto accepts = [&ctx](const std::shared_ptr<Type> &param,
+                        const std::shared_ptr<Type> &value) {
+    return IsAssignable(param, value, ctx.structs) ||
+           (param->kind == TypeKind::Real && value->kind == TypeKind::Int);
+  };
+  auto scalar = [](const std::shared_ptr<Type> &type) {
+    return type->kind == TypeKind::Int || type->kind == TypeKind::Real ||
+           type->kind == TypeKind::Bool;
+  };
+  size_t params = name == "reduce" ? 2 : 1;
+  const ExprPtr &fn_name = args[1];
+  const FunctionInfo *fn = fn_name->kind == ExprKind::Var
+                               ? ctx.lookup_func(fn_name->text)
+                               : nullptr;
+  if (!fn || fn->params.size() != params)
+    throw CompileError(name + "() expects the name of a function of " +
+                       (params == 1 ? "one parameter" : "two parameters") +
+                       line);
+  if (name == "map") {
+    if (!accepts(fn->params[0], elem) || !scalar(fn->return_type))
+      throw CompileError("map() expects a function from the element type to "
+                         "int, real or bool" +
+                         line);
+    return std::make_shared<Type>(
+        Type{TypeKind::Array, "", fn->return_type});
+  }
+  if (name == "filter") {
+    if (!accepts(fn->params[0], elem) ||
+        fn->return_type->kind != TypeKind::Bool)
+      throw CompileError("filter() expects a function from the element type "
+                         "to bool" +
+                         line);
+    return std::make_shared<Type>(Type{TypeKind::Array, "", elem});
+  }
+  // reduce(a, f, init): acc = f(acc, x) for each element x.
+  auto init = CheckExpr(args[2], env, ctx);
+  auto acc = fn->return_type;
+  if (!scalar(acc) || !accepts(fn->params[0], acc) ||
+      !accepts(fn->params[1], elem) || !accepts(acc, init))
+    throw CompileError("reduce() expects a function (acc, x) returning the "
+                       "int, real or bool accumulator, and its initial value" +
+                       line);
+  return acc;
+}
+
 static std::shared_ptr<Type> CheckCall(const ExprPtr &expr, Env &env,
                                        const TypeContext &ctx) {
+  if (expr->base->kind == ExprKind::Var &&
+      IsPipelineBuiltin(expr->base->text) &&
+      !ctx.lookup_func(expr->base->text))
+    return CheckPipeline(expr, env, ctx);
   for (auto &arg : expr->args)
     CheckExpr(arg, env, ctx);
 
   if (expr->base->kind == ExprKind::Var) {
     std::string name = expr->base->text;
-    if (name == "print")
+    if (name == "print") {
+      for (const auto &arg : expr->args) {
+        if (arg->type->kind == TypeKind::Vector)
+          throw CompileError("print() cannot format " + arg->type->name +
+                             "; print its lanes at line " +
+                             std::to_string(expr->line));
+      }
+      return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
+    }
+    if (name == "flush") {
+      if (!expr->args.empty())
+        throw CompileError("flush() takes no arguments at line " +
+                           std::to_string(expr->line));
       return ResolveType(TypeSpec{"void", 0, true}, ctx.structs);
-    if (name == "sqrt")
+    }
+    if (name == "join" && expr->args.size() == 1 &&
+        expr->args[0]->type->kind == TypeKind::Task)
+      return expr->args[0]->type->element;
+    if (name == "sqrt") {
+      if (expr->args.size() == 1 && expr->args[0]->type->name == "real2")
+        return expr->args[0]->type;
       return ResolveType(TypeSpec{"real", 0, false}, ctx.structs);
+    }
+    // A user function of the same name takes precedence over the builtins.
+    if (IsVectorBuiltin(name) && !ctx.lookup_func(name))
+      return CheckVectorBuiltin(expr, name, ctx);
+    if (IsArrayBuiltin(name) && !ctx.lookup_func(name))
+      return CheckArrayBuiltin(expr, name, ctx);
+    if (IsStringBuiltin(name) && !ctx.lookup_func(name))
+      return CheckStringBuiltin(expr, name, ctx);
 
     const FunctionInfo *info = ctx.lookup_func(name);
     if (!info)
@@ -251,8 +851,31 @@ static std::shared_ptr<Type> CheckCall(const ExprPtr &expr, Env &env,
     auto base_type = CheckExpr(field->base, env, ctx);
     if ((base_type->kind == TypeKind::Array ||
          base_type->kind == TypeKind::String) &&
-        field->field == "length")
+        field->field == "length") {
+      // a.length(k) is dimension k of a rectangular array.
+      if (!expr->args.empty()) {
+        const ExprPtr &k = expr->args[0];
+        if (base_type->kind != TypeKind::Array || expr->args.size() != 1 ||
+            k->kind != ExprKind::IntLit || k->int_value < 0 ||
+            k->int_value >= base_type->dims)
+          throw CompileError("length() takes a dimension from 0 to " +
+                             std::to_string(base_type->kind ==
+                                                    TypeKind::Array
+                                                ? base_type->dims - 1
+                                                : 0) +
+                             " at line " + std::to_string(expr->line));
+        CheckExpr(k, env, ctx);
+      }
       return ResolveType(TypeSpec{"int", 0, false}, ctx.structs);
+    }
+    if (base_type->kind == TypeKind::StringBuilder)
+      return CheckBuilderMethod(expr, ctx);
+    if (base_type->kind == TypeKind::Map)
+      return CheckMapMethod(expr, base_type, ctx);
+    if (base_type->kind == TypeKind::Vec)
+      return CheckVecMethod(expr, base_type, ctx);
+    if (base_type->kind == TypeKind::Gen)
+      return CheckGenMethod(expr, base_type, ctx);
     if (base_type->kind != TypeKind::Struct)
       throw CompileError("Method on non-struct at line " +
                          std::to_string(expr->line));
@@ -266,19 +889,55 @@ static std::shared_ptr<Type> CheckCall(const ExprPtr &expr, Env &env,
   throw CompileError("Unsupported call");
 }
 
+// spawn f(args): f is a function (not a builtin or method) whose params and
+// result fit 8-byte cells.
+static std::shared_ptr<Type> CheckSpawn(const ExprPtr &expr, Env &env,
+                                        const TypeContext &ctx) {
+  const ExprPtr &call = expr->left;
+  std::string line = " at line " + std::to_string(expr->line);
+  const FunctionInfo *fn = call->base->kind == ExprKind::Var
+                               ? ctx.lookup_func(call->base->text)
+                               : nullptr;
+  if (!fn)
+    throw CompileError("spawn expects a call of a function" + line);
+  CheckExpr(call, env, ctx);
+  if (call->args.size() != fn->params.size())
+    throw CompileError("spawn " + call->base->text + "() expects " +
+                       std::to_string(fn->params.size()) + " arguments" +
+                       line);
+  for (const auto &param : fn->params) {
+    if (param->kind == TypeKind::Vector)
+      throw CompileError("spawn cannot pass " + param->name + " values" + line);
+  }
+  if (fn->return_type->kind == TypeKind::Vector)
+    throw CompileError("spawn cannot return " + fn->return_type->name +
+                       " values" + line);
+  return std::make_shared<Type>(
+      Type{TypeKind::Task, "task", fn->return_type});
+}
+
 static std::shared_ptr<Type> CheckNew(const ExprPtr &expr, Env &env,
                                       const TypeContext &ctx) {
   if (expr->new_size) {
-    auto size_type = CheckExpr(expr->new_size, env, ctx);
-    if (size_type->kind != TypeKind::Int)
+    bool ints = CheckExpr(expr->new_size, env, ctx)->kind == TypeKind::Int;
+    for (const auto &arg : expr->args)
+      ints = CheckExpr(arg, env, ctx)->kind == TypeKind::Int && ints;
+    if (!ints)
       throw CompileError("Array size int needed");
-    auto base = ResolveType(expr->new_type, ctx.structs);
-    auto type = std::make_shared<Type>();
-    type->kind = TypeKind::Array;
-    type->element = base;
-    return type;
+    if (!expr->args.empty() && expr->new_type.array_depth > 0)
+      throw CompileError("Rectangular arrays cannot be nested at line " +
+                         std::to_string(expr->line));
+    TypeSpec spec = expr->new_type;
+    spec.array_depth++;
+    spec.dims = static_cast<int>(expr->args.size()) + 1;
+    return ResolveType(spec, ctx.structs);
   }
-  return ResolveType(expr->new_type, ctx.structs);
+  auto type = ResolveType(expr->new_type, ctx.structs);
+  if (type->kind == TypeKind::Vector)
+    throw CompileError(type->name + " is a value type; build it with " +
+                       type->name + "(...) at line " +
+                       std::to_string(expr->line));
+  return type;
 }
 
 // --- Main Type Checking Functions ---
@@ -321,12 +980,18 @@ std::shared_ptr<Type> CheckExpr(const ExprPtr &expr, Env &env,
   case ExprKind::Index:
     type = CheckIndex(expr, env, ctx);
     break;
+  case ExprKind::Slice:
+    type = CheckSlice(expr, env, ctx);
+    break;
   case ExprKind::Call:
     type = CheckCall(expr, env, ctx);
     break;
   case ExprKind::NewExpr:
     type = CheckNew(expr, env, ctx);
     break;
+  case ExprKind::Spawn:
+    type = CheckSpawn(expr, env, ctx);
+    break;
   default:
     throw CompileError("Unhandled expression at line " +
                        std::to_string(expr->line));
@@ -336,6 +1001,22 @@ std::shared_ptr<Type> CheckExpr(const ExprPtr &expr, Env &env,
   return type;
 }
 
+// Only the loop itself steps the index of a for loop.
+static void RequireUnassigned(const std::vector<StmtPtr> &stmts,
+                              const std::string &index) {
+  for (const auto &s : stmts) {
+    if ((s->kind == StmtKind::Assign && s->target->kind == ExprKind::Var &&
+         s->target->text == index) ||
+        (s->kind == StmtKind::VarDecl && s->var_name == index))
+      throw CompileError("The for index " + index +
+                         " cannot be assigned at line " +
+                         std::to_string(s->line));
+    RequireUnassigned(s->then_body, index);
+    RequireUnassigned(s->else_body, index);
+    RequireUnassigned(s->body, index);
+  }
+}
+
 void CheckStmt(const StmtPtr &stmt, Env &env, const TypeContext &ctx) {
   if (!stmt)
     return;
@@ -344,8 +1025,13 @@ void CheckStmt(const StmtPtr &stmt, Env &env, const TypeContext &ctx) {
   switch (stmt->kind) {
   case StmtKind::VarDecl:
     if (stmt->expr) {
-      CheckExpr(stmt->expr, env, ctx);
+      auto value = CheckExpr(stmt->expr, env, ctx);
       auto var_type = ResolveType(stmt->var_type, ctx.structs);
+      if (var_type->kind == TypeKind::Vector ||
+          value->kind == TypeKind::Vector || var_type->kind == TypeKind::Task ||
+          value->kind == TypeKind::Task || var_type->kind == TypeKind::Gen ||
+          value->kind == TypeKind::Gen)
+        RequireSameType(var_type, value, stmt->line, ctx.structs);
       env.locals[stmt->var_name] = LocalInfo{stmt->var_name, var_type};
     } else {
       auto var_type = ResolveType(stmt->var_type, ctx.structs);
@@ -354,8 +1040,25 @@ void CheckStmt(const StmtPtr &stmt, Env &env, const TypeContext &ctx) {
     break;
   case StmtKind::Assign:
     std::cerr << "CheckStmt Assign Start at line " << stmt->line << std::endl;
-    CheckExpr(stmt->target, env, ctx);
-    CheckExpr(stmt->expr, env, ctx);
+    {
+      auto target = CheckExpr(stmt->target, env, ctx);
+      auto value = CheckExpr(stmt->expr, env, ctx);
+      if (target->kind == TypeKind::Vector || value->kind == TypeKind::Vector ||
+          target->kind == TypeKind::Task || value->kind == TypeKind::Task ||
+          target->kind == TypeKind::Gen || value->kind == TypeKind::Gen)
+        RequireSameType(target, value, stmt->line, ctx.structs);
+      const ExprPtr &lhs = stmt->target;
+      if (lhs->kind == ExprKind::Index &&
+          lhs->base->type->kind == TypeKind::Vector) {
+        auto res = lhs->base->kind == ExprKind::Var
+                       ? FindIdentifier(lhs->base->text, env, ctx.structs)
+                       : std::nullopt;
+        if (!res || res->kind == LookupResult::Kind::Field)
+          throw CompileError("Only local vectors can have a lane assigned at "
+                             "line " +
+                             std::to_string(stmt->line));
+      }
+    }
     std::cerr << "CheckStmt Assign End at line " << stmt->line << std::endl;
     break;
   case StmtKind::If:
@@ -375,12 +1078,66 @@ void CheckStmt(const StmtPtr &stmt, Env &env, const TypeContext &ctx) {
       Env loop_env = env;
       CheckStmts(stmt->body, loop_env, ctx);
     }
+    if (stmt->parallel)
+      MatchParallelLoop(*stmt, env, ctx.structs);
+    break;
+  case StmtKind::Match: {
+    if (CheckExpr(stmt->expr, env, ctx)->kind != TypeKind::Int)
+      throw CompileError("match needs an int value at line " +
+                         std::to_string(stmt->line));
+    std::unordered_set<int64_t> seen;
+    for (const auto &arm : stmt->body) {
+      for (int64_t value : arm->cases) {
+        if (!seen.insert(value).second)
+          throw CompileError("Duplicate case " + std::to_string(value) +
+                             " in match at line " + std::to_string(arm->line));
+      }
+      Env arm_env = env;
+      CheckStmts(arm->then_body, arm_env, ctx);
+    }
+    Env else_env = env;
+    CheckStmts(stmt->else_body, else_env, ctx);
+  } break;
+  case StmtKind::Case:
     break;
+  case StmtKind::For: {
+    // The bounds are evaluated before the index exists, then the loop runs
+    // in a scope of its own. The index gets no wasm local of its own, so it
+    // may not shadow one.
+    if (env.locals.count(stmt->var_name) || env.params.count(stmt->var_name))
+      throw CompileError("The for index " + stmt->var_name +
+                         " shadows a local at line " +
+                         std::to_string(stmt->line));
+    Env loop_env = env;
+    for (const auto &s : stmt->body) {
+      CheckStmt(s, loop_env, ctx);
+      if (s->kind == StmtKind::VarDecl && s->expr->type->kind != TypeKind::Int)
+        throw CompileError("for needs int bounds at line " +
+                           std::to_string(stmt->line));
+    }
+    const auto &body = stmt->body.back()->body;
+    RequireUnassigned(std::vector<StmtPtr>(body.begin(), body.end() - 1),
+                      stmt->var_name);
+  } break;
   case StmtKind::Return:
+    if (stmt->expr && env.generator)
+      throw CompileError("A generator cannot return a value at line " +
+                         std::to_string(stmt->line));
     if (stmt->expr) {
       CheckExpr(stmt->expr, env, ctx);
     }
     break;
+  case StmtKind::Yield: {
+    if (!env.generator)
+      throw CompileError("yield outside a gen[T] function at line " +
+                         std::to_string(stmt->line));
+    auto value = CheckExpr(stmt->expr, env, ctx);
+    const auto &expected = env.generator->element;
+    if (!IsAssignable(expected, value, ctx.structs) &&
+        !(expected->kind == TypeKind::Real && value->kind == TypeKind::Int))
+      throw CompileError("yield expects a " + expected->name + " value at line " +
+                         std::to_string(stmt->line));
+  } break;
   case StmtKind::ExprStmt:
     CheckExpr(stmt->expr, env, ctx);
     break;
@@ -24,6 +24,9 @@ struct TypeContext {
   std::function<const FunctionInfo *(const std::string &)> lookup_func;
 };
 
+// Rank limit of rectangular arrays (real[,,,]).
+constexpr int kMaxArrayDims = 4;
+
 // Type Resolution & Layout
 void InitStructs(const Program &program,
                  std::unordered_map<std::string, StructInfo> &structs);
@@ -31,12 +34,28 @@ std::shared_ptr<Type>
 ResolveType(const TypeSpec &spec,
             const std::unordered_map<std::string, StructInfo> &structs);
 int64_t GetTypeSize(const std::shared_ptr<Type> &type);
+// byte (u8), i32 and f32: held as int/real values, stored narrow. Values
+// assigned to them wrap (byte, i32) or round (f32) to the storage type.
+bool IsNarrow(const std::shared_ptr<Type> &type);
+// An array of a `soa` struct: [len][one column per field], the column of a
+// field at 8 + len * field.offset. Elements exist only as arr[i].field.
+bool IsSoaArray(const std::shared_ptr<Type> &type,
+                const std::unordered_map<std::string, StructInfo> &structs);
 int64_t Align8(int64_t value);
 
 // Type Rules
 bool IsAssignable(const std::shared_ptr<Type> &expected,
                   const std::shared_ptr<Type> &actual,
                   const std::unordered_map<std::string, StructInfo> &structs);
+// int2/real2 constructors, load2/store2, shuffle and hsum/hmin/hmax.
+bool IsVectorBuiltin(const std::string &name);
+// copy/fill/equals/resize/sort on arrays.
+bool IsArrayBuiltin(const std::string &name);
+// to_string(x) and hash(s).
+bool IsStringBuiltin(const std::string &name);
+// map/filter/reduce/sum/min/max over arrays; a user function of the same
+// name takes precedence.
+bool IsPipelineBuiltin(const std::string &name);
 void RequireSameType(
     const std::shared_ptr<Type> &expected, const std::shared_ptr<Type> &actual,
     int line, const std::unordered_map<std::string, StructInfo> &structs);